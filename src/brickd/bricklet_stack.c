@@ -44,6 +44,7 @@
 
 #include "hardware.h"
 #include "network.h"
+#include "scheduler.h"
 
 typedef enum {
 	SPITFP_STATE_START,
@@ -80,16 +81,28 @@ static int bricklet_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipie
 	}
 
 	mutex_lock(&bricklet_stack->request_queue_mutex);
-	queued_request = queue_push(&bricklet_stack->request_queue);
+	queued_request = lane_queue_push(&bricklet_stack->request_queue, hardware_get_request_lane(request),
+	                                 request->header.uid);
 	memcpy(queued_request, request, request->header.length);
 	mutex_unlock(&bricklet_stack->request_queue_mutex);
 
-	log_packet_debug("Packet is queued to be send over SPI (%s)",
-	                 packet_get_request_signature(packet_signature, request));
+	log_packet_request_debug(request, "Packet is queued to be send over SPI (%s)",
+	                                  packet_get_request_signature(packet_signature, request));
 
 	return 0;
 }
 
+static int bricklet_stack_get_backlog(Stack *stack) {
+	BrickletStack *bricklet_stack = (BrickletStack *)stack;
+	int backlog;
+
+	mutex_lock(&bricklet_stack->request_queue_mutex);
+	backlog = bricklet_stack->request_queue.count;
+	mutex_unlock(&bricklet_stack->request_queue_mutex);
+
+	return backlog;
+}
+
 // New packet from BrickletStack is send into brickd event loop
 static void bricklet_stack_dispatch_from_spi(void *opaque) {
 	BrickletStack *bricklet_stack = opaque;
@@ -257,15 +270,17 @@ static void bricklet_stack_check_request_queue(BrickletStack *bricklet_stack) {
 	}
 
 	mutex_lock(&bricklet_stack->request_queue_mutex);
-	Packet *request = queue_peek(&bricklet_stack->request_queue);
+	Packet *request = lane_queue_peek(&bricklet_stack->request_queue);
 	mutex_unlock(&bricklet_stack->request_queue_mutex);
 
 	if(request != NULL) {
 		bricklet_stack_send_ack_and_message(bricklet_stack, (uint8_t*)request, request->header.length);
 
 		mutex_lock(&bricklet_stack->request_queue_mutex);
-		queue_pop(&bricklet_stack->request_queue, NULL);
+		lane_queue_pop(&bricklet_stack->request_queue, NULL);
 		mutex_unlock(&bricklet_stack->request_queue_mutex);
+
+		scheduler_announce_write_done();
 	}
 }
 
@@ -281,6 +296,13 @@ static bool bricklet_stack_handle_message_from_bricklet(BrickletStack *bricklet_
 	mutex_lock(&bricklet_stack->response_queue_mutex);
 	queued_response = queue_push(&bricklet_stack->response_queue);
 	memcpy(queued_response, data, length);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	queued_response->trace_id = packet_get_next_response_trace_id();
+#endif
+
+	packet_add_trace(queued_response);
+
 	mutex_unlock(&bricklet_stack->response_queue_mutex);
 
 	if (bricklet_stack_notify(bricklet_stack) < 0) {
@@ -735,6 +757,8 @@ int bricklet_stack_create(BrickletStack *bricklet_stack, BrickletStackConfig *co
 		goto cleanup;
 	}
 
+	bricklet_stack->base.get_backlog = bricklet_stack_get_backlog;
+
 	phase = 1;
 
 	// add to stacks array
@@ -781,7 +805,7 @@ int bricklet_stack_create(BrickletStack *bricklet_stack, BrickletStackConfig *co
 	phase = 4;
 
 	// Initialize SPI packet queues
-	if (queue_create(&bricklet_stack->request_queue, sizeof(Packet)) < 0) {
+	if (lane_queue_create(&bricklet_stack->request_queue, sizeof(Packet)) < 0) {
 		log_error("Could not create SPI request queue: %s (%d)",
 		          get_errno_name(errno), errno);
 
@@ -820,7 +844,7 @@ cleanup:
 
 	case 5:
 		mutex_destroy(&bricklet_stack->request_queue_mutex);
-		queue_destroy(&bricklet_stack->request_queue, NULL);
+		lane_queue_destroy(&bricklet_stack->request_queue, NULL);
 		// fall through
 
 	case 4:
@@ -867,7 +891,7 @@ void bricklet_stack_destroy(BrickletStack *bricklet_stack) {
 	hardware_remove_stack(&bricklet_stack->base);
 	stack_destroy(&bricklet_stack->base);
 
-	queue_destroy(&bricklet_stack->request_queue, NULL);
+	lane_queue_destroy(&bricklet_stack->request_queue, NULL);
 	mutex_destroy(&bricklet_stack->request_queue_mutex);
 
 	queue_destroy(&bricklet_stack->response_queue, NULL);
@@ -32,6 +32,7 @@ extern "C" {
 #endif
 
 #include <daemonlib/threads.h>
+#include <daemonlib/lane_queue.h>
 #include <daemonlib/queue.h>
 #include <daemonlib/ringbuffer.h>
 #ifdef BRICKD_UWP_BUILD
@@ -103,7 +104,7 @@ typedef struct _BrickletStackPlatform BrickletStackPlatform;
 typedef struct {
 	Stack base;
 
-	Queue request_queue;
+	LaneQueue request_queue;
 	Mutex request_queue_mutex;
 
 	Queue response_queue;
@@ -0,0 +1,188 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * capture.c: Record TFP traffic for replay
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the capture records the TFP traffic between the clients and the stacks to a
+ * binary file: requests as received from the clients, the stacks they got
+ * routed to, and the responses and callbacks as dispatched to the clients.
+ * each record is tagged with the ID of the client and the stack involved. the
+ * brickd-replay tool reads the capture and replays the client side of it
+ * against another brickd, with the original timing or as fast as possible.
+ *
+ * the file starts with a header, followed by one record per captured packet.
+ * all values are little endian:
+ *
+ *   header: magic "TFPCAPTR" (8), version (4), wall-clock (8), timestamp (8)
+ *   record: timestamp (8), client-ID (4), stack-ID (2), type (1),
+ *           packet length (1), packet (packet length)
+ *
+ * record timestamps are monotonic microseconds, the file header maps them to
+ * wall-clock time. client-IDs and stack-IDs are assigned in creation order
+ * starting at 1, 0 means that the record is not tied to a client or stack.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifndef _MSC_VER
+	#include <sys/time.h>
+#endif
+
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/macros.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#include "capture.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define CAPTURE_MAGIC "TFPCAPTR"
+#define CAPTURE_VERSION 1
+#define CAPTURE_BUFFER_SIZE (64 * 1024) // bytes
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint64_t wall_clock; // microseconds since epoch, at the time of ...
+	uint64_t timestamp; // ... this monotonic timestamp in microseconds
+} ATTRIBUTE_PACKED CaptureHeader;
+
+typedef struct {
+	uint64_t timestamp; // microseconds
+	uint32_t client_id;
+	uint16_t stack_id;
+	uint8_t type;
+	uint8_t packet_length;
+} ATTRIBUTE_PACKED CaptureRecordHeader;
+
+#include <daemonlib/packed_end.h>
+
+STATIC_ASSERT(sizeof(CaptureHeader) == 28, "CaptureHeader has invalid size");
+STATIC_ASSERT(sizeof(CaptureRecordHeader) == 16, "CaptureRecordHeader has invalid size");
+
+static Mutex _mutex; // protects writing to _file and _record_count
+static FILE *_file = NULL;
+static uint64_t _record_count = 0;
+
+int capture_init(void) {
+	const char *filename = config_get_option_value("capture.file")->string;
+	CaptureHeader header;
+	struct timeval now;
+
+	if (filename == NULL) {
+		return 0;
+	}
+
+	// each start begins a new capture, appending would mix unrelated runs
+	_file = fopen(filename, "wb");
+
+	if (_file == NULL) {
+		log_error("Could not open capture file '%s': %s (%d)",
+		          filename, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	// the file is written in full buffers, not record by record
+	setvbuf(_file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+	if (gettimeofday(&now, NULL) < 0) {
+		now.tv_sec = time(NULL);
+		now.tv_usec = 0;
+	}
+
+	memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+
+	header.version = uint32_to_le(CAPTURE_VERSION);
+	header.wall_clock = uint64_to_le((uint64_t)now.tv_sec * 1000000 + now.tv_usec);
+	header.timestamp = uint64_to_le(microtime());
+
+	fwrite(&header, 1, sizeof(header), _file);
+	fflush(_file);
+
+	mutex_create(&_mutex);
+
+	_record_count = 0;
+
+	log_info("Capturing TFP traffic to '%s'", filename);
+
+	return 0;
+}
+
+void capture_exit(void) {
+	if (_file == NULL) {
+		return;
+	}
+
+	log_info("Captured %" PRIu64 " record(s)", _record_count);
+
+	fclose(_file);
+	mutex_destroy(&_mutex);
+
+	_file = NULL;
+}
+
+bool capture_is_enabled(void) {
+	return _file != NULL;
+}
+
+// called from the network worker threads as well
+void capture_packet(CaptureType type, uint32_t client_id, uint16_t stack_id, Packet *packet) {
+	uint8_t buffer[sizeof(CaptureRecordHeader) + sizeof(Packet)];
+	CaptureRecordHeader *header = (CaptureRecordHeader *)buffer;
+	int packet_length = MIN(MAX(packet->header.length, (int)sizeof(PacketHeader)), (int)sizeof(Packet));
+
+	header->timestamp = uint64_to_le(microtime());
+	header->client_id = uint32_to_le(client_id);
+	header->stack_id = uint16_to_le(stack_id);
+	header->type = (uint8_t)type;
+	header->packet_length = (uint8_t)packet_length;
+
+	memcpy(buffer + sizeof(CaptureRecordHeader), packet, packet_length);
+
+	mutex_lock(&_mutex);
+
+	fwrite(buffer, 1, sizeof(CaptureRecordHeader) + packet_length, _file);
+
+	++_record_count;
+
+	mutex_unlock(&_mutex);
+}
+
+// in a quiet period a partly filled buffer could stay unwritten for long. this
+// is called periodically, together with packet_log_flush
+void capture_flush(void) {
+	if (_file == NULL) {
+		return;
+	}
+
+	mutex_lock(&_mutex);
+
+	fflush(_file);
+
+	mutex_unlock(&_mutex);
+}
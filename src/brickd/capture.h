@@ -0,0 +1,47 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * capture.h: Record TFP traffic for replay
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_CAPTURE_H
+#define BRICKD_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <daemonlib/packet.h>
+
+#define CAPTURE_NO_CLIENT 0
+#define CAPTURE_NO_STACK 0
+
+typedef enum {
+	CAPTURE_TYPE_REQUEST = 0, // received from a client
+	CAPTURE_TYPE_RESPONSE, // dispatched to the client that send the request
+	CAPTURE_TYPE_CALLBACK, // broadcast to all clients
+	CAPTURE_TYPE_ROUTE // request passed to a stack
+} CaptureType;
+
+int capture_init(void);
+void capture_exit(void);
+
+bool capture_is_enabled(void);
+void capture_packet(CaptureType type, uint32_t client_id, uint16_t stack_id, Packet *packet);
+void capture_flush(void);
+
+#endif // BRICKD_CAPTURE_H
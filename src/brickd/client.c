@@ -32,7 +32,7 @@
 
 #include "client.h"
 
-#include "hardware.h"
+#include "capture.h"
 #include "hmac.h"
 #include "network.h"
 #ifdef BRICKD_WITH_RED_BRICK
@@ -42,6 +42,8 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+static uint32_t _next_id = 1; // 0 is CAPTURE_NO_CLIENT
+
 extern uint8_t _redapid_version[3];
 
 #define UID_BRICK_DAEMON 1
@@ -165,6 +167,67 @@ static void client_handle_authenticate_request(Client *client,
 	}
 }
 
+static void client_handle_set_batch_mode_request(Client *client,
+                                                 SetBatchModeRequest *request) {
+	bool enable = request->enable != 0;
+	union {
+		SetBatchModeResponse response;
+		Packet packet;
+	} u;
+
+	if (client->authentication_state != CLIENT_AUTHENTICATION_STATE_DISABLED &&
+	    client->authentication_state != CLIENT_AUTHENTICATION_STATE_DONE) {
+		log_error("Client ("CLIENT_SIGNATURE_FORMAT") tries to change batch mode before authenticating, disconnecting client",
+		          client_expand_signature(client));
+
+		client->disconnected = true;
+
+		return;
+	}
+
+	// most clients never use batch mode, only allocate the buffer on demand.
+	// if that fails then batch mode stays disabled and the response reports a
+	// maximum payload length of zero
+	if (enable && client->batch_buffer == NULL) {
+		client->batch_buffer = malloc(PACKET_MAX_BATCH_LENGTH);
+
+		if (client->batch_buffer == NULL) {
+			log_error("Could not allocate batch buffer for client ("CLIENT_SIGNATURE_FORMAT"), keeping batch mode disabled: %s (%d)",
+			          client_expand_signature(client), get_errno_name(ENOMEM), ENOMEM);
+
+			enable = false;
+		}
+	}
+
+	// the response is still send in the current mode. when disabling batch
+	// mode it is the last packet of the last batch frame
+	if (packet_header_get_response_expected(&request->header)) {
+		u.response.header = request->header;
+		u.response.header.length = sizeof(u.response);
+		u.response.max_payload_length = uint16_to_le(enable ? PACKET_MAX_BATCH_PAYLOAD_LENGTH : 0);
+
+		packet_header_set_error_code(&u.response.header, PACKET_E_SUCCESS);
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+		u.packet.trace_id = packet_get_next_response_trace_id();
+#endif
+
+		packet_add_trace(&u.packet);
+		client_dispatch_response(client, NULL, &u.packet, false, false);
+	}
+
+	if (!enable) {
+		client_flush_batch(client);
+	}
+
+	if (client->batch_mode != enable) {
+		log_debug("Client ("CLIENT_SIGNATURE_FORMAT") %s batch mode",
+		          client_expand_signature(client), enable ? "enabled" : "disabled");
+	}
+
+	client->batch_mode = enable;
+}
+
 static void client_handle_request(Client *client, Packet *request) {
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	union {
@@ -174,6 +237,10 @@ static void client_handle_request(Client *client, Packet *request) {
 
 	packet_add_trace(request);
 
+	if (capture_is_enabled()) {
+		capture_packet(CAPTURE_TYPE_REQUEST, client->id, CAPTURE_NO_STACK, request);
+	}
+
 	// handle requests meant for brickd
 	if (uint32_from_le(request->header.uid) == UID_BRICK_DAEMON) {
 		// add as pending request if response is expected
@@ -205,6 +272,18 @@ static void client_handle_request(Client *client, Packet *request) {
 			}
 
 			client_handle_authenticate_request(client, (AuthenticateRequest *)request);
+		} else if (request->header.function_id == FUNCTION_SET_BATCH_MODE) {
+			if (request->header.length != sizeof(SetBatchModeRequest)) {
+				log_error("Received set-batch-mode request (%s) from client ("CLIENT_SIGNATURE_FORMAT") with wrong length, disconnecting client",
+				          packet_get_request_signature(packet_signature, request),
+				          client_expand_signature(client));
+
+				client->disconnected = true;
+
+				return;
+			}
+
+			client_handle_set_batch_mode_request(client, (SetBatchModeRequest *)request);
 		} else if (packet_header_get_response_expected(&request->header)) {
 			u.response.header = request->header;
 			u.response.header.length = sizeof(u.response);
@@ -226,26 +305,107 @@ static void client_handle_request(Client *client, Packet *request) {
 			network_client_expects_response(client, request);
 		}
 
-		// ...then dispatch it to the hardware
+		// ...then let the scheduler dispatch it to the hardware
 		packet_add_trace(request);
-		hardware_dispatch_request(request);
+		network_submit_request(client->scheduler_client, request);
 	} else {
-		log_packet_debug("Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
-		                 client_expand_signature(client),
-		                 packet_get_request_signature(packet_signature, request));
+		log_packet_request_debug(request, "Client ("CLIENT_SIGNATURE_FORMAT") is not authenticated, dropping request (%s)",
+		                                  client_expand_signature(client),
+		                                  packet_get_request_signature(packet_signature, request));
+	}
+}
+
+// RECEIVED has to be a complete and valid request. it points into the read
+// buffer and is only copied if the trace ID has to be added to it
+static void client_handle_received_request(Client *client, Packet *received) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	Packet request;
+#endif
+
+	if (received->header.function_id == FUNCTION_DISCONNECT_PROBE) {
+		log_packet_debug("Received disconnect probe from client ("CLIENT_SIGNATURE_FORMAT"), dropping request",
+		                 client_expand_signature(client));
+
+		return;
+	}
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	memcpy(&request, received, received->header.length);
+
+	request.trace_id = packet_get_next_request_trace_id();
+	received = &request;
+#endif
+
+	log_packet_request_debug(received, "Received request (%s) from client ("CLIENT_SIGNATURE_FORMAT")",
+	                                   packet_get_request_signature(packet_signature, received),
+	                                   client_expand_signature(client));
+
+	client_handle_request(client, received);
+}
+
+// the payload of a batch frame has to consist of complete and valid requests
+static void client_handle_batch(Client *client, uint8_t *payload, int length) {
+	int offset = 0;
+	PacketHeader *header;
+	const char *message = NULL;
+	char packet_dump[PACKET_MAX_DUMP_LENGTH];
+
+	while (!client->disconnected && offset < length) {
+		header = (PacketHeader *)(payload + offset);
+
+		if (length - offset < (int)sizeof(PacketHeader)) {
+			message = "Incomplete header";
+		} else if (!packet_header_is_valid_request(header, &message)) {
+			// message is already set
+		} else if (header->length > length - offset) {
+			message = "Incomplete packet";
+		} else {
+			client_handle_received_request(client, (Packet *)header);
+
+			offset += header->length;
+
+			continue;
+		}
+
+		log_error("Received invalid request (packet: %s) in batch frame from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s",
+		          packet_get_dump(packet_dump, (Packet *)header, MIN(length - offset, (int)sizeof(Packet))),
+		          client_expand_signature(client), message);
+
+		client->disconnected = true;
+
+		return;
 	}
 }
 
+// in batch mode the stream consists of batch frames, otherwise of requests
+static int client_get_frame_length(const uint8_t *data, int available,
+                                   void *opaque, const char **message) {
+	Client *client = opaque;
+
+	if (!client->batch_mode) {
+		return framer_get_request_length(data, available, NULL, message);
+	}
+
+	if (available < (int)sizeof(BatchHeader)) {
+		return 0;
+	}
+
+	if (!packet_batch_header_is_valid((BatchHeader *)data, message)) {
+		return -1;
+	}
+
+	return (int)sizeof(BatchHeader) + uint16_from_le(((BatchHeader *)data)->payload_length);
+}
+
 static void client_handle_read(void *opaque) {
 	Client *client = opaque;
 	int length;
+	uint8_t *frame;
 	const char *message = NULL;
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
-	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
-	Packet request;
 
-	length = io_read(client->io, client->request_buffer + client->request_buffer_used,
-	                 sizeof(client->request_buffer) - client->request_buffer_used);
+	length = framer_read(&client->request_framer, client->io);
 
 	if (length == 0) {
 		log_info("Client ("CLIENT_SIGNATURE_FORMAT") disconnected by peer",
@@ -280,60 +440,42 @@ static void client_handle_read(void *opaque) {
 		return;
 	}
 
-	client->request_buffer_used += length;
+	while (!client->disconnected) {
+		frame = framer_next(&client->request_framer, &length, &message);
 
-	while (!client->disconnected && client->request_buffer_used > 0) {
-		if (client->request_buffer_used < (int)sizeof(PacketHeader)) {
-			// wait for complete header
-			break;
-		}
+		if (frame == NULL) {
+			if (length < 0) {
+				frame = framer_peek(&client->request_framer, &length);
 
-		if (!client->request_header_checked) {
-			if (!packet_header_is_valid_request(&client->request.header, &message)) {
-				log_error("Received invalid request (packet: %s) from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s",
-				          packet_get_dump(packet_dump, &client->request, client->request_buffer_used),
-				          client_expand_signature(client), message);
+				if (client->batch_mode) {
+					log_error("Received invalid batch frame (header: %s) from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s",
+					          packet_get_dump(packet_dump, (Packet *)frame, MIN(length, (int)sizeof(BatchHeader))),
+					          client_expand_signature(client), message);
+				} else {
+					log_error("Received invalid request (packet: %s) from client ("CLIENT_SIGNATURE_FORMAT"), disconnecting client: %s",
+					          packet_get_dump(packet_dump, (Packet *)frame, length),
+					          client_expand_signature(client), message);
+				}
 
 				client->disconnected = true;
-
-				return;
 			}
 
-			client->request_header_checked = true;
-		}
-
-		length = client->request.header.length;
-
-		if (client->request_buffer_used < length) {
-			// wait for complete packet
+			// wait for complete frame
 			break;
 		}
 
-		if (client->request.header.function_id == FUNCTION_DISCONNECT_PROBE) {
-			log_packet_debug("Received disconnect probe from client ("CLIENT_SIGNATURE_FORMAT"), dropping request",
-			                 client_expand_signature(client));
+		if (client->batch_mode) {
+			client_handle_batch(client, frame + sizeof(BatchHeader),
+			                    length - (int)sizeof(BatchHeader));
 		} else {
-			memcpy(&request, &client->request, length);
-
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
-			request.trace_id = packet_get_next_request_trace_id();
-#endif
-
-			log_packet_debug("Received request (%s) from client ("CLIENT_SIGNATURE_FORMAT")",
-			                 packet_get_request_signature(packet_signature, &request),
-			                 client_expand_signature(client));
-
-			client_handle_request(client, &request);
+			client_handle_received_request(client, (Packet *)frame);
 		}
-
-		memmove(client->request_buffer, client->request_buffer + length, client->request_buffer_used - length);
-
-		client->request_buffer_used -= length;
-		client->request_header_checked = false;
 	}
 }
 
 void pending_request_remove_and_free(PendingRequest *pending_request) {
+	network_remove_route(pending_request);
+
 	node_remove(&pending_request->global_node);
 	node_remove(&pending_request->client_node);
 
@@ -381,12 +523,19 @@ int client_create(Client *client, const char *name, IO *io,
 	log_debug("Creating client from %s (handle: %d/%d)",
 	          io->type, io->read_handle, io->write_handle);
 
+#ifdef DAEMONLIB_WITH_EVENT_THREADS
+	client->id = __atomic_fetch_add(&_next_id, 1, __ATOMIC_RELAXED); // might be called from network workers
+#else
+	client->id = _next_id++;
+#endif
+
 	string_copy(client->name, sizeof(client->name), name, -1);
 
 	client->io = io;
 	client->disconnected = false;
-	client->request_buffer_used = 0;
-	client->request_header_checked = false;
+	client->batch_mode = false;
+	client->batch_buffer = NULL;
+	client->batch_payload_used = 0;
 	client->pending_request_count = 0;
 	client->dropped_pending_requests = 0;
 	client->authentication_state = CLIENT_AUTHENTICATION_STATE_DISABLED;
@@ -399,6 +548,15 @@ int client_create(Client *client, const char *name, IO *io,
 
 	node_reset(&client->pending_request_sentinel);
 
+	// create request framer
+	if (framer_create(&client->request_framer, CLIENT_READ_BUFFER_SIZE,
+	                  client_get_frame_length, client) < 0) {
+		log_error("Could not create request framer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
 	// create response writer
 	if (writer_create(&client->response_writer, client->io,
 	                  "response", packet_get_response_signature,
@@ -407,12 +565,32 @@ int client_create(Client *client, const char *name, IO *io,
 		log_error("Could not create response writer: %s (%d)",
 		          get_errno_name(errno), errno);
 
+		framer_destroy(&client->request_framer);
+
+		return -1;
+	}
+
+	// create scheduler state
+	client->scheduler_client = network_create_scheduler_client(client->name);
+
+	if (client->scheduler_client == NULL) {
+		writer_destroy(&client->response_writer);
+		framer_destroy(&client->request_framer);
+
 		return -1;
 	}
 
 	// add I/O object as event source
-	return event_add_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC,
-	                        "client", EVENT_READ, client_handle_read, client);
+	if (event_add_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     "client", EVENT_READ, client_handle_read, client) < 0) {
+		network_destroy_scheduler_client(client->scheduler_client);
+		writer_destroy(&client->response_writer);
+		framer_destroy(&client->request_framer);
+
+		return -1;
+	}
+
+	return 0;
 }
 
 void client_destroy(Client *client) {
@@ -431,7 +609,10 @@ void client_destroy(Client *client) {
 		}
 	}
 
+	network_destroy_scheduler_client(client->scheduler_client);
 	writer_destroy(&client->response_writer);
+	framer_destroy(&client->request_framer);
+	free(client->batch_buffer);
 
 	event_remove_source(client->io->read_handle, EVENT_SOURCE_TYPE_GENERIC);
 	io_destroy(client->io);
@@ -450,6 +631,25 @@ void client_destroy(Client *client) {
 	}
 }
 
+// in batch mode responses are collected and written as one batch frame by
+// client_flush_batch at the end of the current event loop iteration
+static int client_write_response(Client *client, Packet *response) {
+	if (!client->batch_mode) {
+		return writer_write(&client->response_writer, response);
+	}
+
+	if (client->batch_payload_used + response->header.length > PACKET_MAX_BATCH_PAYLOAD_LENGTH) {
+		client_flush_batch(client);
+	}
+
+	memcpy(client->batch_buffer + sizeof(BatchHeader) + client->batch_payload_used,
+	       response, response->header.length);
+
+	client->batch_payload_used += response->header.length;
+
+	return 1;
+}
+
 void client_dispatch_response(Client *client, PendingRequest *pending_request,
                               Packet *response, bool force, bool ignore_authentication) {
 	Node *pending_request_client_node = NULL;
@@ -497,7 +697,7 @@ void client_dispatch_response(Client *client, PendingRequest *pending_request,
 	}
 
 	if (force || pending_request != NULL) {
-		enqueued = writer_write(&client->response_writer, response);
+		enqueued = client_write_response(client, response);
 
 		if (enqueued < 0) {
 			goto cleanup;
@@ -558,3 +758,27 @@ void client_send_red_brick_enumerate(Client *client, EnumerationType type) {
 }
 
 #endif
+
+void client_flush_batch(Client *client) {
+	int payload_length = client->batch_payload_used;
+	BatchHeader *batch;
+
+	if (payload_length == 0) {
+		return;
+	}
+
+	client->batch_payload_used = 0;
+
+	if (client->disconnected) {
+		return;
+	}
+
+	batch = (BatchHeader *)client->batch_buffer;
+
+	packet_batch_header_init(batch, payload_length);
+
+	if (writer_write_batch(&client->response_writer, batch) >= 0) {
+		log_packet_debug("Sent batch frame with %d byte(s) of responses to client ("CLIENT_SIGNATURE_FORMAT")",
+		                 payload_length, client_expand_signature(client));
+	}
+}
@@ -31,13 +31,17 @@
 #endif
 
 #include <daemonlib/array.h>
+#include <daemonlib/framer.h>
 #include <daemonlib/io.h>
 #include <daemonlib/node.h>
 #include <daemonlib/packet.h>
 #include <daemonlib/writer.h>
 
+#include "scheduler.h"
+
 #define CLIENT_MAX_NAME_LENGTH 128
 #define CLIENT_MAX_PENDING_REQUESTS 32768
+#define CLIENT_READ_BUFFER_SIZE 8192 // bytes, at least PACKET_MAX_BATCH_LENGTH
 
 typedef struct _Client Client;
 typedef struct _Zombie Zombie;
@@ -58,23 +62,24 @@ struct _PendingRequest {
 	Node client_node; // also used as zombie_node
 	Client *client;
 	Zombie *zombie;
+	void *route; // with network workers, see network.c
 	PacketHeader header;
 };
 
 struct _Client {
+	uint32_t id; // for the capture
 	char name[CLIENT_MAX_NAME_LENGTH]; // for display purpose
 	IO *io;
 	bool disconnected;
-	union {
-		uint8_t request_buffer[512];
-		Packet request;
-	};
-	int request_buffer_used;
-	bool request_header_checked;
+	Framer request_framer;
+	bool batch_mode;
+	uint8_t *batch_buffer; // allocated when batch mode is enabled for the first time
+	int batch_payload_used; // bytes
 	Node pending_request_sentinel;
 	int pending_request_count;
 	uint32_t dropped_pending_requests;
 	Writer response_writer;
+	SchedulerClient *scheduler_client; // might be owned by the hardware thread
 	ClientAuthenticationState authentication_state;
 	uint32_t authentication_nonce; // server
 	ClientDestroyDoneFunction destroy_done;
@@ -83,7 +88,7 @@ struct _Client {
 #define CLIENT_SIGNATURE_FORMAT "N: %s, T: %s, H: %d/%d, B: %d, P: %d, A: %s"
 #define client_expand_signature(client) (client)->name, (client)->io->type, \
 	(int)(client)->io->read_handle, (int)(client)->io->write_handle, \
-	(client)->request_buffer_used, (client)->pending_request_count, \
+	(client)->request_framer.end - (client)->request_framer.start, (client)->pending_request_count, \
 	client_get_authentication_state_name((client)->authentication_state)
 
 void pending_request_remove_and_free(PendingRequest *pending_request);
@@ -97,6 +102,7 @@ void client_destroy(Client *client);
 
 void client_dispatch_response(Client *client, PendingRequest *pending_request,
                               Packet *response, bool force, bool ignore_authentication);
+void client_flush_batch(Client *client);
 
 #ifdef BRICKD_WITH_RED_BRICK
 
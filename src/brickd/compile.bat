@@ -33,7 +33,9 @@
  ..\daemonlib\enum.c^
  ..\daemonlib\event.c^
  ..\daemonlib\file.c^
+ ..\daemonlib\framer.c^
  ..\daemonlib\io.c^
+ ..\daemonlib\lane_queue.c^
  ..\daemonlib\log.c^
  ..\daemonlib\node.c^
  ..\daemonlib\packet.c^
@@ -48,6 +50,7 @@
 
 %CC% /FIfixes_msvc.h^
  base64.c^
+ capture.c^
  client.c^
  config_options.c^
  event_winapi.c^
@@ -60,8 +63,10 @@
  mesh_stack.c^
  main_winapi.c^
  network.c^
+ scheduler.c^
  service.c^
  sha1.c^
+ sim_stack.c^
  stack.c^
  usb.c^
  usb_stack.c^
@@ -78,9 +78,25 @@ ConfigOption config_options[] = {
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.websocket_port", 0, UINT16_MAX, 0), // default to enable: 4280
 	CONFIG_OPTION_INTEGER_INITIALIZER("listen.mesh_gateway_port", 1, UINT16_MAX, 4240),
 	CONFIG_OPTION_BOOLEAN_INITIALIZER("listen.dual_stack", false),
+	CONFIG_OPTION_STRING_INITIALIZER("listen.unix_socket_path", 0, -1, NULL),
 	CONFIG_OPTION_STRING_INITIALIZER("authentication.secret", 0, 64, NULL),
+	CONFIG_OPTION_INTEGER_INITIALIZER("scheduler.rate_limit", 0, 1000000, 0), // requests per second, 0 = unlimited
+	CONFIG_OPTION_INTEGER_INITIALIZER("scheduler.rate_burst", 1, 1000000, 100), // requests
+	CONFIG_OPTION_STRING_INITIALIZER("request_lanes.rules", 0, -1, NULL),
+	CONFIG_OPTION_INTEGER_INITIALIZER("network.worker_threads", 0, 64, 0),
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("event.profiling", false),
+	CONFIG_OPTION_INTEGER_INITIALIZER("event.stall_threshold", 0, 60000, 100), // milliseconds, 0 = no warnings
 	CONFIG_OPTION_SYMBOL_INITIALIZER("log.level", config_parse_log_level, config_format_log_level, LOG_LEVEL_INFO),
 	CONFIG_OPTION_STRING_INITIALIZER("log.debug_filter", 0, -1, NULL),
+	CONFIG_OPTION_BOOLEAN_INITIALIZER("log.async", false),
+	CONFIG_OPTION_STRING_INITIALIZER("log.packet_file", 0, -1, NULL),
+	CONFIG_OPTION_INTEGER_INITIALIZER("simulation.devices", 0, 1000, 0), // 0 = disabled
+	CONFIG_OPTION_INTEGER_INITIALIZER("simulation.first_uid", 2, INT32_MAX, 100000),
+	CONFIG_OPTION_INTEGER_INITIALIZER("simulation.latency", 0, 10000000, 0), // microseconds
+	CONFIG_OPTION_INTEGER_INITIALIZER("simulation.callback_period", 0, 3600000, 0), // milliseconds, 0 = disabled
+	CONFIG_OPTION_INTEGER_INITIALIZER("simulation.error_rate", 0, 100, 0), // percent
+	CONFIG_OPTION_INTEGER_INITIALIZER("simulation.drop_rate", 0, 100, 0), // percent
+	CONFIG_OPTION_STRING_INITIALIZER("capture.file", 0, -1, NULL),
 #ifdef BRICKD_WITH_RED_BRICK
 	CONFIG_OPTION_SYMBOL_INITIALIZER("led_trigger.green", config_parse_red_led_trigger, config_format_red_led_trigger, RED_LED_TRIGGER_HEARTBEAT),
 	CONFIG_OPTION_SYMBOL_INITIALIZER("led_trigger.red", config_parse_red_led_trigger, config_format_red_led_trigger, RED_LED_TRIGGER_OFF),
@@ -646,6 +646,8 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 			         event_get_source_type_name(EVENT_SOURCE_TYPE_GENERIC, false));
 		}
 
+		event_count_iteration();
+
 		// now cleanup event sources that got marked as disconnected/removed
 		// during the event handling
 		cleanup();
@@ -21,23 +21,139 @@
 
 #include <errno.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include <daemonlib/array.h>
+#include <daemonlib/base58.h>
+#include <daemonlib/config.h>
 #include <daemonlib/log.h>
 #include <daemonlib/packet.h>
 #include <daemonlib/utils.h>
 
 #include "hardware.h"
 
+#include "scheduler.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+typedef struct {
+	uint32_t uid; // always little endian, 0 = any
+	int function_id; // -1 = any
+	QueueLane lane;
+} RequestLaneRule;
+
 static Array _stacks;
+static RequestLaneRule _request_lane_rules[64];
+static int _request_lane_rule_count = 0;
+
+// parses a comma separated list of rules in the form <+|-><uid>:<function-id>.
+// a + puts matching requests into the high priority lane, a - puts them into
+// the low priority lane. the UID and the function ID can be * to match any
+static void hardware_set_request_lane_rules(const char *rules) {
+	const char *p = rules;
+	int i = 0;
+	const char *tmp;
+	char rule[32];
+	char *colon;
+	uint32_t uid;
+	int function_id;
+
+	_request_lane_rule_count = 0;
+
+	while (*p != '\0') {
+		if (i >= (int)sizeof(_request_lane_rules) / (int)sizeof(_request_lane_rules[0])) {
+			log_warn("Too many rules in request lane rules '%s'", rules);
+
+			return;
+		}
+
+		if (*p == '+') {
+			_request_lane_rules[i].lane = QUEUE_LANE_HIGH;
+		} else if (*p == '-') {
+			_request_lane_rules[i].lane = QUEUE_LANE_LOW;
+		} else {
+			log_warn("Unexpected char '%c' in request lane rules '%s' at index %d",
+			         *p, rules, (int)(p - rules));
+
+			return;
+		}
+
+		++p;
+		tmp = strchr(p, ',');
+
+		if (tmp == NULL) {
+			tmp = p + strlen(p);
+		}
+
+		if (tmp - p >= (int)sizeof(rule)) {
+			log_warn("Rule is too long in request lane rules '%s' at index %d",
+			         rules, (int)(p - rules));
+
+			return;
+		}
+
+		memcpy(rule, p, tmp - p);
+		rule[tmp - p] = '\0';
+
+		colon = strchr(rule, ':');
+
+		if (colon == NULL) {
+			log_warn("Missing colon in request lane rules '%s' at index %d",
+			         rules, (int)(p - rules));
+
+			return;
+		}
+
+		*colon = '\0';
+
+		if (strcmp(rule, "*") == 0) {
+			uid = 0;
+		} else if (base58_decode(&uid, rule) < 0 || uid == 0) {
+			log_warn("Invalid UID '%s' in request lane rules '%s' at index %d",
+			         rule, rules, (int)(p - rules));
+
+			return;
+		}
+
+		if (strcmp(colon + 1, "*") == 0) {
+			function_id = -1;
+		} else if (parse_int(colon + 1, NULL, 10, &function_id) < 0 ||
+		           function_id < 0 || function_id > 255) {
+			log_warn("Invalid function ID '%s' in request lane rules '%s' at index %d",
+			         colon + 1, rules, (int)(p - rules));
+
+			return;
+		}
+
+		_request_lane_rules[i].uid = uint32_to_le(uid);
+		_request_lane_rules[i].function_id = function_id;
+
+		p = tmp;
+
+		if (*p == ',') {
+			++p;
+
+			if (*p == '\0') {
+				log_warn("Request lane rules '%s' end with a trailing comma", rules);
+
+				return;
+			}
+		}
+
+		_request_lane_rule_count = ++i;
+	}
+}
 
 int hardware_init(void) {
+	const char *request_lane_rules = config_get_option_value("request_lanes.rules")->string;
+
 	log_debug("Initializing hardware subsystem");
 
+	if (request_lane_rules != NULL) {
+		hardware_set_request_lane_rules(request_lane_rules);
+	}
+
 	// create stack array
 	if (array_create(&_stacks, 32, sizeof(Stack *), true) < 0) {
 		log_error("Could not create stack array: %s (%d)",
@@ -46,12 +162,21 @@ int hardware_init(void) {
 		return -1;
 	}
 
+	// the scheduler dispatches client requests to the stacks
+	if (scheduler_init() < 0) {
+		array_destroy(&_stacks, NULL);
+
+		return -1;
+	}
+
 	return 0;
 }
 
 void hardware_exit(void) {
 	log_debug("Shutting down hardware subsystem");
 
+	scheduler_exit();
+
 	if (_stacks.count > 0) {
 		log_warn("Still %d stack(s) connected", _stacks.count);
 	}
@@ -84,6 +209,8 @@ int hardware_remove_stack(Stack *stack) {
 		if (candidate == stack) {
 			array_remove(&_stacks, i, NULL);
 
+			scheduler_remove_stack(stack);
+
 			return 0;
 		}
 	}
@@ -103,16 +230,16 @@ void hardware_dispatch_request(Packet *request) {
 	packet_add_trace(request);
 
 	if (_stacks.count == 0) {
-		log_packet_debug("No stacks connected, dropping request (%s)",
-		                 packet_get_request_signature(packet_signature, request));
+		log_packet_request_debug(request, "No stacks connected, dropping request (%s)",
+		                                  packet_get_request_signature(packet_signature, request));
 
 		return;
 	}
 
 	if (request->header.uid == 0) {
-		log_packet_debug("Broadcasting request (%s) to %d stack(s)",
-		                 packet_get_request_signature(packet_signature, request),
-		                 _stacks.count);
+		log_packet_request_debug(request, "Broadcasting request (%s) to %d stack(s)",
+		                                  packet_get_request_signature(packet_signature, request),
+		                                  _stacks.count);
 
 		packet_add_trace(request);
 
@@ -123,9 +250,9 @@ void hardware_dispatch_request(Packet *request) {
 			stack_dispatch_request(stack, request, true);
 		}
 	} else {
-		log_packet_debug("Dispatching request (%s) to %d stack(s)",
-		                 packet_get_request_signature(packet_signature, request),
-		                 _stacks.count);
+		log_packet_request_debug(request, "Dispatching request (%s) to %d stack(s)",
+		                                  packet_get_request_signature(packet_signature, request),
+		                                  _stacks.count);
 
 		packet_add_trace(request);
 
@@ -164,6 +291,72 @@ void hardware_dispatch_request(Packet *request) {
 	}
 }
 
+// collects the stacks that would receive the request in STACKS (of Stack *),
+// following the same routing rules as hardware_dispatch_request. returns -1
+// on error, otherwise the number of stacks
+int hardware_get_request_stacks(Packet *request, Array *stacks) {
+	int i;
+	Stack *stack;
+	Stack **item;
+	bool known = false;
+
+	array_resize(stacks, 0, NULL);
+
+	if (request->header.uid != 0) {
+		for (i = 0; i < _stacks.count; ++i) {
+			stack = *(Stack **)array_get(&_stacks, i);
+
+			if (stack_get_recipient(stack, request->header.uid) != NULL) {
+				item = array_append(stacks);
+
+				if (item == NULL) {
+					return -1;
+				}
+
+				*item = stack;
+				known = true;
+			}
+		}
+	}
+
+	if (!known) {
+		// broadcast or unknown UID, request would be send to all stacks
+		for (i = 0; i < _stacks.count; ++i) {
+			item = array_append(stacks);
+
+			if (item == NULL) {
+				return -1;
+			}
+
+			*item = *(Stack **)array_get(&_stacks, i);
+		}
+	}
+
+	return stacks->count;
+}
+
+// returns the write queue lane for the request. the first matching rule wins.
+// without a matching rule getters go into the high priority lane, because
+// someone is waiting for their response, and everything else goes into the low
+// priority lane. the write queues are keyed by UID, a request is only put into
+// this lane if no other request for the same UID is still queued in the other
+// lane, so the requests for one device are never reordered
+QueueLane hardware_get_request_lane(Packet *request) {
+	int i;
+	RequestLaneRule *rule;
+
+	for (i = 0; i < _request_lane_rule_count; ++i) {
+		rule = &_request_lane_rules[i];
+
+		if ((rule->uid == 0 || rule->uid == request->header.uid) &&
+		    (rule->function_id < 0 || rule->function_id == request->header.function_id)) {
+			return rule->lane;
+		}
+	}
+
+	return packet_header_get_response_expected(&request->header) ? QUEUE_LANE_HIGH : QUEUE_LANE_LOW;
+}
+
 void hardware_announce_disconnect(void) {
 	int i;
 	Stack *stack;
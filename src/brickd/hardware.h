@@ -22,6 +22,8 @@
 #ifndef BRICKD_HARDWARE_H
 #define BRICKD_HARDWARE_H
 
+#include <daemonlib/array.h>
+#include <daemonlib/lane_queue.h>
 #include <daemonlib/packet.h>
 
 #include "stack.h"
@@ -33,6 +35,8 @@ int hardware_add_stack(Stack *stack);
 int hardware_remove_stack(Stack *stack);
 
 void hardware_dispatch_request(Packet *request);
+int hardware_get_request_stacks(Packet *request, Array *stacks);
+QueueLane hardware_get_request_lane(Packet *request);
 
 void hardware_announce_disconnect(void);
 
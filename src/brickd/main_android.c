@@ -33,6 +33,7 @@
 #include "network.h"
 #include "usb.h"
 #include "mesh.h"
+#include "sim_stack.h"
 #include "version.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -42,6 +43,7 @@ extern jobject android_service;
 
 static void handle_event_cleanup(void) {
 	network_cleanup_clients_and_zombies();
+	mesh_flush_stacks();
 	mesh_cleanup_stacks();
 }
 
@@ -116,12 +118,22 @@ Java_com_tinkerforge_brickd_MainService_main(JNIEnv *env, jobject this, jobject
 
 	phase = 8;
 
+	if (sim_stack_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 9;
+
 	if (event_run(handle_event_cleanup) < 0) {
 		goto cleanup;
 	}
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 9:
+		sim_stack_exit();
+		// fall through
+
 	case 8:
 		mesh_exit();
 		// fall through
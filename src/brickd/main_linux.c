@@ -36,16 +36,20 @@
 #include <daemonlib/daemon.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
+#include <daemonlib/packet.h>
 #include <daemonlib/pid_file.h>
 #ifdef BRICKD_WITH_RED_BRICK
 	#include <daemonlib/gpio_red.h>
 	#include <daemonlib/red_led.h>
 #endif
 #include <daemonlib/signal.h>
+#include <daemonlib/timer.h>
 #include <daemonlib/utils.h>
 
+#include "capture.h"
 #include "hardware.h"
 #include "network.h"
+#include "scheduler.h"
 #ifdef BRICKD_WITH_RED_BRICK
 	#include "redapid.h"
 	#include "red_stack.h"
@@ -60,6 +64,7 @@
 #endif
 #include "usb.h"
 #include "mesh.h"
+#include "sim_stack.h"
 #include "version.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -71,6 +76,7 @@ static const char *_pid_filename = _pid_filename_default;
 static char _log_filename_default[1024] = LOCALSTATEDIR"/log/brickd.log";
 static const char *_log_filename = _log_filename_default;
 static File _log_file;
+static Timer _flush_timer;
 
 #ifdef BRICKD_WITH_LIBUSB_HOTPLUG_MKNOD
 extern bool usb_hotplug_mknod;
@@ -228,6 +234,10 @@ static void handle_sighup(void) {
 }
 
 static void handle_sigusr1(void) {
+	// without profiling this does nothing
+	event_log_profile();
+	scheduler_log_stats();
+
 #ifdef BRICKD_WITH_USB_REOPEN_ON_SIGUSR1
 	log_info("Reopening all USB devices, triggered by SIGUSR1");
 
@@ -239,8 +249,16 @@ static void handle_sigusr1(void) {
 #endif
 }
 
+static void handle_flush(void *opaque) {
+	(void)opaque;
+
+	packet_log_flush();
+	capture_flush();
+}
+
 static void handle_event_cleanup(void) {
 	network_cleanup_clients_and_zombies();
+	mesh_flush_stacks();
 	mesh_cleanup_stacks();
 }
 
@@ -253,6 +271,8 @@ int main(int argc, char **argv) {
 	bool check_config = false;
 	bool daemon = false;
 	const char *debug_filter = NULL;
+	const char *packet_log_filename;
+	bool flushing = false;
 	int pid_fd = -1;
 #ifdef BRICKD_WITH_LIBUDEV
 	bool initialized_udev = false;
@@ -363,6 +383,10 @@ int main(int argc, char **argv) {
 		goto cleanup;
 	}
 
+	if (config_get_option_value("log.async")->boolean) {
+		log_enable_async();
+	}
+
 	log_info("Brick Daemon %s started (pid: %u, daemonized: %d)",
 	         VERSION_STRING, getpid(), daemon ? 1 : 0);
 
@@ -385,6 +409,19 @@ int main(int argc, char **argv) {
 		         _config_filename);
 	}
 
+	packet_log_filename = config_get_option_value("log.packet_file")->string;
+
+	// the binary packet log is a debugging aid, brickd works without it
+	if (packet_log_filename != NULL) {
+		packet_log_init(packet_log_filename);
+	}
+
+	// the packet trace is only compiled in with WITH_PACKET_TRACE=yes
+	packet_trace_init();
+
+	// the capture is a testing aid, brickd works without it
+	capture_init();
+
 #ifdef BRICKD_WITH_LIBUSB_DLOPEN
 	if (libusb_init_dlopen() < 0) {
 		goto cleanup;
@@ -393,12 +430,26 @@ int main(int argc, char **argv) {
 	phase = 4;
 #endif
 
+	if (config_get_option_value("event.profiling")->boolean) {
+		event_enable_profiling(config_get_option_value("event.stall_threshold")->integer);
+	}
+
 	if (event_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 5;
 
+	// a quiet period could keep records in the packet log and capture buffers
+	// for long, flush them periodically. brickd works without it
+	if ((packet_log_is_enabled() || capture_is_enabled()) &&
+	    timer_create_(&_flush_timer, handle_flush, NULL) >= 0) {
+		flushing = true;
+
+		timer_configure(&_flush_timer, PACKET_LOG_FLUSH_INTERVAL,
+		                PACKET_LOG_FLUSH_INTERVAL);
+	}
+
 	if (signal_init(handle_sighup, handle_sigusr1) < 0) {
 		goto cleanup;
 	}
@@ -485,6 +536,12 @@ int main(int argc, char **argv) {
 	phase = 17;
 #endif
 
+	if (sim_stack_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 18;
+
 	if (event_run(handle_event_cleanup) < 0) {
 		goto cleanup;
 	}
@@ -499,7 +556,11 @@ int main(int argc, char **argv) {
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 18:
+		sim_stack_exit();
 #ifdef BRICKD_WITH_BRICKLET
+		// fall through
+
 	case 17:
 		bricklet_exit();
 #endif
@@ -557,6 +618,10 @@ cleanup:
 		// fall through
 
 	case 5:
+		if (flushing) {
+			timer_destroy(&_flush_timer);
+		}
+
 		event_exit();
 
 #ifdef BRICKD_WITH_LIBUSB_DLOPEN
@@ -568,6 +633,9 @@ cleanup:
 		// fall through
 
 	case 3:
+		capture_exit();
+		packet_trace_exit();
+		packet_log_exit();
 		log_info("Brick Daemon %s stopped", VERSION_STRING);
 		// fall through
 
@@ -34,15 +34,20 @@
 #include <daemonlib/daemon.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
+#include <daemonlib/packet.h>
 #include <daemonlib/pid_file.h>
 #include <daemonlib/signal.h>
+#include <daemonlib/timer.h>
 #include <daemonlib/utils.h>
 
+#include "capture.h"
 #include "hardware.h"
 #include "iokit.h"
 #include "network.h"
+#include "scheduler.h"
 #include "usb.h"
 #include "mesh.h"
+#include "sim_stack.h"
 #include "version.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -51,6 +56,7 @@ static const char *_config_filename = SYSCONFDIR"/brickd.conf";
 static const char *_pid_filename = LOCALSTATEDIR"/run/brickd.pid";
 static const char *_log_filename = LOCALSTATEDIR"/log/brickd.log";
 static File _log_file;
+static Timer _flush_timer;
 
 static void print_usage(void) {
 	printf("Usage:\n"
@@ -69,6 +75,10 @@ static void print_usage(void) {
 }
 
 static void handle_sigusr1(void) {
+	// without profiling this does nothing
+	event_log_profile();
+	scheduler_log_stats();
+
 #ifdef BRICKD_WITH_USB_REOPEN_ON_SIGUSR1
 	log_info("Reopening all USB devices, triggered by SIGUSR1");
 
@@ -80,8 +90,16 @@ static void handle_sigusr1(void) {
 #endif
 }
 
+static void handle_flush(void *opaque) {
+	(void)opaque;
+
+	packet_log_flush();
+	capture_flush();
+}
+
 static void handle_event_cleanup(void) {
 	network_cleanup_clients_and_zombies();
+	mesh_flush_stacks();
 	mesh_cleanup_stacks();
 }
 
@@ -95,6 +113,8 @@ int main(int argc, char **argv) {
 	bool daemon = false;
 	bool launchd = false;
 	const char *debug_filter = NULL;
+	const char *packet_log_filename;
+	bool flushing = false;
 	int pid_fd = -1;
 
 	for (i = 1; i < argc; ++i) {
@@ -207,6 +227,10 @@ int main(int argc, char **argv) {
 		goto cleanup;
 	}
 
+	if (config_get_option_value("log.async")->boolean) {
+		log_enable_async();
+	}
+
 	log_info("Brick Daemon %s started (pid: %u, daemonized: %d)",
 	         VERSION_STRING, getpid(), daemon || launchd ? 1 : 0);
 
@@ -229,12 +253,39 @@ int main(int argc, char **argv) {
 		         _config_filename);
 	}
 
+	packet_log_filename = config_get_option_value("log.packet_file")->string;
+
+	// the binary packet log is a debugging aid, brickd works without it
+	if (packet_log_filename != NULL) {
+		packet_log_init(packet_log_filename);
+	}
+
+	// the packet trace is only compiled in with WITH_PACKET_TRACE=yes
+	packet_trace_init();
+
+	// the capture is a testing aid, brickd works without it
+	capture_init();
+
+	if (config_get_option_value("event.profiling")->boolean) {
+		event_enable_profiling(config_get_option_value("event.stall_threshold")->integer);
+	}
+
 	if (event_init() < 0) {
 		goto cleanup;
 	}
 
 	phase = 4;
 
+	// a quiet period could keep records in the packet log and capture buffers
+	// for long, flush them periodically. brickd works without it
+	if ((packet_log_is_enabled() || capture_is_enabled()) &&
+	    timer_create_(&_flush_timer, handle_flush, NULL) >= 0) {
+		flushing = true;
+
+		timer_configure(&_flush_timer, PACKET_LOG_FLUSH_INTERVAL,
+		                PACKET_LOG_FLUSH_INTERVAL);
+	}
+
 	if (signal_init(NULL, handle_sigusr1) < 0) {
 		goto cleanup;
 	}
@@ -271,6 +322,12 @@ int main(int argc, char **argv) {
 
 	phase = 10;
 
+	if (sim_stack_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 11;
+
 	if (event_run(handle_event_cleanup) < 0) {
 		goto cleanup;
 	}
@@ -279,6 +336,10 @@ int main(int argc, char **argv) {
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 11:
+		sim_stack_exit();
+		// fall through
+
 	case 10:
 		mesh_exit();
 		// fall through
@@ -304,10 +365,17 @@ cleanup:
 		// fall through
 
 	case 4:
+		if (flushing) {
+			timer_destroy(&_flush_timer);
+		}
+
 		event_exit();
 		// fall through
 
 	case 3:
+		capture_exit();
+		packet_trace_exit();
+		packet_log_exit();
 		log_info("Brick Daemon %s stopped", VERSION_STRING);
 		// fall through
 
@@ -67,6 +67,7 @@ BOOL WINAPI Process32Next(HANDLE hSnapshot, PROCESSENTRY32 *lppe);
 #include "service.h"
 #include "usb.h"
 #include "mesh.h"
+#include "sim_stack.h"
 #include "version.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -352,6 +353,7 @@ static int rotate_log_file(IO *output, LogLevel *level, char *message, int messa
 
 static void handle_event_cleanup(void) {
 	network_cleanup_clients_and_zombies();
+	mesh_flush_stacks();
 	mesh_cleanup_stacks();
 }
 
@@ -499,6 +501,10 @@ init:
 		goto cleanup;
 	}
 
+	if (config_get_option_value("event.profiling")->boolean) {
+		event_enable_profiling(config_get_option_value("event.stall_threshold")->integer);
+	}
+
 	if (event_init() < 0) {
 		// FIXME: set service_exit_code
 		goto cleanup;
@@ -534,6 +540,13 @@ init:
 
 	phase = 5;
 
+	if (sim_stack_init() < 0) {
+		// FIXME: set service_exit_code
+		goto cleanup;
+	}
+
+	phase = 6;
+
 	// running
 	if (_run_as_service) {
 		service_set_status(SERVICE_RUNNING, NO_ERROR);
@@ -548,6 +561,10 @@ init:
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 6:
+		sim_stack_exit();
+		// fall through
+
 	case 5:
 		mesh_exit();
 		// fall through
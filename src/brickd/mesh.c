@@ -40,6 +40,8 @@
 #include "mesh_stack.h"
 
 Array mesh_stacks;
+Array mesh_nodes;
+Array mesh_routes;
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 static Array _server_sockets;
@@ -50,24 +52,66 @@ static void mesh_destroy_server_socket(Socket *server_socket) {
 }
 
 int mesh_init(void) {
+	int phase = 0;
+
 	log_debug("Initializing mesh subsystem");
 
 	if (array_create(&mesh_stacks, MAX_MESH_STACKS, sizeof(MeshStack), false) < 0) {
 		log_error("Failed to create mesh stack array: %s (%d)",
 		          get_errno_name(errno), errno);
 
-		return -1;
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	// the node and route arrays are independent of the mesh stacks, so that
+	// the routes of a mesh network survive a reconnect of its root node
+	if (array_create(&mesh_nodes, 32, sizeof(MeshNode), true) < 0) {
+		log_error("Failed to create mesh node array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
 	}
 
+	phase = 2;
+
+	if (array_create(&mesh_routes, 32, sizeof(MeshRoute), true) < 0) {
+		log_error("Failed to create mesh route array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
 	if (mesh_start_listening() < 0) {
 		log_error("Failed to open mesh listen socket");
 
+		goto cleanup;
+	}
+
+	phase = 4;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 3:
+		array_destroy(&mesh_routes, NULL);
+		// fall through
+
+	case 2:
+		array_destroy(&mesh_nodes, NULL);
+		// fall through
+
+	case 1:
 		array_destroy(&mesh_stacks, (ItemDestroyFunction)mesh_stack_destroy);
+		// fall through
 
-		return -1;
+	default:
+		break;
 	}
 
-	return 0;
+	return phase == 4 ? 0 : -1;
 }
 
 void mesh_exit(void) {
@@ -75,6 +119,8 @@ void mesh_exit(void) {
 
 	array_destroy(&_server_sockets, (ItemDestroyFunction)mesh_destroy_server_socket);
 	array_destroy(&mesh_stacks, (ItemDestroyFunction)mesh_stack_destroy);
+	array_destroy(&mesh_routes, NULL);
+	array_destroy(&mesh_nodes, NULL);
 }
 
 void mesh_handle_accept(void *opaque) {
@@ -174,6 +220,21 @@ int mesh_start_listening(void) {
 	return _server_sockets.count > 0 ? 0 : -1;
 }
 
+// called after each event loop iteration to write the mesh packets that were
+// queued for each mesh stack during the iteration
+void mesh_flush_stacks(void) {
+	int i;
+	MeshStack *mesh_stack;
+
+	for (i = 0; i < mesh_stacks.count; ++i) {
+		mesh_stack = array_get(&mesh_stacks, i);
+
+		if (!mesh_stack->cleanup) {
+			mesh_stack_flush(mesh_stack);
+		}
+	}
+}
+
 void mesh_cleanup_stacks(void) {
 	int i;
 	MeshStack *mesh_stack;
@@ -188,3 +249,150 @@ void mesh_cleanup_stacks(void) {
 		}
 	}
 }
+
+// returns 1 if the node was not known before, 0 if it was already known and -1
+// on error
+int mesh_add_node(const uint8_t *group_id, const uint8_t *node_addr) {
+	MeshNode *node;
+
+	if (mesh_get_node(group_id, node_addr) != NULL) {
+		return 0;
+	}
+
+	node = array_append(&mesh_nodes);
+
+	if (node == NULL) {
+		log_error("Could not append to mesh node array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	memcpy(node->group_id, group_id, sizeof(node->group_id));
+	memcpy(node->node_addr, node_addr, sizeof(node->node_addr));
+
+	node->discovering = false;
+	node->answered = false;
+
+	log_debug("Added mesh node (G: %02X-%02X-%02X-%02X-%02X-%02X, A: %02X-%02X-%02X-%02X-%02X-%02X)",
+	          group_id[0], group_id[1], group_id[2], group_id[3], group_id[4], group_id[5],
+	          node_addr[0], node_addr[1], node_addr[2], node_addr[3], node_addr[4], node_addr[5]);
+
+	return 1;
+}
+
+MeshNode *mesh_get_node(const uint8_t *group_id, const uint8_t *node_addr) {
+	int i;
+	MeshNode *node;
+
+	for (i = 0; i < mesh_nodes.count; ++i) {
+		node = array_get(&mesh_nodes, i);
+
+		if (memcmp(node->group_id, group_id, sizeof(node->group_id)) == 0 &&
+		    memcmp(node->node_addr, node_addr, sizeof(node->node_addr)) == 0) {
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+// removes the node and all routes to it
+void mesh_remove_node(const uint8_t *group_id, const uint8_t *node_addr) {
+	int i;
+	MeshNode *node;
+	MeshRoute *route;
+
+	// iterate backwards for simpler index handling
+	for (i = mesh_routes.count - 1; i >= 0; --i) {
+		route = array_get(&mesh_routes, i);
+
+		if (memcmp(route->group_id, group_id, sizeof(route->group_id)) == 0 &&
+		    memcmp(route->node_addr, node_addr, sizeof(route->node_addr)) == 0) {
+			array_remove(&mesh_routes, i, NULL);
+		}
+	}
+
+	for (i = 0; i < mesh_nodes.count; ++i) {
+		node = array_get(&mesh_nodes, i);
+
+		if (memcmp(node->group_id, group_id, sizeof(node->group_id)) == 0 &&
+		    memcmp(node->node_addr, node_addr, sizeof(node->node_addr)) == 0) {
+			log_debug("Removed mesh node (G: %02X-%02X-%02X-%02X-%02X-%02X, A: %02X-%02X-%02X-%02X-%02X-%02X)",
+			          group_id[0], group_id[1], group_id[2], group_id[3], group_id[4], group_id[5],
+			          node_addr[0], node_addr[1], node_addr[2], node_addr[3], node_addr[4], node_addr[5]);
+
+			array_remove(&mesh_nodes, i, NULL);
+
+			return;
+		}
+	}
+}
+
+// a UID can only be connected to one node of a mesh network at a time. if the
+// UID shows up on another node then its route is updated
+int mesh_add_route(const uint8_t *group_id, uint32_t uid /* always little endian */,
+                   const uint8_t *node_addr) {
+	MeshRoute *route;
+
+	if (mesh_add_node(group_id, node_addr) < 0) {
+		return -1;
+	}
+
+	route = mesh_get_route(group_id, uid);
+
+	if (route == NULL) {
+		route = array_append(&mesh_routes);
+
+		if (route == NULL) {
+			log_error("Could not append to mesh route array: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		memcpy(route->group_id, group_id, sizeof(route->group_id));
+		route->uid = uid;
+	}
+
+	memcpy(route->node_addr, node_addr, sizeof(route->node_addr));
+
+	return 0;
+}
+
+MeshRoute *mesh_get_route(const uint8_t *group_id, uint32_t uid /* always little endian */) {
+	int i;
+	MeshRoute *route;
+
+	for (i = 0; i < mesh_routes.count; ++i) {
+		route = array_get(&mesh_routes, i);
+
+		if (route->uid == uid &&
+		    memcmp(route->group_id, group_id, sizeof(route->group_id)) == 0) {
+			return route;
+		}
+	}
+
+	return NULL;
+}
+
+// the route is only removed if it still leads to the given node. the UID might
+// have moved to another node in the meantime
+void mesh_remove_route(const uint8_t *group_id, uint32_t uid /* always little endian */,
+                       const uint8_t *node_addr) {
+	int i;
+	MeshRoute *route;
+
+	for (i = 0; i < mesh_routes.count; ++i) {
+		route = array_get(&mesh_routes, i);
+
+		if (route->uid == uid &&
+		    memcmp(route->group_id, group_id, sizeof(route->group_id)) == 0) {
+			if (memcmp(route->node_addr, node_addr, sizeof(route->node_addr)) == 0) {
+				array_remove(&mesh_routes, i, NULL);
+			}
+
+			return;
+		}
+	}
+}
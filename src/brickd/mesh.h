@@ -23,12 +23,41 @@
 #ifndef BRICKD_MESH_H
 #define BRICKD_MESH_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include <daemonlib/socket.h>
 
+#include "mesh_packet.h"
+
+// A node of a mesh network that is known to brickd, either because it sent a
+// hello or because a TFP packet was received from it.
+typedef struct {
+	uint8_t group_id[6];
+	uint8_t node_addr[ESP_MESH_ADDRESS_LEN];
+	bool discovering; // a discovery enumerate request was sent to the node
+	bool answered; // a TFP packet was received from the node since then
+} MeshNode;
+
+// Maps the UID of a device to the mesh node it is connected to.
+typedef struct {
+	uint8_t group_id[6];
+	uint32_t uid; // always little endian
+	uint8_t node_addr[ESP_MESH_ADDRESS_LEN];
+} MeshRoute;
+
 int mesh_init(void);
 void mesh_exit(void);
 void mesh_handle_accept(void *opaque);
 int mesh_start_listening(void);
+void mesh_flush_stacks(void);
 void mesh_cleanup_stacks(void);
 
+int mesh_add_node(const uint8_t *group_id, const uint8_t *node_addr);
+MeshNode *mesh_get_node(const uint8_t *group_id, const uint8_t *node_addr);
+void mesh_remove_node(const uint8_t *group_id, const uint8_t *node_addr);
+int mesh_add_route(const uint8_t *group_id, uint32_t uid, const uint8_t *node_addr);
+MeshRoute *mesh_get_route(const uint8_t *group_id, uint32_t uid);
+void mesh_remove_route(const uint8_t *group_id, uint32_t uid, const uint8_t *node_addr);
+
 #endif // BRICKD_MESH_H
@@ -33,11 +33,260 @@
 #include "mesh_stack.h"
 
 #include "hardware.h"
+#include "mesh.h"
 #include "network.h"
+#include "scheduler.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 extern Array mesh_stacks;
+extern Array mesh_nodes;
+extern Array mesh_routes;
+
+static int mesh_stack_get_packet_length(const uint8_t *header) {
+	return ((const MeshPacketHeader *)header)->length;
+}
+
+static char *mesh_stack_get_packet_signature(char *signature, Packet *packet) {
+	return mesh_packet_get_dump(signature, (uint8_t *)packet,
+	                            ((MeshPacketHeader *)packet)->length);
+}
+
+static char *mesh_stack_get_recipient_signature(char *signature, bool upper, void *opaque) {
+	MeshStack *mesh_stack = opaque;
+
+	snprintf(signature, WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH,
+	         "%cesh stack (N: %s)", upper ? 'M' : 'm', mesh_stack->name);
+
+	return signature;
+}
+
+static void mesh_stack_recipient_disconnect(void *opaque) {
+	MeshStack *mesh_stack = opaque;
+
+	mesh_stack->cleanup = true;
+}
+
+// Requests wait in the write backlog while the socket to the root node is
+// busy. Requests that wait for the mesh network itself are not visible here.
+static int mesh_stack_get_backlog(Stack *stack) {
+	return ((MeshStack *)stack)->writer.backlog_count;
+}
+
+// The scheduler might be waiting for room in the write backlog
+static void mesh_stack_handle_backlog_written(void *opaque) {
+	(void)opaque;
+
+	scheduler_handle_write_done();
+}
+
+// Queue a mesh packet for the next mesh_stack_flush call. All mesh packets
+// queued while handling one event loop iteration are written together.
+static int mesh_stack_send(MeshStack *mesh_stack, void *packet) {
+	int length = ((MeshPacketHeader *)packet)->length;
+
+	if (mesh_stack->pending_length + length > (int)sizeof(mesh_stack->pending_buffer) &&
+	    mesh_stack_flush(mesh_stack) < 0) {
+		return -1;
+	}
+
+	memcpy(mesh_stack->pending_buffer + mesh_stack->pending_length, packet, length);
+
+	mesh_stack->pending_length += length;
+	++mesh_stack->sent_packets;
+
+	return 0;
+}
+
+// Send an enumerate request to the given node, or to the whole mesh network if
+// no node address is given. The resulting enumerate callbacks populate the
+// mesh routing table.
+static void mesh_stack_send_enumerate(MeshStack *mesh_stack, const uint8_t *node_addr) {
+	MeshPayloadPacket tfp_mesh_pkt;
+	uint8_t dst_addr[ESP_MESH_ADDRESS_LEN];
+	MeshNode *node;
+
+	memset(&dst_addr, 0, sizeof(dst_addr));
+
+	if (node_addr != NULL) {
+		memcpy(&dst_addr, node_addr, sizeof(dst_addr));
+	}
+
+	memset(&tfp_mesh_pkt, 0, sizeof(MeshPayloadPacket));
+	mesh_packet_header_create(&tfp_mesh_pkt.header,
+	                          // Direction.
+	                          MESH_PACKET_DIRECTION_DOWNWARD,
+	                          // P2P.
+	                          false,
+	                          // ESP mesh payload protocol.
+	                          MESH_PACKET_PROTOCOL_BINARY,
+	                          // Length of the mesh packet.
+	                          sizeof(MeshPacketHeader) + sizeof(PacketHeader),
+	                          // Destination address.
+	                          dst_addr,
+	                          // Source address.
+	                          mesh_stack->gw_addr,
+	                          MESH_PACKET_TYPE_PAYLOAD);
+
+	tfp_mesh_pkt.payload.header.uid = 0;
+	tfp_mesh_pkt.payload.header.length = sizeof(PacketHeader);
+	tfp_mesh_pkt.payload.header.function_id = FUNCTION_ENUMERATE;
+	packet_header_set_sequence_number(&tfp_mesh_pkt.payload.header, 1);
+	packet_header_set_response_expected(&tfp_mesh_pkt.payload.header, false);
+
+	if (mesh_stack_send(mesh_stack, &tfp_mesh_pkt) < 0) {
+		log_error("Failed to send enumerate request to mesh stack (N: %s)",
+		          mesh_stack->name);
+
+		return;
+	}
+
+	// The enumerate callbacks that answer the discovery are not forwarded to
+	// the clients, they did not ask for them. A node that does not answer at
+	// all before the discovery timer fires is considered lost.
+	if (node_addr != NULL) {
+		node = mesh_get_node(mesh_stack->group_id, node_addr);
+
+		if (node != NULL) {
+			node->discovering = true;
+			node->answered = false;
+		}
+	} else {
+		mesh_stack->discovering_all = true;
+	}
+
+	mesh_stack->hiding_discovery_replies = true;
+
+	timer_configure(&mesh_stack->timer_discovery, TIME_DISCOVERY, 0);
+
+	if (node_addr != NULL) {
+		++mesh_stack->unicast_requests;
+
+		log_debug("Sent enumerate request to mesh node (N: %s, A: %02X-%02X-%02X-%02X-%02X-%02X)",
+		          mesh_stack->name,
+		          dst_addr[0], dst_addr[1], dst_addr[2], dst_addr[3], dst_addr[4], dst_addr[5]);
+	} else {
+		++mesh_stack->broadcast_requests;
+
+		log_debug("Broadcast enumerate request to mesh stack (N: %s)",
+		          mesh_stack->name);
+	}
+}
+
+// End the pending discovery. If REMOVE_LOST is true then the nodes that did not
+// answer it are removed together with their routes.
+static void mesh_stack_end_discovery(MeshStack *mesh_stack, bool remove_lost) {
+	int i;
+	int k;
+	MeshNode *node;
+	MeshRoute *route;
+	uint8_t node_addr[ESP_MESH_ADDRESS_LEN];
+
+	// iterate backwards for simpler index handling
+	for (i = mesh_nodes.count - 1; i >= 0; --i) {
+		node = array_get(&mesh_nodes, i);
+
+		if (memcmp(node->group_id, mesh_stack->group_id, sizeof(node->group_id)) != 0 ||
+		    !node->discovering) {
+			continue;
+		}
+
+		node->discovering = false;
+
+		if (!remove_lost || node->answered) {
+			continue;
+		}
+
+		memcpy(node_addr, node->node_addr, sizeof(node_addr));
+
+		log_info("Mesh node (A: %02X-%02X-%02X-%02X-%02X-%02X) did not answer the discovery, removing its routes from mesh stack (N: %s)",
+		         node_addr[0], node_addr[1], node_addr[2], node_addr[3], node_addr[4], node_addr[5],
+		         mesh_stack->name);
+
+		for (k = 0; k < mesh_routes.count; ++k) {
+			route = array_get(&mesh_routes, k);
+
+			if (memcmp(route->group_id, mesh_stack->group_id, sizeof(route->group_id)) == 0 &&
+			    memcmp(route->node_addr, node_addr, sizeof(route->node_addr)) == 0) {
+				stack_remove_recipient(&mesh_stack->base, route->uid);
+			}
+		}
+
+		mesh_remove_node(mesh_stack->group_id, node_addr);
+	}
+
+	mesh_stack->discovering_all = false;
+	mesh_stack->hiding_discovery_replies = false;
+}
+
+static void timer_discovery_handler(void *opaque) {
+	MeshStack *mesh_stack = (MeshStack *)opaque;
+
+	mesh_stack_end_discovery(mesh_stack, true);
+}
+
+// Restore the known routes of the mesh network after its root node (re)connected
+// and send a targeted enumerate request to each known node of it. Only if no
+// node is known yet, the enumerate request is broadcast once.
+static void mesh_stack_discover_nodes(MeshStack *mesh_stack) {
+	int i;
+	MeshNode *node;
+	MeshRoute *route;
+	uint64_t node_addr;
+	int discovered = 0;
+
+	for (i = 0; i < mesh_routes.count; ++i) {
+		route = array_get(&mesh_routes, i);
+
+		if (memcmp(route->group_id, mesh_stack->group_id, sizeof(route->group_id)) != 0) {
+			continue;
+		}
+
+		node_addr = 0;
+
+		memcpy(&node_addr, route->node_addr, sizeof(route->node_addr));
+
+		if (stack_add_recipient(&mesh_stack->base, route->uid, node_addr) < 0) {
+			return;
+		}
+	}
+
+	for (i = 0; i < mesh_nodes.count; ++i) {
+		node = array_get(&mesh_nodes, i);
+
+		if (memcmp(node->group_id, mesh_stack->group_id, sizeof(node->group_id)) == 0) {
+			mesh_stack_send_enumerate(mesh_stack, node->node_addr);
+
+			++discovered;
+		}
+	}
+
+	log_info("Restored %d route(s) for mesh stack (N: %s), sent enumerate request to %d known node(s)",
+	         mesh_stack->base.recipients.count, mesh_stack->name, discovered);
+
+	if (mesh_add_node(mesh_stack->group_id, mesh_stack->root_node_addr) > 0) {
+		if (discovered == 0) {
+			mesh_stack_send_enumerate(mesh_stack, NULL);
+		} else {
+			mesh_stack_send_enumerate(mesh_stack, mesh_stack->root_node_addr);
+		}
+	}
+}
+
+static int mesh_stack_get_frame_length(const uint8_t *data, int available,
+                                       void *opaque, const char **message) {
+	(void)opaque;
+
+	if (available < (int)sizeof(MeshPacketHeader)) {
+		return 0;
+	}
+
+	if (!mesh_packet_header_is_valid_response((MeshPacketHeader *)data, message)) {
+		return -1;
+	}
+
+	return ((const MeshPacketHeader *)data)->length;
+}
 
 static void mesh_stack_recv_handler(void *opaque) {
 	int length = 0;
@@ -46,6 +295,7 @@ static void mesh_stack_recv_handler(void *opaque) {
 	const char *message = NULL;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
+	uint8_t *data;
 
 	if (mesh_stack->cleanup) {
 		log_warn("Mesh stack (N: %s) already scheduled for cleanup, ignoring receive",
@@ -54,9 +304,7 @@ static void mesh_stack_recv_handler(void *opaque) {
 		return;
 	}
 
-	length = socket_receive(mesh_stack->sock,
-	                        mesh_stack->response_buffer + mesh_stack->response_buffer_used,
-	                        sizeof(mesh_stack->response_buffer) - mesh_stack->response_buffer_used);
+	length = framer_read(&mesh_stack->response_framer, &mesh_stack->sock->base);
 
 	if (length == 0) {
 		log_info("Mesh stack (N: %s) disconnected by peer",
@@ -91,39 +339,25 @@ static void mesh_stack_recv_handler(void *opaque) {
 		return;
 	}
 
-	mesh_stack->response_buffer_used += length;
+	while (!mesh_stack->cleanup) {
+		mesh_stack->response = framer_next(&mesh_stack->response_framer, &length, &message);
 
-	while (!mesh_stack->cleanup && mesh_stack->response_buffer_used > 0) {
-		if (mesh_stack->response_buffer_used < (int)sizeof(MeshPacketHeader)) {
-			// wait for complete header
-			break;
-		}
+		if (mesh_stack->response == NULL) {
+			if (length < 0) {
+				data = framer_peek(&mesh_stack->response_framer, &length);
 
-		// Now we have a complete mesh header.
-		if (!mesh_stack->response_header_checked) {
-			if (!mesh_packet_header_is_valid_response(&mesh_stack->response_header, &message)) {
 				log_error("Received invalid mesh response (packet: %s) from mesh stack (N: %s), disconnecting mesh stack: %s",
-				          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response_buffer, mesh_stack->response_buffer_used),
+				          mesh_packet_get_dump(mesh_packet_dump, data, length),
 				          mesh_stack->name, message);
 
 				mesh_stack->cleanup = true;
-
-				return;
 			}
 
-			mesh_stack->response_header_checked = true;
-		}
-
-		length = mesh_stack->response_header.length;
-
-		// FIXME: add mesh_header->len validation
-
-		if (mesh_stack->response_buffer_used < length) {
 			// wait for complete packet
 			break;
 		}
 
-		mesh_pkt_type = mesh_stack->response_header.type;
+		mesh_pkt_type = mesh_stack->response_header->type;
 
 		// Handle mesh hello packet.
 		if (mesh_pkt_type == MESH_PACKET_TYPE_HELLO) {
@@ -139,11 +373,11 @@ static void mesh_stack_recv_handler(void *opaque) {
 		}
 		// Handle TFP packet.
 		else if (mesh_pkt_type == MESH_PACKET_TYPE_PAYLOAD) {
-			if (mesh_stack->payload_response.header.length != sizeof(MeshPacketHeader) + mesh_stack->payload_response.payload.header.length) {
+			if (mesh_stack->payload_response->header.length != sizeof(MeshPacketHeader) + mesh_stack->payload_response->payload.header.length) {
 				log_error("Received mesh response (packet: %s) with length mismatch (outer: %d != header + inner: %d) from mesh stack (N: %s), disconnecting mesh stack",
-				          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response_buffer, mesh_stack->response_buffer_used),
-				          mesh_stack->payload_response.header.length,
-				          (int)sizeof(MeshPacketHeader) + mesh_stack->payload_response.payload.header.length,
+				          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response, length),
+				          mesh_stack->payload_response->header.length,
+				          (int)sizeof(MeshPacketHeader) + mesh_stack->payload_response->payload.header.length,
 				          mesh_stack->name);
 
 				mesh_stack->cleanup = true;
@@ -151,9 +385,9 @@ static void mesh_stack_recv_handler(void *opaque) {
 				return;
 			}
 
-			if (!packet_header_is_valid_response(&mesh_stack->payload_response.payload.header, &message)) {
+			if (!packet_header_is_valid_response(&mesh_stack->payload_response->payload.header, &message)) {
 				log_error("Received invalid response (packet: %s) from mesh stack (N: %s), disconnecting mesh stack: %s",
-				          packet_get_dump(packet_dump, &mesh_stack->payload_response.payload, mesh_stack->response_buffer_used - sizeof(MeshPacketHeader)),
+				          packet_get_dump(packet_dump, &mesh_stack->payload_response->payload, length - sizeof(MeshPacketHeader)),
 				          mesh_stack->name,
 				          message);
 
@@ -167,15 +401,9 @@ static void mesh_stack_recv_handler(void *opaque) {
 		// Packet type is unknown.
 		else {
 			log_error("Unknown mesh packet (packet: %s) type received: %d",
-			          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response_buffer, mesh_stack->response_buffer_used),
+			          mesh_packet_get_dump(mesh_packet_dump, mesh_stack->response, length),
 			          mesh_pkt_type);
 		}
-
-		memmove(mesh_stack->response_buffer, mesh_stack->response_buffer + length,
-		        mesh_stack->response_buffer_used - length);
-
-		mesh_stack->response_buffer_used -= length;
-		mesh_stack->response_header_checked = false;
 	}
 }
 
@@ -231,8 +459,7 @@ void timer_hb_do_ping_handler(void *opaque) {
 	          mesh_packet_get_dump(mesh_packet_dump, (uint8_t *)&pkt_mesh_hb, pkt_mesh_hb.header.length),
 	          mesh_stack->name);
 
-	// TODO: Integrate buffered IO write.
-	if (socket_send(mesh_stack->sock, &pkt_mesh_hb, pkt_mesh_hb.header.length) < 0) {
+	if (mesh_stack_send(mesh_stack, &pkt_mesh_hb) < 0) {
 		log_error("Failed to send ping to mesh root node, cleaning up mesh stack (N: %s)",
 		          mesh_stack->name);
 
@@ -264,7 +491,7 @@ void timer_hb_wait_pong_handler(void *opaque) {
 
 void hello_recv_handler(MeshStack *mesh_stack) {
 	char prefix_str[17];
-	MeshHelloPacket *pkt_mesh_hello = &mesh_stack->hello_response;
+	MeshHelloPacket *pkt_mesh_hello = mesh_stack->hello_response;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	log_debug("Received mesh packet (T: HELLO, L: %d, packet: %s) from mesh stack (N: %s)",
@@ -272,9 +499,9 @@ void hello_recv_handler(MeshStack *mesh_stack) {
 	          mesh_packet_get_dump(mesh_packet_dump, (uint8_t *)pkt_mesh_hello, pkt_mesh_hello->header.length),
 	          mesh_stack->name);
 
-	timer_configure(&mesh_stack->timer_wait_hello, 0, 0);
-
 	if (pkt_mesh_hello->is_root_node) {
+		timer_configure(&mesh_stack->timer_wait_hello, 0, 0);
+
 		memset(&prefix_str, 0, sizeof(prefix_str));
 		memcpy(&prefix_str, &pkt_mesh_hello->prefix, sizeof(pkt_mesh_hello->prefix));
 
@@ -301,6 +528,12 @@ void hello_recv_handler(MeshStack *mesh_stack) {
 			return;
 		}
 	} else {
+		// A hello from a non-root node doesn't make the mesh stack operational,
+		// keep waiting for the hello from the root node
+		if (mesh_stack->state == MESH_STACK_STATE_WAIT_HELLO) {
+			timer_configure(&mesh_stack->timer_wait_hello, TIME_WAIT_HELLO, 0);
+		}
+
 		memset(&prefix_str, 0, sizeof(prefix_str));
 		memcpy(&prefix_str, &pkt_mesh_hello->prefix, sizeof(pkt_mesh_hello->prefix));
 
@@ -331,7 +564,14 @@ void hello_recv_handler(MeshStack *mesh_stack) {
 
 void tfp_recv_handler(MeshStack *mesh_stack) {
 	uint64_t mesh_src_addr = 0;
-	MeshPayloadPacket *pkt_mesh_tfp = &mesh_stack->payload_response;
+	MeshPayloadPacket *pkt_mesh_tfp = mesh_stack->payload_response;
+	Packet *payload = &pkt_mesh_tfp->payload;
+	int enumeration_type = -1; // not an enumerate callback
+	Recipient *recipient;
+	MeshNode *node;
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	Packet response;
+#endif
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	// FIXME: the stack is not fully initialized until the hello packet is received
@@ -364,13 +604,61 @@ void tfp_recv_handler(MeshStack *mesh_stack) {
 	       &pkt_mesh_tfp->header.src_addr,
 	       sizeof(pkt_mesh_tfp->header.src_addr));
 
-	if (stack_add_recipient(&mesh_stack->base, pkt_mesh_tfp->payload.header.uid, mesh_src_addr) < 0) {
-		log_error("Failed to add recipient to mesh stack");
+	if (payload->header.function_id == CALLBACK_ENUMERATE &&
+	    payload->header.length >= (int)sizeof(EnumerateCallback)) {
+		enumeration_type = ((EnumerateCallback *)payload)->enumeration_type;
+	}
+
+	if (enumeration_type == ENUMERATION_TYPE_DISCONNECTED) {
+		// The device is gone, unless it showed up on another node already
+		recipient = stack_get_recipient(&mesh_stack->base, payload->header.uid);
+
+		if (recipient != NULL && recipient->opaque == mesh_src_addr) {
+			stack_remove_recipient(&mesh_stack->base, payload->header.uid);
+		}
+
+		mesh_remove_route(mesh_stack->group_id, payload->header.uid,
+		                  pkt_mesh_tfp->header.src_addr);
+	} else {
+		if (stack_add_recipient(&mesh_stack->base, pkt_mesh_tfp->payload.header.uid, mesh_src_addr) < 0) {
+			log_error("Failed to add recipient to mesh stack");
+
+			return;
+		}
+
+		if (mesh_add_route(mesh_stack->group_id, pkt_mesh_tfp->payload.header.uid,
+		                   pkt_mesh_tfp->header.src_addr) < 0) {
+			log_error("Failed to add route to mesh stack");
+
+			return;
+		}
+	}
+
+	node = mesh_get_node(mesh_stack->group_id, pkt_mesh_tfp->header.src_addr);
+
+	if (node != NULL) {
+		node->answered = true;
+	}
+
+	if (enumeration_type == ENUMERATION_TYPE_AVAILABLE && mesh_stack->hiding_discovery_replies &&
+	    (mesh_stack->discovering_all || (node != NULL && node->discovering))) {
+		log_debug("Learned route from discovery reply of mesh stack (N: %s), not dispatching it to clients",
+		          mesh_stack->name);
 
 		return;
 	}
 
-	network_dispatch_response(&pkt_mesh_tfp->payload);
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	// The payload points into the read buffer, copy it to add the trace ID.
+	memcpy(&response, &pkt_mesh_tfp->payload, pkt_mesh_tfp->payload.header.length);
+
+	response.trace_id = packet_get_next_response_trace_id();
+	payload = &response;
+#endif
+
+	packet_add_trace(payload);
+
+	network_dispatch_response(payload);
 
 	log_debug("TFP packet dispatched (L: %d)", pkt_mesh_tfp->payload.header.length);
 }
@@ -381,12 +669,29 @@ void mesh_stack_destroy(MeshStack *mesh_stack) {
 	timer_configure(&mesh_stack->timer_hb_do_ping, 0, 0);
 	timer_configure(&mesh_stack->timer_hb_wait_pong, 0, 0);
 	timer_configure(&mesh_stack->timer_cleanup_after_reset_sent, 0, 0);
+	timer_configure(&mesh_stack->timer_discovery, 0, 0);
 
 	// Cleanup the timers of the mesh stack.
 	timer_destroy(&mesh_stack->timer_wait_hello);
 	timer_destroy(&mesh_stack->timer_hb_do_ping);
 	timer_destroy(&mesh_stack->timer_hb_wait_pong);
 	timer_destroy(&mesh_stack->timer_cleanup_after_reset_sent);
+	timer_destroy(&mesh_stack->timer_discovery);
+
+	// Without the root node, nodes that did not answer yet are not lost. The
+	// next root hello starts a new discovery.
+	mesh_stack_end_discovery(mesh_stack, false);
+
+	log_debug("Mesh stack (N: %s) queued %u packet(s) in %u write(s), dropped %u packet(s)",
+	          mesh_stack->name, mesh_stack->sent_packets, mesh_stack->sent_writes,
+	          mesh_stack->writer.dropped_packets);
+
+	log_debug("Mesh stack (N: %s) sent %u unicast and %u broadcast request(s), dropped %u request(s) to unknown UIDs",
+	          mesh_stack->name, mesh_stack->unicast_requests, mesh_stack->broadcast_requests,
+	          mesh_stack->unroutable_requests);
+
+	writer_destroy(&mesh_stack->writer);
+	framer_destroy(&mesh_stack->response_framer);
 
 	event_remove_source(mesh_stack->sock->handle, EVENT_SOURCE_TYPE_GENERIC);
 
@@ -429,6 +734,53 @@ int mesh_stack_create(char *name, Socket *sock) {
 	 */
 	mesh_stack->state = MESH_STACK_STATE_WAIT_HELLO;
 
+	// Initialise the mesh stack.
+	mesh_stack->sock = sock;
+	mesh_stack->pending_length = 0;
+	mesh_stack->sent_packets = 0;
+	mesh_stack->sent_writes = 0;
+	mesh_stack->unicast_requests = 0;
+	mesh_stack->broadcast_requests = 0;
+	mesh_stack->unroutable_requests = 0;
+	mesh_stack->cleanup = false;
+	mesh_stack->response = NULL;
+	mesh_stack->discovering_all = false;
+	mesh_stack->hiding_discovery_replies = false;
+
+	if (framer_create(&mesh_stack->response_framer, MESH_STACK_READ_BUFFER_SIZE,
+	                  mesh_stack_get_frame_length, mesh_stack) < 0) {
+		log_error("Failed to create response framer: %s (%d)",
+		          get_errno_name(errno),
+		          errno);
+
+		socket_destroy(sock);
+		free(sock);
+
+		array_remove(&mesh_stacks, mesh_stacks.count - 1, NULL);
+
+		return -1;
+	}
+
+	if (writer_create(&mesh_stack->writer, &sock->base,
+	                  "mesh packet", mesh_stack_get_packet_signature,
+	                  "mesh stack", mesh_stack_get_recipient_signature,
+	                  mesh_stack_recipient_disconnect, mesh_stack) < 0) {
+		log_error("Failed to create mesh stack writer: %s (%d)",
+		          get_errno_name(errno),
+		          errno);
+
+		framer_destroy(&mesh_stack->response_framer);
+		socket_destroy(sock);
+		free(sock);
+
+		array_remove(&mesh_stacks, mesh_stacks.count - 1, NULL);
+
+		return -1;
+	}
+
+	writer_set_packet_length_function(&mesh_stack->writer, mesh_stack_get_packet_length);
+	writer_set_backlog_written_function(&mesh_stack->writer, mesh_stack_handle_backlog_written);
+
 	if (event_add_source(sock->handle, EVENT_SOURCE_TYPE_GENERIC, "mesh-stack",
 	                     EVENT_READ, mesh_stack_recv_handler, mesh_stack) < 0) {
 		log_error("Failed to add stack receive event");
@@ -440,12 +792,6 @@ int mesh_stack_create(char *name, Socket *sock) {
 		return -1;
 	}
 
-	// Initialise the mesh stack.
-	mesh_stack->sock = sock;
-	mesh_stack->cleanup = false;
-	mesh_stack->response_buffer_used = 0;
-	mesh_stack->response_header_checked = false;
-
 	snprintf(mesh_stack->name, sizeof(mesh_stack->name), "%s", name);
 
 	// Initialise timers.
@@ -499,11 +845,24 @@ int mesh_stack_create(char *name, Socket *sock) {
 		return -1;
 	}
 
+	if (timer_create_(&mesh_stack->timer_discovery, timer_discovery_handler, mesh_stack) < 0) {
+		log_error("Failed to initialise discovery timer: %s (%d)",
+		          get_errno_name(errno),
+		          errno);
+
+		array_remove(&mesh_stacks,
+		             mesh_stacks.count - 1,
+		             (ItemDestroyFunction)mesh_stack_destroy);
+
+		return -1;
+	}
+
 	// Initially disable all the timers.
 	timer_configure(&mesh_stack->timer_wait_hello, 0, 0);
 	timer_configure(&mesh_stack->timer_hb_do_ping, 0, 0);
 	timer_configure(&mesh_stack->timer_hb_wait_pong, 0, 0);
 	timer_configure(&mesh_stack->timer_cleanup_after_reset_sent, 0, 0);
+	timer_configure(&mesh_stack->timer_discovery, 0, 0);
 
 	if (timer_configure(&mesh_stack->timer_wait_hello, TIME_WAIT_HELLO, 0) < 0) {
 		log_error("Failed to start wait hello timer: %s (%d)",
@@ -524,7 +883,7 @@ int mesh_stack_create(char *name, Socket *sock) {
 
 void hb_ping_recv_handler(MeshStack *mesh_stack) {
 	MeshHeartBeatPacket pkt_mesh_hb_pong;
-	MeshHeartBeatPacket *pkt_mesh_hb_ping = &mesh_stack->heart_beat_response;
+	MeshHeartBeatPacket *pkt_mesh_hb_ping = mesh_stack->heart_beat_response;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	log_debug("Received mesh ping packet (T: PING, L: %d, A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
@@ -544,8 +903,7 @@ void hb_ping_recv_handler(MeshStack *mesh_stack) {
 
 	pkt_mesh_hb_pong.header.type = MESH_PACKET_TYPE_HEART_BEAT_PONG;
 
-	// TODO: Integrate buffered IO write.
-	if (socket_send(mesh_stack->sock, &pkt_mesh_hb_pong, pkt_mesh_hb_pong.header.length) < 0) {
+	if (mesh_stack_send(mesh_stack, &pkt_mesh_hb_pong) < 0) {
 		log_error("Failed to send mesh pong packet");
 	} else {
 		log_debug("Sent mesh pong packet (A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
@@ -560,7 +918,7 @@ void hb_ping_recv_handler(MeshStack *mesh_stack) {
 }
 
 void hb_pong_recv_handler(MeshStack *mesh_stack) {
-	MeshHeartBeatPacket *pkt_mesh_hb = &mesh_stack->heart_beat_response;
+	MeshHeartBeatPacket *pkt_mesh_hb = mesh_stack->heart_beat_response;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	timer_configure(&mesh_stack->timer_hb_wait_pong, 0, 0);
@@ -611,8 +969,7 @@ void broadcast_reset_packet(MeshStack *mesh_stack) {
 	                          addr,
 	                          MESH_PACKET_TYPE_RESET);
 
-	// TODO: Integrate buffered IO write.
-	if (socket_send(mesh_stack->sock, &pkt_mesh_reset, pkt_mesh_reset.header.length) < 0) {
+	if (mesh_stack_send(mesh_stack, &pkt_mesh_reset) < 0) {
 		log_error("Failed to send broadcast reset stack packet (packet: %s)",
 		          mesh_packet_get_dump(mesh_packet_dump, (uint8_t *)&pkt_mesh_reset, pkt_mesh_reset.header.length));
 	} else {
@@ -625,7 +982,7 @@ bool hello_root_recv_handler(MeshStack *mesh_stack) {
 	char prefix_str[17];
 	MeshOllehPacket olleh_mesh_pkt;
 	MeshStack *mesh_stack_from_list = NULL;
-	MeshHelloPacket *hello_mesh_pkt = &mesh_stack->hello_response;
+	MeshHelloPacket *hello_mesh_pkt = mesh_stack->hello_response;
 	int i;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
@@ -680,8 +1037,7 @@ bool hello_root_recv_handler(MeshStack *mesh_stack) {
 			                          hello_mesh_pkt->header.dst_addr,
 			                          MESH_PACKET_TYPE_RESET);
 
-			// TODO: Integrate buffered IO write.
-			if (socket_send(mesh_stack_from_list->sock, &pkt_mesh_reset, pkt_mesh_reset.header.length) < 0) {
+			if (mesh_stack_send(mesh_stack_from_list, &pkt_mesh_reset) < 0) {
 				log_error("Failed to send mesh stack reset packet (A: %02X-%02X-%02X-%02X-%02X-%02X)",
 				          mesh_stack_from_list->root_node_addr[0],
 				          mesh_stack_from_list->root_node_addr[1],
@@ -716,8 +1072,7 @@ bool hello_root_recv_handler(MeshStack *mesh_stack) {
 			                          hello_mesh_pkt->header.dst_addr,
 			                          MESH_PACKET_TYPE_RESET);
 
-			// TODO: Integrate buffered IO write.
-			if (socket_send(mesh_stack->sock, &pkt_mesh_reset, pkt_mesh_reset.header.length) < 0) {
+			if (mesh_stack_send(mesh_stack, &pkt_mesh_reset) < 0) {
 				log_error("Failed to send mesh stack reset packet (A: %02X-%02X-%02X-%02X-%02X-%02X)",
 				          hello_mesh_pkt->header.src_addr[0],
 				          hello_mesh_pkt->header.src_addr[1],
@@ -792,6 +1147,8 @@ bool hello_root_recv_handler(MeshStack *mesh_stack) {
 		return false;
 	}
 
+	mesh_stack->base.get_backlog = mesh_stack_get_backlog;
+
 	// Add to main stacks array.
 	if (hardware_add_stack(&mesh_stack->base) < 0) {
 		stack_destroy(&mesh_stack->base);
@@ -818,8 +1175,7 @@ bool hello_root_recv_handler(MeshStack *mesh_stack) {
 	                          hello_mesh_pkt->header.dst_addr,
 	                          MESH_PACKET_TYPE_OLLEH);
 
-	// TODO: Integrate buffered IO write.
-	if (socket_send(mesh_stack->sock, &olleh_mesh_pkt, olleh_mesh_pkt.header.length) < 0) {
+	if (mesh_stack_send(mesh_stack, &olleh_mesh_pkt) < 0) {
 		log_error("Failed to send mesh olleh packet (A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
 		          olleh_mesh_pkt.header.dst_addr[0],
 		          olleh_mesh_pkt.header.dst_addr[1],
@@ -877,6 +1233,8 @@ bool hello_root_recv_handler(MeshStack *mesh_stack) {
 
 	arm_timer_hb_do_ping(mesh_stack);
 
+	mesh_stack_discover_nodes(mesh_stack);
+
 	return true;
 }
 
@@ -888,14 +1246,41 @@ int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipi
 	uint8_t dst_addr[ESP_MESH_ADDRESS_LEN];
 	MeshStack *mesh_stack = (MeshStack *)stack;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
+	MeshRoute *route;
 
 	memset(&dst_addr, 0, sizeof(dst_addr));
 
+	// A client asked for the devices itself, so it gets all enumerate callbacks,
+	// also those answering a pending discovery.
+	if (request->header.function_id == FUNCTION_ENUMERATE) {
+		mesh_stack->hiding_discovery_replies = false;
+	}
+
 	// Unicast.
 	if (recipient != NULL) {
 		is_broadcast = false;
 
 		memcpy(&dst_addr, &recipient->opaque, sizeof(dst_addr));
+	} else if (request->header.uid != 0) {
+		// Only true broadcast requests are broadcast to the whole mesh
+		// network. A request to a UID that is not known to this stack is
+		// unicast if the routing table knows the node of the UID, otherwise
+		// it is dropped instead of flooding the mesh network with it.
+		route = mesh_get_route(mesh_stack->group_id, request->header.uid);
+
+		if (route == NULL) {
+			++mesh_stack->unroutable_requests;
+
+			log_debug("Dropping TFP packet for unknown UID %s, not broadcasting it to mesh stack (N: %s)",
+			          base58_encode(base58, uint32_from_le(request->header.uid)),
+			          mesh_stack->name);
+
+			return 0;
+		}
+
+		is_broadcast = false;
+
+		memcpy(&dst_addr, &route->node_addr, sizeof(dst_addr));
 	}
 
 	memset(&tfp_mesh_pkt, 0, sizeof(MeshPayloadPacket));
@@ -918,11 +1303,10 @@ int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipi
 
 	if (!is_broadcast) {
 		memset(&base58, 0, sizeof(base58));
-		base58_encode(base58, uint32_from_le(recipient->uid));
+		base58_encode(base58, uint32_from_le(request->header.uid));
 	}
 
-	// TODO: Integrate buffered IO write.
-	ret = socket_send(mesh_stack->sock, &tfp_mesh_pkt, tfp_mesh_pkt.header.length);
+	ret = mesh_stack_send(mesh_stack, &tfp_mesh_pkt);
 
 	if (ret < 0) {
 		if (is_broadcast) {
@@ -946,18 +1330,19 @@ int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipi
 			          mesh_packet_get_dump(mesh_packet_dump, (uint8_t *)&tfp_mesh_pkt, tfp_mesh_pkt.header.length));
 		}
 
-		log_debug("Marking mesh stack for cleanup (N: %s)", mesh_stack->name);
-		mesh_stack->cleanup = true;
-
 		return -1;
 	} else {
 		if (is_broadcast) {
-			log_debug("TFP packet sent to mesh (L: %d, B: %d, packet: %s)",
+			++mesh_stack->broadcast_requests;
+
+			log_debug("TFP packet queued for mesh (L: %d, B: %d, packet: %s)",
 			          request->header.length,
 			          is_broadcast,
 			          mesh_packet_get_dump(mesh_packet_dump, (uint8_t *)&tfp_mesh_pkt, tfp_mesh_pkt.header.length));
 		} else {
-			log_debug("TFP packet sent to mesh (U: %s, L: %d, B: %d, A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
+			++mesh_stack->unicast_requests;
+
+			log_debug("TFP packet queued for mesh (U: %s, L: %d, B: %d, A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
 			          base58,
 			          request->header.length,
 			          is_broadcast,
@@ -974,6 +1359,30 @@ int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipi
 	return 0;
 }
 
+// Write all queued mesh packets with a single write. If the socket cannot take
+// everything right now, then the rest is kept in the write backlog and written
+// as soon as the socket becomes writable again.
+int mesh_stack_flush(MeshStack *mesh_stack) {
+	int length = mesh_stack->pending_length;
+
+	if (length == 0) {
+		return 0;
+	}
+
+	mesh_stack->pending_length = 0;
+	++mesh_stack->sent_writes;
+
+	if (writer_write_multiple(&mesh_stack->writer, mesh_stack->pending_buffer, length) < 0) {
+		log_debug("Marking mesh stack for cleanup (N: %s)", mesh_stack->name);
+
+		mesh_stack->cleanup = true;
+
+		return -1;
+	}
+
+	return 0;
+}
+
 void arm_timer_cleanup_after_reset_sent(MeshStack *mesh_stack) {
 	if (timer_configure(&mesh_stack->timer_cleanup_after_reset_sent,
 	                    TIME_CLEANUP_AFTER_RESET_SENT,
@@ -990,7 +1399,7 @@ void arm_timer_cleanup_after_reset_sent(MeshStack *mesh_stack) {
 
 bool hello_non_root_recv_handler(MeshStack *mesh_stack) {
 	MeshOllehPacket olleh_mesh_pkt;
-	MeshHelloPacket *hello_mesh_pkt = &mesh_stack->hello_response;
+	MeshHelloPacket *hello_mesh_pkt = mesh_stack->hello_response;
 	char mesh_packet_dump[MESH_PACKET_MAX_DUMP_LENGTH];
 
 	// Prepare the olleh packet.
@@ -1010,8 +1419,7 @@ bool hello_non_root_recv_handler(MeshStack *mesh_stack) {
 	                          mesh_stack->gw_addr,
 	                          MESH_PACKET_TYPE_OLLEH);
 
-	// TODO: Integrate buffered IO write.
-	if (socket_send(mesh_stack->sock, &olleh_mesh_pkt, olleh_mesh_pkt.header.length) < 0) {
+	if (mesh_stack_send(mesh_stack, &olleh_mesh_pkt) < 0) {
 		log_error("Olleh packet send failed (A: %02X-%02X-%02X-%02X-%02X-%02X, packet: %s)",
 		          hello_mesh_pkt->header.src_addr[0],
 		          hello_mesh_pkt->header.src_addr[1],
@@ -1033,5 +1441,13 @@ bool hello_non_root_recv_handler(MeshStack *mesh_stack) {
 	          hello_mesh_pkt->header.src_addr[5],
 	          mesh_packet_get_dump(mesh_packet_dump, (uint8_t *)&olleh_mesh_pkt, olleh_mesh_pkt.header.length));
 
+	// Discover the devices of a node that joined the mesh network after its
+	// root node connected. Nodes that joined before are handled as part of
+	// the root node hello.
+	if (mesh_add_node(hello_mesh_pkt->group_id, hello_mesh_pkt->header.src_addr) > 0 &&
+	    mesh_stack->state == MESH_STACK_STATE_OPERATIONAL) {
+		mesh_stack_send_enumerate(mesh_stack, hello_mesh_pkt->header.src_addr);
+	}
+
 	return true;
 }
@@ -23,8 +23,10 @@
 #ifndef BRICKD_MESH_STACK_H
 #define BRICKD_MESH_STACK_H
 
+#include <daemonlib/framer.h>
 #include <daemonlib/timer.h>
 #include <daemonlib/socket.h>
+#include <daemonlib/writer.h>
 
 #include "stack.h"
 #include "mesh_packet.h"
@@ -39,6 +41,13 @@
 #define TIME_WAIT_HELLO 8000000
 #define TIME_HB_WAIT_PONG (TIME_HB_DO_PING/2)
 #define TIME_CLEANUP_AFTER_RESET_SENT 4000000
+#define TIME_DISCOVERY 10000000
+
+// Mesh packets are collected and written together, up to about one TCP segment.
+#define MESH_STACK_MAX_PENDING_LENGTH 1400
+
+// In bytes.
+#define MESH_STACK_READ_BUFFER_SIZE 4096
 
 // Mesh stack struct.
 typedef struct {
@@ -48,6 +57,14 @@ typedef struct {
 	 */
 	Stack base;
 	Socket *sock; // FIXME_ does this have to be a pointer?
+	Writer writer;
+	uint8_t pending_buffer[MESH_STACK_MAX_PENDING_LENGTH];
+	int pending_length;
+	uint32_t sent_packets;
+	uint32_t sent_writes;
+	uint32_t unicast_requests;
+	uint32_t broadcast_requests;
+	uint32_t unroutable_requests;
 	bool cleanup;
 	uint8_t state;
 	char prefix[16];
@@ -57,18 +74,21 @@ typedef struct {
 	Timer timer_hb_wait_pong;
 	char name[STACK_MAX_NAME_LENGTH];
 	Timer timer_cleanup_after_reset_sent;
+	Timer timer_discovery;
+	bool discovering_all; // a discovery enumerate request was broadcast
+	bool hiding_discovery_replies; // until a client sends its own enumerate request
 	uint8_t root_node_firmware_version[3];
 	uint8_t gw_addr[ESP_MESH_ADDRESS_LEN];
 	uint8_t root_node_addr[ESP_MESH_ADDRESS_LEN];
+	Framer response_framer;
+	// Mesh packet that is currently handled, points into the read buffer.
 	union {
-		uint8_t response_buffer[512];
-		MeshPacketHeader response_header;
-		MeshHelloPacket hello_response;
-		MeshHeartBeatPacket heart_beat_response;
-		MeshPayloadPacket payload_response;
+		uint8_t *response;
+		MeshPacketHeader *response_header;
+		MeshHelloPacket *hello_response;
+		MeshHeartBeatPacket *heart_beat_response;
+		MeshPayloadPacket *payload_response;
 	};
-	int response_buffer_used;
-	bool response_header_checked;
 } MeshStack;
 
 void timer_hb_do_ping_handler(void *opaque);
@@ -85,5 +105,6 @@ bool hello_root_recv_handler(MeshStack *mesh_stack);
 bool hello_non_root_recv_handler(MeshStack *mesh_stack);
 void arm_timer_cleanup_after_reset_sent(MeshStack *mesh_stack);
 int mesh_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipient);
+int mesh_stack_flush(MeshStack *mesh_stack);
 
 #endif // BRICKD_MESH_STACK_H
@@ -36,147 +36,1083 @@
 #include <daemonlib/config.h>
 #include <daemonlib/event.h>
 #include <daemonlib/log.h>
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	#include <daemonlib/mpsc_queue.h>
+#endif
 #include <daemonlib/node.h>
 #include <daemonlib/packet.h>
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	#include <daemonlib/pipe.h>
+#endif
 #include <daemonlib/socket.h>
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	#include <daemonlib/threads.h>
+#endif
 #include <daemonlib/utils.h>
 
-#include "network.h"
+#include "network.h"
+
+#include "capture.h"
+#include "hmac.h"
+#include "websocket.h"
+#include "zombie.h"
+
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	#ifdef BRICKD_WITH_RED_BRICK
+		#error Network worker threads are not supported on the RED Brick
+	#endif
+
+	#ifndef DAEMONLIB_WITH_EVENT_THREADS
+		#error Network worker threads require DAEMONLIB_WITH_EVENT_THREADS
+	#endif
+#endif
+
+/*
+ * with network.worker_threads set to N > 0 the client I/O is moved out of the
+ * main thread that runs the stacks and the scheduler (the hardware thread).
+ * each worker thread runs its own event loop and owns a shard of the clients
+ * together with their zombies and pending requests. the hardware thread only
+ * accepts new client sockets and hands them to the workers in round robin
+ * order.
+ *
+ * the threads talk to each other through inboxes, lock-free MPSC queues with a
+ * pipe to wake up the event loop of the receiving thread. requests cross from
+ * the workers into the hardware thread and are submitted to the scheduler
+ * there. the scheduler state of each client lives in the hardware thread and
+ * might outlive the client for a moment.
+ *
+ * responses cross back out to the worker that owns the matching pending
+ * request only. for this each worker tells the hardware thread about each
+ * pending request it adds, before the request itself is posted. the hardware
+ * thread keeps these routes in a single list in the order they arrived. a
+ * response takes the oldest matching route, just as it would take the oldest
+ * matching pending request from the single global list without workers.
+ * callbacks and responses without a matching route are passed to all workers.
+ *
+ * a worker that drops a pending request before its response arrived, for
+ * example because its zombie timed out, also drops its route. both threads
+ * claim the route with an atomic flag before using it, so only one of them
+ * gets it. if the hardware thread wins then the response is already on its
+ * way and the worker drops it on arrival.
+ *
+ * the hardware thread posts the responses and callbacks for a worker into its
+ * inbox in order and each client belongs to a single worker. this way a client
+ * gets its responses and callbacks in the same order as without workers.
+ */
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+typedef struct {
+	Array clients;
+	Array zombies;
+	Node pending_request_sentinel;
+} NetworkShard;
+
+typedef struct {
+	SchedulerClient base;
+	char name[CLIENT_MAX_NAME_LENGTH]; // the client might be gone before this
+} NetworkSchedulerClient;
+
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+
+#define NETWORK_MAX_WORKER_THREADS 64 // same as the maximum of network.worker_threads
+
+typedef struct {
+	int remaining; // number of workers that did not look at the broadcast yet
+	int populated; // number of workers that have clients or zombies
+	Packet packet;
+} NetworkBroadcast;
+
+typedef enum {
+	NETWORK_MESSAGE_TYPE_ACCEPT = 0, // to a worker
+	NETWORK_MESSAGE_TYPE_RESPONSE, // to the worker that owns the route
+	NETWORK_MESSAGE_TYPE_BROADCAST, // to all workers
+	NETWORK_MESSAGE_TYPE_REQUEST, // to the hardware thread
+	NETWORK_MESSAGE_TYPE_ROUTE, // to the hardware thread
+	NETWORK_MESSAGE_TYPE_UNROUTE, // to the hardware thread
+	NETWORK_MESSAGE_TYPE_DESTROY_SCHEDULER_CLIENT // to the hardware thread
+} NetworkMessageType;
+
+typedef struct _NetworkMessage NetworkMessage;
+
+struct _NetworkMessage {
+	MPSCNode node;
+	NetworkMessageType type;
+	union {
+		struct {
+			Socket *socket;
+			bool websocket;
+			uint32_t authentication_nonce;
+			char name[CLIENT_MAX_NAME_LENGTH];
+		} accept;
+		struct { // also used by the RESPONSE message
+			Node node; // in the route list of the hardware thread
+			int worker; // index of the worker that owns the pending request
+			bool claimed; // by the hardware thread or by the owning worker
+			PendingRequest *pending_request; // only accessed by the owning worker
+			PacketHeader header;
+			Packet response;
+		} route;
+		struct {
+			NetworkMessage *route;
+		} unroute;
+		struct {
+			NetworkBroadcast *broadcast;
+		} broadcast;
+		struct {
+			NetworkSchedulerClient *scheduler_client;
+			Packet packet;
+		} request;
+	};
+};
+
+typedef struct {
+	MPSCQueue queue; // of NetworkMessage
+	Pipe notification;
+	bool stop_requested;
+} NetworkInbox;
+
+typedef struct {
+	int index;
+	Thread thread;
+	bool started;
+	NetworkInbox inbox;
+	NetworkShard shard;
+} NetworkWorker;
+
+#endif
+
+static NetworkShard _main_shard;
+static EVENT_THREAD_LOCAL NetworkShard *_shard = &_main_shard;
+static Array _plain_server_sockets;
+static Array _websocket_server_sockets;
+static Array _unix_server_sockets;
+static const char *_unix_socket_path = NULL;
+static uint32_t _next_authentication_nonce = 0;
+
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+
+static NetworkWorker *_workers = NULL; // only modified while no worker is running
+static int _worker_count = 0;
+static int _next_worker = 0;
+static Semaphore _worker_started;
+static NetworkInbox _inbox; // of the hardware thread
+static Node _route_sentinel; // of the hardware thread, in the order the routes arrived
+static EVENT_THREAD_LOCAL NetworkWorker *_worker = NULL; // NULL in the hardware thread
+
+#endif
+
+static Client *network_append_client(const char *name, IO *io,
+                                     uint32_t authentication_nonce);
+
+static void network_handle_websocket_handshake_done(void *opaque) {
+	Client *client = opaque;
+
+	writer_resume(&client->response_writer);
+}
+
+static void network_handle_websocket_control_pending(bool pending, void *opaque) {
+	Client *client = opaque;
+
+	writer_set_io_pending(&client->response_writer, pending);
+}
+
+// takes ownership of the client socket
+static void network_add_client_socket(Socket *client_socket, const char *name,
+                                      bool websocket, uint32_t authentication_nonce) {
+	Client *client;
+
+	// create new client
+	client = network_append_client(name, &client_socket->base, authentication_nonce);
+
+	if (client == NULL) {
+		socket_destroy(client_socket);
+		free(client_socket);
+
+		return;
+	}
+
+	if (websocket) {
+		// responses and callbacks wait in the write backlog of the client
+		// until the WebSocket handshake is done
+		writer_pause(&client->response_writer);
+		websocket_set_handshake_done_function((Websocket *)client_socket,
+		                                      network_handle_websocket_handshake_done,
+		                                      client);
+
+		// a partly sent pong or close frame is continued by the writer
+		websocket_set_control_pending_function((Websocket *)client_socket,
+		                                       network_handle_websocket_control_pending,
+		                                       client);
+	}
+
+#ifdef BRICKD_WITH_RED_BRICK
+	client_send_red_brick_enumerate(client, ENUMERATION_TYPE_CONNECTED);
+#endif
+}
+
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+
+static NetworkMessage *network_create_message(NetworkMessageType type) {
+	NetworkMessage *message = malloc(sizeof(NetworkMessage));
+
+	if (message == NULL) {
+		log_error("Could not allocate network message: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return NULL;
+	}
+
+	message->type = type;
+
+	return message;
+}
+
+// might be called from any thread. the pipe is only written if the inbox was
+// empty before, because the receiving thread takes all messages at once
+static void network_post_message(NetworkInbox *inbox, NetworkMessage *message) {
+	uint8_t byte = 0;
+
+	if (mpsc_queue_push(&inbox->queue, &message->node) &&
+	    pipe_write(&inbox->notification, &byte, sizeof(byte)) < 0) {
+		log_error("Could not write to network inbox pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void network_release_broadcast(NetworkBroadcast *broadcast) {
+	if (__atomic_sub_fetch(&broadcast->remaining, 1, __ATOMIC_ACQ_REL) == 0) {
+		free(broadcast);
+	}
+}
+
+// posts one BROADCAST message per worker, either all or none of them
+static void network_post_broadcast(Packet *packet) {
+	NetworkBroadcast *broadcast = malloc(sizeof(NetworkBroadcast));
+	NetworkMessage *messages[NETWORK_MAX_WORKER_THREADS];
+	int i;
+
+	if (broadcast == NULL) {
+		log_error("Could not allocate network broadcast: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return;
+	}
+
+	broadcast->remaining = _worker_count;
+	broadcast->populated = 0;
+
+	memcpy(&broadcast->packet, packet, packet->header.length);
+
+	for (i = 0; i < _worker_count; ++i) {
+		messages[i] = network_create_message(NETWORK_MESSAGE_TYPE_BROADCAST);
+
+		if (messages[i] == NULL) {
+			for (--i; i >= 0; --i) {
+				free(messages[i]);
+			}
+
+			free(broadcast);
+
+			return;
+		}
+
+		messages[i]->broadcast.broadcast = broadcast;
+	}
+
+	for (i = 0; i < _worker_count; ++i) {
+		network_post_message(&_workers[i].inbox, messages[i]);
+	}
+}
+
+// takes ownership of the client socket
+static void network_post_accept(Socket *client_socket, const char *name, bool websocket) {
+	NetworkMessage *message = network_create_message(NETWORK_MESSAGE_TYPE_ACCEPT);
+	NetworkWorker *worker = &_workers[_next_worker];
+
+	if (message == NULL) {
+		socket_destroy(client_socket);
+		free(client_socket);
+
+		return;
+	}
+
+	message->accept.socket = client_socket;
+	message->accept.websocket = websocket;
+	message->accept.authentication_nonce = _next_authentication_nonce++;
+
+	string_copy(message->accept.name, sizeof(message->accept.name), name, -1);
+
+	log_debug("Handing new client socket (handle: %d) to network worker %d",
+	          client_socket->handle, worker->index);
+
+	_next_worker = (_next_worker + 1) % _worker_count;
+
+	network_post_message(&worker->inbox, message);
+}
+
+#endif
+
+static void network_handle_accept(void *opaque) {
+	Socket *server_socket = opaque;
+	Socket *client_socket;
+	struct sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	char hostname[NI_MAXHOST];
+	char port[NI_MAXSERV];
+	char buffer[NI_MAXHOST + NI_MAXSERV + 4]; // 4 == strlen("[]:") + 1
+	char *name = "<unknown>";
+	bool websocket = server_socket->create_allocated == websocket_create_allocated;
+
+	// accept new client socket
+	client_socket = socket_accept(server_socket, (struct sockaddr *)&address, &length);
+
+	if (client_socket == NULL) {
+		if (!errno_interrupted()) {
+			log_error("Could not accept new client socket: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+
+		return;
+	}
+
+#ifndef _WIN32
+	if (address.ss_family == AF_UNIX) {
+		// the client end of a UNIX domain socket is typically unnamed
+		snprintf(buffer, sizeof(buffer), "unix:%s", _unix_socket_path);
+
+		name = buffer;
+	} else
+#endif
+	if (socket_address_to_hostname((struct sockaddr *)&address, length,
+	                               hostname, sizeof(hostname),
+	                               port, sizeof(port)) < 0) {
+		log_warn("Could not get hostname and port of client (socket: %d): %s (%d)",
+		         client_socket->handle, get_errno_name(errno), errno);
+	} else {
+		if (address.ss_family == AF_INET6) {
+			snprintf(buffer, sizeof(buffer), "[%s]:%s", hostname, port);
+		} else {
+			snprintf(buffer, sizeof(buffer), "%s:%s", hostname, port);
+		}
+
+		name = buffer;
+	}
+
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	if (_worker_count > 0) {
+		network_post_accept(client_socket, name, websocket);
+
+		return;
+	}
+#endif
+
+	network_add_client_socket(client_socket, name, websocket, _next_authentication_nonce++);
+}
+
+static void network_add_server_sockets(Array *server_sockets) {
+	int i;
+	Socket *server_socket;
+
+	for (i = 0; i < server_sockets->count; ++i) {
+		server_socket = array_get(server_sockets, i);
+
+		if (event_add_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC, "server",
+		                     EVENT_READ, network_handle_accept, server_socket) < 0) {
+			break;
+		}
+	}
+
+	if (i < server_sockets->count) {
+		for (--i; i >= 0; --i) {
+			server_socket = array_get(server_sockets, i);
+
+			event_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+		}
+
+		for (i = 0; i < server_sockets->count; ++i) {
+			array_remove(server_sockets, i, (ItemDestroyFunction)socket_destroy);
+		}
+	}
+}
+
+static void network_open_server(Array *server_sockets, uint16_t port,
+                                SocketCreateAllocatedFunction create_allocated) {
+	const char *address = config_get_option_value("listen.address")->string;
+	bool dual_stack = config_get_option_value("listen.dual_stack")->boolean;
+
+	socket_open_server(server_sockets, address, port, dual_stack, create_allocated);
+
+	network_add_server_sockets(server_sockets);
+}
+
+static void network_destroy_server_socket(Socket *server_socket) {
+	event_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
+	socket_destroy(server_socket);
+}
+
+static void network_destroy_unix_server_sockets(void) {
+	bool unlink_path = _unix_server_sockets.count > 0;
+
+	array_destroy(&_unix_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
+
+#ifndef _WIN32
+	if (unlink_path && unlink(_unix_socket_path) < 0) {
+		log_warn("Could not remove UNIX domain socket '%s': %s (%d)",
+		         _unix_socket_path, get_errno_name(errno), errno);
+	}
+#else
+	(void)unlink_path;
+#endif
+}
+
+// drop all pending requests for the given UID from the list of the shard
+static int network_drop_pending_requests(uint32_t uid) {
+	Node *pending_request_global_node = _shard->pending_request_sentinel.next;
+	Node *pending_request_global_node_next;
+	PendingRequest *pending_request;
+	int count = 0;
+
+	while (pending_request_global_node != &_shard->pending_request_sentinel) {
+		pending_request = containerof(pending_request_global_node,
+		                              PendingRequest, global_node);
+		pending_request_global_node_next = pending_request_global_node->next;
+
+		if (pending_request->header.uid == uid) {
+			pending_request_remove_and_free(pending_request);
+
+			++count;
+		}
+
+		pending_request_global_node = pending_request_global_node_next;
+	}
+
+	return count;
+}
+
+// find the oldest pending request of the shard that matches the response
+static PendingRequest *network_find_pending_request(Packet *response) {
+	Node *pending_request_global_node = _shard->pending_request_sentinel.next;
+	PendingRequest *pending_request;
+
+	while (pending_request_global_node != &_shard->pending_request_sentinel) {
+		pending_request = containerof(pending_request_global_node,
+		                              PendingRequest, global_node);
+
+		if (packet_is_matching_response(response, &pending_request->header)) {
+			return pending_request;
+		}
+
+		pending_request_global_node = pending_request_global_node->next;
+	}
+
+	return NULL;
+}
+
+static void network_dispatch_to_pending_request(PendingRequest *pending_request,
+                                                Packet *response) {
+	if (capture_is_enabled()) {
+		capture_packet(CAPTURE_TYPE_RESPONSE,
+		               pending_request->client != NULL ? pending_request->client->id : CAPTURE_NO_CLIENT,
+		               CAPTURE_NO_STACK, response);
+	}
+
+	if (pending_request->client != NULL) {
+		packet_add_trace(response);
+		client_dispatch_response(pending_request->client, pending_request,
+		                         response, false, false);
+	} else {
+		packet_add_trace(response);
+		zombie_dispatch_response(pending_request->zombie, pending_request,
+		                         response);
+	}
+}
+
+static void network_broadcast_response(Packet *response) {
+	int i;
+	Client *client;
+
+	packet_add_trace(response);
+
+	for (i = 0; i < _shard->clients.count; ++i) {
+		client = array_get(&_shard->clients, i);
+
+		client_dispatch_response(client, NULL, response, true, false);
+	}
+}
+
+static void network_dispatch_callback(Packet *response) {
+	EnumerateCallback *enumerate_callback;
+	int dropped_requests;
+	char base58[BASE58_MAX_LENGTH];
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (response->header.function_id == CALLBACK_ENUMERATE) {
+		enumerate_callback = (EnumerateCallback *)response;
+
+		// if an enumerate-connected callback is received then the device
+		// was just started and all pending requests that exist for this
+		// device are stale. the device can never have received the requests
+		// and will never respond to them.
+		//
+		// if a new request is received then it is added to the end of the
+		// global pending request list. if the response for this request
+		// arrives then one of the stale pending requests will match it.
+		// this can result in misrouting responses. to avoid this drop all
+		// pending request for a given UID if an enumerate-connected
+		// callback is received for that UID. this ensures that there are
+		// never stale pending requests.
+		//
+		// do the same for an enumerate-disconnected callback. this is not
+		// strictly necessary, but after the device got disconnected the
+		// pending requests for it will never get a response. this stale
+		// requests just waste space in the pending requests list and can
+		// be dropped.
+		if (enumerate_callback->enumeration_type == ENUMERATION_TYPE_CONNECTED ||
+		    enumerate_callback->enumeration_type == ENUMERATION_TYPE_DISCONNECTED) {
+			dropped_requests = network_drop_pending_requests(response->header.uid);
+
+			if (dropped_requests > 0) {
+				log_warn("Received enumerate-%sconnected callback (uid: %s), dropped %d now stale pending request(s)",
+				         enumerate_callback->enumeration_type == ENUMERATION_TYPE_CONNECTED ? "" : "dis",
+				         base58_encode(base58, uint32_from_le(response->header.uid)), dropped_requests);
+			}
+		}
+	}
+
+	if (_shard->clients.count == 0) {
+		log_packet_response_debug(response, "No clients connected, dropping %s (%s)",
+		                                    packet_get_response_type(response),
+		                                    packet_get_response_signature(packet_signature, response));
+
+		return;
+	}
+
+	log_packet_response_debug(response, "Broadcasting %s (%s) to %d client(s)",
+	                                    packet_get_response_type(response),
+	                                    packet_get_response_signature(packet_signature, response),
+	                                    _shard->clients.count);
+
+	network_broadcast_response(response);
+}
+
+static int network_create_shard(NetworkShard *shard) {
+	node_reset(&shard->pending_request_sentinel);
+
+	// create client array. the Client struct is not relocatable, because a
+	// pointer to it is passed as opaque parameter to the event subsystem
+	if (array_create(&shard->clients, 32, sizeof(Client), false) < 0) {
+		log_error("Could not create client array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	// create zombie array. the Zombie struct is not relocatable, because a
+	// pointer to it is passed as opaque parameter to its timer object
+	if (array_create(&shard->zombies, 32, sizeof(Zombie), false) < 0) {
+		log_error("Could not create zombie array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_destroy(&shard->clients, NULL);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void network_destroy_shard(NetworkShard *shard) {
+	array_destroy(&shard->clients, (ItemDestroyFunction)client_destroy); // might call network_create_zombie
+	array_destroy(&shard->zombies, (ItemDestroyFunction)zombie_destroy);
+}
+
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+
+// the oldest matching route gets the response. the message of the route is
+// reused to pass the response to the owning worker
+static void network_route_response(Packet *response) {
+	Node *route_node = _route_sentinel.next;
+	NetworkMessage *route;
+
+	while (route_node != &_route_sentinel) {
+		route = containerof(route_node, NetworkMessage, route.node);
+		route_node = route_node->next;
+
+		if (!packet_is_matching_response(response, &route->route.header)) {
+			continue;
+		}
+
+		// the worker claimed the route if it dropped the pending request
+		// meanwhile. the UNROUTE message for it is on its way then
+		if (__atomic_exchange_n(&route->route.claimed, true, __ATOMIC_ACQ_REL)) {
+			continue;
+		}
+
+		node_remove(&route->route.node);
+
+		route->type = NETWORK_MESSAGE_TYPE_RESPONSE;
+
+		memcpy(&route->route.response, response, response->header.length);
+
+		network_post_message(&_workers[route->route.worker].inbox, route);
+
+		return;
+	}
+
+	network_post_broadcast(response);
+}
+
+static void network_deliver_response(NetworkMessage *message) {
+	PendingRequest *pending_request = message->route.pending_request;
+	Packet *response = &message->route.response;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (pending_request == NULL) {
+		// the pending request got dropped after the hardware thread claimed
+		// its route. without workers the response would have reached the
+		// pending request before it got dropped, so drop the response too
+		log_packet_response_debug(response, "Matching pending request for response (%s) got dropped meanwhile, dropping response",
+		                                    packet_get_response_signature(packet_signature, response));
+
+		return;
+	}
+
+	pending_request->route = NULL; // the message is freed by the caller
+
+	network_dispatch_to_pending_request(pending_request, response);
+}
+
+// called by each worker for each broadcast. the last worker to look at a
+// response that had no matching route logs this once
+static void network_handle_broadcast(NetworkBroadcast *broadcast) {
+	Packet *packet = &broadcast->packet;
+	bool callback = packet_header_get_sequence_number(&packet->header) == 0;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	if (callback) {
+		network_dispatch_callback(packet);
+	} else if (_shard->clients.count + _shard->zombies.count > 0) {
+		__atomic_add_fetch(&broadcast->populated, 1, __ATOMIC_RELAXED);
+
+		network_broadcast_response(packet);
+	}
+
+	if (__atomic_sub_fetch(&broadcast->remaining, 1, __ATOMIC_ACQ_REL) > 0) {
+		return;
+	}
+
+	if (!callback) {
+		if (__atomic_load_n(&broadcast->populated, __ATOMIC_RELAXED) > 0) {
+			log_warn("Broadcasting response (%s) because no client/zombie has a matching pending request",
+			         packet_get_response_signature(packet_signature, packet));
+		} else {
+			log_packet_response_debug(packet, "No clients/zombies connected, dropping response (%s)",
+			                                  packet_get_response_signature(packet_signature, packet));
+		}
+	}
+
+	free(broadcast);
+}
+
+// tells the hardware thread that the pending request belongs to this worker.
+// this happens before the request is posted, so the route is known before
+// the response can arrive
+static void network_post_route(PendingRequest *pending_request) {
+	NetworkMessage *message = network_create_message(NETWORK_MESSAGE_TYPE_ROUTE);
+
+	if (message == NULL) {
+		return; // the response will be broadcast
+	}
+
+	message->route.worker = _worker->index;
+	message->route.claimed = false;
+	message->route.pending_request = pending_request;
+
+	memcpy(&message->route.header, &pending_request->header, sizeof(PacketHeader));
+
+	pending_request->route = message;
+
+	network_post_message(&_inbox, message);
+}
+
+// used for the routes that are left after all workers stopped
+static void network_destroy_routes(void) {
+	NetworkMessage *route;
+
+	while (_route_sentinel.next != &_route_sentinel) {
+		route = containerof(_route_sentinel.next, NetworkMessage, route.node);
+
+		node_remove(&route->route.node);
+		free(route);
+	}
+}
+
+static void network_handle_message(NetworkMessage *message) {
+	switch (message->type) {
+	case NETWORK_MESSAGE_TYPE_ACCEPT:
+		network_add_client_socket(message->accept.socket, message->accept.name,
+		                          message->accept.websocket,
+		                          message->accept.authentication_nonce);
+
+		break;
+
+	case NETWORK_MESSAGE_TYPE_RESPONSE:
+		network_deliver_response(message);
+
+		break;
+
+	case NETWORK_MESSAGE_TYPE_BROADCAST:
+		network_handle_broadcast(message->broadcast.broadcast);
+
+		break;
+
+	case NETWORK_MESSAGE_TYPE_REQUEST:
+		packet_add_trace(&message->request.packet);
+		scheduler_submit_request(&message->request.scheduler_client->base,
+		                         &message->request.packet);
+
+		break;
+
+	case NETWORK_MESSAGE_TYPE_ROUTE:
+		node_insert_before(&_route_sentinel, &message->route.node);
+
+		return; // the message is owned by the route list now
+
+	case NETWORK_MESSAGE_TYPE_UNROUTE:
+		node_remove(&message->unroute.route->route.node);
+		free(message->unroute.route);
+
+		break;
+
+	case NETWORK_MESSAGE_TYPE_DESTROY_SCHEDULER_CLIENT:
+		scheduler_client_destroy(&message->request.scheduler_client->base);
+		free(message->request.scheduler_client);
+
+		break;
+	}
+
+	free(message);
+}
+
+// used for the messages left in the inbox of a worker that already stopped
+static void network_discard_message(NetworkMessage *message) {
+	switch (message->type) {
+	case NETWORK_MESSAGE_TYPE_ACCEPT:
+		socket_destroy(message->accept.socket);
+		free(message->accept.socket);
+
+		break;
+
+	case NETWORK_MESSAGE_TYPE_BROADCAST:
+		network_release_broadcast(message->broadcast.broadcast);
+
+		break;
+
+	default:
+		break;
+	}
+
+	free(message);
+}
+
+static void network_handle_inbox(void *opaque) {
+	NetworkInbox *inbox = opaque;
+	uint8_t buffer[64];
+	MPSCNode *node;
+	NetworkMessage *message;
+
+	// there might be less bytes than messages, or no byte at all if the
+	// inbox is drained without an event
+	if (pipe_read(&inbox->notification, buffer, sizeof(buffer)) < 0 &&
+	    !errno_would_block() && !errno_interrupted()) {
+		log_error("Could not read from network inbox pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+
+	node = mpsc_queue_take(&inbox->queue);
+
+	while (node != NULL) {
+		message = containerof(node, NetworkMessage, node);
+		node = node->next;
+
+		network_handle_message(message);
+	}
+
+	if (__atomic_load_n(&inbox->stop_requested, __ATOMIC_ACQUIRE)) {
+		event_stop();
+	}
+}
+
+// used for the messages that the stopped workers left in the inbox of the
+// hardware thread. their requests are dropped, but their scheduler clients
+// still have to be destroyed
+static void network_drain_inbox(NetworkInbox *inbox) {
+	MPSCNode *node = mpsc_queue_take(&inbox->queue);
+	NetworkMessage *message;
+
+	while (node != NULL) {
+		message = containerof(node, NetworkMessage, node);
+		node = node->next;
+
+		if (message->type == NETWORK_MESSAGE_TYPE_REQUEST) {
+			network_discard_message(message);
+		} else {
+			network_handle_message(message);
+		}
+	}
+}
+
+static int network_create_inbox(NetworkInbox *inbox) {
+	mpsc_queue_create(&inbox->queue);
+
+	inbox->stop_requested = false;
+
+	if (pipe_create(&inbox->notification, PIPE_FLAG_NON_BLOCKING_READ) < 0) {
+		log_error("Could not create network inbox pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void network_destroy_inbox(NetworkInbox *inbox) {
+	MPSCNode *node = mpsc_queue_take(&inbox->queue);
+	NetworkMessage *message;
+
+	while (node != NULL) {
+		message = containerof(node, NetworkMessage, node);
+		node = node->next;
+
+		network_discard_message(message);
+	}
+
+	pipe_destroy(&inbox->notification);
+}
+
+static void network_run_worker(void *opaque) {
+	NetworkWorker *worker = opaque;
+	int phase = 0;
+
+	_worker = worker;
+	_shard = &worker->shard;
+
+	if (event_init() < 0) {
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (network_create_shard(&worker->shard) < 0) {
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (event_add_source(worker->inbox.notification.base.read_handle,
+	                     EVENT_SOURCE_TYPE_GENERIC, "network-inbox", EVENT_READ,
+	                     network_handle_inbox, &worker->inbox) < 0) {
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	log_debug("Started network worker %d", worker->index);
+
+	worker->started = true;
+
+	semaphore_release(&_worker_started);
+
+	event_run(network_cleanup_clients_and_zombies);
+
+	log_debug("Stopping network worker %d", worker->index);
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 3:
+		event_remove_source(worker->inbox.notification.base.read_handle,
+		                    EVENT_SOURCE_TYPE_GENERIC);
+		// fall through
+
+	case 2:
+		network_destroy_shard(&worker->shard);
+		// fall through
+
+	case 1:
+		event_exit();
+		// fall through
+
+	default:
+		break;
+	}
+
+	if (!worker->started) {
+		semaphore_release(&_worker_started);
+	}
+}
+
+// stops and joins all workers, then drains what they left in the inbox of
+// the hardware thread, such as the scheduler clients of their clients
+static void network_stop_workers(void) {
+	int i;
+	NetworkWorker *worker;
+	uint8_t byte = 0;
+
+	for (i = 0; i < _worker_count; ++i) {
+		worker = &_workers[i];
+
+		__atomic_store_n(&worker->inbox.stop_requested, true, __ATOMIC_RELEASE);
+
+		if (pipe_write(&worker->inbox.notification, &byte, sizeof(byte)) < 0) {
+			log_error("Could not write to network inbox pipe: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
+	}
+
+	for (i = 0; i < _worker_count; ++i) {
+		worker = &_workers[i];
+
+		thread_join(&worker->thread);
+		thread_destroy(&worker->thread);
+	}
+
+	// only discard messages after all workers stopped, because a worker
+	// might still post a message to another worker while stopping
+	for (i = 0; i < _worker_count; ++i) {
+		network_destroy_inbox(&_workers[i].inbox);
+	}
+
+	network_drain_inbox(&_inbox);
+	network_destroy_routes();
 
-#include "hmac.h"
-#include "websocket.h"
-#include "zombie.h"
+	_worker_count = 0;
+}
 
-static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+static int network_start_workers(int count) {
+	int phase = 0;
+	NetworkWorker *worker;
 
-static Array _clients;
-static Array _zombies;
-static Array _plain_server_sockets;
-static Array _websocket_server_sockets;
-static uint32_t _next_authentication_nonce = 0;
-static Node _pending_request_sentinel;
+	log_debug("Starting %d network worker thread(s)", count);
 
-static void network_handle_accept(void *opaque) {
-	Socket *server_socket = opaque;
-	Socket *client_socket;
-	struct sockaddr_storage address;
-	socklen_t length = sizeof(address);
-	char hostname[NI_MAXHOST];
-	char port[NI_MAXSERV];
-	char buffer[NI_MAXHOST + NI_MAXSERV + 4]; // 4 == strlen("[]:") + 1
-	char *name = "<unknown>";
-	Client *client;
+	node_reset(&_route_sentinel);
 
-	// accept new client socket
-	client_socket = socket_accept(server_socket, (struct sockaddr *)&address, &length);
+	_workers = calloc(count, sizeof(NetworkWorker));
 
-	if (client_socket == NULL) {
-		if (!errno_interrupted()) {
-			log_error("Could not accept new client socket: %s (%d)",
-			          get_errno_name(errno), errno);
-		}
+	if (_workers == NULL) {
+		log_error("Could not allocate network workers: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
 
-		return;
+		goto cleanup;
 	}
 
-	if (socket_address_to_hostname((struct sockaddr *)&address, length,
-	                               hostname, sizeof(hostname),
-	                               port, sizeof(port)) < 0) {
-		log_warn("Could not get hostname and port of client (socket: %d): %s (%d)",
-		         client_socket->handle, get_errno_name(errno), errno);
-	} else {
-		if (address.ss_family == AF_INET6) {
-			snprintf(buffer, sizeof(buffer), "[%s]:%s", hostname, port);
-		} else {
-			snprintf(buffer, sizeof(buffer), "%s:%s", hostname, port);
-		}
+	phase = 1;
 
-		name = buffer;
-	}
+	if (semaphore_create(&_worker_started) < 0) {
+		log_error("Could not create network worker semaphore: %s (%d)",
+		          get_errno_name(errno), errno);
 
-	// create new client
-	client = network_create_client(name, &client_socket->base);
+		goto cleanup;
+	}
 
-	if (client == NULL) {
-		socket_destroy(client_socket);
-		free(client_socket);
+	phase = 2;
 
-		return;
+	if (network_create_inbox(&_inbox) < 0) {
+		goto cleanup;
 	}
 
-#ifdef BRICKD_WITH_RED_BRICK
-	client_send_red_brick_enumerate(client, ENUMERATION_TYPE_CONNECTED);
-#endif
-}
+	phase = 3;
 
-static void network_open_server(Array *server_sockets, uint16_t port,
-                                SocketCreateAllocatedFunction create_allocated) {
-	const char *address = config_get_option_value("listen.address")->string;
-	bool dual_stack = config_get_option_value("listen.dual_stack")->boolean;
-	int i;
-	Socket *server_socket;
+	if (event_add_source(_inbox.notification.base.read_handle,
+	                     EVENT_SOURCE_TYPE_GENERIC, "network-inbox", EVENT_READ,
+	                     network_handle_inbox, &_inbox) < 0) {
+		goto cleanup;
+	}
 
-	socket_open_server(server_sockets, address, port, dual_stack, create_allocated);
+	phase = 4;
 
-	for (i = 0; i < server_sockets->count; ++i) {
-		server_socket = array_get(server_sockets, i);
+	while (_worker_count < count) {
+		worker = &_workers[_worker_count];
+		worker->index = _worker_count;
 
-		if (event_add_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC, "server",
-		                     EVENT_READ, network_handle_accept, server_socket) < 0) {
-			break;
+		if (network_create_inbox(&worker->inbox) < 0) {
+			goto cleanup;
 		}
-	}
 
-	if (i < server_sockets->count) {
-		for (--i; i >= 0; --i) {
-			server_socket = array_get(server_sockets, i);
+		thread_create(&worker->thread, network_run_worker, worker);
+		semaphore_acquire(&_worker_started);
 
-			event_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
-		}
+		if (!worker->started) {
+			log_error("Could not start network worker %d", worker->index);
 
-		for (i = 0; i < server_sockets->count; ++i) {
-			array_remove(server_sockets, i, (ItemDestroyFunction)socket_destroy);
+			thread_join(&worker->thread);
+			thread_destroy(&worker->thread);
+			network_destroy_inbox(&worker->inbox);
+
+			goto cleanup;
 		}
+
+		++_worker_count;
 	}
-}
 
-static void network_destroy_server_socket(Socket *server_socket) {
-	event_remove_source(server_socket->handle, EVENT_SOURCE_TYPE_GENERIC);
-	socket_destroy(server_socket);
-}
+	log_info("Started %d network worker thread(s)", count);
 
-// drop all pending requests for the given UID from the global list
-static int network_drop_pending_requests(uint32_t uid) {
-	Node *pending_request_global_node = _pending_request_sentinel.next;
-	Node *pending_request_global_node_next;
-	PendingRequest *pending_request;
-	int count = 0;
+	phase = 5;
 
-	while (pending_request_global_node != &_pending_request_sentinel) {
-		pending_request = containerof(pending_request_global_node,
-		                              PendingRequest, global_node);
-		pending_request_global_node_next = pending_request_global_node->next;
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		network_stop_workers();
+		event_remove_source(_inbox.notification.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		// fall through
 
-		if (pending_request->header.uid == uid) {
-			pending_request_remove_and_free(pending_request);
+	case 3:
+		network_destroy_inbox(&_inbox);
+		// fall through
 
-			++count;
-		}
+	case 2:
+		semaphore_destroy(&_worker_started);
+		// fall through
 
-		pending_request_global_node = pending_request_global_node_next;
+	case 1:
+		free(_workers);
+		_workers = NULL;
+		// fall through
+
+	default:
+		break;
 	}
 
-	return count;
+	return phase == 5 ? 0 : -1;
+}
+
+static void network_exit_workers(void) {
+	if (_workers == NULL) {
+		return;
+	}
+
+	network_stop_workers();
+
+	event_remove_source(_inbox.notification.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	network_destroy_inbox(&_inbox);
+	semaphore_destroy(&_worker_started);
+
+	free(_workers);
+	_workers = NULL;
 }
 
+#endif
+
 int network_init(void) {
 	int phase = 0;
 	uint16_t plain_port = (uint16_t)config_get_option_value("listen.plain_port")->integer;
 	uint16_t websocket_port = (uint16_t)config_get_option_value("listen.websocket_port")->integer;
+	int worker_threads = config_get_option_value("network.worker_threads")->integer;
 
 	log_debug("Initializing network subsystem");
 
-	node_reset(&_pending_request_sentinel);
+	_unix_socket_path = config_get_option_value("listen.unix_socket_path")->string;
 
 	if (config_get_option_value("authentication.secret")->string != NULL) {
 		log_info("Authentication is enabled");
@@ -184,28 +1120,13 @@ int network_init(void) {
 		_next_authentication_nonce = get_random_uint32();
 	}
 
-	// create client array. the Client struct is not relocatable, because a
-	// pointer to it is passed as opaque parameter to the event subsystem
-	if (array_create(&_clients, 32, sizeof(Client), false) < 0) {
-		log_error("Could not create client array: %s (%d)",
-		          get_errno_name(errno), errno);
-
+	// create client and zombie arrays of the hardware thread
+	if (network_create_shard(&_main_shard) < 0) {
 		goto cleanup;
 	}
 
 	phase = 1;
 
-	// create zombie array. the Zombie struct is not relocatable, because a
-	// pointer to it is passed as opaque parameter to its timer object
-	if (array_create(&_zombies, 32, sizeof(Zombie), false) < 0) {
-		log_error("Could not create zombie array: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		goto cleanup;
-	}
-
-	phase = 2;
-
 	// create plain server sockets. the Socket struct is not relocatable, because a
 	// pointer to it is passed as opaque parameter to accept function
 	if (array_create(&_plain_server_sockets, 8, sizeof(Socket), false) < 0) {
@@ -217,7 +1138,7 @@ int network_init(void) {
 
 	network_open_server(&_plain_server_sockets, plain_port, socket_create_allocated);
 
-	phase = 3;
+	phase = 2;
 
 	// create websocket server sockets. the Socket struct is not relocatable, because a
 	// pointer to it is passed as opaque parameter to accept function
@@ -236,9 +1157,29 @@ int network_init(void) {
 		network_open_server(&_websocket_server_sockets, websocket_port, websocket_create_allocated);
 	}
 
+	phase = 3;
+
+	// create UNIX domain server socket. the Socket struct is not relocatable, because a
+	// pointer to it is passed as opaque parameter to accept function
+	if (array_create(&_unix_server_sockets, 1, sizeof(Socket), false) < 0) {
+		log_error("Could not create UNIX domain server socket array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	if (_unix_socket_path != NULL) {
+#ifdef _WIN32
+		log_warn("Ignoring listen.unix_socket_path option, UNIX domain sockets are not supported on Windows");
+#else
+		socket_open_unix_server(&_unix_server_sockets, _unix_socket_path, socket_create_allocated);
+		network_add_server_sockets(&_unix_server_sockets);
+#endif
+	}
+
 	phase = 4;
 
-	if (_plain_server_sockets.count + _websocket_server_sockets.count == 0) {
+	if (_plain_server_sockets.count + _websocket_server_sockets.count + _unix_server_sockets.count == 0) {
 		log_error("Could not open any socket to listen to");
 
 		goto cleanup;
@@ -246,45 +1187,66 @@ int network_init(void) {
 
 	phase = 5;
 
+	if (worker_threads > 0) {
+#if defined BRICKD_WITH_RED_BRICK
+		log_warn("Ignoring network.worker_threads option, not supported on the RED Brick");
+#elif !defined BRICKD_WITH_NETWORK_WORKERS
+		log_warn("Ignoring network.worker_threads option, not supported by this build");
+#else
+		if (network_start_workers(worker_threads) < 0) {
+			goto cleanup;
+		}
+#endif
+	}
+
+	phase = 6;
+
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 5: // network_start_workers cleans up after itself
 	case 4:
-		array_destroy(&_websocket_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
+		network_destroy_unix_server_sockets();
 		// fall through
 
 	case 3:
-		array_destroy(&_plain_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
+		array_destroy(&_websocket_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 		// fall through
 
 	case 2:
-		array_destroy(&_zombies, (ItemDestroyFunction)zombie_destroy);
+		array_destroy(&_plain_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 		// fall through
 
 	case 1:
-		array_destroy(&_clients, (ItemDestroyFunction)client_destroy);
+		network_destroy_shard(&_main_shard);
 		// fall through
 
 	default:
 		break;
 	}
 
-	return phase == 5 ? 0 : -1;
+	return phase == 6 ? 0 : -1;
 }
 
 void network_exit(void) {
 	log_debug("Shutting down network subsystem");
 
+	network_destroy_unix_server_sockets();
 	array_destroy(&_websocket_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
 	array_destroy(&_plain_server_sockets, (ItemDestroyFunction)network_destroy_server_socket);
-	array_destroy(&_clients, (ItemDestroyFunction)client_destroy); // might call network_create_zombie
-	array_destroy(&_zombies, (ItemDestroyFunction)zombie_destroy);
+
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	network_exit_workers();
+#endif
+
+	network_destroy_shard(&_main_shard);
 }
 
-Client *network_create_client(const char *name, IO *io) {
+static Client *network_append_client(const char *name, IO *io,
+                                     uint32_t authentication_nonce) {
 	Client *client;
 
 	// append to client array
-	client = array_append(&_clients);
+	client = array_append(&_shard->clients);
 
 	if (client == NULL) {
 		log_error("Could not append to client array: %s (%d)",
@@ -294,8 +1256,8 @@ Client *network_create_client(const char *name, IO *io) {
 	}
 
 	// create new client that takes ownership of the I/O object
-	if (client_create(client, name, io, _next_authentication_nonce++, NULL) < 0) {
-		array_remove(&_clients, _clients.count - 1, NULL);
+	if (client_create(client, name, io, authentication_nonce, NULL) < 0) {
+		array_remove(&_shard->clients, _shard->clients.count - 1, NULL);
 
 		return NULL;
 	}
@@ -306,11 +1268,16 @@ Client *network_create_client(const char *name, IO *io) {
 	return client;
 }
 
+// must be called from the hardware thread
+Client *network_create_client(const char *name, IO *io) {
+	return network_append_client(name, io, _next_authentication_nonce++);
+}
+
 int network_create_zombie(Client *client) {
 	Zombie *zombie;
 
 	// append to zombie array
-	zombie = array_append(&_zombies);
+	zombie = array_append(&_shard->zombies);
 
 	if (zombie == NULL) {
 		log_error("Could not append to zombie array: %s (%d)",
@@ -321,7 +1288,7 @@ int network_create_zombie(Client *client) {
 
 	// create new zombie that takes ownership of the pending requests
 	if (zombie_create(zombie, client) < 0) {
-		array_remove(&_zombies, _zombies.count - 1, NULL);
+		array_remove(&_shard->zombies, _shard->zombies.count - 1, NULL);
 
 		return -1;
 	}
@@ -337,26 +1304,32 @@ void network_cleanup_clients_and_zombies(void) {
 	Client *client;
 	Zombie *zombie;
 
+	// responses collected in batch mode during this event loop iteration are
+	// written now. this might disconnect the client, so do this first
+	for (i = 0; i < _shard->clients.count; ++i) {
+		client_flush_batch(array_get(&_shard->clients, i));
+	}
+
 	// iterate backwards for simpler index handling
-	for (i = _clients.count - 1; i >= 0; --i) {
-		client = array_get(&_clients, i);
+	for (i = _shard->clients.count - 1; i >= 0; --i) {
+		client = array_get(&_shard->clients, i);
 
 		if (client->disconnected) {
 			log_debug("Removing disconnected client ("CLIENT_SIGNATURE_FORMAT")",
 			          client_expand_signature(client));
 
-			array_remove(&_clients, i, (ItemDestroyFunction)client_destroy);
+			array_remove(&_shard->clients, i, (ItemDestroyFunction)client_destroy);
 		}
 	}
 
 	// iterate backwards for simpler index handling
-	for (i = _zombies.count - 1; i >= 0; --i) {
-		zombie = array_get(&_zombies, i);
+	for (i = _shard->zombies.count - 1; i >= 0; --i) {
+		zombie = array_get(&_shard->zombies, i);
 
 		if (zombie->finished) {
 			log_debug("Removing finished zombie (id: %u)", zombie->id);
 
-			array_remove(&_zombies, i, (ItemDestroyFunction)zombie_destroy);
+			array_remove(&_shard->zombies, i, (ItemDestroyFunction)zombie_destroy);
 		}
 	}
 }
@@ -392,7 +1365,7 @@ void network_client_expects_response(Client *client, Packet *request) {
 		return;
 	}
 
-	node_insert_before(&_pending_request_sentinel, &pending_request->global_node);
+	node_insert_before(&_shard->pending_request_sentinel, &pending_request->global_node);
 	node_insert_before(&client->pending_request_sentinel, &pending_request->client_node);
 
 	++client->pending_request_count;
@@ -402,118 +1375,171 @@ void network_client_expects_response(Client *client, Packet *request) {
 
 	memcpy(&pending_request->header, &request->header, sizeof(PacketHeader));
 
-	log_packet_debug("Added pending request (%s) for client ("CLIENT_SIGNATURE_FORMAT")",
-	                 packet_get_request_signature(packet_signature, request),
-	                 client_expand_signature(client));
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	if (_worker != NULL) {
+		network_post_route(pending_request);
+	}
+#endif
+
+	log_packet_request_debug(request, "Added pending request (%s) for client ("CLIENT_SIGNATURE_FORMAT")",
+	                                  packet_get_request_signature(packet_signature, request),
+	                                  client_expand_signature(client));
 }
 
-void network_dispatch_response(Packet *response) {
-	EnumerateCallback *enumerate_callback;
-	int dropped_requests;
-	char base58[BASE58_MAX_LENGTH];
-	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
-	int i;
-	Client *client;
-	Node *pending_request_global_node;
-	PendingRequest *pending_request;
+// called for each pending request that gets removed. a worker that removes a
+// pending request before its response arrived has to claim its route first
+void network_remove_route(PendingRequest *pending_request) {
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	NetworkMessage *route = pending_request->route;
+	NetworkMessage *message;
 
-	packet_add_trace(response);
+	if (route == NULL) {
+		return;
+	}
 
-	if (packet_header_get_sequence_number(&response->header) == 0) {
-		if (response->header.function_id == CALLBACK_ENUMERATE) {
-			enumerate_callback = (EnumerateCallback *)response;
-
-			// if an enumerate-connected callback is received then the device
-			// was just started and all pending requests that exist for this
-			// device are stale. the device can never have received the requests
-			// and will never respond to them.
-			//
-			// if a new request is received then it is added to the end of the
-			// global pending request list. if the response for this request
-			// arrives then one of the stale pending requests will match it.
-			// this can result in misrouting responses. to avoid this drop all
-			// pending request for a given UID if an enumerate-connected
-			// callback is received for that UID. this ensures that there are
-			// never stale pending requests.
-			//
-			// do the same for an enumerate-disconnected callback. this is not
-			// strictly necessary, but after the device got disconnected the
-			// pending requests for it will never get a response. this stale
-			// requests just waste space in the pending requests list and can
-			// be dropped.
-			if (enumerate_callback->enumeration_type == ENUMERATION_TYPE_CONNECTED ||
-			    enumerate_callback->enumeration_type == ENUMERATION_TYPE_DISCONNECTED) {
-				dropped_requests = network_drop_pending_requests(response->header.uid);
-
-				if (dropped_requests > 0) {
-					log_warn("Received enumerate-%sconnected callback (uid: %s), dropped %d now stale pending request(s)",
-					         enumerate_callback->enumeration_type == ENUMERATION_TYPE_CONNECTED ? "" : "dis",
-					         base58_encode(base58, uint32_from_le(response->header.uid)), dropped_requests);
-				}
-			}
+	pending_request->route = NULL;
+
+	if (__atomic_exchange_n(&route->route.claimed, true, __ATOMIC_ACQ_REL)) {
+		// the hardware thread claimed the route first, the response is on its
+		// way and gets dropped on arrival
+		route->route.pending_request = NULL;
+
+		return;
+	}
+
+	message = network_create_message(NETWORK_MESSAGE_TYPE_UNROUTE);
+
+	if (message == NULL) {
+		return; // the claimed route stays in the route list until the workers stop
+	}
+
+	message->unroute.route = route;
+
+	network_post_message(&_inbox, message);
+#else
+	(void)pending_request;
+#endif
+}
+
+// the scheduler state is only initialized here and not added to the scheduler
+// yet, so this is safe to be called from a worker thread
+SchedulerClient *network_create_scheduler_client(const char *name) {
+	NetworkSchedulerClient *scheduler_client = calloc(1, sizeof(NetworkSchedulerClient));
+
+	if (scheduler_client == NULL) {
+		log_error("Could not allocate scheduler client: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return NULL;
+	}
+
+	string_copy(scheduler_client->name, sizeof(scheduler_client->name), name, -1);
+
+	if (scheduler_client_create(&scheduler_client->base, scheduler_client->name) < 0) {
+		free(scheduler_client);
+
+		return NULL;
+	}
+
+	return &scheduler_client->base;
+}
+
+void network_destroy_scheduler_client(SchedulerClient *scheduler_client) {
+	NetworkSchedulerClient *network_scheduler_client =
+		containerof(scheduler_client, NetworkSchedulerClient, base);
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	NetworkMessage *message;
+
+	if (_worker != NULL) {
+		message = network_create_message(NETWORK_MESSAGE_TYPE_DESTROY_SCHEDULER_CLIENT);
+
+		if (message == NULL) {
+			return; // leak it, the scheduler might still refer to it
 		}
 
-		if (_clients.count == 0) {
-			log_packet_debug("No clients connected, dropping %s (%s)",
-			                 packet_get_response_type(response),
-			                 packet_get_response_signature(packet_signature, response));
+		message->request.scheduler_client = network_scheduler_client;
+
+		network_post_message(&_inbox, message);
+
+		return;
+	}
+#endif
+
+	scheduler_client_destroy(scheduler_client);
+	free(network_scheduler_client);
+}
+
+void network_submit_request(SchedulerClient *scheduler_client, Packet *request) {
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	NetworkMessage *message;
+
+	if (_worker != NULL) {
+		message = network_create_message(NETWORK_MESSAGE_TYPE_REQUEST);
 
+		if (message == NULL) {
 			return;
 		}
 
-		log_packet_debug("Broadcasting %s (%s) to %d client(s)",
-		                 packet_get_response_type(response),
-		                 packet_get_response_signature(packet_signature, response),
-		                 _clients.count);
+		message->request.scheduler_client = containerof(scheduler_client, NetworkSchedulerClient, base);
 
-		packet_add_trace(response);
+		memcpy(&message->request.packet, request, request->header.length);
 
-		for (i = 0; i < _clients.count; ++i) {
-			client = array_get(&_clients, i);
+		network_post_message(&_inbox, message);
 
-			client_dispatch_response(client, NULL, response, true, false);
-		}
-	} else if (_clients.count + _zombies.count > 0) {
-		log_packet_debug("Dispatching response (%s) to %d client(s) and %d zombies(s)",
-		                 packet_get_response_signature(packet_signature, response),
-		                 _clients.count, _zombies.count);
-
-		pending_request_global_node = _pending_request_sentinel.next;
-
-		while (pending_request_global_node != &_pending_request_sentinel) {
-			pending_request = containerof(pending_request_global_node,
-			                              PendingRequest, global_node);
-
-			if (packet_is_matching_response(response, &pending_request->header)) {
-				if (pending_request->client != NULL) {
-					packet_add_trace(response);
-					client_dispatch_response(pending_request->client, pending_request,
-					                         response, false, false);
-				} else {
-					packet_add_trace(response);
-					zombie_dispatch_response(pending_request->zombie, pending_request,
-					                         response);
-				}
-
-				return;
-			}
+		return;
+	}
+#endif
+
+	scheduler_submit_request(scheduler_client, request);
+}
+
+// must be called from the hardware thread
+void network_dispatch_response(Packet *response) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	PendingRequest *pending_request;
+
+	packet_add_trace(response);
 
-			pending_request_global_node = pending_request_global_node->next;
+	// capture callbacks here, with network workers each worker broadcasts
+	// them to its own clients
+	if (capture_is_enabled() && packet_header_get_sequence_number(&response->header) == 0) {
+		capture_packet(CAPTURE_TYPE_CALLBACK, CAPTURE_NO_CLIENT, CAPTURE_NO_STACK, response);
+	}
+
+#ifdef BRICKD_WITH_NETWORK_WORKERS
+	if (_worker_count > 0) {
+		if (packet_header_get_sequence_number(&response->header) == 0) {
+			network_post_broadcast(response);
+		} else {
+			network_route_response(response);
 		}
 
-		log_warn("Broadcasting response (%s) because no client/zombie has a matching pending request",
-		         packet_get_response_signature(packet_signature, response));
+		return;
+	}
+#endif
 
-		packet_add_trace(response);
+	if (packet_header_get_sequence_number(&response->header) == 0) {
+		network_dispatch_callback(response);
+	} else if (_shard->clients.count + _shard->zombies.count > 0) {
+		log_packet_response_debug(response, "Dispatching response (%s) to %d client(s) and %d zombies(s)",
+		                                    packet_get_response_signature(packet_signature, response),
+		                                    _shard->clients.count, _shard->zombies.count);
 
-		for (i = 0; i < _clients.count; ++i) {
-			client = array_get(&_clients, i);
+		pending_request = network_find_pending_request(response);
 
-			client_dispatch_response(client, NULL, response, true, false);
+		if (pending_request != NULL) {
+			network_dispatch_to_pending_request(pending_request, response);
+
+			return;
 		}
+
+		log_warn("Broadcasting response (%s) because no client/zombie has a matching pending request",
+		         packet_get_response_signature(packet_signature, response));
+
+		network_broadcast_response(response);
 	} else {
-		log_packet_debug("No clients/zombies connected, dropping response (%s)",
-		                 packet_get_response_signature(packet_signature, response));
+		log_packet_response_debug(response, "No clients/zombies connected, dropping response (%s)",
+		                                    packet_get_response_signature(packet_signature, response));
 
 		packet_add_trace(response);
 	}
@@ -526,10 +1552,10 @@ void network_announce_red_brick_disconnect(void) {
 	Client *client;
 
 	log_debug("Broadcasting enumerate-disconnected callback for RED Brick to %d client(s)",
-	          _clients.count);
+	          _shard->clients.count);
 
-	for (i = 0; i < _clients.count; ++i) {
-		client = array_get(&_clients, i);
+	for (i = 0; i < _shard->clients.count; ++i) {
+		client = array_get(&_shard->clients, i);
 
 		client_send_red_brick_enumerate(client, ENUMERATION_TYPE_DISCONNECTED);
 	}
@@ -36,8 +36,13 @@ int network_create_zombie(Client *client);
 void network_cleanup_clients_and_zombies(void);
 
 void network_client_expects_response(Client *client, Packet *request);
+void network_remove_route(PendingRequest *pending_request);
 void network_dispatch_response(Packet *response);
 
+SchedulerClient *network_create_scheduler_client(const char *name);
+void network_destroy_scheduler_client(SchedulerClient *scheduler_client);
+void network_submit_request(SchedulerClient *scheduler_client, Packet *request);
+
 #ifdef BRICKD_WITH_RED_BRICK
 
 void network_announce_red_brick_disconnect(void);
@@ -22,6 +22,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
@@ -40,6 +41,8 @@
 #include <daemonlib/base58.h>
 #include <daemonlib/config.h>
 #include <daemonlib/event.h>
+#include <daemonlib/framer.h>
+#include <daemonlib/io.h>
 #include <daemonlib/log.h>
 #include <daemonlib/packet.h>
 #include <daemonlib/pipe.h>
@@ -53,6 +56,7 @@
 
 #include "hardware.h"
 #include "network.h"
+#include "scheduler.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -77,12 +81,11 @@ static Timer crc_error_count_update_timer;
 #endif
 
 // Time related constants
-static uint64_t TIMEOUT = 0;
-// delay between polls in nanoseconds. configurable with brickd.conf option poll_delay.rs485 in microseconds
-static uint64_t MASTER_POLL_SLAVE_INTERVAL = 40000000;
-static uint32_t TIMEOUT_BYTES = 86;
-static uint64_t last_timer_enable_at_us = 0;
-static uint64_t time_passed_from_last_timer_enable = 0;
+// delay between two polls in microseconds. configurable with brickd.conf option poll_delay.rs485
+static uint64_t MASTER_POLL_SLAVE_INTERVAL = 4000;
+// maximum interval between two polls of an idle slave in microseconds (poll delay times slave count)
+static uint64_t MASTER_POLL_SLAVE_INTERVAL_MAX = 4000;
+#define RESPONSE_TIMEOUT_MARGIN                                         8000 // Turnaround time of the slave in microseconds
 
 // Frame related constants
 #define RS485_FRAME_HEADER_LENGTH      3
@@ -162,6 +165,11 @@ typedef struct {
 	uint8_t address;
 	uint8_t sequence;
 	Queue packet_queue;
+
+	uint64_t last_poll_at; // microtime of the last poll
+	uint64_t poll_interval; // current interval between polls while idle in microseconds
+	uint64_t poll_count;
+	uint64_t hit_count; // number of polls that got a data response
 } RS485Slave;
 
 typedef struct {
@@ -182,25 +190,26 @@ static int _red_rs485_serial_fd = -1; // Serial interface file descriptor
 // Variables tracking current states
 static char current_request_as_byte_array[sizeof(Packet) + RS485_FRAME_OVERHEAD] = {0};
 static int master_current_slave_to_process = -1; // Only used used by master
+static bool master_current_poll_hit = false; // Current slave exchanged data during the current poll
+static uint64_t master_last_poll_done_at = 0;
 
-// Receive buffer
 #include <daemonlib/packed_begin.h>
 
-static union {
+typedef struct {
 	struct {
-		struct {
-			uint8_t address;
-			uint8_t function_code;
-			uint8_t sequence_number;
-		} ATTRIBUTE_PACKED frame;
-		Packet packet;
-	} ATTRIBUTE_PACKED;
-	uint8_t buffer[RECEIVE_BUFFER_SIZE];
-} ATTRIBUTE_PACKED _receive;
+		uint8_t address;
+		uint8_t function_code;
+		uint8_t sequence_number;
+	} ATTRIBUTE_PACKED frame;
+	Packet packet;
+} ATTRIBUTE_PACKED RS485Frame;
 
 #include <daemonlib/packed_end.h>
 
-static int _receive_buffer_used = 0;
+// Receive buffer. Frames are handed out by pointer into it, the echo of the
+// request and the response following it are handled in one pass
+static Framer _receive_framer;
+static IO _red_rs485_serial_io; // Only used to read from the serial interface
 
 // Events
 static int _master_timer_event = 0;
@@ -221,6 +230,7 @@ static GPIOREDPin _rx_pin; // Active low
 uint16_t crc16(uint8_t*, uint16_t);
 int serial_interface_init(const char*);
 void verify_buffer(void);
+static bool verify_frame(uint8_t *frame, int frame_length);
 void send_packet(void);
 void init_rxe_pin_state(int);
 void serial_data_available_handler(void*);
@@ -232,6 +242,10 @@ void pop_packet_from_slave_queue(void);
 bool is_current_request_empty(void);
 void seq_pop_poll(void);
 void arm_master_poll_slave_interval_timer(void);
+static void arm_master_timer(uint64_t delay);
+static uint64_t get_response_timeout(int request_length);
+static int select_next_slave(uint64_t *due_at);
+static void reschedule_master_poll(void);
 bool init_crc_error_count_to_fs(void);
 static void update_crc_error_count_to_fs(void *opaque);
 
@@ -387,41 +401,88 @@ char *frame_get_content_dump(char *content_dump, uint8_t *frame, int length) {
 	return content_dump;
 }
 
-// Verify packet
-void verify_buffer(void) {
-	int frame_length;
-	uint16_t crc16_calculated;
-	uint16_t crc16_on_packet;
-	RS485ExtensionPacket* queue_packet;
-	int i;
-	char frame_content_dump[RS485_FRAME_MAX_CONTENT_DUMP_LENGTH];
-	char base58[BASE58_MAX_LENGTH];
+static int serial_io_read(IO *io, void *buffer, int length) {
+	(void)io;
+
+	return robust_read(_red_rs485_serial_fd, buffer, length);
+}
+
+static int get_frame_length(const uint8_t *data, int available,
+                            void *opaque, const char **message) {
+	const PacketHeader *header = (const PacketHeader *)(data + RS485_FRAME_HEADER_LENGTH);
+
+	(void)opaque;
 
 	// Check if length byte is available
-	if (_receive_buffer_used < 8) {
-		return;
+	if (available < RS485_FRAME_HEADER_LENGTH + (int)sizeof(PacketHeader)) {
+		return 0;
 	}
 
-	// Calculate packet end index
-	frame_length = RS485_FRAME_HEADER_LENGTH + _receive.packet.header.length + RS485_FRAME_FOOTER_LENGTH;
+	if (header->length < (int)sizeof(PacketHeader) || header->length > (int)sizeof(Packet)) {
+		*message = "Packet length is out of range";
 
-	// Check if complete packet is available
-	if (_receive_buffer_used < frame_length) {
-		return;
+		return -1;
 	}
 
-	// If send verify flag was set
-	if (send_verify_flag) {
-		for (i = 0; i < frame_length; i++) {
-			if (_receive.buffer[i] != current_request_as_byte_array[i]) {
+	return RS485_FRAME_HEADER_LENGTH + header->length + RS485_FRAME_FOOTER_LENGTH;
+}
+
+// Verify all complete frames in the receive buffer
+void verify_buffer(void) {
+	uint8_t *frame;
+	int frame_length;
+	int available;
+	const char *message = NULL;
+	char frame_content_dump[RS485_FRAME_MAX_CONTENT_DUMP_LENGTH];
+
+	for (;;) {
+		frame = framer_next(&_receive_framer, &frame_length, &message);
+
+		if (frame == NULL) {
+			if (frame_length < 0) {
+				frame = framer_peek(&_receive_framer, &available);
+
 				// Move on to next slave
 				disable_master_timer();
-				log_error("Send verification failed (offset: %d, actual: %u != expected: %u)",
-				          i, _receive.buffer[i], current_request_as_byte_array[i]);
+				log_error("Received invalid frame (frame: %s): %s",
+				          frame_get_content_dump(frame_content_dump, frame, available), message);
+				framer_reset(&_receive_framer);
 				seq_pop_poll();
-
-				return;
 			}
+
+			return;
+		}
+
+		if (!verify_frame(frame, frame_length)) {
+			return;
+		}
+	}
+}
+
+// Verify a complete frame, returns true if the next frame in the receive
+// buffer should be verified as well
+static bool verify_frame(uint8_t *frame, int frame_length) {
+	RS485Frame *response = (RS485Frame *)frame;
+	uint16_t crc16_calculated;
+	uint16_t crc16_on_packet;
+	RS485ExtensionPacket* queue_packet;
+	int i;
+	char frame_content_dump[RS485_FRAME_MAX_CONTENT_DUMP_LENGTH];
+	char base58[BASE58_MAX_LENGTH];
+
+	// If send verify flag was set the frame is the echo of the request
+	if (send_verify_flag) {
+		if (frame_length != (uint8_t)current_request_as_byte_array[7] + RS485_FRAME_OVERHEAD ||
+		    memcmp(frame, current_request_as_byte_array, frame_length) != 0) {
+			for (i = 0; i < frame_length - 1 && frame[i] == (uint8_t)current_request_as_byte_array[i]; i++) {}
+
+			// Move on to next slave
+			disable_master_timer();
+			log_error("Send verification failed (offset: %d, actual: %u != expected: %u)",
+			          i, frame[i], (uint8_t)current_request_as_byte_array[i]);
+			seq_pop_poll();
+
+			return false;
 		}
 
 		// Send verify successful. Reset flag
@@ -436,47 +497,24 @@ void verify_buffer(void) {
 				log_packet_debug("Processed current request");
 				++_red_rs485_extension.slaves[master_current_slave_to_process].sequence;
 				queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+				scheduler_handle_write_done();
 			}
 
 			// Poll next slave after the configured timeout
 			arm_master_poll_slave_interval_timer();
 
-			return;
-		} else if (_receive_buffer_used == frame_length) {
-			// Everything OK. Wait for response now
-			log_packet_debug("No more Data. Waiting for response");
-			_receive_buffer_used = 0;
-			memset(_receive.buffer, 0, RECEIVE_BUFFER_SIZE);
-
-			return;
-		} else if (_receive_buffer_used > frame_length) {
-			// More data in the receive buffer
-			log_packet_debug("Potential partial data in the buffer. Verifying");
-
-			memmove(_receive.buffer, _receive.buffer + frame_length,
-			        _receive_buffer_used - frame_length);
-
-			_receive_buffer_used -= frame_length;
-
-			// A recursive call to handle the remaining bytes in the buffer
-			if (_receive_buffer_used >= 8) {
-				verify_buffer(); // FIXME: turn this into an external loop
-			}
+			return false;
+		}
 
-			return;
-		} else {
-			// Undefined state
-			disable_master_timer();
-			log_error("Undefined receive buffer state");
-			seq_pop_poll();
+		// Everything OK. The response might already be in the receive buffer
+		log_packet_debug("Waiting for response");
 
-			return;
-		}
+		return true;
 	}
 
 	// Checking the CRC16 checksum
-	crc16_calculated = crc16(_receive.buffer, frame_length - RS485_FRAME_FOOTER_LENGTH);
-	crc16_on_packet = (_receive.buffer[frame_length - 2] << 8) | _receive.buffer[frame_length - 1];
+	crc16_calculated = crc16(frame, frame_length - RS485_FRAME_FOOTER_LENGTH);
+	crc16_on_packet = (frame[frame_length - 2] << 8) | frame[frame_length - 1];
 
 	if (crc16_calculated != crc16_on_packet) {
 		// Increase CRC error count
@@ -485,49 +523,49 @@ void verify_buffer(void) {
 		// Move on to next slave
 		disable_master_timer();
 		log_error("Received response (frame: %s) with CRC-16 mismatch (actual: %04X != expected: %04X)",
-		          frame_get_content_dump(frame_content_dump, _receive.buffer, frame_length),
+		          frame_get_content_dump(frame_content_dump, frame, frame_length),
 		          crc16_calculated, crc16_on_packet);
 		seq_pop_poll();
 
-		return;
+		return false;
 	}
 
 	// Checking address
-	if (_receive.frame.address != current_request_as_byte_array[0]) {
+	if (response->frame.address != current_request_as_byte_array[0]) {
 		// Move on to next slave
 		disable_master_timer();
 		log_error("Received response (frame: %s) with address mismatch (actual: %u != expected: %u)",
-		          frame_get_content_dump(frame_content_dump, _receive.buffer, frame_length),
-		          _receive.frame.address, current_request_as_byte_array[0]);
+		          frame_get_content_dump(frame_content_dump, frame, frame_length),
+		          response->frame.address, current_request_as_byte_array[0]);
 		seq_pop_poll();
 
-		return;
+		return false;
 	}
 
 	// Checking function code
-	if (_receive.frame.function_code != current_request_as_byte_array[1]) {
+	if (response->frame.function_code != current_request_as_byte_array[1]) {
 		// Move on to next slave
 		disable_master_timer();
 		log_error("Received response (frame: %s) with function code mismatch (actual: %u != expected: %u)",
-		          frame_get_content_dump(frame_content_dump, _receive.buffer, frame_length),
-		          _receive.frame.function_code, current_request_as_byte_array[1]);
+		          frame_get_content_dump(frame_content_dump, frame, frame_length),
+		          response->frame.function_code, current_request_as_byte_array[1]);
 		seq_pop_poll();
 
-		return;
+		return false;
 	}
 
 	// Received empty packet from the other side (UID=0, FID=0)
-	if (_receive.packet.header.uid == 0 && _receive.packet.header.function_id == 0) {
+	if (response->packet.header.uid == 0 && response->packet.header.function_id == 0) {
 		// Checking current sequence number
-		if (_receive.frame.sequence_number != current_request_as_byte_array[2]) {
+		if (response->frame.sequence_number != current_request_as_byte_array[2]) {
 			// Move on to next slave
 			disable_master_timer();
 			log_error("Received empty response (frame: %s) with sequence number mismatch (actual: %u != expected: %u)",
-			          frame_get_content_dump(frame_content_dump, _receive.buffer, frame_length),
-			          _receive.frame.sequence_number, current_request_as_byte_array[2]);
+			          frame_get_content_dump(frame_content_dump, frame, frame_length),
+			          response->frame.sequence_number, current_request_as_byte_array[2]);
 			seq_pop_poll();
 
-			return;
+			return false;
 		}
 
 		disable_master_timer();
@@ -539,24 +577,31 @@ void verify_buffer(void) {
 
 		// Popping slave's packet queue
 		queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+		scheduler_handle_write_done();
 
 		// Poll next slave after the configured timeout
 		arm_master_poll_slave_interval_timer();
+
+		return false;
 	}
+
 	// Received data packet from the other side
-	else if (_receive.packet.header.uid != 0 && _receive.packet.header.function_id != 0) {
+	if (response->packet.header.uid != 0 && response->packet.header.function_id != 0) {
 		// Checking current sequence number
-		if (_receive.frame.sequence_number != current_request_as_byte_array[2]) {
+		if (response->frame.sequence_number != current_request_as_byte_array[2]) {
 			log_warn("Received data response (frame: %s) with sequence number mismatch (actual: %u != expected: %u)",
-			         frame_get_content_dump(frame_content_dump, _receive.buffer, frame_length),
-			         _receive.frame.sequence_number, current_request_as_byte_array[2]);
+			         frame_get_content_dump(frame_content_dump, frame, frame_length),
+			         response->frame.sequence_number, current_request_as_byte_array[2]);
 		} else {
 			log_packet_debug("Received data response");
 
-			stack_add_recipient(&_red_rs485_extension.base, _receive.packet.header.uid, _receive.frame.address); // FIXME: check return value
+			++_red_rs485_extension.slaves[master_current_slave_to_process].hit_count;
+			master_current_poll_hit = true;
+
+			stack_add_recipient(&_red_rs485_extension.base, response->packet.header.uid, response->frame.address); // FIXME: check return value
 
 			// Send message into brickd dispatcher
-			network_dispatch_response(&_receive.packet);
+			network_dispatch_response(&response->packet);
 		}
 
 		queue_packet = queue_peek(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue);
@@ -571,7 +616,7 @@ void verify_buffer(void) {
 				          _red_rs485_extension.slaves[master_current_slave_to_process].address,
 				          get_errno_name(errno), errno);
 
-				return; // FIXME
+				return false; // FIXME
 			}
 
 			sent_ack_of_data_packet = 2;
@@ -584,22 +629,26 @@ void verify_buffer(void) {
 		queue_packet->tries_left = RS485_FRAME_TRIES_EMPTY;
 		queue_packet->packet.header.length = 8;
 
-		_receive_buffer_used = 0;
-		memset(_receive.buffer, 0, RECEIVE_BUFFER_SIZE);
+		// Anything after the data response is stale, the echo of the ACK comes next
+		framer_reset(&_receive_framer);
 
 		log_packet_debug("Sending ACK of the data response");
 
 		send_packet();
-	} else {
-		// Undefined packet
-		disable_master_timer();
-		log_error("Undefined response (frame: %s, U: %s, L: %u, F: %u)",
-		          frame_get_content_dump(frame_content_dump, _receive.buffer, frame_length),
-		          base58_encode(base58, uint32_from_le(_receive.packet.header.uid)),
-		          _receive.packet.header.length,
-		          _receive.packet.header.function_id);
-		seq_pop_poll();
+
+		return false;
 	}
+
+	// Undefined packet
+	disable_master_timer();
+	log_error("Undefined response (frame: %s, U: %s, L: %u, F: %u)",
+	          frame_get_content_dump(frame_content_dump, frame, frame_length),
+	          base58_encode(base58, uint32_from_le(response->packet.header.uid)),
+	          response->packet.header.length,
+	          response->packet.header.function_id);
+	seq_pop_poll();
+
+	return false;
 }
 
 // Send packet
@@ -660,12 +709,7 @@ void send_packet(void) {
 	log_packet_debug("Sent packet");
 
 	// Start the master timer
-	master_timer.it_interval.tv_sec = 0;
-	master_timer.it_interval.tv_nsec = 0;
-	master_timer.it_value.tv_sec = 0;
-	master_timer.it_value.tv_nsec = TIMEOUT;
-	timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
-	last_timer_enable_at_us = microtime();
+	arm_master_timer(get_response_timeout(sizeof(rs485_packet)));
 }
 
 // Initialize RX state
@@ -704,47 +748,72 @@ void disable_master_timer(void) {
 
 // New data available event handler
 void serial_data_available_handler(void* opaque) {
+	int available;
+	int length;
+
 	(void)opaque;
 
 	// Check if there is space in the receive buffer
-	if (_receive_buffer_used >= RECEIVE_BUFFER_SIZE) {
+	framer_peek(&_receive_framer, &available);
+
+	if (available >= RECEIVE_BUFFER_SIZE) {
 		log_warn("No more space in the receive buffer. Aborting current request");
 
+		framer_reset(&_receive_framer);
+
 		// Poll next slave after the configured timeout
 		arm_master_poll_slave_interval_timer();
 
 		return;
 	}
 
-	// Put newly received bytes on the specific index in receive buffer
-	int bytes_received = robust_read(_red_rs485_serial_fd,
-	                                 _receive.buffer + _receive_buffer_used,
-	                                 RECEIVE_BUFFER_SIZE - _receive_buffer_used);
+	// Append newly received bytes to the receive buffer
+	length = framer_read(&_receive_framer, &_red_rs485_serial_io);
+
+	if (length < 0) {
+		if (!errno_would_block()) {
+			log_error("Could not read from serial interface: %s (%d)",
+			          get_errno_name(errno), errno);
+		}
 
-	if (bytes_received < 0) {
-		// FIXME: log error?
 		return;
 	}
 
-	_receive_buffer_used += bytes_received;
 	verify_buffer();
 }
 
 // Master polling slave event handler
 void master_poll_slave(void) {
 	RS485ExtensionPacket* slave_queue_packet;
+	RS485Slave *slave;
+	uint64_t now = microtime();
+	uint64_t due_at;
+	int next_slave = select_next_slave(&due_at);
+
+	// No slave is due yet, wait for the next one
+	if (due_at > now) {
+		master_poll_interval = true;
+		arm_master_timer(due_at - now);
+
+		return;
+	}
+
 	sent_ack_of_data_packet = 0;
-	_receive_buffer_used = 0;
-	memset(_receive.buffer, 0, RECEIVE_BUFFER_SIZE);
+	framer_reset(&_receive_framer);
 
 	// Updating current slave to process
-	if (++master_current_slave_to_process >= _red_rs485_extension.slave_num) {
-		master_current_slave_to_process = 0;
-	}
+	master_current_slave_to_process = next_slave;
+	slave = &_red_rs485_extension.slaves[master_current_slave_to_process];
 
 	log_debug("Updated current RS485 slave's index");
 
-	if (_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue.count == 0) {
+	slave->last_poll_at = now;
+	++slave->poll_count;
+
+	// A slave that gets a request is going to have a response soon
+	master_current_poll_hit = slave->packet_queue.count > 0;
+
+	if (slave->packet_queue.count == 0) {
 		// Nothing to send in the slave's queue. So send a poll packet
 		slave_queue_packet = queue_push(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue);
 
@@ -779,46 +848,26 @@ void master_poll_slave(void) {
 
 // Master timer event handler
 void master_timeout_handler(void* opaque) {
-	(void)opaque;
+	uint64_t expirations = 0;
 
-	disable_master_timer();
-
-	if (master_poll_interval) {
-		// For some unknown reason the timer randomly times out or this timeout function is called
-		// much long before the actual timeout. This is a fix to this problem
-		// until we find the real problem
-		time_passed_from_last_timer_enable = (microtime() - last_timer_enable_at_us) * 1000;
-
-		if (time_passed_from_last_timer_enable < MASTER_POLL_SLAVE_INTERVAL) {
-			master_timer.it_interval.tv_sec = 0;
-			master_timer.it_interval.tv_nsec = 0;
-			master_timer.it_value.tv_sec = 0;
-			master_timer.it_value.tv_nsec = MASTER_POLL_SLAVE_INTERVAL;
-			timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
-			last_timer_enable_at_us = microtime();
+	(void)opaque;
 
-			return;
+	// The timer might have been disabled or re-armed after the event loop
+	// noticed that it expired. Then there is nothing to read and the
+	// expiration is stale
+	if (robust_read(_master_timer_event, &expirations, sizeof(expirations)) < 0) {
+		if (!errno_would_block()) {
+			log_error("Could not read from RS485 master timer: %s (%d)",
+			          get_errno_name(errno), errno);
 		}
 
-		log_debug("Master poll slave interval timed out... time to poll next slave");
-		master_poll_interval = false;
-		master_poll_slave();
-
 		return;
 	}
 
-	// For some unknown reason the timer randomly times out or this timeout function is called
-	// much long before the actual timeout. This is a fix to this problem
-	// until we find the real problem
-	time_passed_from_last_timer_enable = (microtime() - last_timer_enable_at_us) * 1000;
-
-	if (time_passed_from_last_timer_enable < TIMEOUT) {
-		master_timer.it_interval.tv_sec = 0;
-		master_timer.it_interval.tv_nsec = 0;
-		master_timer.it_value.tv_sec = 0;
-		master_timer.it_value.tv_nsec = TIMEOUT;
-		timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
-		last_timer_enable_at_us = microtime();
+	if (master_poll_interval) {
+		log_debug("Master poll slave interval timed out... time to poll next slave");
+		master_poll_interval = false;
+		master_poll_slave();
 
 		return;
 	}
@@ -842,6 +891,7 @@ void pop_packet_from_slave_queue(void) {
 
 	if (current_slave_queue_packet != NULL && --current_slave_queue_packet->tries_left == 0) {
 		queue_pop(&_red_rs485_extension.slaves[master_current_slave_to_process].packet_queue, NULL);
+		scheduler_handle_write_done();
 	}
 }
 
@@ -870,16 +920,119 @@ void seq_pop_poll(void) {
 	arm_master_poll_slave_interval_timer();
 }
 
+// Adapt the poll interval of the current slave to its activity and arm the
+// master timer to poll the next slave that is due, but not before the poll
+// delay has passed. Slaves that exchanged data during their last poll are
+// polled again after the poll delay, idle slaves back off up to the maximum
+// poll interval
 void arm_master_poll_slave_interval_timer(void) {
-	log_debug("Waiting before polling next slave");
+	RS485Slave *slave = &_red_rs485_extension.slaves[master_current_slave_to_process];
+	uint64_t now = microtime();
+	uint64_t due_at;
+	uint64_t delay = MASTER_POLL_SLAVE_INTERVAL;
+
+	if (master_current_poll_hit) {
+		slave->poll_interval = MASTER_POLL_SLAVE_INTERVAL;
+	} else if (slave->poll_interval < MASTER_POLL_SLAVE_INTERVAL_MAX) {
+		slave->poll_interval *= 2;
+
+		if (slave->poll_interval > MASTER_POLL_SLAVE_INTERVAL_MAX) {
+			slave->poll_interval = MASTER_POLL_SLAVE_INTERVAL_MAX;
+		}
+	}
+
+	master_last_poll_done_at = now;
+
+	select_next_slave(&due_at);
+
+	if (due_at > now + delay) {
+		delay = due_at - now;
+	}
+
+	log_debug("Waiting %" PRIu64 " usec before polling next slave", delay);
 	master_poll_interval = true;
 
+	arm_master_timer(delay);
+}
+
+// Arm the master timer to expire once after the given delay in microseconds
+static void arm_master_timer(uint64_t delay) {
+	if (delay == 0) {
+		delay = 1; // an all zero it_value would disarm the timer
+	}
+
 	master_timer.it_interval.tv_sec = 0;
 	master_timer.it_interval.tv_nsec = 0;
-	master_timer.it_value.tv_sec = 0;
-	master_timer.it_value.tv_nsec = MASTER_POLL_SLAVE_INTERVAL;
-	timerfd_settime(_master_timer_event, 0, &master_timer, NULL);
-	last_timer_enable_at_us = microtime();
+	master_timer.it_value.tv_sec = delay / 1000000;
+	master_timer.it_value.tv_nsec = (delay % 1000000) * 1000;
+
+	if (timerfd_settime(_master_timer_event, 0, &master_timer, NULL) < 0) {
+		log_error("Could not arm RS485 master timer: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+// Time to send the request and to receive a response of maximum length plus
+// the turnaround time of the slave in microseconds
+static uint64_t get_response_timeout(int request_length) {
+	uint64_t bits_per_byte = 1 + 8 + _red_rs485_extension.stopbits; // start, data and stop bits
+
+	if (_red_rs485_extension.parity != EXTENSION_RS485_PARITY_NONE) {
+		++bits_per_byte;
+	}
+
+	return (uint64_t)(request_length + sizeof(Packet) + RS485_FRAME_OVERHEAD) *
+	       bits_per_byte * 1000000 / _red_rs485_extension.baudrate + RESPONSE_TIMEOUT_MARGIN;
+}
+
+// Select the slave to poll next. A slave with a queued request is due now,
+// an idle slave is due once its poll interval has passed since its last poll.
+// The search starts after the current slave so that slaves with queued
+// requests are served in round robin order
+static int select_next_slave(uint64_t *due_at) {
+	int i;
+	int k;
+	int next_slave = 0;
+	uint64_t due;
+	RS485Slave *slave;
+
+	*due_at = UINT64_MAX;
+
+	for (k = 1; k <= _red_rs485_extension.slave_num; k++) {
+		i = (master_current_slave_to_process + k) % _red_rs485_extension.slave_num;
+		slave = &_red_rs485_extension.slaves[i];
+
+		if (slave->packet_queue.count > 0) {
+			*due_at = 0;
+
+			return i;
+		}
+
+		due = slave->last_poll_at + slave->poll_interval;
+
+		if (due < *due_at) {
+			*due_at = due;
+			next_slave = i;
+		}
+	}
+
+	return next_slave;
+}
+
+// A request got queued. If the master is waiting for an idle slave to become
+// due then poll as soon as the poll delay has passed instead
+static void reschedule_master_poll(void) {
+	uint64_t now;
+	uint64_t due_at;
+
+	if (!_initialized || !master_poll_interval) {
+		return;
+	}
+
+	now = microtime();
+	due_at = master_last_poll_done_at + MASTER_POLL_SLAVE_INTERVAL;
+
+	arm_master_timer(due_at > now ? due_at - now : 0);
 }
 
 // New packet from brickd event loop is queued to be sent via RS485 interface
@@ -907,9 +1060,9 @@ int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipie
 			queued_request->tries_left = RS485_FRAME_TRIES_DATA;
 			memcpy(&queued_request->packet, request, request->header.length);
 
-			log_packet_debug("Broadcast... Packet is queued to be sent to slave %d. Function signature = (%s)",
-			                 _red_rs485_extension.slaves[i].address,
-			                 packet_get_request_signature(packet_signature, request));
+			log_packet_request_debug(request, "Broadcast... Packet is queued to be sent to slave %d. Function signature = (%s)",
+			                                  _red_rs485_extension.slaves[i].address,
+			                                  packet_get_request_signature(packet_signature, request));
 		}
 	} else if (recipient != NULL) {
 		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
@@ -928,18 +1081,35 @@ int red_rs485_extension_dispatch_to_rs485(Stack *stack, Packet *request, Recipie
 				queued_request->tries_left = RS485_FRAME_TRIES_DATA;
 				memcpy(&queued_request->packet, request, request->header.length);
 
-				log_packet_debug("Packet is queued to be sent to slave %d over. Function signature = (%s)",
-				                 _red_rs485_extension.slaves[i].address,
-				                 packet_get_request_signature(packet_signature, request));
+				log_packet_request_debug(request, "Packet is queued to be sent to slave %d over. Function signature = (%s)",
+				                                  _red_rs485_extension.slaves[i].address,
+				                                  packet_get_request_signature(packet_signature, request));
 
 				break;
 			}
 		}
 	}
 
+	reschedule_master_poll();
+
 	return 0;
 }
 
+// The master polls one slave at a time over the shared bus, so every queued
+// request waits for the requests of all slaves
+static int red_rs485_extension_get_backlog(Stack *stack) {
+	int backlog = 0;
+	int i;
+
+	(void)stack;
+
+	for (i = 0; i < _red_rs485_extension.slave_num; i++) {
+		backlog += _red_rs485_extension.slaves[i].packet_queue.count;
+	}
+
+	return backlog;
+}
+
 // Init function called from central brickd code
 int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 	int phase = 0;
@@ -949,7 +1119,7 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 
 	log_info("Initializing extension subsystem");
 
-	MASTER_POLL_SLAVE_INTERVAL = (uint64_t)config_get_option_value("poll_delay.rs485")->integer * 1000;
+	MASTER_POLL_SLAVE_INTERVAL = (uint64_t)config_get_option_value("poll_delay.rs485")->integer;
 
 	// Create base stack
 	if (stack_create(&_red_rs485_extension.base, "red_rs485_extension",
@@ -960,6 +1130,8 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 		goto cleanup;
 	}
 
+	_red_rs485_extension.base.get_backlog = red_rs485_extension_get_backlog;
+
 	phase = 1;
 
 	// Add to stacks array
@@ -982,6 +1154,10 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
 			_red_rs485_extension.slaves[i].address = rs485_config->slave_address[i];
 			_red_rs485_extension.slaves[i].sequence = 0;
+			_red_rs485_extension.slaves[i].last_poll_at = 0;
+			_red_rs485_extension.slaves[i].poll_interval = MASTER_POLL_SLAVE_INTERVAL;
+			_red_rs485_extension.slaves[i].poll_count = 0;
+			_red_rs485_extension.slaves[i].hit_count = 0;
 
 			if (queue_create(&_red_rs485_extension.slaves[i].packet_queue, sizeof(RS485ExtensionPacket)) < 0) {
 				log_error("Could not create slave queue, %s (%d)",
@@ -995,9 +1171,7 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 		goto cleanup;
 	}
 
-	// Calculate time to send number of bytes of max packet length and to receive the same amount
-	TIMEOUT = (((double)(TIMEOUT_BYTES / (double)(_red_rs485_extension.baudrate / 8)) *
-	            (double)1000000000) * (double)2) + (double)8000000;
+	MASTER_POLL_SLAVE_INTERVAL_MAX = MASTER_POLL_SLAVE_INTERVAL * (_red_rs485_extension.slave_num > 0 ? _red_rs485_extension.slave_num : 1);
 
 	// Configuring serial interface from the configs
 	if (serial_interface_init(RS485_EXTENSION_SERIAL_DEVICE) < 0) {
@@ -1038,6 +1212,20 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 
 	phase = 5;
 
+	// Setup receive buffer
+	if (framer_create(&_receive_framer, RECEIVE_BUFFER_SIZE, get_frame_length, NULL) < 0) {
+		log_error("Could not create RS485 receive buffer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	io_create(&_red_rs485_serial_io, "rs485-serial", NULL, serial_io_read, NULL, NULL);
+
+	_red_rs485_serial_io.read_handle = _red_rs485_serial_fd;
+
+	phase = 6;
+
 	// Get things going in case of a master with slaves configured
 	if (_red_rs485_extension.slave_num > 0) {
 		_initialized = true;
@@ -1061,10 +1249,14 @@ int red_rs485_extension_init(ExtensionRS485Config *rs485_config) {
 		goto cleanup;
 	}
 
-	phase = 6;
+	phase = 7;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 6:
+		framer_destroy(&_receive_framer);
+		// fall through
+
 	case 5:
 		event_remove_source(_master_timer_event, EVENT_SOURCE_TYPE_GENERIC);
 		robust_close(_master_timer_event);
@@ -1100,7 +1292,7 @@ cleanup:
 		return 0;
 	}
 
-	return phase == 6 ? 0 : -1;
+	return phase == 7 ? 0 : -1;
 }
 
 // Exit function called from central brickd code
@@ -1125,10 +1317,17 @@ void red_rs485_extension_exit(void) {
 
 	if (_red_rs485_extension.address == 0) {
 		for (i = 0; i < _red_rs485_extension.slave_num; i++) {
+			log_info("RS485 slave %u: %" PRIu64 " poll(s), %" PRIu64 " hit(s)",
+			         _red_rs485_extension.slaves[i].address,
+			         _red_rs485_extension.slaves[i].poll_count,
+			         _red_rs485_extension.slaves[i].hit_count);
+
 			queue_destroy(&_red_rs485_extension.slaves[i].packet_queue, NULL);
 		}
 	}
 
+	framer_destroy(&_receive_framer);
+
 	conf_file_destroy(&crc_error_count_file);
 	timer_destroy(&crc_error_count_update_timer);
 }
@@ -22,12 +22,14 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <linux/types.h>
@@ -40,6 +42,7 @@
 #include <daemonlib/gpio_red.h>
 #include <daemonlib/gpio_sysfs.h>
 #include <daemonlib/io.h>
+#include <daemonlib/lane_queue.h>
 #include <daemonlib/log.h>
 #include <daemonlib/packet.h>
 #include <daemonlib/pearson_hash.h>
@@ -51,6 +54,7 @@
 #include "hardware.h"
 #include "network.h"
 #include "red_usb_gadget.h"
+#include "scheduler.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
@@ -65,6 +69,7 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 #define RED_STACK_SPI_MAX_SLAVES        8
 #define RED_STACK_SPI_ROUTING_WAIT      50             // Give slave 50ms between each routing table setup try
 #define RED_STACK_SPI_ROUTING_TRIES     10             // Try 10 times for each slave to setup routing table
+#define RED_STACK_SPI_MAX_POLL_INTERVAL 2000           // Poll idle slaves at least every 2ms to pick up their callbacks
 
 #define RED_STACK_SPI_INFO_SEQUENCE_MASTER_MASK (0x07)
 #define RED_STACK_SPI_INFO_SEQUENCE_SLAVE_MASK  (0x38)
@@ -119,11 +124,18 @@ static pthread_cond_t _red_stack_wait_for_reset_cond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t _red_stack_wait_for_reset_mutex = PTHREAD_MUTEX_INITIALIZER;
 static int _red_stack_wait_for_reset_helper = 0;
 
+// The SPI thread sleeps on this condition variable if no slave is due for a
+// transfer. It is signaled if a new request gets queued for any slave.
+static pthread_cond_t _red_stack_spi_wakeup_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t _red_stack_spi_wakeup_mutex = PTHREAD_MUTEX_INITIALIZER;
+static bool _red_stack_spi_wakeup_pending = false;
+
 static int _red_stack_notification_event;
 static int _red_stack_reset_fd;
 static int _red_stack_reset_detected = 0;
 
-// delay between transfers in microseconds. configurable with brickd.conf option poll_delay.spi
+// minimum delay between two transfers to the same slave in microseconds.
+// configurable with brickd.conf option poll_delay.spi
 static int _red_stack_spi_poll_delay = 50;
 
 typedef enum {
@@ -142,9 +154,15 @@ typedef struct {
 	uint8_t sequence_number_slave;
 	REDStackSlaveStatus status;
 	GPIOREDPin slave_select_pin;
-	Queue request_queue;
+	LaneQueue request_queue;
 	Mutex request_queue_mutex;
 	bool next_packet_empty;
+
+	// Scheduling state, only accessed by the SPI thread
+	uint64_t last_transfer; // microtime of the last transfer to this slave
+	uint32_t poll_interval; // current interval between polls while idle in microseconds
+	uint64_t poll_count; // number of transfers to this slave
+	uint64_t hit_count; // number of transfers that received a packet from this slave
 } REDStackSlave;
 
 typedef struct {
@@ -444,8 +462,8 @@ static int red_stack_spi_transceive_message(REDStackRequest *packet_send, REDSta
 
 			packet_add_trace(&packet_recv->packet);
 
-			log_packet_debug("Received packet over SPI (%s)",
-			                 packet_get_response_signature(packet_signature, &packet_recv->packet));
+			log_packet_response_debug(&packet_recv->packet, "Received packet over SPI (%s)",
+			                                                packet_get_response_signature(packet_signature, &packet_recv->packet));
 
 			retval = (retval & (~RED_STACK_TRANSCEIVE_RESULT_MASK_READ)) | RED_STACK_TRANSCEIVE_RESULT_READ_OK;
 			retval |= RED_STACK_TRANSCEIVE_DATA_RECEIVED;
@@ -592,20 +610,150 @@ static void red_stack_spi_handle_reset(void) {
 
 		// Unfortunately we have to discard all of the queued packets.
 		// we can't be sure that the packets are for the correct slave after a reset.
-		while (queue_peek(&_red_stack.slaves[slave].request_queue) != NULL) {
-			queue_pop(&_red_stack.slaves[slave].request_queue, NULL);
+		while (lane_queue_peek(&_red_stack.slaves[slave].request_queue) != NULL) {
+			lane_queue_pop(&_red_stack.slaves[slave].request_queue, NULL);
 		}
 	}
+
+	scheduler_announce_write_done();
+}
+
+static void red_stack_spi_reset_schedule(void) {
+	int i;
+	REDStackSlave *slave;
+
+	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
+		slave = &_red_stack.slaves[i];
+
+		slave->last_transfer = 0;
+		slave->poll_interval = _red_stack_spi_poll_delay;
+		slave->poll_count = 0;
+		slave->hit_count = 0;
+	}
+}
+
+static void red_stack_spi_log_schedule_statistics(void) {
+	int i;
+	REDStackSlave *slave;
+
+	for (i = 0; i < _red_stack.slave_num; i++) {
+		slave = &_red_stack.slaves[i];
+
+		log_info("SPI slave %d: %" PRIu64 " poll(s), %" PRIu64 " hit(s) (%.1f%%)",
+		         slave->stack_address, slave->poll_count, slave->hit_count,
+		         slave->poll_count > 0 ? 100.0 * (double)slave->hit_count / (double)slave->poll_count : 0.0);
+	}
+}
+
+// Select the next slave to transfer to. A slave with queued requests (or a
+// pending empty packet) is due as soon as the poll delay since its last transfer
+// has passed. An idle slave is due after its current poll interval, that starts
+// at the poll delay and doubles with every transfer that didn't exchange any
+// data, up to RED_STACK_SPI_MAX_POLL_INTERVAL. The search starts after the last
+// selected slave, so a busy slave cannot starve the others. If no slave is due
+// NULL is returned and next_due is set to the microtime of the next due slave.
+static REDStackSlave *red_stack_spi_select_slave(uint8_t *stack_address_cycle,
+                                                 uint64_t *next_due) {
+	uint64_t now = microtime();
+	REDStackSlave *idle_slave = NULL;
+	REDStackSlave *slave;
+	bool pending;
+	uint64_t due;
+	int i;
+
+	*next_due = UINT64_MAX;
+
+	for (i = 0; i < _red_stack.slave_num; i++) {
+		slave = &_red_stack.slaves[(*stack_address_cycle + i) % _red_stack.slave_num];
+
+		if (slave->next_packet_empty) {
+			pending = true;
+		} else {
+			mutex_lock(&slave->request_queue_mutex);
+			pending = lane_queue_peek(&slave->request_queue) != NULL;
+			mutex_unlock(&slave->request_queue_mutex);
+		}
+
+		if (pending) {
+			due = slave->last_transfer + _red_stack_spi_poll_delay;
+		} else {
+			due = slave->last_transfer + slave->poll_interval;
+		}
+
+		if (due <= now) {
+			if (pending) {
+				break;
+			}
+
+			if (idle_slave == NULL) {
+				idle_slave = slave;
+			}
+		} else if (due < *next_due) {
+			*next_due = due;
+		}
+	}
+
+	if (i == _red_stack.slave_num) {
+		if (idle_slave == NULL) {
+			return NULL;
+		}
+
+		slave = idle_slave;
+	}
+
+	*stack_address_cycle = (slave->stack_address + 1) % _red_stack.slave_num;
+
+	return slave;
+}
+
+// Sleep until the given microtime or until a new request gets queued
+static void red_stack_spi_wait(uint64_t next_due) {
+	uint64_t now = microtime();
+	uint64_t delay;
+	struct timespec deadline;
+
+	delay = next_due > now ? next_due - now : 0;
+
+	if (delay > RED_STACK_SPI_MAX_POLL_INTERVAL) {
+		delay = RED_STACK_SPI_MAX_POLL_INTERVAL;
+	}
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+
+	deadline.tv_nsec += (long)delay * 1000;
+
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec += deadline.tv_nsec / 1000000000;
+		deadline.tv_nsec %= 1000000000;
+	}
+
+	pthread_mutex_lock(&_red_stack_spi_wakeup_mutex);
+
+	while (!_red_stack_spi_wakeup_pending) {
+		if (pthread_cond_timedwait(&_red_stack_spi_wakeup_cond, &_red_stack_spi_wakeup_mutex, &deadline) != 0) {
+			break; // timeout
+		}
+	}
+
+	_red_stack_spi_wakeup_pending = false;
+
+	pthread_mutex_unlock(&_red_stack_spi_wakeup_mutex);
 }
 
 // Main SPI loop. This runs independently from the brickd event thread.
-// Data between RED Brick and SPI slave is exchanged every 500us.
-// If there is no data to be send, we cycle through the slaves and request
-// data. If there is data to be send the slave that ought to receive
-// the data gets priority. This can greatly reduce latency in a big stack.
+// Slaves are not polled in strict round robin order. A slave with queued
+// requests is visited as soon as the poll delay since its last transfer has
+// passed. Idle slaves are polled less often the longer they don't send any
+// data, but at least every RED_STACK_SPI_MAX_POLL_INTERVAL so callbacks are
+// still picked up. This gives a busy slave most of the bus instead of 1/n.
+//
+// The poll delay is the minimum time between two transfers to the same slave.
+// If no slave is due the thread sleeps until the next one is or until a new
+// request gets queued.
 static void red_stack_spi_thread(void *opaque) {
 	uint8_t stack_address_cycle;
 	int ret;
+	uint64_t next_due;
 
 	(void)opaque;
 
@@ -614,6 +762,7 @@ static void red_stack_spi_thread(void *opaque) {
 		_red_stack_reset_detected = 0;
 		_red_stack.slave_num = 0;
 		red_stack_spi_create_routing_table();
+		red_stack_spi_reset_schedule();
 
 		_red_stack_spi_thread_running = false;
 
@@ -625,10 +774,18 @@ static void red_stack_spi_thread(void *opaque) {
 		_red_stack_reset_detected = 0;
 
 		while (_red_stack_spi_thread_running) {
-			REDStackSlave *slave = &_red_stack.slaves[stack_address_cycle];
+			REDStackSlave *slave;
 			REDStackRequest *request = NULL;
 			REDStackResponse response;
 
+			slave = red_stack_spi_select_slave(&stack_address_cycle, &next_due);
+
+			if (slave == NULL) {
+				red_stack_spi_wait(next_due);
+
+				continue;
+			}
+
 			// Get packet from queue. The queue contains request that are to
 			// be send over SPI. It is filled through from the main brickd
 			// event thread, so we have to make sure that there is not race
@@ -638,22 +795,19 @@ static void red_stack_spi_thread(void *opaque) {
 				request = NULL;
 			} else {
 				mutex_lock(&slave->request_queue_mutex);
-				request = queue_peek(&slave->request_queue);
+				request = lane_queue_peek(&slave->request_queue);
 				mutex_unlock(&slave->request_queue_mutex);
 			}
 
-			stack_address_cycle++;
-
-			if (stack_address_cycle >= _red_stack.slave_num) {
-				stack_address_cycle = 0;
-			}
-
 			// Set request if we have a packet to send
 			if (request != NULL) {
-				log_packet_debug("Packet will now be send over SPI (%s)",
-				                 packet_get_request_signature(packet_signature, &request->packet));
+				log_packet_request_debug(&request->packet, "Packet will now be send over SPI (%s)",
+				                                           packet_get_request_signature(packet_signature, &request->packet));
 			}
 
+			slave->last_transfer = microtime();
+			slave->poll_count++;
+
 			ret = red_stack_spi_transceive_message(request, &response, slave);
 
 			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_SEND) == RED_STACK_TRANSCEIVE_RESULT_SEND_OK) {
@@ -663,14 +817,18 @@ static void red_stack_spi_thread(void *opaque) {
 					// If the sending didn't work (for whatever reason), we don't pop it
 					// and therefore we will automatically try to send it again in the next cycle.
 					mutex_lock(&slave->request_queue_mutex);
-					queue_pop(&slave->request_queue, NULL);
+					lane_queue_pop(&slave->request_queue, NULL);
 					mutex_unlock(&slave->request_queue_mutex);
+
+					scheduler_announce_write_done();
 				}
 			}
 
 			// If we received a packet, we will dispatch it immediately.
 			// We have some time until we try the next SPI communication anyway.
 			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_OK) {
+				slave->hit_count++;
+
 				// TODO: Check again if packet is valid?
 				// We did already check the hash.
 
@@ -683,9 +841,23 @@ static void red_stack_spi_thread(void *opaque) {
 				//semaphore_acquire(&_red_stack_dispatch_packet_from_spi_semaphore);
 			}
 
-			microsleep(_red_stack_spi_poll_delay);
+			// A slave that just exchanged data is likely to have more (a response
+			// to the request or further callbacks), poll it again soon. Otherwise
+			// back off until the minimum poll rate is reached.
+			if ((ret & RED_STACK_TRANSCEIVE_RESULT_MASK_READ) == RED_STACK_TRANSCEIVE_RESULT_READ_OK ||
+			    (ret & RED_STACK_TRANSCEIVE_RESULT_MASK_SEND) == RED_STACK_TRANSCEIVE_RESULT_SEND_OK) {
+				slave->poll_interval = _red_stack_spi_poll_delay;
+			} else if (slave->poll_interval < RED_STACK_SPI_MAX_POLL_INTERVAL) {
+				slave->poll_interval *= 2;
+
+				if (slave->poll_interval > RED_STACK_SPI_MAX_POLL_INTERVAL) {
+					slave->poll_interval = RED_STACK_SPI_MAX_POLL_INTERVAL;
+				}
+			}
 		}
 
+		red_stack_spi_log_schedule_statistics();
+
 		if (_red_stack.slave_num == 0) {
 			pthread_mutex_lock(&_red_stack_wait_for_reset_mutex);
 			// Use helper to be save against spurious wakeups
@@ -830,9 +1002,18 @@ static void red_stack_dispatch_from_spi(void *opaque) {
 	}
 }
 
+// Wake up the SPI thread if it is sleeping because no slave was due
+static void red_stack_spi_wakeup(void) {
+	pthread_mutex_lock(&_red_stack_spi_wakeup_mutex);
+	_red_stack_spi_wakeup_pending = true;
+	pthread_cond_signal(&_red_stack_spi_wakeup_cond);
+	pthread_mutex_unlock(&_red_stack_spi_wakeup_mutex);
+}
+
 // New packet from brickd event loop is queued to be written to stack via SPI
 static int red_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipient *recipient) {
 	REDStackRequest *queued_request;
+	QueueLane lane = hardware_get_request_lane(request);
 
 	(void)stack;
 
@@ -842,34 +1023,53 @@ static int red_stack_dispatch_to_spi(Stack *stack, Packet *request, Recipient *r
 
 		for (is = 0; is < _red_stack.slave_num; is++) {
 			mutex_lock(&_red_stack.slaves[is].request_queue_mutex);
-			queued_request = queue_push(&_red_stack.slaves[is].request_queue);
+			queued_request = lane_queue_push(&_red_stack.slaves[is].request_queue, lane, request->header.uid);
 			queued_request->status = RED_STACK_REQUEST_STATUS_ADDED;
 			queued_request->slave = &_red_stack.slaves[is];
 			memcpy(&queued_request->packet, request, request->header.length);
 			mutex_unlock(&_red_stack.slaves[is].request_queue_mutex);
 
-			log_packet_debug("Request is queued to be broadcast to slave %d (%s)",
-			                 is, packet_get_request_signature(packet_signature, request));
+			log_packet_request_debug(request, "Request is queued to be broadcast to slave %d (%s)",
+			                                  is, packet_get_request_signature(packet_signature, request));
 		}
 	} else if (recipient != NULL) {
 		// Get slave for recipient opaque (== stack_address)
 		REDStackSlave *slave = &_red_stack.slaves[recipient->opaque];
 
 		mutex_lock(&slave->request_queue_mutex);
-		queued_request = queue_push(&slave->request_queue);
+		queued_request = lane_queue_push(&slave->request_queue, lane, request->header.uid);
 		queued_request->status = RED_STACK_REQUEST_STATUS_ADDED;
 		queued_request->slave = slave;
 		memcpy(&queued_request->packet, request, request->header.length);
 		mutex_unlock(&slave->request_queue_mutex);
 
-		log_packet_debug("Packet is queued to be send to slave %d over SPI (%s)",
-		                 slave->stack_address,
-		                 packet_get_request_signature(packet_signature, request));
+		log_packet_request_debug(request, "Packet is queued to be send to slave %d over SPI (%s)",
+		                                  slave->stack_address,
+		                                  packet_get_request_signature(packet_signature, request));
 	}
 
+	red_stack_spi_wakeup();
+
 	return 0;
 }
 
+// All slaves share the one SPI bus, so every queued request waits for the
+// requests of all slaves
+static int red_stack_get_backlog(Stack *stack) {
+	int backlog = 0;
+	uint8_t i;
+
+	(void)stack;
+
+	for (i = 0; i < _red_stack.slave_num; i++) {
+		mutex_lock(&_red_stack.slaves[i].request_queue_mutex);
+		backlog += _red_stack.slaves[i].request_queue.count;
+		mutex_unlock(&_red_stack.slaves[i].request_queue_mutex);
+	}
+
+	return backlog;
+}
+
 static void red_stack_reset_handler(void *opaque) {
 	char buf[2];
 
@@ -884,6 +1084,8 @@ static void red_stack_reset_handler(void *opaque) {
 
 	_red_stack_spi_thread_running = false;
 
+	red_stack_spi_wakeup();
+
 	// If there is no slave we have to wake up the spi thread
 	if (_red_stack.slave_num == 0) {
 		pthread_mutex_lock(&_red_stack_wait_for_reset_mutex);
@@ -926,6 +1128,8 @@ int red_stack_init(void) {
 		goto cleanup;
 	}
 
+	_red_stack.base.get_backlog = red_stack_get_backlog;
+
 	phase = 1;
 
 	// add to stacks array
@@ -958,7 +1162,7 @@ int red_stack_init(void) {
 
 	// Initialize SPI packet queues
 	for (k = 0; k < RED_STACK_SPI_MAX_SLAVES; k++) {
-		if (queue_create(&_red_stack.slaves[k].request_queue, sizeof(REDStackRequest)) < 0) {
+		if (lane_queue_create(&_red_stack.slaves[k].request_queue, sizeof(REDStackRequest)) < 0) {
 			log_error("Could not create SPI request queue %d: %s (%d)",
 			          k, get_errno_name(errno), errno);
 
@@ -1021,7 +1225,7 @@ cleanup:
 
 	case 4:
 		for (k--; k >= 0; k--) {
-			queue_destroy(&_red_stack.slaves[k].request_queue, NULL);
+			lane_queue_destroy(&_red_stack.slaves[k].request_queue, NULL);
 		}
 
 		event_remove_source(_red_stack_notification_event, EVENT_SOURCE_TYPE_GENERIC);
@@ -1064,6 +1268,7 @@ void red_stack_exit(void) {
 		// Write in eventfd to make sure that we are not blocking the Thread
 		eventfd_t ev = 1;
 		eventfd_write(_red_stack_notification_event, ev);
+		red_stack_spi_wakeup();
 
 		thread_join(&_red_stack_spi_thread);
 		thread_destroy(&_red_stack_spi_thread);
@@ -1076,7 +1281,7 @@ void red_stack_exit(void) {
 
 	// We can also free the queue and stack now, nobody will use them anymore
 	for (i = 0; i < RED_STACK_SPI_MAX_SLAVES; i++) {
-		queue_destroy(&_red_stack.slaves[i].request_queue, NULL);
+		lane_queue_destroy(&_red_stack.slaves[i].request_queue, NULL);
 	}
 
 	hardware_remove_stack(&_red_stack.base);
@@ -25,6 +25,7 @@
 
 #include <daemonlib/base58.h>
 #include <daemonlib/event.h>
+#include <daemonlib/framer.h>
 #include <daemonlib/log.h>
 #include <daemonlib/queue.h>
 #include <daemonlib/socket.h>
@@ -41,17 +42,13 @@ static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
 #define RECONNECT_INTERVAL 2000000 // 2 seconds in microseconds
 #define SOCKET_FILENAME "/var/run/redapid-brickd.socket"
+#define READ_BUFFER_SIZE 4096 // bytes
 
 typedef struct {
 	Stack base;
 
 	Socket socket;
-	union {
-		uint8_t response_buffer[512];
-		Packet response;
-	};
-	int response_buffer_used;
-	bool response_header_checked;
+	Framer response_framer;
 	Writer request_writer;
 } REDBrickAPIDaemon;
 
@@ -83,14 +80,14 @@ static void redapid_disconnect(bool reconnect) {
 
 static void redapid_handle_read(void *opaque) {
 	int length;
+	Packet *response;
 	const char *message = NULL;
 	char packet_dump[PACKET_MAX_DUMP_LENGTH];
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 
 	(void)opaque;
 
-	length = socket_receive(&_redapid.socket, _redapid.response_buffer + _redapid.response_buffer_used,
-	                        sizeof(_redapid.response_buffer) - _redapid.response_buffer_used);
+	length = framer_read(&_redapid.response_framer, &_redapid.socket.base);
 
 	if (length == 0) {
 		log_info("RED Brick API Daemon disconnected by peer");
@@ -117,48 +114,30 @@ static void redapid_handle_read(void *opaque) {
 		return;
 	}
 
-	_redapid.response_buffer_used += length;
+	while (_connected) {
+		response = (Packet *)framer_next(&_redapid.response_framer, &length, &message);
 
-	while (_connected && _redapid.response_buffer_used > 0) {
-		if (_redapid.response_buffer_used < (int)sizeof(PacketHeader)) {
-			// wait for complete header
-			break;
-		}
+		if (response == NULL) {
+			if (length < 0) {
+				response = (Packet *)framer_peek(&_redapid.response_framer, &length);
 
-		if (!_redapid.response_header_checked) {
-			if (!packet_header_is_valid_response(&_redapid.response.header, &message)) {
 				log_error("Received invalid response (packet: %s) from RED Brick API Daemon, disconnecting redapid: %s",
-				          packet_get_dump(packet_dump, &_redapid.response, _redapid.response_buffer_used),
-				          message);
+				          packet_get_dump(packet_dump, response, length), message);
 
 				redapid_disconnect(true);
-
-				return;
 			}
 
-			_redapid.response_header_checked = true;
-		}
-
-		length = _redapid.response.header.length;
-
-		if (_redapid.response_buffer_used < length) {
 			// wait for complete packet
 			break;
 		}
 
-		log_packet_debug("Received %s (%s) from RED Brick API Daemon",
-		                 packet_get_response_type(&_redapid.response),
-		                 packet_get_response_signature(packet_signature, &_redapid.response));
-
-		stack_add_recipient(&_redapid.base, _redapid.response.header.uid, 0);
+		log_packet_response_debug(response, "Received %s (%s) from RED Brick API Daemon",
+		                                    packet_get_response_type(response),
+		                                    packet_get_response_signature(packet_signature, response));
 
-		network_dispatch_response(&_redapid.response);
+		stack_add_recipient(&_redapid.base, response->header.uid, 0);
 
-		memmove(_redapid.response_buffer, _redapid.response_buffer + length,
-		        _redapid.response_buffer_used - length);
-
-		_redapid.response_buffer_used -= length;
-		_redapid.response_header_checked = false;
+		network_dispatch_response(response);
 	}
 }
 
@@ -239,8 +218,7 @@ static void redapid_handle_reconnect(void *opaque) {
 
 	(void)opaque;
 
-	_redapid.response_buffer_used = 0;
-	_redapid.response_header_checked = false;
+	framer_reset(&_redapid.response_framer);
 
 	log_debug("Connecting to RED Brick API Daemon");
 
@@ -404,6 +382,17 @@ int redapid_init(void) {
 
 	phase = 1;
 
+	// create response framer
+	if (framer_create(&_redapid.response_framer, READ_BUFFER_SIZE,
+	                  framer_get_response_length, NULL) < 0) {
+		log_error("Could not create response framer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
 	// create reconnect timer
 	if (timer_create_(&_reconnect_timer, redapid_handle_reconnect, NULL) < 0) {
 		log_error("Could not create reconnect timer: %s (%d)",
@@ -412,7 +401,7 @@ int redapid_init(void) {
 		goto cleanup;
 	}
 
-	phase = 2;
+	phase = 3;
 
 	if (timer_configure(&_reconnect_timer, 0, RECONNECT_INTERVAL) < 0) {
 		log_error("Could not start reconnect timer: %s (%d)",
@@ -423,19 +412,21 @@ int redapid_init(void) {
 
 	// add to stacks array
 	if (hardware_add_stack(&_redapid.base) < 0) {
-		stack_destroy(&_redapid.base);
-
 		goto cleanup;
 	}
 
-	phase = 3;
+	phase = 4;
 
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
-	case 2:
+	case 3:
 		timer_destroy(&_reconnect_timer);
 		// fall through
 
+	case 2:
+		framer_destroy(&_redapid.response_framer);
+		// fall through
+
 	case 1:
 		stack_destroy(&_redapid.base);
 		// fall through
@@ -444,7 +435,7 @@ cleanup:
 		break;
 	}
 
-	return phase == 3 ? 0 : -1;
+	return phase == 4 ? 0 : -1;
 }
 
 void redapid_exit(void) {
@@ -457,6 +448,7 @@ void redapid_exit(void) {
 	}
 
 	timer_destroy(&_reconnect_timer);
+	framer_destroy(&_redapid.response_framer);
 
 	stack_destroy(&_redapid.base);
 }
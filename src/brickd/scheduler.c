@@ -0,0 +1,756 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * scheduler.c: Fair scheduling of client requests to the hardware
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the scheduler sits between the clients and the stacks. without it a single
+ * client flooding requests could fill the write queues of the stacks and all
+ * other clients would have to wait for the flood to be written before their
+ * requests get a chance.
+ *
+ * each stack reports its write backlog. as long as the stacks that would
+ * receive a request have room, the request is passed through to the hardware
+ * directly. otherwise it is queued per client and the queued requests are
+ * dispatched in deficit round robin order across the clients as soon as the
+ * stacks have room again. the stacks report each written request, so a waiting
+ * client gets its turn without polling. optionally, each client can be limited
+ * to a request rate by a token bucket.
+ *
+ * the backlog of a stack is shared between the clients that have requests in
+ * it. the scheduler remembers which client a request in the backlog came from
+ * and a client can only have its share of the backlog in flight. the stacks
+ * only report the size of their backlog, not which requests they wrote. so the
+ * requests in flight are assumed to be written in the order they were
+ * dispatched. this is not exact, because getters can overtake setters in the
+ * write queues, but the number of requests in flight per stack always matches
+ * its backlog.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/event.h>
+#include <daemonlib/log.h>
+#include <daemonlib/pipe.h>
+#include <daemonlib/timer.h>
+#include <daemonlib/utils.h>
+
+#include "scheduler.h"
+
+#include "hardware.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define SCHEDULER_MAX_STACK_BACKLOG 32 // requests
+#define SCHEDULER_MAX_QUEUED_REQUESTS 32768 // per client
+#define SCHEDULER_QUANTUM 80 // bytes per client and round
+#define SCHEDULER_TOKEN_SCALE 1000000 // one token per request, in microseconds
+
+typedef struct {
+	uint64_t timestamp; // microseconds
+	Packet request;
+} ScheduledRequest;
+
+typedef struct {
+	SchedulerClient *scheduler_client;
+	int count; // requests in flight
+} SchedulerStackClient;
+
+typedef struct {
+	Stack *stack;
+	Array owners; // of SchedulerClient *, in dispatch order, NULL if destroyed
+	Array clients; // of SchedulerStackClient, with requests in flight
+} SchedulerStack;
+
+static Node _active_sentinel;
+static Node _client_sentinel;
+static Pipe _write_done_pipe;
+static Timer _token_timer;
+static bool _waiting = false; // read by other threads
+static bool _write_done_pending = false; // written by other threads
+static int64_t _rate_limit; // requests per second, 0 = unlimited
+static int64_t _max_tokens;
+static Array _stacks; // of SchedulerStack
+static Array _request_stacks; // of Stack *, see scheduler_has_room
+
+static void scheduler_refill_tokens(SchedulerClient *scheduler_client, uint64_t now) {
+	if (_rate_limit <= 0) {
+		return;
+	}
+
+	if (now > scheduler_client->last_refill) {
+		scheduler_client->tokens += (int64_t)(now - scheduler_client->last_refill) * _rate_limit;
+
+		if (scheduler_client->tokens > _max_tokens) {
+			scheduler_client->tokens = _max_tokens;
+		}
+	}
+
+	scheduler_client->last_refill = now;
+}
+
+static bool scheduler_has_token(SchedulerClient *scheduler_client) {
+	return _rate_limit <= 0 || scheduler_client->tokens >= SCHEDULER_TOKEN_SCALE;
+}
+
+// returns the time until the client has a token again, in microseconds
+static uint64_t scheduler_get_token_delay(SchedulerClient *scheduler_client) {
+	return (uint64_t)((SCHEDULER_TOKEN_SCALE - scheduler_client->tokens + _rate_limit - 1) / _rate_limit);
+}
+
+static SchedulerStack *scheduler_get_stack(Stack *stack, bool create) {
+	int i;
+	SchedulerStack *scheduler_stack;
+
+	for (i = 0; i < _stacks.count; ++i) {
+		scheduler_stack = array_get(&_stacks, i);
+
+		if (scheduler_stack->stack == stack) {
+			return scheduler_stack;
+		}
+	}
+
+	if (!create) {
+		return NULL;
+	}
+
+	scheduler_stack = array_append(&_stacks);
+
+	if (scheduler_stack == NULL) {
+		log_error("Could not append to scheduler stack array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return NULL;
+	}
+
+	scheduler_stack->stack = stack;
+
+	if (array_create(&scheduler_stack->owners, SCHEDULER_MAX_STACK_BACKLOG,
+	                 sizeof(SchedulerClient *), true) < 0) {
+		log_error("Could not create scheduler owner array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_remove(&_stacks, _stacks.count - 1, NULL);
+
+		return NULL;
+	}
+
+	if (array_create(&scheduler_stack->clients, 8, sizeof(SchedulerStackClient), true) < 0) {
+		log_error("Could not create scheduler client array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_destroy(&scheduler_stack->owners, NULL);
+		array_remove(&_stacks, _stacks.count - 1, NULL);
+
+		return NULL;
+	}
+
+	return scheduler_stack;
+}
+
+static void scheduler_destroy_stack(void *item) {
+	SchedulerStack *scheduler_stack = item;
+
+	array_destroy(&scheduler_stack->clients, NULL);
+	array_destroy(&scheduler_stack->owners, NULL);
+}
+
+static SchedulerStackClient *scheduler_get_stack_client(SchedulerStack *scheduler_stack,
+                                                        SchedulerClient *scheduler_client,
+                                                        int *index) {
+	int i;
+	SchedulerStackClient *stack_client;
+
+	for (i = 0; i < scheduler_stack->clients.count; ++i) {
+		stack_client = array_get(&scheduler_stack->clients, i);
+
+		if (stack_client->scheduler_client == scheduler_client) {
+			if (index != NULL) {
+				*index = i;
+			}
+
+			return stack_client;
+		}
+	}
+
+	return NULL;
+}
+
+// the requests that are not in the backlog anymore got written or dropped
+static void scheduler_reconcile_stack(SchedulerStack *scheduler_stack, int backlog) {
+	SchedulerClient *owner;
+	SchedulerStackClient *stack_client;
+	int index;
+
+	while (scheduler_stack->owners.count > backlog) {
+		owner = *(SchedulerClient **)array_get(&scheduler_stack->owners, 0);
+
+		array_remove(&scheduler_stack->owners, 0, NULL);
+
+		if (owner == NULL) {
+			continue;
+		}
+
+		stack_client = scheduler_get_stack_client(scheduler_stack, owner, &index);
+
+		if (stack_client != NULL && --stack_client->count == 0) {
+			array_remove(&scheduler_stack->clients, index, NULL);
+		}
+	}
+}
+
+// returns true if all stacks that would receive the request have room for it
+// and the client has not used up its share of their backlogs yet. the share
+// is split evenly between the clients with requests in flight on a stack. the
+// stacks are kept for scheduler_add_in_flight, which has to be called if the
+// request gets dispatched
+static bool scheduler_has_room(SchedulerClient *scheduler_client, Packet *request) {
+	int i;
+	Stack *stack;
+	SchedulerStack *scheduler_stack;
+	SchedulerStackClient *stack_client;
+	int backlog;
+	int competing;
+
+	if (hardware_get_request_stacks(request, &_request_stacks) < 0) {
+		log_error("Could not collect stacks for request: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_resize(&_request_stacks, 0, NULL);
+	}
+
+	for (i = 0; i < _request_stacks.count; ++i) {
+		stack = *(Stack **)array_get(&_request_stacks, i);
+		backlog = stack_get_backlog(stack);
+
+		if (backlog >= SCHEDULER_MAX_STACK_BACKLOG) {
+			return false;
+		}
+
+		scheduler_stack = scheduler_get_stack(stack, false);
+
+		if (scheduler_stack == NULL) {
+			continue;
+		}
+
+		scheduler_reconcile_stack(scheduler_stack, backlog);
+
+		stack_client = scheduler_get_stack_client(scheduler_stack, scheduler_client, NULL);
+
+		if (stack_client == NULL) {
+			continue;
+		}
+
+		competing = MAX(scheduler_stack->clients.count, 1);
+
+		if (stack_client->count >= MAX(SCHEDULER_MAX_STACK_BACKLOG / competing, 1)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void scheduler_add_in_flight(SchedulerClient *scheduler_client) {
+	int i;
+	SchedulerStack *scheduler_stack;
+	SchedulerClient **owner;
+	SchedulerStackClient *stack_client;
+
+	for (i = 0; i < _request_stacks.count; ++i) {
+		scheduler_stack = scheduler_get_stack(*(Stack **)array_get(&_request_stacks, i), true);
+
+		if (scheduler_stack == NULL) {
+			continue;
+		}
+
+		stack_client = scheduler_get_stack_client(scheduler_stack, scheduler_client, NULL);
+
+		if (stack_client == NULL) {
+			stack_client = array_append(&scheduler_stack->clients);
+
+			if (stack_client == NULL) {
+				log_error("Could not append to scheduler client array: %s (%d)",
+				          get_errno_name(errno), errno);
+
+				continue;
+			}
+
+			stack_client->scheduler_client = scheduler_client;
+			stack_client->count = 0;
+		}
+
+		owner = array_append(&scheduler_stack->owners);
+
+		if (owner == NULL) {
+			log_error("Could not append to scheduler owner array: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			if (stack_client->count == 0) {
+				array_remove(&scheduler_stack->clients, scheduler_stack->clients.count - 1, NULL);
+			}
+
+			continue;
+		}
+
+		*owner = scheduler_client;
+		++stack_client->count;
+	}
+}
+
+static void scheduler_dispatch_request(SchedulerClient *scheduler_client,
+                                       Packet *request, uint64_t queueing_delay) {
+	if (_rate_limit > 0) {
+		scheduler_client->tokens -= SCHEDULER_TOKEN_SCALE;
+	}
+
+	if (queueing_delay > 0) {
+		++scheduler_client->delayed_requests;
+
+		scheduler_client->total_queueing_delay += queueing_delay;
+
+		if (queueing_delay > scheduler_client->max_queueing_delay) {
+			scheduler_client->max_queueing_delay = (uint32_t)MIN(queueing_delay, UINT32_MAX);
+		}
+	}
+
+	scheduler_add_in_flight(scheduler_client);
+
+	packet_add_trace(request);
+	hardware_dispatch_request(request);
+}
+
+// the stacks only report written requests while clients are waiting for room.
+// the fence orders the store before the following backlog checks, a stack
+// either sees the flag or the checks see the room that the stack made
+static void scheduler_set_waiting(bool waiting) {
+	__atomic_store_n(&_waiting, waiting, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// dispatch queued requests in deficit round robin order until no client can
+// make progress anymore, either because its queue is empty, because it has no
+// tokens left or because the stacks for its next request are busy. the stacks
+// report when they have room again, the token timer fires when the first
+// client without tokens gets its next one
+static void scheduler_run(void) {
+	uint64_t now = microtime();
+	uint64_t token_delay = UINT64_MAX;
+	bool progress = true;
+	bool dispatched;
+	Node *node;
+	Node *next;
+	Node *last;
+	SchedulerClient *scheduler_client;
+	ScheduledRequest *scheduled_request;
+
+	if (_active_sentinel.next == &_active_sentinel) {
+		return;
+	}
+
+	scheduler_set_waiting(true);
+
+	while (progress) {
+		progress = false;
+		last = _active_sentinel.prev;
+
+		for (node = _active_sentinel.next; node != &_active_sentinel; node = next) {
+			next = node == last ? &_active_sentinel : node->next;
+			scheduler_client = containerof(node, SchedulerClient, active_node);
+			dispatched = false;
+
+			scheduler_refill_tokens(scheduler_client, now);
+
+			// limit the deficit, otherwise a client that had to wait for the
+			// stacks for some time could dispatch a burst of requests later on
+			scheduler_client->deficit = MIN(scheduler_client->deficit + SCHEDULER_QUANTUM,
+			                                2 * SCHEDULER_QUANTUM);
+
+			while (scheduler_client->request_queue.count > 0) {
+				scheduled_request = queue_peek(&scheduler_client->request_queue);
+
+				if (!scheduler_has_token(scheduler_client)) {
+					token_delay = MIN(token_delay, scheduler_get_token_delay(scheduler_client));
+
+					break;
+				}
+
+				if (scheduled_request->request.header.length > scheduler_client->deficit ||
+				    !scheduler_has_room(scheduler_client, &scheduled_request->request)) {
+					break;
+				}
+
+				scheduler_client->deficit -= scheduled_request->request.header.length;
+
+				scheduler_dispatch_request(scheduler_client, &scheduled_request->request,
+				                           now - scheduled_request->timestamp);
+
+				queue_pop(&scheduler_client->request_queue, NULL);
+
+				dispatched = true;
+			}
+
+			if (scheduler_client->request_queue.count == 0) {
+				scheduler_client->deficit = 0;
+
+				node_remove(&scheduler_client->active_node);
+			} else if (dispatched) {
+				// move client to the end of the list, so the next client gets
+				// the first chance if the stacks only have room for a few
+				// requests on the next run
+				node_remove(&scheduler_client->active_node);
+				node_insert_before(&_active_sentinel, &scheduler_client->active_node);
+			}
+
+			progress = progress || dispatched;
+		}
+	}
+
+	if (_active_sentinel.next == &_active_sentinel) {
+		scheduler_set_waiting(false);
+	}
+
+	// a client might have got a token in a later pass than the one in which
+	// the delay was calculated. then the timer fires once without effect
+	if (token_delay != UINT64_MAX &&
+	    timer_configure(&_token_timer, token_delay, 0) < 0) {
+		log_error("Could not start scheduler token timer: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+static void scheduler_handle_token_timer(void *opaque) {
+	(void)opaque;
+
+	scheduler_run();
+}
+
+static void scheduler_handle_write_done_event(void *opaque) {
+	uint8_t buffer[64];
+
+	(void)opaque;
+
+	// clear the flag before looking at the backlogs, so a request that is
+	// written from now on triggers another event
+	__atomic_store_n(&_write_done_pending, false, __ATOMIC_SEQ_CST);
+
+	if (pipe_read(&_write_done_pipe, buffer, sizeof(buffer)) < 0 &&
+	    !errno_would_block() && !errno_interrupted()) {
+		log_error("Could not read from scheduler pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+
+	scheduler_run();
+}
+
+int scheduler_init(void) {
+	int phase = 0;
+
+	log_debug("Initializing scheduler subsystem");
+
+	_rate_limit = config_get_option_value("scheduler.rate_limit")->integer;
+	_max_tokens = (int64_t)config_get_option_value("scheduler.rate_burst")->integer * SCHEDULER_TOKEN_SCALE;
+
+	node_reset(&_active_sentinel);
+	node_reset(&_client_sentinel);
+
+	if (array_create(&_stacks, 8, sizeof(SchedulerStack), true) < 0) {
+		log_error("Could not create scheduler stack array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	if (array_create(&_request_stacks, 8, sizeof(Stack *), true) < 0) {
+		log_error("Could not create scheduler request stack array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if (timer_create_(&_token_timer, scheduler_handle_token_timer, NULL) < 0) {
+		log_error("Could not create scheduler token timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	if (pipe_create(&_write_done_pipe, PIPE_FLAG_NON_BLOCKING_READ | PIPE_FLAG_NON_BLOCKING_WRITE) < 0) {
+		log_error("Could not create scheduler pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	if (event_add_source(_write_done_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                     "scheduler", EVENT_READ, scheduler_handle_write_done_event, NULL) < 0) {
+		goto cleanup;
+	}
+
+	phase = 5;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		pipe_destroy(&_write_done_pipe);
+		// fall through
+
+	case 3:
+		timer_destroy(&_token_timer);
+		// fall through
+
+	case 2:
+		array_destroy(&_request_stacks, NULL);
+		// fall through
+
+	case 1:
+		array_destroy(&_stacks, NULL);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 5 ? 0 : -1;
+}
+
+void scheduler_exit(void) {
+	log_debug("Shutting down scheduler subsystem");
+
+	event_remove_source(_write_done_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+	pipe_destroy(&_write_done_pipe);
+	timer_destroy(&_token_timer);
+	array_destroy(&_request_stacks, NULL);
+	array_destroy(&_stacks, scheduler_destroy_stack);
+}
+
+int scheduler_client_create(SchedulerClient *scheduler_client, const char *name) {
+	scheduler_client->name = name;
+
+	if (queue_create(&scheduler_client->request_queue, sizeof(ScheduledRequest)) < 0) {
+		log_error("Could not create scheduler request queue: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	node_reset(&scheduler_client->active_node);
+	node_reset(&scheduler_client->client_node);
+
+	scheduler_client->deficit = 0;
+	scheduler_client->tokens = _max_tokens;
+	scheduler_client->last_refill = microtime();
+	scheduler_client->dropped_requests = 0;
+	scheduler_client->delayed_requests = 0;
+	scheduler_client->total_queueing_delay = 0;
+	scheduler_client->max_queueing_delay = 0;
+
+	return 0;
+}
+
+void scheduler_client_destroy(SchedulerClient *scheduler_client) {
+	int i;
+	int k;
+	int index;
+	SchedulerStack *scheduler_stack;
+	SchedulerClient **owner;
+
+	// the queued requests are dropped. dispatching them all at once would
+	// bypass the stack backlog limit and the fairness towards the other
+	// clients, and nobody is left to receive their responses anyway
+	if (scheduler_client->request_queue.count > 0) {
+		log_debug("Dropping %d queued request(s) of client (N: %s) while destroying it",
+		          scheduler_client->request_queue.count, scheduler_client->name);
+
+		scheduler_client->dropped_requests += scheduler_client->request_queue.count;
+	}
+
+	if (scheduler_client->delayed_requests > 0 || scheduler_client->dropped_requests > 0) {
+		log_debug("Scheduler delayed %u request(s) of client (N: %s), queueing delay: %u usec average, %u usec maximum, %u request(s) dropped",
+		          scheduler_client->delayed_requests, scheduler_client->name,
+		          scheduler_client->delayed_requests > 0
+		          ? (uint32_t)(scheduler_client->total_queueing_delay / scheduler_client->delayed_requests) : 0,
+		          scheduler_client->max_queueing_delay, scheduler_client->dropped_requests);
+	}
+
+	// its requests in flight are still in the backlogs, but are not accounted
+	// to it anymore
+	for (i = 0; i < _stacks.count; ++i) {
+		scheduler_stack = array_get(&_stacks, i);
+
+		if (scheduler_get_stack_client(scheduler_stack, scheduler_client, &index) != NULL) {
+			array_remove(&scheduler_stack->clients, index, NULL);
+		}
+
+		for (k = 0; k < scheduler_stack->owners.count; ++k) {
+			owner = array_get(&scheduler_stack->owners, k);
+
+			if (*owner == scheduler_client) {
+				*owner = NULL;
+			}
+		}
+	}
+
+	node_remove(&scheduler_client->active_node);
+	node_remove(&scheduler_client->client_node);
+	queue_destroy(&scheduler_client->request_queue, NULL);
+
+	if (_active_sentinel.next == &_active_sentinel) {
+		scheduler_set_waiting(false);
+	}
+}
+
+void scheduler_submit_request(SchedulerClient *scheduler_client, Packet *request) {
+	uint64_t now = microtime();
+	ScheduledRequest *scheduled_request;
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+
+	// the client is created on the thread that owns it, but is only linked
+	// into the list of all clients here on the hardware thread
+	if (scheduler_client->client_node.next == &scheduler_client->client_node) {
+		node_insert_before(&_client_sentinel, &scheduler_client->client_node);
+	}
+
+	scheduler_refill_tokens(scheduler_client, now);
+
+	// fast path, nothing is queued for this client, it has a token left and
+	// the stacks have room for the request
+	if (scheduler_client->request_queue.count == 0 &&
+	    scheduler_has_token(scheduler_client) &&
+	    scheduler_has_room(scheduler_client, request)) {
+		scheduler_dispatch_request(scheduler_client, request, 0);
+
+		return;
+	}
+
+	if (scheduler_client->request_queue.count >= SCHEDULER_MAX_QUEUED_REQUESTS) {
+		log_warn("Scheduler request queue for client (N: %s) is full, dropping request (%s), %u + 1 dropped in total",
+		         scheduler_client->name,
+		         packet_get_request_signature(packet_signature, request),
+		         scheduler_client->dropped_requests);
+
+		++scheduler_client->dropped_requests;
+
+		return;
+	}
+
+	scheduled_request = queue_push(&scheduler_client->request_queue);
+
+	if (scheduled_request == NULL) {
+		log_error("Could not push request (%s) to scheduler request queue for client (N: %s), dropping request: %s (%d)",
+		          packet_get_request_signature(packet_signature, request),
+		          scheduler_client->name, get_errno_name(errno), errno);
+
+		return;
+	}
+
+	scheduled_request->timestamp = now;
+
+	memcpy(&scheduled_request->request, request, sizeof(Packet));
+
+	log_packet_request_debug(request, "Queued request (%s) for client (N: %s) in scheduler (count: %d)",
+	                                  packet_get_request_signature(packet_signature, request),
+	                                  scheduler_client->name, scheduler_client->request_queue.count);
+
+	if (scheduler_client->active_node.next == &scheduler_client->active_node) {
+		node_insert_before(&_active_sentinel, &scheduler_client->active_node);
+	}
+
+	scheduler_run();
+}
+
+// must be called from the hardware thread after a stack was removed
+void scheduler_remove_stack(Stack *stack) {
+	int i;
+	SchedulerStack *scheduler_stack;
+
+	for (i = 0; i < _stacks.count; ++i) {
+		scheduler_stack = array_get(&_stacks, i);
+
+		if (scheduler_stack->stack == stack) {
+			array_remove(&_stacks, i, scheduler_destroy_stack);
+
+			break;
+		}
+	}
+
+	// requests that waited for this stack might have room elsewhere now
+	scheduler_run();
+}
+
+// must be called from the hardware thread by a stack after it wrote or dropped
+// queued requests
+void scheduler_handle_write_done(void) {
+	scheduler_run();
+}
+
+// same as scheduler_handle_write_done, but for stacks that write from their
+// own thread. the scheduler runs on the next event loop iteration. the pipe is
+// only written once until the event is handled
+void scheduler_announce_write_done(void) {
+	uint8_t byte = 0;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (!__atomic_load_n(&_waiting, __ATOMIC_RELAXED) ||
+	    __atomic_exchange_n(&_write_done_pending, true, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	if (pipe_write(&_write_done_pipe, &byte, sizeof(byte)) < 0 && !errno_would_block()) {
+		log_error("Could not write to scheduler pipe: %s (%d)",
+		          get_errno_name(errno), errno);
+	}
+}
+
+// logs the counters of all clients that submitted requests, on info level so
+// they show up in a SIGUSR1 dump without enabling debug logging
+void scheduler_log_stats(void) {
+	Node *node;
+	int count = 0;
+	SchedulerClient *scheduler_client;
+
+	for (node = _client_sentinel.next; node != &_client_sentinel; node = node->next) {
+		++count;
+	}
+
+	log_info("Scheduler has %d client(s), rate limit: %d request(s) per second",
+	         count, (int)_rate_limit);
+
+	for (node = _client_sentinel.next; node != &_client_sentinel; node = node->next) {
+		scheduler_client = containerof(node, SchedulerClient, client_node);
+
+		log_info("Scheduler client (N: %s): %d request(s) queued, %u request(s) delayed, queueing delay: %u usec average, %u usec maximum, %u request(s) dropped",
+		         scheduler_client->name, scheduler_client->request_queue.count,
+		         scheduler_client->delayed_requests,
+		         scheduler_client->delayed_requests > 0
+		         ? (uint32_t)(scheduler_client->total_queueing_delay / scheduler_client->delayed_requests) : 0,
+		         scheduler_client->max_queueing_delay, scheduler_client->dropped_requests);
+	}
+}
@@ -0,0 +1,62 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * scheduler.h: Fair scheduling of client requests to the hardware
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BRICKD_SCHEDULER_H
+#define BRICKD_SCHEDULER_H
+
+#include <stdint.h>
+
+#include <daemonlib/node.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/queue.h>
+
+#include "stack.h"
+
+typedef struct {
+	const char *name; // for display purpose
+	Queue request_queue; // of ScheduledRequest
+	Node active_node; // in the list of clients with queued requests
+	Node client_node; // in the list of all clients, added on first request
+	int deficit; // bytes
+	int64_t tokens; // in 1/SCHEDULER_TOKEN_SCALE requests
+	uint64_t last_refill; // microseconds
+	uint32_t dropped_requests;
+	uint32_t delayed_requests;
+	uint64_t total_queueing_delay; // microseconds
+	uint32_t max_queueing_delay; // microseconds
+} SchedulerClient;
+
+int scheduler_init(void);
+void scheduler_exit(void);
+
+int scheduler_client_create(SchedulerClient *scheduler_client, const char *name);
+void scheduler_client_destroy(SchedulerClient *scheduler_client);
+
+void scheduler_submit_request(SchedulerClient *scheduler_client, Packet *request);
+
+void scheduler_remove_stack(Stack *stack);
+
+void scheduler_handle_write_done(void);
+void scheduler_announce_write_done(void);
+
+void scheduler_log_stats(void);
+
+#endif // BRICKD_SCHEDULER_H
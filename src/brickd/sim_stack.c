@@ -0,0 +1,648 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * sim_stack.c: Simulated stack for testing without hardware
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * the simulated stack emulates a configurable number of Master Bricks without
+ * any hardware. requests pass through the same scheduler and hardware dispatch
+ * path as requests for real devices and responses and callbacks are passed to
+ * the clients through network_dispatch_response. this allows to measure the
+ * performance of brickd itself in a reproducible way.
+ *
+ * only a few functions of the Master Brick are implemented. all other function
+ * IDs are answered with a function-not-supported error. the stack voltage
+ * callback is triggered with the configured period or the period set by the
+ * client. the response latency, the error rate and the drop rate are
+ * configurable. the random numbers for values and error injection come from a
+ * fixed seed, so each run behaves the same for the same sequence of requests.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <daemonlib/array.h>
+#include <daemonlib/base58.h>
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/queue.h>
+#include <daemonlib/timer.h>
+#include <daemonlib/utils.h>
+
+#include "sim_stack.h"
+
+#include "hardware.h"
+#include "network.h"
+#include "scheduler.h"
+#include "stack.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define CALLBACK_TICK 1000 // 1 millisecond in microseconds
+#define RANDOM_SEED 2463534242u
+
+#define MASTER_DEVICE_IDENTIFIER 13
+
+#define MASTER_FUNCTION_GET_STACK_VOLTAGE 1
+#define MASTER_FUNCTION_GET_STACK_CURRENT 2
+#define MASTER_FUNCTION_GET_USB_VOLTAGE 40
+#define MASTER_FUNCTION_SET_STACK_VOLTAGE_CALLBACK_PERIOD 47
+#define MASTER_FUNCTION_GET_STACK_VOLTAGE_CALLBACK_PERIOD 48
+#define MASTER_FUNCTION_SET_DEBOUNCE_PERIOD 57
+#define MASTER_FUNCTION_GET_DEBOUNCE_PERIOD 58
+#define MASTER_CALLBACK_STACK_VOLTAGE 60
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+	char uid[8];
+	char connected_uid[8];
+	char position;
+	uint8_t hardware_version[3];
+	uint8_t firmware_version[3];
+	uint16_t device_identifier; // always little endian
+} ATTRIBUTE_PACKED GetIdentityResponse;
+
+#include <daemonlib/packed_end.h>
+
+typedef struct {
+	uint32_t uid; // always little endian
+	uint32_t callback_period; // milliseconds, 0 = disabled
+	uint64_t next_callback; // microtime
+	uint32_t debounce_period; // milliseconds
+} SimDevice;
+
+typedef struct {
+	uint64_t due; // microtime
+	Packet response;
+} SimResponse;
+
+typedef struct {
+	Stack base;
+
+	Array devices;
+	Queue responses;
+	Timer response_timer;
+	Timer callback_timer;
+	bool callback_timer_active;
+
+	uint64_t latency; // microseconds
+	uint32_t error_rate; // percent
+	uint32_t drop_rate; // percent
+	uint32_t random;
+
+	uint64_t request_count;
+	uint64_t response_count;
+	uint64_t callback_count;
+	uint64_t error_count;
+	uint64_t drop_count;
+} SimStack;
+
+static SimStack _sim_stack;
+static bool _sim_stack_initialized = false;
+static const uint8_t _hardware_version[3] = { 2, 1, 0 };
+static const uint8_t _firmware_version[3] = { 2, 5, 0 };
+
+// xorshift32
+static uint32_t sim_stack_get_random(void) {
+	uint32_t x = _sim_stack.random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	_sim_stack.random = x;
+
+	return x;
+}
+
+static void sim_stack_set_payload(Packet *packet, const void *payload, int length) {
+	memcpy(packet->payload, payload, length);
+
+	packet->header.length = sizeof(PacketHeader) + length;
+}
+
+static void sim_stack_set_uint16(Packet *packet, uint16_t value) {
+	value = uint16_to_le(value);
+
+	sim_stack_set_payload(packet, &value, sizeof(value));
+}
+
+static void sim_stack_set_uint32(Packet *packet, uint32_t value) {
+	value = uint32_to_le(value);
+
+	sim_stack_set_payload(packet, &value, sizeof(value));
+}
+
+static int sim_stack_get_uint32(Packet *request, uint32_t *value) {
+	if (request->header.length < sizeof(PacketHeader) + sizeof(*value)) {
+		return -1;
+	}
+
+	memcpy(value, request->payload, sizeof(*value));
+
+	*value = uint32_from_le(*value);
+
+	return 0;
+}
+
+static void sim_stack_prepare_enumerate_callback(SimDevice *device,
+                                                 EnumerateCallback *enumerate_callback,
+                                                 EnumerationType enumeration_type) {
+	memset(enumerate_callback, 0, sizeof(*enumerate_callback));
+
+	enumerate_callback->header.uid = device->uid;
+	enumerate_callback->header.length = sizeof(*enumerate_callback);
+	enumerate_callback->header.function_id = CALLBACK_ENUMERATE;
+	packet_header_set_sequence_number(&enumerate_callback->header, 0);
+	packet_header_set_response_expected(&enumerate_callback->header, true);
+
+	base58_encode(enumerate_callback->uid, uint32_from_le(device->uid));
+	memcpy(enumerate_callback->connected_uid, PACKET_NO_CONNECTED_UID_STR,
+	       PACKET_NO_CONNECTED_UID_STR_LENGTH);
+
+	enumerate_callback->position = '0';
+
+	memcpy(enumerate_callback->hardware_version, _hardware_version,
+	       sizeof(enumerate_callback->hardware_version));
+	memcpy(enumerate_callback->firmware_version, _firmware_version,
+	       sizeof(enumerate_callback->firmware_version));
+
+	enumerate_callback->device_identifier = uint16_to_le(MASTER_DEVICE_IDENTIFIER);
+	enumerate_callback->enumeration_type = enumeration_type;
+}
+
+static void sim_stack_prepare_get_identity_response(SimDevice *device, Packet *response) {
+	GetIdentityResponse *get_identity_response = (GetIdentityResponse *)response;
+
+	base58_encode(get_identity_response->uid, uint32_from_le(device->uid));
+	memcpy(get_identity_response->connected_uid, PACKET_NO_CONNECTED_UID_STR,
+	       PACKET_NO_CONNECTED_UID_STR_LENGTH);
+
+	get_identity_response->position = '0';
+
+	memcpy(get_identity_response->hardware_version, _hardware_version,
+	       sizeof(get_identity_response->hardware_version));
+	memcpy(get_identity_response->firmware_version, _firmware_version,
+	       sizeof(get_identity_response->firmware_version));
+
+	get_identity_response->device_identifier = uint16_to_le(MASTER_DEVICE_IDENTIFIER);
+	get_identity_response->header.length = sizeof(*get_identity_response);
+}
+
+// responses are always dispatched from the response timer and never from
+// within sim_stack_dispatch_request, because a response that is dispatched
+// before the request is marked as pending would not be matched to the client
+static void sim_stack_queue_response(Packet *response) {
+	SimResponse *queued_response;
+	bool was_empty = _sim_stack.responses.count == 0;
+
+	queued_response = queue_push(&_sim_stack.responses);
+
+	if (queued_response == NULL) {
+		log_error("Could not push response to queue of simulated stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	// all responses have the same latency, so the queue is ordered by due time
+	queued_response->due = microtime() + _sim_stack.latency;
+
+	memcpy(&queued_response->response, response, response->header.length);
+
+	if (was_empty) {
+		timer_configure(&_sim_stack.response_timer,
+		                _sim_stack.latency > 0 ? _sim_stack.latency : 1, 0);
+	}
+}
+
+static void sim_stack_handle_response_timer(void *opaque) {
+	uint64_t now = microtime();
+	SimResponse *queued_response;
+
+	(void)opaque;
+
+	while ((queued_response = queue_peek(&_sim_stack.responses)) != NULL &&
+	       queued_response->due <= now) {
+		network_dispatch_response(&queued_response->response);
+
+		++_sim_stack.response_count;
+
+		queue_pop(&_sim_stack.responses, NULL);
+	}
+
+	if (queued_response != NULL) {
+		timer_configure(&_sim_stack.response_timer, queued_response->due - now, 0);
+	}
+
+	scheduler_handle_write_done();
+}
+
+static void sim_stack_handle_callback_timer(void *opaque) {
+	uint64_t now = microtime();
+	int i;
+	SimDevice *device;
+	Packet callback;
+
+	(void)opaque;
+
+	for (i = 0; i < _sim_stack.devices.count; ++i) {
+		device = array_get(&_sim_stack.devices, i);
+
+		if (device->callback_period == 0 || device->next_callback > now) {
+			continue;
+		}
+
+		memset(&callback, 0, sizeof(callback));
+
+		callback.header.uid = device->uid;
+		callback.header.function_id = MASTER_CALLBACK_STACK_VOLTAGE;
+		packet_header_set_sequence_number(&callback.header, 0);
+		packet_header_set_response_expected(&callback.header, true);
+
+		sim_stack_set_uint16(&callback, 5000 + sim_stack_get_random() % 100);
+
+		network_dispatch_response(&callback);
+
+		++_sim_stack.callback_count;
+
+		device->next_callback += (uint64_t)device->callback_period * 1000;
+
+		// don't try to catch up after the event loop was blocked
+		if (device->next_callback <= now) {
+			device->next_callback = now + (uint64_t)device->callback_period * 1000;
+		}
+	}
+}
+
+// the callback timer only runs while at least one device has callbacks enabled
+static void sim_stack_update_callback_timer(void) {
+	bool active = false;
+	int i;
+	SimDevice *device;
+
+	for (i = 0; i < _sim_stack.devices.count && !active; ++i) {
+		device = array_get(&_sim_stack.devices, i);
+
+		if (device->callback_period > 0) {
+			active = true;
+		}
+	}
+
+	if (active == _sim_stack.callback_timer_active) {
+		return;
+	}
+
+	if (active) {
+		timer_configure(&_sim_stack.callback_timer, CALLBACK_TICK, CALLBACK_TICK);
+	} else {
+		timer_configure(&_sim_stack.callback_timer, 0, 0);
+	}
+
+	_sim_stack.callback_timer_active = active;
+}
+
+static SimDevice *sim_stack_get_device(uint32_t uid /* always little endian */) {
+	int i;
+	SimDevice *device;
+
+	for (i = 0; i < _sim_stack.devices.count; ++i) {
+		device = array_get(&_sim_stack.devices, i);
+
+		if (device->uid == uid) {
+			return device;
+		}
+	}
+
+	return NULL;
+}
+
+static int sim_stack_dispatch_request(Stack *stack, Packet *request, Recipient *recipient) {
+	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	SimDevice *device;
+	Packet response;
+	EnumerateCallback enumerate_callback;
+	uint32_t value;
+	int i;
+
+	(void)stack;
+
+	++_sim_stack.request_count;
+
+	if (request->header.uid == 0) {
+		if (request->header.function_id == FUNCTION_ENUMERATE) {
+			for (i = 0; i < _sim_stack.devices.count; ++i) {
+				device = array_get(&_sim_stack.devices, i);
+
+				sim_stack_prepare_enumerate_callback(device, &enumerate_callback,
+				                                     ENUMERATION_TYPE_AVAILABLE);
+				sim_stack_queue_response((Packet *)&enumerate_callback);
+			}
+		}
+
+		return 0;
+	}
+
+	if (recipient != NULL) {
+		device = array_get(&_sim_stack.devices, (int)recipient->opaque);
+	} else {
+		device = sim_stack_get_device(request->header.uid);
+	}
+
+	if (device == NULL) {
+		return 0;
+	}
+
+	if (_sim_stack.drop_rate > 0 && sim_stack_get_random() % 100 < _sim_stack.drop_rate) {
+		log_packet_request_debug(request, "Dropping request (%s) in simulated stack",
+		                                  packet_get_request_signature(packet_signature, request));
+
+		++_sim_stack.drop_count;
+
+		return 0;
+	}
+
+	memset(&response, 0, sizeof(response));
+
+	response.header = request->header;
+	response.header.length = sizeof(PacketHeader);
+	packet_header_set_error_code(&response.header, PACKET_E_SUCCESS);
+
+	switch (request->header.function_id) {
+	case FUNCTION_ENUMERATE:
+		sim_stack_prepare_enumerate_callback(device, &enumerate_callback,
+		                                     ENUMERATION_TYPE_AVAILABLE);
+		sim_stack_queue_response((Packet *)&enumerate_callback);
+
+		return 0;
+
+	case FUNCTION_GET_IDENTITY:
+		sim_stack_prepare_get_identity_response(device, &response);
+		break;
+
+	case FUNCTION_GET_CHIP_TEMPERATURE:
+		sim_stack_set_uint16(&response, 2500 + sim_stack_get_random() % 100);
+		break;
+
+	case MASTER_FUNCTION_GET_STACK_VOLTAGE:
+	case MASTER_FUNCTION_GET_USB_VOLTAGE:
+		sim_stack_set_uint16(&response, 5000 + sim_stack_get_random() % 100);
+		break;
+
+	case MASTER_FUNCTION_GET_STACK_CURRENT:
+		sim_stack_set_uint16(&response, 100 + sim_stack_get_random() % 50);
+		break;
+
+	case MASTER_FUNCTION_SET_STACK_VOLTAGE_CALLBACK_PERIOD:
+		if (sim_stack_get_uint32(request, &value) < 0) {
+			packet_header_set_error_code(&response.header, PACKET_E_INVALID_PARAMETER);
+
+			break;
+		}
+
+		device->callback_period = value;
+		device->next_callback = microtime() + (uint64_t)value * 1000;
+
+		sim_stack_update_callback_timer();
+
+		break;
+
+	case MASTER_FUNCTION_GET_STACK_VOLTAGE_CALLBACK_PERIOD:
+		sim_stack_set_uint32(&response, device->callback_period);
+		break;
+
+	case MASTER_FUNCTION_SET_DEBOUNCE_PERIOD:
+		if (sim_stack_get_uint32(request, &value) < 0) {
+			packet_header_set_error_code(&response.header, PACKET_E_INVALID_PARAMETER);
+
+			break;
+		}
+
+		device->debounce_period = value;
+
+		break;
+
+	case MASTER_FUNCTION_GET_DEBOUNCE_PERIOD:
+		sim_stack_set_uint32(&response, device->debounce_period);
+		break;
+
+	default:
+		packet_header_set_error_code(&response.header, PACKET_E_FUNCTION_NOT_SUPPORTED);
+		break;
+	}
+
+	if (!packet_header_get_response_expected(&request->header)) {
+		return 0;
+	}
+
+	if (_sim_stack.error_rate > 0 && sim_stack_get_random() % 100 < _sim_stack.error_rate) {
+		response.header.length = sizeof(PacketHeader);
+		packet_header_set_error_code(&response.header, PACKET_E_UNKNOWN_ERROR);
+
+		++_sim_stack.error_count;
+	}
+
+	sim_stack_queue_response(&response);
+
+	return 0;
+}
+
+// the queued responses stand in for the requests that a real device would
+// still have to process
+static int sim_stack_get_backlog(Stack *stack) {
+	(void)stack;
+
+	return _sim_stack.responses.count;
+}
+
+int sim_stack_init(void) {
+	int phase = 0;
+	int device_count = config_get_option_value("simulation.devices")->integer;
+	uint32_t first_uid = (uint32_t)config_get_option_value("simulation.first_uid")->integer;
+	uint32_t callback_period = (uint32_t)config_get_option_value("simulation.callback_period")->integer;
+	uint64_t now = microtime();
+	int i;
+	SimDevice *device;
+	EnumerateCallback enumerate_callback;
+	char base58[BASE58_MAX_LENGTH];
+
+	if (device_count == 0) {
+		return 0;
+	}
+
+	log_info("Initializing simulated stack with %d device(s), starting at UID %s",
+	         device_count, base58_encode(base58, first_uid));
+
+	_sim_stack.latency = (uint64_t)config_get_option_value("simulation.latency")->integer;
+	_sim_stack.error_rate = (uint32_t)config_get_option_value("simulation.error_rate")->integer;
+	_sim_stack.drop_rate = (uint32_t)config_get_option_value("simulation.drop_rate")->integer;
+	_sim_stack.random = RANDOM_SEED;
+	_sim_stack.callback_timer_active = false;
+	_sim_stack.request_count = 0;
+	_sim_stack.response_count = 0;
+	_sim_stack.callback_count = 0;
+	_sim_stack.error_count = 0;
+	_sim_stack.drop_count = 0;
+
+	if (stack_create(&_sim_stack.base, "simulation", sim_stack_dispatch_request) < 0) {
+		log_error("Could not create base stack for simulated stack: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	_sim_stack.base.get_backlog = sim_stack_get_backlog;
+
+	phase = 1;
+
+	// create device array
+	if (array_create(&_sim_stack.devices, device_count, sizeof(SimDevice), true) < 0) {
+		log_error("Could not create device array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	// create response queue
+	if (queue_create(&_sim_stack.responses, sizeof(SimResponse)) < 0) {
+		log_error("Could not create response queue: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 3;
+
+	// create response timer
+	if (timer_create_(&_sim_stack.response_timer, sim_stack_handle_response_timer, NULL) < 0) {
+		log_error("Could not create response timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	// create callback timer
+	if (timer_create_(&_sim_stack.callback_timer, sim_stack_handle_callback_timer, NULL) < 0) {
+		log_error("Could not create callback timer: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 5;
+
+	// create devices, their callbacks are spread over the callback period
+	for (i = 0; i < device_count; ++i) {
+		device = array_append(&_sim_stack.devices);
+
+		if (device == NULL) {
+			log_error("Could not append to device array: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+
+		device->uid = uint32_to_le(first_uid + i);
+		device->callback_period = callback_period;
+		device->next_callback = now + (uint64_t)callback_period * 1000 * (i + 1) / device_count;
+		device->debounce_period = 100;
+
+		if (stack_add_recipient(&_sim_stack.base, device->uid, i) < 0) {
+			goto cleanup;
+		}
+	}
+
+	sim_stack_update_callback_timer();
+
+	// add to stacks array
+	if (hardware_add_stack(&_sim_stack.base) < 0) {
+		goto cleanup;
+	}
+
+	phase = 6;
+
+	// announce devices like a newly connected USB device does
+	for (i = 0; i < _sim_stack.devices.count; ++i) {
+		device = array_get(&_sim_stack.devices, i);
+
+		sim_stack_prepare_enumerate_callback(device, &enumerate_callback,
+		                                     ENUMERATION_TYPE_CONNECTED);
+		network_dispatch_response((Packet *)&enumerate_callback);
+	}
+
+	_sim_stack_initialized = true;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 5:
+		timer_destroy(&_sim_stack.callback_timer);
+		// fall through
+
+	case 4:
+		timer_destroy(&_sim_stack.response_timer);
+		// fall through
+
+	case 3:
+		queue_destroy(&_sim_stack.responses, NULL);
+		// fall through
+
+	case 2:
+		array_destroy(&_sim_stack.devices, NULL);
+		// fall through
+
+	case 1:
+		stack_destroy(&_sim_stack.base);
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 6 ? 0 : -1;
+}
+
+void sim_stack_exit(void) {
+	if (!_sim_stack_initialized) {
+		return;
+	}
+
+	log_debug("Shutting down simulated stack");
+
+	log_info("Simulated stack handled %" PRIu64 " request(s), sent %" PRIu64 " response(s) and %" PRIu64 " callback(s), injected %" PRIu64 " error(s) and dropped %" PRIu64 " request(s)",
+	         _sim_stack.request_count, _sim_stack.response_count, _sim_stack.callback_count,
+	         _sim_stack.error_count, _sim_stack.drop_count);
+
+	hardware_remove_stack(&_sim_stack.base);
+
+	timer_destroy(&_sim_stack.callback_timer);
+	timer_destroy(&_sim_stack.response_timer);
+	queue_destroy(&_sim_stack.responses, NULL);
+	array_destroy(&_sim_stack.devices, NULL);
+	stack_destroy(&_sim_stack.base);
+
+	_sim_stack_initialized = false;
+}
@@ -41,16 +41,26 @@
 #include <daemonlib/log.h>
 #include <daemonlib/utils.h>
 
+#include "capture.h"
 #include "network.h"
 #include "stack.h"
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
+static uint16_t _next_id = 1; // 0 is CAPTURE_NO_STACK
+
 int stack_create(Stack *stack, const char *name,
                  StackDispatchRequestFunction dispatch_request) {
+	stack->id = _next_id++;
+
+	if (_next_id == 0) { // wrapped around, e.g. after many mesh reconnects
+		_next_id = 1;
+	}
+
 	string_copy(stack->name, sizeof(stack->name), name, -1);
 
 	stack->dispatch_request = dispatch_request;
+	stack->get_backlog = NULL;
 
 	if (array_create(&stack->recipients, 32, sizeof(Recipient), true) < 0) {
 		log_error("Could not create recipient array: %s (%d)",
@@ -112,6 +122,21 @@ Recipient *stack_get_recipient(Stack *stack, uint32_t uid /* always little endia
 	return NULL;
 }
 
+void stack_remove_recipient(Stack *stack, uint32_t uid /* always little endian */) {
+	int i;
+	Recipient *recipient;
+
+	for (i = 0; i < stack->recipients.count; ++i) {
+		recipient = array_get(&stack->recipients, i);
+
+		if (recipient->uid == uid) {
+			array_remove(&stack->recipients, i, NULL);
+
+			return;
+		}
+	}
+}
+
 // returns -1 on error, 0 if the request was not dispatched and 1 if it was dispatch
 int stack_dispatch_request(Stack *stack, Packet *request, bool force) {
 	Recipient *recipient = NULL;
@@ -130,6 +155,10 @@ int stack_dispatch_request(Stack *stack, Packet *request, bool force) {
 		return -1;
 	}
 
+	if (capture_is_enabled()) {
+		capture_packet(CAPTURE_TYPE_ROUTE, CAPTURE_NO_CLIENT, stack->id, request);
+	}
+
 	if (force) {
 		log_packet_debug("Forced to sent request to %s", stack->name);
 	} else {
@@ -139,6 +168,14 @@ int stack_dispatch_request(Stack *stack, Packet *request, bool force) {
 	return 1;
 }
 
+int stack_get_backlog(Stack *stack) {
+	if (stack->get_backlog == NULL) {
+		return 0;
+	}
+
+	return stack->get_backlog(stack);
+}
+
 void stack_announce_disconnect(Stack *stack) {
 	int i;
 	Recipient *recipient;
@@ -36,12 +36,15 @@ typedef struct {
 } Recipient;
 
 typedef int (*StackDispatchRequestFunction)(Stack *stack, Packet *request, Recipient *recipient);
+typedef int (*StackGetBacklogFunction)(Stack *stack);
 
 #define STACK_MAX_NAME_LENGTH 128
 
 struct _Stack {
+	uint16_t id; // for the capture
 	char name[STACK_MAX_NAME_LENGTH]; // for display purpose
 	StackDispatchRequestFunction dispatch_request;
+	StackGetBacklogFunction get_backlog; // optional, number of requests waiting to be written
 	Array recipients;
 };
 
@@ -51,8 +54,10 @@ void stack_destroy(Stack *stack);
 
 int stack_add_recipient(Stack *stack, uint32_t uid /* always little endian */, uint64_t opaque);
 Recipient *stack_get_recipient(Stack *stack, uint32_t uid /* always little endian */);
+void stack_remove_recipient(Stack *stack, uint32_t uid /* always little endian */);
 
 int stack_dispatch_request(Stack *stack, Packet *request, bool force);
+int stack_get_backlog(Stack *stack);
 
 void stack_announce_disconnect(Stack *stack);
 
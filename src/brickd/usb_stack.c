@@ -37,6 +37,7 @@
 
 #include "hardware.h"
 #include "network.h"
+#include "scheduler.h"
 #include "usb.h"
 #include "usb_transfer.h"
 
@@ -132,10 +133,10 @@ static void usb_stack_read_callback(USBTransfer *usb_transfer) {
 			return;
 		}
 
-		log_packet_debug("Received %s (%s) from %s",
-		                 packet_get_response_type(&usb_transfer->packet),
-		                 packet_get_response_signature(packet_signature, &usb_transfer->packet),
-		                 usb_transfer->usb_stack->base.name);
+		log_packet_response_debug(&usb_transfer->packet, "Received %s (%s) from %s",
+		                                                 packet_get_response_type(&usb_transfer->packet),
+		                                                 packet_get_response_signature(packet_signature, &usb_transfer->packet),
+		                                                 usb_transfer->usb_stack->base.name);
 
 #ifdef DAEMONLIB_WITH_PACKET_TRACE
 		usb_transfer->packet.trace_id = packet_get_next_response_trace_id();
@@ -164,7 +165,7 @@ static void usb_stack_write_callback(USBTransfer *usb_transfer) {
 
 	if (!usb_transfer->usb_stack->expecting_disconnect &&
 	    usb_transfer->usb_stack->write_queue.count > 0) {
-		request = queue_peek(&usb_transfer->usb_stack->write_queue);
+		request = lane_queue_peek(&usb_transfer->usb_stack->write_queue);
 
 		memcpy(&usb_transfer->packet, request, request->header.length);
 
@@ -177,12 +178,14 @@ static void usb_stack_write_callback(USBTransfer *usb_transfer) {
 			return;
 		}
 
-		queue_pop(&usb_transfer->usb_stack->write_queue, NULL);
+		lane_queue_pop(&usb_transfer->usb_stack->write_queue, NULL);
 
-		log_packet_debug("Sent queued request (%s) to %s, %d request(s) left in write queue",
-		                 packet_get_request_signature(packet_signature, &usb_transfer->packet),
-		                 usb_transfer->usb_stack->base.name,
-		                 usb_transfer->usb_stack->write_queue.count);
+		log_packet_request_debug(&usb_transfer->packet, "Sent queued request (%s) to %s, %d request(s) left in write queue",
+		                                                packet_get_request_signature(packet_signature, &usb_transfer->packet),
+		                                                usb_transfer->usb_stack->base.name,
+		                                                usb_transfer->usb_stack->write_queue.count);
+
+		scheduler_handle_write_done();
 	}
 }
 
@@ -237,12 +240,14 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 
 		usb_stack->dropped_requests += requests_to_drop;
 
+		// drop from the low priority lane first
 		while (usb_stack->write_queue.count >= MAX_QUEUED_WRITES) {
-			queue_pop(&usb_stack->write_queue, NULL);
+			lane_queue_drop(&usb_stack->write_queue, NULL);
 		}
 	}
 
-	queued_request = queue_push(&usb_stack->write_queue);
+	queued_request = lane_queue_push(&usb_stack->write_queue, hardware_get_request_lane(request),
+	                                 request->header.uid);
 
 	if (queued_request == NULL) {
 		log_error("Could not push request (%s) to write queue for %s, dropping request: %s (%d)",
@@ -258,6 +263,10 @@ static int usb_stack_dispatch_request(Stack *stack, Packet *request,
 	return 0;
 }
 
+static int usb_stack_get_backlog(Stack *stack) {
+	return ((USBStack *)stack)->write_queue.count;
+}
+
 int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_address) {
 	int phase = 0;
 	int rc;
@@ -295,6 +304,8 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 		goto cleanup;
 	}
 
+	usb_stack->base.get_backlog = usb_stack_get_backlog;
+
 	phase = 1;
 
 	// initialize per-device libusb context
@@ -524,7 +535,7 @@ int usb_stack_create(USBStack *usb_stack, uint8_t bus_number, uint8_t device_add
 	}
 
 	// allocate write queue
-	if (queue_create(&usb_stack->write_queue, sizeof(Packet)) < 0) {
+	if (lane_queue_create(&usb_stack->write_queue, sizeof(Packet)) < 0) {
 		log_error("Could not create write queue for %s: %s (%d)",
 		          usb_stack->base.name, get_errno_name(errno), errno);
 
@@ -577,7 +588,7 @@ cleanup:
 		// fall through
 
 	case 7:
-		queue_destroy(&usb_stack->write_queue, NULL);
+		lane_queue_destroy(&usb_stack->write_queue, NULL);
 		// fall through
 
 	case 6:
@@ -623,7 +634,7 @@ void usb_stack_destroy(USBStack *usb_stack) {
 
 	timer_destroy(&usb_stack->stall_timer);
 
-	queue_destroy(&usb_stack->write_queue, NULL);
+	lane_queue_destroy(&usb_stack->write_queue, NULL);
 
 	libusb_release_interface(usb_stack->device_handle, usb_stack->interface_number);
 
@@ -27,7 +27,7 @@
 #include <stdbool.h>
 
 #include <daemonlib/array.h>
-#include <daemonlib/queue.h>
+#include <daemonlib/lane_queue.h>
 #include <daemonlib/timer.h>
 
 #include "stack.h"
@@ -45,7 +45,7 @@ typedef struct {
 	Timer stall_timer;
 	Array read_transfers;
 	Array write_transfers;
-	Queue write_queue;
+	LaneQueue write_queue;
 	uint32_t dropped_requests;
 	bool connected;
 	bool expecting_short_Ax_response;
@@ -21,6 +21,7 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -33,56 +34,237 @@
 #include "base64.h"
 #include "sha1.h"
 
+#ifdef DAEMONLIB_WITH_LOGGING
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+#endif
 
 extern void socket_destroy_platform(Socket *socket);
 extern int socket_receive_platform(Socket *socket, void *buffer, int length);
 extern int socket_send_platform(Socket *socket, const void *buffer, int length);
 
-typedef struct {
-	void *buffer;
-	int length;
-} WebsocketQueuedData;
+// returns the length of the frame header written to BUFFER
+static int websocket_frame_build_header(uint8_t *buffer, int opcode, uint64_t payload_length) {
+	WebsocketFrameHeader *header = (WebsocketFrameHeader *)buffer;
+	int i;
+
+	header->opcode_rsv_fin = 0;
+	header->payload_length_mask = 0;
+	websocket_frame_set_fin(header, 1);
+	websocket_frame_set_opcode(header, opcode);
+	websocket_frame_set_mask(header, 0);
+
+	if (payload_length <= WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH) {
+		websocket_frame_set_payload_length(header, (int)payload_length);
+
+		return sizeof(WebsocketFrameHeader);
+	}
+
+	// extended payload length is in network byte order
+	if (payload_length <= UINT16_MAX) {
+		websocket_frame_set_payload_length(header, 126);
+
+		buffer[2] = (uint8_t)(payload_length >> 8);
+		buffer[3] = (uint8_t)payload_length;
+
+		return sizeof(WebsocketFrameHeader) + 2;
+	}
+
+	websocket_frame_set_payload_length(header, 127);
+
+	for (i = 0; i < 8; ++i) {
+		buffer[2 + i] = (uint8_t)(payload_length >> (56 - i * 8));
+	}
+
+	return sizeof(WebsocketFrameHeader) + 8;
+}
+
+// a control frame is send on behalf of the peer, not of the user of the
+// WebSocket. if it could not be sent completely then the user has to be told,
+// so it calls websocket_send again once the socket is writable
+static void websocket_set_control_pending(Websocket *websocket, bool pending) {
+	if (websocket->control_pending == pending) {
+		return;
+	}
+
+	websocket->control_pending = pending;
+
+	if (websocket->control_pending_changed != NULL) {
+		websocket->control_pending_changed(pending, websocket->control_pending_opaque);
+	}
+}
+
+// sets errno on error
+//
+// writes pending frame bytes first, then BUFFER as payload of the current
+// frame and of a new binary frame. all data passed in one call is coalesced
+// into one frame. a partially written frame is continued on the next call.
+// this works because the caller retries with the data that was not written.
+// returns the number of bytes of BUFFER that were written
+static int websocket_send_frames(Websocket *websocket, const uint8_t *buffer, int length) {
+	uint8_t frame[WEBSOCKET_MAX_SEND_HEADER_LENGTH + WEBSOCKET_MAX_COALESCED_PAYLOAD_DATA_LENGTH];
+	int header_length;
+	int payload_length;
+	int offset = 0;
+	int to_send;
+	int rc;
+
+	for (;;) {
+		if (websocket->send_pending_offset < websocket->send_pending_length) {
+			to_send = websocket->send_pending_length - websocket->send_pending_offset;
+			rc = socket_send_platform(&websocket->base,
+			                          websocket->send_pending + websocket->send_pending_offset,
+			                          to_send);
+
+			if (rc < 0) {
+				return errno_would_block() ? offset : -1;
+			}
+
+			websocket->send_pending_offset += rc;
+
+			if (rc < to_send) {
+				break;
+			}
+		} else if (websocket->send_remaining > 0) {
+			if (offset >= length) {
+				break;
+			}
+
+			// continue the payload of the current frame
+			to_send = (int)MIN((uint64_t)(length - offset), websocket->send_remaining);
+			rc = socket_send_platform(&websocket->base, buffer + offset, to_send);
+
+			if (rc < 0) {
+				return errno_would_block() ? offset : -1;
+			}
+
+			offset += rc;
+			websocket->send_remaining -= rc;
+
+			if (rc < to_send) {
+				break;
+			}
+		} else if (websocket->send_control_opcode != 0) {
+			// control frames can only be send between data frames
+			websocket->send_pending_length =
+				websocket_frame_build_header(websocket->send_pending,
+				                             websocket->send_control_opcode,
+				                             websocket->send_control_length);
+
+			memcpy(websocket->send_pending + websocket->send_pending_length,
+			       websocket->send_control_payload, websocket->send_control_length);
+
+			websocket->send_pending_length += websocket->send_control_length;
+			websocket->send_pending_offset = 0;
+			websocket->send_control_opcode = 0;
+		} else if (offset < length) {
+			// start a new binary frame, small payloads are copied behind the
+			// header to send both in one go
+			payload_length = length - offset;
+			header_length = websocket_frame_build_header(frame, WEBSOCKET_OPCODE_BINARY_FRAME,
+			                                             payload_length);
+			to_send = header_length;
+
+			if (payload_length <= WEBSOCKET_MAX_COALESCED_PAYLOAD_DATA_LENGTH) {
+				memcpy(frame + header_length, buffer + offset, payload_length);
+
+				to_send += payload_length;
+			}
+
+			rc = socket_send_platform(&websocket->base, frame, to_send);
+
+			if (rc < 0) {
+				return errno_would_block() ? offset : -1;
+			}
+
+			websocket->send_remaining = payload_length;
+
+			if (rc < header_length) {
+				// only payload bytes are reported as written, keep the rest
+				// of the header to send it before the payload
+				memcpy(websocket->send_pending, frame, header_length);
+
+				websocket->send_pending_length = header_length;
+				websocket->send_pending_offset = rc;
+			} else {
+				offset += rc - header_length;
+				websocket->send_remaining -= rc - header_length;
+			}
+
+			if (rc < to_send) {
+				break;
+			}
+		} else {
+			break;
+		}
+	}
 
-static void websocket_free_queued_data(void *item) {
-	WebsocketQueuedData *queued_data = item;
+	if (websocket->send_control_opcode == 0 &&
+	    websocket->send_pending_offset >= websocket->send_pending_length) {
+		websocket_set_control_pending(websocket, false);
+	}
 
-	free(queued_data->buffer);
+	return offset;
 }
 
-static int websocket_send_frame(Websocket *websocket, const void *buffer, int length) {
-	WebsocketFrameWithPayload frame;
+// sets errno on error
+static int websocket_send_control_frame(Websocket *websocket, int opcode,
+                                        const uint8_t *payload, int length) {
+	websocket->send_control_opcode = opcode;
+	websocket->send_control_length = length;
 
-	if (length > WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH) {
-		// currently length should never exceed 80 (the current maximum packet
-		// size). so this is just a safeguard for possible later changes to the
-		// maximum packet size that might require adjustments here.
-		errno = E2BIG;
+	memcpy(websocket->send_control_payload, payload, length);
 
+	// if a data frame is in progress then the control frame is send after the
+	// remaining payload of that frame on the next call of websocket_send
+	if (websocket_send_frames(websocket, NULL, 0) < 0) {
 		return -1;
 	}
 
-	frame.header.opcode_rsv_fin = 0;
-	frame.header.payload_length_mask = 0;
-	websocket_frame_set_fin(&frame.header, 1);
-	websocket_frame_set_opcode(&frame.header, 2);
-	websocket_frame_set_mask(&frame.header, 0);
-	websocket_frame_set_payload_length(&frame.header, length);
-	memcpy(frame.payload_data, buffer, length);
+	if (websocket->send_control_opcode != 0 ||
+	    websocket->send_pending_offset < websocket->send_pending_length) {
+		websocket_set_control_pending(websocket, true);
+	}
 
-	return socket_send_platform((Socket *)websocket, &frame, sizeof(WebsocketFrameHeader) + length);
+	return 0;
 }
 
-static void websocket_send_queued_data(Websocket *websocket) {
-	WebsocketQueuedData *queued_data;
+static int websocket_handle_control_frame(Websocket *websocket) {
+	switch (websocket->control_opcode) {
+	case WEBSOCKET_OPCODE_CLOSE_FRAME:
+		log_debug("WebSocket opcode 'close frame'");
 
-	while (websocket->send_queue.count > 0) {
-		queued_data = queue_peek(&websocket->send_queue);
+		websocket->closed = true;
 
-		websocket_send_frame(websocket, queued_data->buffer, queued_data->length);
+		// echo the status code, if any
+		(void)websocket_send_control_frame(websocket, WEBSOCKET_OPCODE_CLOSE_FRAME,
+		                                   websocket->control_payload,
+		                                   MIN(websocket->control_payload_length, 2));
 
-		queue_pop(&websocket->send_queue, websocket_free_queued_data);
+		return 0;
+
+	case WEBSOCKET_OPCODE_PING_FRAME:
+		log_packet_debug("WebSocket opcode 'ping', sending pong");
+
+		if (websocket_send_control_frame(websocket, WEBSOCKET_OPCODE_PONG_FRAME,
+		                                 websocket->control_payload,
+		                                 websocket->control_payload_length) < 0) {
+			log_error("Could not send WebSocket pong: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		return 0;
+
+	case WEBSOCKET_OPCODE_PONG_FRAME:
+		log_packet_debug("WebSocket opcode 'pong', ignoring it");
+
+		return 0;
 	}
+
+	log_error("Unknown WebSocket control opcode (%d)", websocket->control_opcode);
+
+	return -1;
 }
 
 int websocket_frame_get_opcode(WebsocketFrameHeader *header) {
@@ -191,11 +373,13 @@ int websocket_parse_handshake_line(Websocket *websocket, char *line, int length)
 
 			rc = websocket_answer_handshake_ok(websocket, base64, base64_length);
 
-			if (rc < 0) {
+			if (rc < 0 && rc != IO_CONTINUE) {
 				return rc;
 			}
 
-			websocket_send_queued_data(websocket);
+			if (websocket->handshake_done != NULL) {
+				websocket->handshake_done(websocket->handshake_done_opaque);
+			}
 
 			return IO_CONTINUE;
 		} else {
@@ -251,144 +435,269 @@ int websocket_parse_handshake(Websocket *websocket, char *handshake_part, int le
 	return IO_CONTINUE;
 }
 
-int websocket_parse_header(Websocket *websocket, uint8_t *buffer, int length) {
-	int websocket_frame_length = sizeof(WebsocketFrame);
-	int to_copy = MIN(length, websocket_frame_length - websocket->frame_index);
+// the complete header length is only known after the first two bytes are read
+static int websocket_get_frame_length(Websocket *websocket) {
+	if (websocket->frame_index < (int)sizeof(WebsocketFrameHeader)) {
+		return sizeof(WebsocketFrameHeader);
+	}
 
-	if (to_copy <= 0) {
-		log_error("WebSocket frame index has invalid value (%d)", websocket->frame_index);
-		return -1;
+	switch (websocket_frame_get_payload_length(&websocket->frame.header)) {
+	case 126:
+		return sizeof(WebsocketFrameExtended);
+
+	case 127:
+		return sizeof(WebsocketFrameExtended2);
+
+	default:
+		return sizeof(WebsocketFrame);
 	}
+}
+
+int websocket_parse_header(Websocket *websocket, uint8_t *buffer, int length) {
+	int offset = 0;
+	int frame_length;
+	int to_copy;
+	int fin;
+	int opcode;
+	int mask;
+	uint64_t payload_length;
+	uint8_t *extended;
+	uint8_t *masking_key;
+	int i;
+
+	while (websocket->frame_index < (frame_length = websocket_get_frame_length(websocket))) {
+		if (offset >= length) {
+			// wait for the rest of the header
+			return offset;
+		}
+
+		to_copy = MIN(length - offset, frame_length - websocket->frame_index);
+
+		memcpy(((uint8_t *)&websocket->frame) + websocket->frame_index, buffer + offset, to_copy);
 
-	memcpy(((char*)&websocket->frame) + websocket->frame_index, buffer, to_copy);
-	if (to_copy + websocket->frame_index < websocket_frame_length) {
 		websocket->frame_index += to_copy;
-		return IO_CONTINUE;
+		offset += to_copy;
+	}
+
+	fin = websocket_frame_get_fin(&websocket->frame.header);
+	opcode = websocket_frame_get_opcode(&websocket->frame.header);
+	payload_length = websocket_frame_get_payload_length(&websocket->frame.header);
+	mask = websocket_frame_get_mask(&websocket->frame.header);
+
+	// extended payload length is in network byte order
+	if (payload_length == 126) {
+		extended = (uint8_t *)&websocket->frame_extended.payload_length_extended;
+		masking_key = websocket->frame_extended.masking_key;
+		payload_length = ((uint64_t)extended[0] << 8) | extended[1];
+	} else if (payload_length == 127) {
+		extended = (uint8_t *)&websocket->frame_extended2.payload_length_extended;
+		masking_key = websocket->frame_extended2.masking_key;
+		payload_length = 0;
+
+		for (i = 0; i < 8; ++i) {
+			payload_length = (payload_length << 8) | extended[i];
+		}
 	} else {
-		int fin = websocket_frame_get_fin(&websocket->frame.header);
-		int opcode = websocket_frame_get_opcode(&websocket->frame.header);
-		int payload_length = websocket_frame_get_payload_length(&websocket->frame.header);
-		int mask = websocket_frame_get_mask(&websocket->frame.header);
+		masking_key = websocket->frame.masking_key;
+	}
 
-		log_packet_debug("WebSocket header received (fin: %d, opc: %d, len: %d, key: [%d %d %d %d])",
-		                 fin, opcode, payload_length,
-		                 websocket->frame.masking_key[0],
-		                 websocket->frame.masking_key[1],
-		                 websocket->frame.masking_key[2],
-		                 websocket->frame.masking_key[3]);
+	log_packet_debug("WebSocket header received (fin: %d, opc: %d, len: %" PRIu64 ", key: [%d %d %d %d])",
+	                 fin, opcode, payload_length,
+	                 masking_key[0], masking_key[1], masking_key[2], masking_key[3]);
 
-		if (mask != 1) {
-			log_error("WebSocket frame has invalid mask (%d)", mask);
+	if (mask != 1) {
+		log_error("WebSocket frame has invalid mask (%d)", mask);
 
-			return -1;
-		}
+		return -1;
+	}
 
-		if (payload_length == 126 || payload_length == 127) {
-			log_error("WebSocket frame with extended payload length not supported (%d)", payload_length);
+	if ((websocket->frame.header.opcode_rsv_fin & 0x70) != 0) {
+		log_error("WebSocket frame has reserved bits set, but no extension was negotiated");
 
-			return -1;
-		}
+		return -1;
+	}
 
-		switch (opcode) {
-		case WEBSOCKET_OPCODE_CONTINUATION_FRAME:
-		case WEBSOCKET_OPCODE_TEXT_FRAME:
-			log_error("WebSocket opcodes 'continuation' and 'text' not supported");
+	if ((payload_length >> 63) != 0) {
+		log_error("WebSocket frame has invalid payload length");
 
-			return -1;
+		return -1;
+	}
 
-		case WEBSOCKET_OPCODE_BINARY_FRAME:
-			websocket->mask_index = 0;
-			websocket->frame_index = 0;
-			websocket->to_read = payload_length;
-			websocket->state = WEBSOCKET_STATE_HEADER_DONE;
+	websocket->control_opcode = 0;
 
-			if (length - to_copy > 0) {
-				memmove(buffer, buffer + to_copy, length - to_copy);
+	switch (opcode) {
+	case WEBSOCKET_OPCODE_CONTINUATION_FRAME:
+		if (!websocket->fragmented) {
+			log_error("WebSocket continuation frame without preceding binary frame");
 
-				return websocket_parse_data(websocket, buffer, length - to_copy);
-			}
+			return -1;
+		}
 
-			return IO_CONTINUE;
+		websocket->fragmented = fin == 0;
 
-		case WEBSOCKET_OPCODE_CLOSE_FRAME:
-			log_debug("WebSocket opcode 'close frame'");
+		break;
 
-			return 0;
+	case WEBSOCKET_OPCODE_TEXT_FRAME:
+		log_error("WebSocket opcode 'text' not supported");
 
-		case WEBSOCKET_OPCODE_PING_FRAME:
-			log_error("WebSocket opcode 'ping' not supported");
+		return -1;
+
+	case WEBSOCKET_OPCODE_BINARY_FRAME:
+		if (websocket->fragmented) {
+			log_error("WebSocket binary frame while previous message is not finished");
 
 			return -1;
+		}
 
-		case WEBSOCKET_OPCODE_PONG_FRAME:
-			log_error("WebSocket opcode 'pong' not supported");
+		// the payload of all frames forms the TFP stream, so a fragmented
+		// message is handled as if its frames were separate messages
+		websocket->fragmented = fin == 0;
+
+		break;
+
+	case WEBSOCKET_OPCODE_CLOSE_FRAME:
+	case WEBSOCKET_OPCODE_PING_FRAME:
+	case WEBSOCKET_OPCODE_PONG_FRAME:
+		// control frames can be interleaved with the frames of a fragmented
+		// message, but cannot be fragmented themselves
+		if (fin != 1 || payload_length > WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH) {
+			log_error("WebSocket control frame is fragmented or too long (opc: %d)", opcode);
 
 			return -1;
 		}
+
+		websocket->control_opcode = opcode;
+		websocket->control_payload_length = 0;
+
+		break;
+
+	default:
+		log_error("Unknown WebSocket opcode (%d)", opcode);
+
+		return -1;
 	}
 
-	log_error("Unknown WebSocket opcode (%d)", websocket_frame_get_opcode(&websocket->frame.header));
+	memcpy(websocket->masking_key, masking_key, WEBSOCKET_MASK_LENGTH);
 
-	return -1;
+	websocket->mask_index = 0;
+	websocket->frame_index = 0;
+	websocket->to_read = payload_length;
+	websocket->state = WEBSOCKET_STATE_HEADER_DONE;
+
+	return offset;
 }
 
-int websocket_parse_data(Websocket *websocket, uint8_t *buffer, int length) {
+// unmasks LENGTH bytes of payload from SOURCE to TARGET. TARGET can be equal
+// to SOURCE or lie before it in the same buffer. the masking key is rotated to
+// the current mask index and repeated to unmask a whole word at once
+void websocket_parse_data(Websocket *websocket, uint8_t *target, const uint8_t *source, int length) {
+	uint8_t key_bytes[8];
+	uint64_t key;
+	uint64_t word;
 	int i;
-	int length_recursive_add = 0;
-	int to_read = MIN(length, websocket->to_read);
-
-	for (i = 0; i < to_read; i++) {
-		buffer[i] ^= websocket->frame.masking_key[websocket->mask_index];
-		websocket->mask_index++;
 
-		if (websocket->mask_index >= WEBSOCKET_MASK_LENGTH) {
-			websocket->mask_index = 0;
-		}
+	for (i = 0; i < (int)sizeof(key_bytes); ++i) {
+		key_bytes[i] = websocket->masking_key[(websocket->mask_index + i) % WEBSOCKET_MASK_LENGTH];
 	}
 
-	websocket->to_read -= to_read;
+	memcpy(&key, key_bytes, sizeof(key));
 
-	if (websocket->to_read < 0) {
-		log_error("WebSocket length mismatch (%d)", websocket->to_read);
+	// the word is read completely before it is written, this allows TARGET
+	// to overlap with SOURCE
+	for (i = 0; i + (int)sizeof(word) <= length; i += sizeof(word)) {
+		memcpy(&word, source + i, sizeof(word));
 
-		return -1;
-	} else if (websocket->to_read == 0) {
-		websocket->state = WEBSOCKET_STATE_HANDSHAKE_DONE;
-		websocket->mask_index = 0;
-		websocket->frame_index = 0;
+		word ^= key;
+
+		memcpy(target + i, &word, sizeof(word));
 	}
 
-	if (length > to_read) {
-		length_recursive_add = websocket_parse(websocket, buffer + to_read, length - to_read);
+	for (; i < length; ++i) {
+		target[i] = source[i] ^ key_bytes[i % sizeof(key_bytes)];
+	}
+
+	websocket->mask_index = (websocket->mask_index + length) % WEBSOCKET_MASK_LENGTH;
+}
+
+// parses all frames in BUFFER in one go. the unmasked payload of the data
+// frames is moved to the start of BUFFER. returns the length of the payload
+int websocket_parse(Websocket *websocket, void *buffer, int length) {
+	uint8_t *data = buffer;
+	int in = 0; // parsed bytes
+	int out = 0; // payload bytes
+	int to_read;
+	int rc;
 
-		if (length_recursive_add < 0) {
-			if (length_recursive_add == IO_CONTINUE) {
-				length_recursive_add = 0;
+	while (in < length && !websocket->closed) {
+		switch (websocket->state) {
+		case WEBSOCKET_STATE_WAIT_FOR_HANDSHAKE:
+		case WEBSOCKET_STATE_FOUND_HANDSHAKE_KEY:
+			// the client waits for the handshake answer before sending
+			// frames, so the handshake takes the whole buffer
+			rc = websocket_parse_handshake(websocket, (char *)data + in, length - in);
+
+			if (rc < 0 && rc != IO_CONTINUE) {
+				return rc;
+			}
+
+			in = length;
+
+			break;
+
+		case WEBSOCKET_STATE_HANDSHAKE_DONE:
+			rc = websocket_parse_header(websocket, data + in, length - in);
+
+			if (rc < 0) {
+				return rc;
+			}
+
+			in += rc;
+
+			break;
+
+		case WEBSOCKET_STATE_HEADER_DONE:
+			to_read = (int)MIN((uint64_t)(length - in), websocket->to_read);
+
+			if (websocket->control_opcode != 0) {
+				// control frame payload is not part of the TFP stream
+				websocket_parse_data(websocket, websocket->control_payload + websocket->control_payload_length,
+				                     data + in, to_read);
+
+				websocket->control_payload_length += to_read;
 			} else {
-				return length_recursive_add;
+				websocket_parse_data(websocket, data + out, data + in, to_read);
+
+				out += to_read;
 			}
+
+			in += to_read;
+			websocket->to_read -= to_read;
+
+			break;
+
+		default:
+			log_error("In invalid WebSocket state (%d)", websocket->state);
+
+			return -1;
 		}
-	}
 
-	return to_read + length_recursive_add;
-}
+		// this also finishes frames without payload right after their header
+		if (websocket->state == WEBSOCKET_STATE_HEADER_DONE && websocket->to_read == 0) {
+			websocket->state = WEBSOCKET_STATE_HANDSHAKE_DONE;
 
-int websocket_parse(Websocket *websocket, void *buffer, int length) {
-	switch (websocket->state) {
-	case WEBSOCKET_STATE_WAIT_FOR_HANDSHAKE:
-	case WEBSOCKET_STATE_FOUND_HANDSHAKE_KEY:
-		return websocket_parse_handshake(websocket, buffer, length);
+			if (websocket->control_opcode != 0) {
+				rc = websocket_handle_control_frame(websocket);
 
-	case WEBSOCKET_STATE_HANDSHAKE_DONE:
-		return websocket_parse_header(websocket, buffer, length);
+				websocket->control_opcode = 0;
 
-	case WEBSOCKET_STATE_HEADER_DONE:
-		return websocket_parse_data(websocket, buffer, length);
+				if (rc < 0) {
+					return rc;
+				}
+			}
+		}
 	}
 
-	log_error("In invalid WebSocket state (%d)", websocket->state);
-
-	return -1;
+	return out > 0 ? out : IO_CONTINUE;
 }
 
 // sets errno on error
@@ -403,16 +712,29 @@ int websocket_create(Websocket *websocket) {
 	websocket->base.send = websocket_send;
 
 	websocket->frame_index = 0;
+	websocket->mask_index = 0;
+	websocket->to_read = 0;
+	websocket->fragmented = false;
+	websocket->closed = false;
+	websocket->control_opcode = 0;
+	websocket->control_payload_length = 0;
+	websocket->send_pending_length = 0;
+	websocket->send_pending_offset = 0;
+	websocket->send_remaining = 0;
+	websocket->send_control_opcode = 0;
+	websocket->send_control_length = 0;
+	websocket->control_pending = false;
 	websocket->line_index = 0;
 	websocket->state = WEBSOCKET_STATE_WAIT_FOR_HANDSHAKE;
 
-	memset(&websocket->frame, 0, sizeof(WebsocketFrame));
+	memset(&websocket->frame_extended2, 0, sizeof(WebsocketFrameExtended2));
 	memset(websocket->line, 0, WEBSOCKET_MAX_LINE_LENGTH);
 	memset(websocket->client_key, 0, WEBSOCKET_CLIENT_KEY_LENGTH);
 
-	if (queue_create(&websocket->send_queue, sizeof(WebsocketQueuedData)) < 0) {
-		return -1;
-	}
+	websocket->handshake_done = NULL;
+	websocket->handshake_done_opaque = NULL;
+	websocket->control_pending_changed = NULL;
+	websocket->control_pending_opaque = NULL;
 
 	return 0;
 }
@@ -437,16 +759,39 @@ Socket *websocket_create_allocated(void) {
 }
 
 void websocket_destroy(Socket *socket) {
-	Websocket *websocket = (Websocket *)socket;
+	socket_destroy_platform(socket);
+}
 
-	queue_destroy(&websocket->send_queue, websocket_free_queued_data);
+// FUNCTION is called once the handshake is done and frames can be send. until
+// then the user of the WebSocket has to hold back its data, websocket_send
+// fails with EWOULDBLOCK
+void websocket_set_handshake_done_function(Websocket *websocket,
+                                           WebsocketHandshakeDoneFunction function,
+                                           void *opaque) {
+	websocket->handshake_done = function;
+	websocket->handshake_done_opaque = opaque;
+}
 
-	socket_destroy_platform(socket);
+// FUNCTION is called with true if a control frame could not be sent completely
+// and with false once it is sent. while pending, the user of the WebSocket has
+// to call websocket_send whenever the socket is writable, an empty write is
+// enough to continue the control frame
+void websocket_set_control_pending_function(Websocket *websocket,
+                                            WebsocketControlPendingFunction function,
+                                            void *opaque) {
+	websocket->control_pending_changed = function;
+	websocket->control_pending_opaque = opaque;
 }
 
 // sets errno on error
 int websocket_receive(Socket *socket, void *buffer, int length) {
 	Websocket *websocket = (Websocket *)socket;
+	int rc;
+
+	if (websocket->closed) {
+		// the close frame was received in the last call
+		return 0;
+	}
 
 	length = socket_receive_platform(socket, buffer, length);
 
@@ -454,38 +799,33 @@ int websocket_receive(Socket *socket, void *buffer, int length) {
 		return length;
 	}
 
-	return websocket_parse(websocket, buffer, length);
+	rc = websocket_parse(websocket, buffer, length);
+
+	// report the close frame now, if no payload was received before it
+	if (rc == IO_CONTINUE && websocket->closed) {
+		return 0;
+	}
+
+	return rc;
 }
 
 // sets errno on error
 int websocket_send(Socket *socket, const void *buffer, int length) {
 	Websocket *websocket = (Websocket *)socket;
-	WebsocketQueuedData *queued_data;
 
 	if (websocket->state == WEBSOCKET_STATE_HANDSHAKE_DONE ||
 	    websocket->state == WEBSOCKET_STATE_HEADER_DONE) {
-		return websocket_send_frame(websocket, buffer, length);
+		// the caller might pass more than one packet at once, e.g. from its
+		// backlog. all of them are send in one frame
+		return websocket_send_frames(websocket, buffer, length);
 	}
 
 	// initial handshake not finished yet
-	if (length > 0) {
-		queued_data = queue_push(&websocket->send_queue);
+#ifdef _WIN32
+	errno = ERRNO_WINAPI_OFFSET + WSAEWOULDBLOCK;
+#else
+	errno = EWOULDBLOCK;
+#endif
 
-		if (queued_data == NULL) {
-			return -1;
-		}
-
-		queued_data->buffer = malloc(length);
-		queued_data->length = length;
-
-		if (queued_data->buffer == NULL) {
-			errno = ENOMEM;
-
-			return -1;
-		}
-
-		memcpy(queued_data->buffer, buffer, length);
-	}
-
-	return length;
+	return -1;
 }
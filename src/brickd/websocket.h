@@ -23,9 +23,9 @@
 #ifndef BRICKD_WEBSOCKET_H
 #define BRICKD_WEBSOCKET_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
-#include <daemonlib/queue.h>
 #include <daemonlib/socket.h>
 
 #define WEBSOCKET_MAX_LINE_LENGTH 100 // Line length > 100 are not interesting for us
@@ -50,6 +50,10 @@
 #define WEBSOCKET_MASK_LENGTH 4
 
 #define WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH 125
+#define WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH 125
+
+#define WEBSOCKET_MAX_SEND_HEADER_LENGTH 10 // server frames are not masked
+#define WEBSOCKET_MAX_COALESCED_PAYLOAD_DATA_LENGTH 1024 // copied behind the header to save a send call
 
 #include <daemonlib/packed_begin.h>
 
@@ -91,6 +95,9 @@ typedef enum {
 	WEBSOCKET_STATE_HEADER_DONE
 } WebsocketState;
 
+typedef void (*WebsocketHandshakeDoneFunction)(void *opaque);
+typedef void (*WebsocketControlPendingFunction)(bool pending, void *opaque);
+
 typedef struct {
 	Socket base;
 
@@ -101,13 +108,38 @@ typedef struct {
 	char line[WEBSOCKET_MAX_LINE_LENGTH];
 	int line_index;
 
-	WebsocketFrame frame;
+	union {
+		WebsocketFrame frame;
+		WebsocketFrameExtended frame_extended;
+		WebsocketFrameExtended2 frame_extended2;
+	};
 	int frame_index;
+	uint8_t masking_key[WEBSOCKET_MASK_LENGTH];
 	int mask_index;
 
-	int to_read;
-
-	Queue send_queue;
+	uint64_t to_read;
+	bool fragmented; // inside a binary message split into continuation frames
+	bool closed; // close frame received
+	int control_opcode; // of the control frame currently being received, 0 for data frames
+	uint8_t control_payload[WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH];
+	int control_payload_length;
+
+	// header bytes of the current frame or a complete control frame that could
+	// not be sent completely yet
+	uint8_t send_pending[WEBSOCKET_MAX_SEND_HEADER_LENGTH + WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH];
+	int send_pending_length;
+	int send_pending_offset;
+	uint64_t send_remaining; // payload bytes of the current frame not sent yet
+
+	int send_control_opcode; // control frame to be send between data frames, 0 for none
+	uint8_t send_control_payload[WEBSOCKET_MAX_CONTROL_PAYLOAD_DATA_LENGTH];
+	int send_control_length;
+	bool control_pending; // a control frame is waiting or partly sent
+
+	WebsocketHandshakeDoneFunction handshake_done;
+	void *handshake_done_opaque;
+	WebsocketControlPendingFunction control_pending_changed;
+	void *control_pending_opaque;
 } Websocket;
 
 int websocket_frame_get_opcode(WebsocketFrameHeader *header);
@@ -124,12 +156,18 @@ int websocket_answer_handshake_ok(Websocket *websocket, char *key, int length);
 int websocket_parse_handshake_line(Websocket *websocket, char *line, int length);
 int websocket_parse_handshake(Websocket *websocket, char *handshake_part, int length);
 int websocket_parse_header(Websocket *websocket, uint8_t *buffer, int length);
-int websocket_parse_data(Websocket *websocket, uint8_t *buffer, int length);
+void websocket_parse_data(Websocket *websocket, uint8_t *target, const uint8_t *source, int length);
 int websocket_parse(Websocket *websocket, void *buffer, int length);
 
 int websocket_create(Websocket *websocket);
 Socket *websocket_create_allocated(void);
 void websocket_destroy(Socket *socket);
+void websocket_set_handshake_done_function(Websocket *websocket,
+                                           WebsocketHandshakeDoneFunction function,
+                                           void *opaque);
+void websocket_set_control_pending_function(Websocket *websocket,
+                                            WebsocketControlPendingFunction function,
+                                            void *opaque);
 int websocket_receive(Socket *socket, void *buffer, int length);
 int websocket_send(Socket *socket, const void *buffer, int length);
 
@@ -42,7 +42,11 @@ int zombie_create(Zombie *zombie, Client *client) {
 	Node *pending_request_client_node;
 	PendingRequest *pending_request;
 
+#ifdef DAEMONLIB_WITH_EVENT_THREADS
+	zombie->id = __atomic_fetch_add(&_next_id, 1, __ATOMIC_RELAXED); // might be called from network workers
+#else
 	zombie->id = _next_id++;
+#endif
 	zombie->finished = false;
 	zombie->pending_request_count = client->pending_request_count;
 
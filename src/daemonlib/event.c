@@ -21,6 +21,8 @@
  */
 
 #include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "event.h"
@@ -32,10 +34,33 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-static bool _running;
-static bool _stop_requested;
-static Array _event_sources;
-static Pipe _stop_pipe;
+static EVENT_THREAD_LOCAL bool _running;
+static EVENT_THREAD_LOCAL bool _stop_requested;
+static EVENT_THREAD_LOCAL Array _event_sources;
+static EVENT_THREAD_LOCAL Pipe _stop_pipe;
+
+// bucket N counts handler durations below 2^N microseconds, the last bucket
+// also counts all longer durations
+#define EVENT_PROFILE_BUCKET_COUNT 20
+#define EVENT_PROFILE_MAX_NAME_LENGTH 32
+
+typedef struct {
+	char name[EVENT_PROFILE_MAX_NAME_LENGTH];
+	uint64_t calls;
+	uint64_t total_duration; // microseconds
+	uint64_t max_duration; // microseconds
+	uint32_t buckets[EVENT_PROFILE_BUCKET_COUNT];
+} EventProfile;
+
+// profiling is enabled before the first event loop is initialized and stays
+// unchanged afterwards, the collected data is per event loop
+static bool _profiling = false;
+static uint64_t _stall_threshold = 0; // microseconds, 0 = no stall warnings
+static EVENT_THREAD_LOCAL Array _profiles;
+static EVENT_THREAD_LOCAL uint64_t _iteration_count;
+static EVENT_THREAD_LOCAL uint64_t _handled_count;
+static EVENT_THREAD_LOCAL int _iteration_handled_count;
+static EVENT_THREAD_LOCAL int _max_iteration_handled_count;
 
 extern int event_init_platform(void);
 extern void event_exit_platform(void);
@@ -96,8 +121,29 @@ int event_init(void) {
 
 	phase = 4;
 
+	if (_profiling) {
+		_iteration_count = 0;
+		_handled_count = 0;
+		_iteration_handled_count = 0;
+		_max_iteration_handled_count = 0;
+
+		if (array_create(&_profiles, 16, sizeof(EventProfile), true) < 0) {
+			log_error("Could not create event profile array: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+	}
+
+	phase = 5;
+
 cleanup:
 	switch (phase) { // no breaks, all cases fall through intentionally
+	case 4:
+		event_remove_source(_stop_pipe.base.read_handle, EVENT_SOURCE_TYPE_GENERIC);
+		event_cleanup_sources();
+		// fall through
+
 	case 3:
 		pipe_destroy(&_stop_pipe);
 		// fall through
@@ -114,7 +160,7 @@ cleanup:
 		break;
 	}
 
-	return phase == 4 ? 0 : -1;
+	return phase == 5 ? 0 : -1;
 }
 
 void event_exit(void) {
@@ -139,6 +185,12 @@ void event_exit(void) {
 	}
 
 	array_destroy(&_event_sources, NULL);
+
+	if (_profiling) {
+		event_log_profile();
+
+		array_destroy(&_profiles, NULL);
+	}
 }
 
 static EventSource *event_find_source(int start, int end, IOHandle handle,
@@ -433,7 +485,132 @@ void event_cleanup_sources(void) {
 	}
 }
 
-void event_handle_source(EventSource *event_source, uint32_t received_events) {
+static int event_get_profile_bucket(uint64_t duration) {
+	int bucket = 0;
+
+	while (duration > 0 && bucket < EVENT_PROFILE_BUCKET_COUNT - 1) {
+		duration >>= 1;
+		++bucket;
+	}
+
+	return bucket;
+}
+
+static EventProfile *event_get_profile(const char *name) {
+	int i;
+	EventProfile *profile;
+
+	for (i = 0; i < _profiles.count; ++i) {
+		profile = array_get(&_profiles, i);
+
+		if (strncmp(profile->name, name, sizeof(profile->name) - 1) == 0) {
+			return profile;
+		}
+	}
+
+	profile = array_append(&_profiles);
+
+	if (profile == NULL) {
+		log_error("Could not append to event profile array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return NULL;
+	}
+
+	memset(profile, 0, sizeof(EventProfile));
+	string_copy(profile->name, sizeof(profile->name), name, -1);
+
+	return profile;
+}
+
+static void event_profile_source(EventSource *event_source, uint32_t received_events,
+                                 uint64_t duration) {
+	EventProfile *profile;
+
+	++_handled_count;
+	++_iteration_handled_count;
+
+	profile = event_get_profile(event_source->name != NULL ? event_source->name : "<unnamed>");
+
+	if (profile != NULL) {
+		++profile->calls;
+		profile->total_duration += duration;
+		profile->max_duration = MAX(profile->max_duration, duration);
+
+		++profile->buckets[event_get_profile_bucket(duration)];
+	}
+
+	if (_stall_threshold > 0 && duration >= _stall_threshold) {
+		log_warn("Handling %s event source (handle: %d, name: %s, received-events: 0x%04X) blocked the event loop for %" PRIu64 ".%03" PRIu64 " msec",
+		         event_get_source_type_name(event_source->type, false),
+		         event_source->handle, event_source->name, received_events,
+		         duration / 1000, duration % 1000);
+	}
+}
+
+// STALL_THRESHOLD is in milliseconds. has to be called before event_init
+void event_enable_profiling(uint32_t stall_threshold) {
+	_profiling = true;
+	_stall_threshold = (uint64_t)stall_threshold * 1000;
+}
+
+void event_log_profile(void) {
+	int i;
+	int k;
+	EventProfile *profile;
+	char histogram[512];
+	char bucket[48];
+
+	if (!_profiling) {
+		return;
+	}
+
+	log_info("Event loop profile: %" PRIu64 " iteration(s), %" PRIu64 " event source(s) handled, %.2f per iteration on average, %d at most",
+	         _iteration_count, _handled_count,
+	         _iteration_count > 0 ? (double)_handled_count / _iteration_count : 0.0,
+	         _max_iteration_handled_count);
+
+	for (i = 0; i < _profiles.count; ++i) {
+		profile = array_get(&_profiles, i);
+		histogram[0] = '\0';
+
+		for (k = 0; k < EVENT_PROFILE_BUCKET_COUNT; ++k) {
+			if (profile->buckets[k] == 0) {
+				continue;
+			}
+
+			if (k < EVENT_PROFILE_BUCKET_COUNT - 1) {
+				snprintf(bucket, sizeof(bucket), "%s<%u: %u", histogram[0] != '\0' ? ", " : "",
+				         1u << k, profile->buckets[k]);
+			} else {
+				snprintf(bucket, sizeof(bucket), "%s>=%u: %u", histogram[0] != '\0' ? ", " : "",
+				         1u << (k - 1), profile->buckets[k]);
+			}
+
+			string_append(histogram, sizeof(histogram), bucket);
+		}
+
+		log_info("Event loop profile of %s event source(s): %" PRIu64 " call(s), %.1f usec on average, %" PRIu64 " usec at most, histogram in usec: %s",
+		         profile->name, profile->calls,
+		         profile->calls > 0 ? (double)profile->total_duration / profile->calls : 0.0,
+		         profile->max_duration, histogram);
+	}
+}
+
+// called by the platform specific event loops after handling all event sources
+// that were reported as ready by one wait
+void event_count_iteration(void) {
+	if (!_profiling) {
+		return;
+	}
+
+	++_iteration_count;
+
+	_max_iteration_handled_count = MAX(_max_iteration_handled_count, _iteration_handled_count);
+	_iteration_handled_count = 0;
+}
+
+static void event_dispatch_source(EventSource *event_source, uint32_t received_events) {
 	if (event_source->state != EVENT_SOURCE_STATE_NORMAL) {
 		log_event_debug("Ignoring %s event source (handle: %d, name: %s, received-events: 0x%04X) in state transition",
 		                event_get_source_type_name(event_source->type, false),
@@ -516,6 +693,22 @@ void event_handle_source(EventSource *event_source, uint32_t received_events) {
 	}
 }
 
+void event_handle_source(EventSource *event_source, uint32_t received_events) {
+	uint64_t start;
+
+	if (!_profiling) {
+		event_dispatch_source(event_source, received_events);
+
+		return;
+	}
+
+	start = microtime();
+
+	event_dispatch_source(event_source, received_events);
+
+	event_profile_source(event_source, received_events, microtime() - start);
+}
+
 int event_run(EventCleanupFunction cleanup) {
 	int rc;
 
@@ -544,7 +737,7 @@ int event_run(EventCleanupFunction cleanup) {
 	return rc;
 }
 
-// might be called from a non-main-thread
+// might be called from a non-main-thread, see EVENT_THREAD_LOCAL
 void event_stop(void) {
 	uint8_t byte = 0;
 
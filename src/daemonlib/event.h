@@ -35,6 +35,15 @@
 
 #include "io.h"
 
+// with DAEMONLIB_WITH_EVENT_THREADS the event loop state is thread-local and
+// each thread can run its own event loop. in this case event_stop stops the
+// event loop of the calling thread only
+#ifdef DAEMONLIB_WITH_EVENT_THREADS
+	#define EVENT_THREAD_LOCAL __thread
+#else
+	#define EVENT_THREAD_LOCAL
+#endif
+
 typedef void (*EventFunction)(void *opaque);
 typedef void (*EventCleanupFunction)(void);
 
@@ -101,6 +110,10 @@ void event_remove_source(IOHandle handle, EventSourceType type);
 void event_cleanup_sources(void);
 
 void event_handle_source(EventSource *event_source, uint32_t received_events);
+void event_count_iteration(void);
+
+void event_enable_profiling(uint32_t stall_threshold);
+void event_log_profile(void);
 
 int event_run(EventCleanupFunction cleanup);
 void event_stop(void);
@@ -34,8 +34,8 @@
 
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
 
-static int _epollfd;
-static int _epollfd_event_count;
+static EVENT_THREAD_LOCAL int _epollfd;
+static EVENT_THREAD_LOCAL int _epollfd_event_count;
 
 int event_init_platform(void) {
 	// create epollfd
@@ -178,6 +178,8 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 
 		log_event_debug("Handled all ready event sources");
 
+		event_count_iteration();
+
 		// now cleanup event sources that got marked as disconnected/removed
 		// during the event handling
 		cleanup();
@@ -141,6 +141,8 @@ int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction
 			         handled, ready);
 		}
 
+		event_count_iteration();
+
 		// now cleanup event sources that got marked as disconnected/removed
 		// during the event handling
 		cleanup();
@@ -0,0 +1,1094 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * event_uring.c: io_uring based event loop
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * event sources are watched by one-shot poll requests that get rearmed after
+ * each delivery. this keeps the level-triggered behavior of the epoll and poll
+ * based event loops: a function that does not drain its event source gets
+ * called again. rearming costs no extra syscall, all queued requests are
+ * submitted together with the wait for the next completions.
+ *
+ * accepted sockets can be attached by the socket layer. for an attached
+ * socket the event loop keeps a read into a registered receive buffer in
+ * flight, and sending only copies to a registered send buffer. all sends
+ * queued during one iteration are submitted at once with the next wait. the
+ * read and write events of an attached socket are derived from its buffers:
+ * readable while received data, EOF or an error is pending, writable while
+ * the send buffer has room. in the common case a request and its response do
+ * not cost a syscall of their own anymore.
+ *
+ * liburing is not used, the few syscalls and the ring handling are simple
+ * enough to do them directly.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "event.h"
+#include "event_uring.h"
+
+#include "array.h"
+#include "log.h"
+#include "utils.h"
+
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
+#define URING_ENTRIES 256
+#define URING_SOCKET_SLOTS 128
+#define URING_RECEIVE_BUFFER_SIZE 4096
+#define URING_SEND_BUFFER_SIZE 16384
+#define URING_SLOT_SIZE (URING_RECEIVE_BUFFER_SIZE + URING_SEND_BUFFER_SIZE)
+#define URING_MAX_READY_ROUNDS 64
+
+// the user data of a request: generation << 32 | index << 2 | kind
+#define URING_KIND_POLL 0
+#define URING_KIND_RECEIVE 1
+#define URING_KIND_SEND 2
+#define URING_KIND_CANCEL 3
+
+#define URING_USER_DATA(generation, index, kind) \
+	((uint64_t)(generation) << 32 | (uint64_t)(index) << 2 | (kind))
+
+typedef struct {
+	EventSource *event_source; // NULL if unused
+	uint32_t generation; // incremented on each (re)arm with changed events
+} UringPoll;
+
+typedef struct {
+	IOHandle handle; // IO_HANDLE_INVALID if the slot is unused
+	bool attached; // false while in flight requests drain after detach
+	EventSource *event_source;
+	int pending; // requests in flight
+	bool receiving;
+	bool sending;
+	bool send_queued;
+	bool ready;
+	uint8_t *receive_buffer;
+	int receive_offset;
+	int receive_length;
+	bool receive_eof;
+	int error; // errno of the first failed request, 0 if none failed
+	uint8_t *send_buffer;
+	int send_length; // in flight and queued bytes
+} UringSocket;
+
+static int _ring_fd = -1;
+static uint8_t *_sq_ring = MAP_FAILED;
+static size_t _sq_ring_size;
+static uint8_t *_cq_ring = MAP_FAILED;
+static size_t _cq_ring_size;
+static struct io_uring_sqe *_sqes = MAP_FAILED;
+static size_t _sqes_size;
+static unsigned *_sq_head;
+static unsigned *_sq_tail;
+static unsigned _sq_mask;
+static unsigned _sq_entries;
+static unsigned _sq_local_tail;
+static unsigned *_cq_head;
+static unsigned *_cq_tail;
+static unsigned _cq_mask;
+static struct io_uring_cqe *_cqes;
+static int _source_count;
+static Array _polls;
+static uint8_t *_buffers = MAP_FAILED;
+static bool _fixed_buffers;
+static UringSocket _sockets[URING_SOCKET_SLOTS];
+static int _ready_sockets[URING_SOCKET_SLOTS];
+static int _ready_socket_count;
+static int _send_sockets[URING_SOCKET_SLOTS];
+static int _send_socket_count;
+static uint64_t _socket_progress; // incremented on each receive and send
+
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(unsigned to_submit, unsigned min_complete) {
+	return (int)syscall(__NR_io_uring_enter, _ring_fd, to_submit, min_complete,
+	                    IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+static int uring_register(unsigned opcode, const void *arg, unsigned count) {
+	return (int)syscall(__NR_io_uring_register, _ring_fd, opcode, arg, count);
+}
+
+// sets errno on error
+static int uring_submit(unsigned min_complete) {
+	unsigned to_submit;
+
+	__atomic_store_n(_sq_tail, _sq_local_tail, __ATOMIC_RELEASE);
+
+	to_submit = _sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE);
+
+	return uring_enter(to_submit, min_complete);
+}
+
+static struct io_uring_sqe *uring_get_sqe(void) {
+	struct io_uring_sqe *sqe;
+
+	if (_sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) {
+		// submission queue is full, submit without waiting
+		if (uring_submit(0) < 0 && !errno_interrupted()) {
+			log_error("Could not submit to io_uring: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return NULL;
+		}
+
+		if (_sq_local_tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) >= _sq_entries) {
+			log_error("io_uring submission queue is still full");
+
+			return NULL;
+		}
+	}
+
+	sqe = &_sqes[_sq_local_tail & _sq_mask];
+
+	memset(sqe, 0, sizeof(*sqe));
+
+	++_sq_local_tail;
+
+	return sqe;
+}
+
+static int uring_queue_poll(IOHandle handle, uint32_t events, uint64_t user_data) {
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	if (sqe == NULL) {
+		return -1;
+	}
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = handle;
+	sqe->poll32_events = events;
+	sqe->user_data = user_data;
+
+	return 0;
+}
+
+static void uring_queue_cancel(uint8_t opcode, uint64_t user_data) {
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	if (sqe == NULL) {
+		return;
+	}
+
+	sqe->opcode = opcode;
+	sqe->fd = -1;
+	sqe->addr = user_data;
+	sqe->user_data = URING_USER_DATA(0, 0, URING_KIND_CANCEL);
+}
+
+static UringPoll *uring_find_poll(EventSource *event_source, int *index) {
+	int i;
+	UringPoll *poll;
+
+	for (i = 0; i < _polls.count; ++i) {
+		poll = array_get(&_polls, i);
+
+		if (poll->event_source == event_source) {
+			*index = i;
+
+			return poll;
+		}
+	}
+
+	return NULL;
+}
+
+static int uring_find_socket(IOHandle handle) {
+	int slot;
+
+	for (slot = 0; slot < URING_SOCKET_SLOTS; ++slot) {
+		if (_sockets[slot].handle == handle && _sockets[slot].attached) {
+			return slot;
+		}
+	}
+
+	return -1;
+}
+
+static void uring_mark_socket_ready(int slot) {
+	if (!_sockets[slot].ready) {
+		_sockets[slot].ready = true;
+		_ready_sockets[_ready_socket_count++] = slot;
+	}
+}
+
+static uint32_t uring_get_socket_events(UringSocket *socket) {
+	uint32_t events = 0;
+
+	if (!socket->attached || socket->event_source == NULL) {
+		return 0;
+	}
+
+	if (socket->receive_offset < socket->receive_length ||
+	    socket->receive_eof || socket->error != 0) {
+		events |= EVENT_READ;
+	}
+
+	if (socket->send_length < URING_SEND_BUFFER_SIZE || socket->error != 0) {
+		events |= EVENT_WRITE;
+	}
+
+	return events & socket->event_source->events;
+}
+
+static void uring_queue_receive(int slot) {
+	UringSocket *socket = &_sockets[slot];
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	if (sqe == NULL) {
+		socket->error = EIO;
+
+		uring_mark_socket_ready(slot);
+
+		return;
+	}
+
+	sqe->opcode = _fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = socket->handle;
+	sqe->off = (uint64_t)-1; // sockets have no file position
+	sqe->addr = (uint64_t)(uintptr_t)socket->receive_buffer;
+	sqe->len = URING_RECEIVE_BUFFER_SIZE;
+	sqe->buf_index = _fixed_buffers ? slot : 0;
+	sqe->user_data = URING_USER_DATA(0, slot, URING_KIND_RECEIVE);
+
+	socket->receiving = true;
+	++socket->pending;
+}
+
+static void uring_queue_send(int slot) {
+	UringSocket *socket = &_sockets[slot];
+	struct io_uring_sqe *sqe = uring_get_sqe();
+
+	if (sqe == NULL) {
+		socket->error = EIO;
+
+		uring_mark_socket_ready(slot);
+
+		return;
+	}
+
+	sqe->opcode = _fixed_buffers ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+	sqe->fd = socket->handle;
+	sqe->off = (uint64_t)-1;
+	sqe->addr = (uint64_t)(uintptr_t)socket->send_buffer;
+	sqe->len = socket->send_length;
+	sqe->buf_index = _fixed_buffers ? slot : 0;
+	sqe->user_data = URING_USER_DATA(0, slot, URING_KIND_SEND);
+
+	socket->sending = true;
+	++socket->pending;
+}
+
+// queue one send per socket for everything that got sent since the last wait
+static void uring_queue_sends(void) {
+	int i;
+	int slot;
+	UringSocket *socket;
+
+	for (i = 0; i < _send_socket_count; ++i) {
+		slot = _send_sockets[i];
+		socket = &_sockets[slot];
+
+		socket->send_queued = false;
+
+		if (socket->attached && !socket->sending &&
+		    socket->send_length > 0 && socket->error == 0) {
+			uring_queue_send(slot);
+		}
+	}
+
+	_send_socket_count = 0;
+}
+
+static void uring_release_socket(UringSocket *socket) {
+	socket->handle = IO_HANDLE_INVALID;
+	socket->event_source = NULL;
+}
+
+static void uring_handle_socket_completion(int slot, int kind, int result) {
+	UringSocket *socket = &_sockets[slot];
+
+	--socket->pending;
+
+	if (kind == URING_KIND_RECEIVE) {
+		socket->receiving = false;
+	} else {
+		socket->sending = false;
+	}
+
+	if (!socket->attached) {
+		if (socket->pending == 0) {
+			uring_release_socket(socket);
+		}
+
+		return;
+	}
+
+	if (result == -EAGAIN || result == -EINTR) {
+		if (kind == URING_KIND_RECEIVE) {
+			uring_queue_receive(slot);
+		} else {
+			uring_queue_send(slot);
+		}
+
+		return;
+	}
+
+	if (result < 0) {
+		if (socket->error == 0) {
+			socket->error = -result;
+		}
+	} else if (kind == URING_KIND_RECEIVE) {
+		if (result == 0) {
+			socket->receive_eof = true;
+		} else {
+			socket->receive_offset = 0;
+			socket->receive_length = result;
+		}
+	} else if (result == 0) {
+		// a stream socket never accepts nothing from a non-empty send. resubmitting
+		// would likely get the same answer forever, so fail the socket instead of
+		// leaving the data waiting for a completion that never comes
+		if (socket->error == 0) {
+			socket->error = EIO;
+		}
+	} else {
+		socket->send_length -= result;
+
+		if (socket->send_length > 0) {
+			// the rest of the in flight data and everything sent while it
+			// was in flight goes out with the next submission
+			memmove(socket->send_buffer, socket->send_buffer + result, socket->send_length);
+			uring_queue_send(slot);
+		}
+	}
+
+	uring_mark_socket_ready(slot);
+}
+
+static void uring_handle_poll_completion(int index, uint32_t generation, int result) {
+	UringPoll *poll;
+	EventSource *event_source;
+
+	if (index >= _polls.count) {
+		return;
+	}
+
+	poll = array_get(&_polls, index);
+	event_source = poll->event_source;
+
+	// the event source got modified or removed since the poll was armed
+	if (event_source == NULL || poll->generation != generation) {
+		return;
+	}
+
+	if (result < 0) {
+		if (result != -ECANCELED) {
+			log_error("Could not poll %s event source (handle: %d, name: %s): %s (%d)",
+			          event_get_source_type_name(event_source->type, false),
+			          event_source->handle, event_source->name,
+			          get_errno_name(-result), -result);
+		}
+
+		return;
+	}
+
+	event_handle_source(event_source, (uint32_t)result);
+
+	// the array might have been reallocated by the event function
+	poll = array_get(&_polls, index);
+
+	if (poll->event_source == event_source && poll->generation == generation &&
+	    event_source->events != 0) {
+		uring_queue_poll(event_source->handle, event_source->events,
+		                 URING_USER_DATA(generation, index, URING_KIND_POLL));
+	}
+}
+
+static void uring_handle_completions(bool *running) {
+	unsigned head = *_cq_head;
+	struct io_uring_cqe *cqe;
+	uint64_t user_data;
+	int result;
+
+	while (*running && head != __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE)) {
+		cqe = &_cqes[head & _cq_mask];
+		user_data = cqe->user_data;
+		result = cqe->res;
+
+		// release the entry before handling it, the event functions can
+		// cause submissions that might have to wait for completions
+		__atomic_store_n(_cq_head, ++head, __ATOMIC_RELEASE);
+
+		switch (user_data & 3) {
+		case URING_KIND_POLL:
+			uring_handle_poll_completion((int)(uint32_t)(user_data >> 2 & 0x3FFFFFFF),
+			                             (uint32_t)(user_data >> 32), result);
+			break;
+
+		case URING_KIND_RECEIVE:
+		case URING_KIND_SEND:
+			uring_handle_socket_completion((int)(user_data >> 2 & 0x3FFFFFFF),
+			                               (int)(user_data & 3), result);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+// attached sockets have no poll request, deliver their events as long as the
+// event functions make progress on them
+static void uring_handle_ready_sockets(bool *running) {
+	int ready_sockets[URING_SOCKET_SLOTS];
+	int ready_socket_count;
+	int round;
+	int i;
+	int slot;
+	uint32_t events;
+	uint64_t progress;
+	EventSource *event_source;
+
+	for (round = 0; *running && _ready_socket_count > 0 && round < URING_MAX_READY_ROUNDS; ++round) {
+		progress = _socket_progress;
+		ready_socket_count = _ready_socket_count;
+
+		memcpy(ready_sockets, _ready_sockets, sizeof(int) * ready_socket_count);
+
+		_ready_socket_count = 0;
+
+		for (i = 0; i < ready_socket_count; ++i) {
+			_sockets[ready_sockets[i]].ready = false;
+		}
+
+		for (i = 0; *running && i < ready_socket_count; ++i) {
+			slot = ready_sockets[i];
+			events = uring_get_socket_events(&_sockets[slot]);
+
+			if (events == 0) {
+				continue;
+			}
+
+			event_source = _sockets[slot].event_source;
+
+			// a (re-)added or modified event source is normal again after
+			// the next cleanup, try again after that
+			if (event_source->state != EVENT_SOURCE_STATE_NORMAL) {
+				uring_mark_socket_ready(slot);
+
+				continue;
+			}
+
+			event_handle_source(event_source, events);
+
+			if (uring_get_socket_events(&_sockets[slot]) != 0) {
+				uring_mark_socket_ready(slot);
+			}
+		}
+
+		if (_socket_progress == progress) {
+			break;
+		}
+	}
+}
+
+int event_init_platform(void) {
+	int phase = 0;
+	struct io_uring_params params;
+	struct iovec iovecs[URING_SOCKET_SLOTS];
+	unsigned i;
+
+	memset(&params, 0, sizeof(params));
+
+	// the ring is only used by the event loop thread. let the kernel defer
+	// completion work until the event loop waits, if supported
+#if defined IORING_SETUP_SINGLE_ISSUER && defined IORING_SETUP_DEFER_TASKRUN
+	params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+#endif
+
+	_ring_fd = uring_setup(URING_ENTRIES, &params);
+
+	if (_ring_fd < 0 && errno == EINVAL && params.flags != 0) {
+		memset(&params, 0, sizeof(params));
+
+		_ring_fd = uring_setup(URING_ENTRIES, &params);
+	}
+
+	if (_ring_fd < 0) {
+		log_error("Could not create io_uring: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 1;
+
+	_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		_sq_ring_size = MAX(_sq_ring_size, _cq_ring_size);
+		_cq_ring_size = _sq_ring_size;
+	}
+
+	_sq_ring = mmap(NULL, _sq_ring_size, PROT_READ | PROT_WRITE,
+	                MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQ_RING);
+
+	if (_sq_ring == MAP_FAILED) {
+		log_error("Could not map io_uring submission queue: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 2;
+
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		_cq_ring = _sq_ring;
+	} else {
+		_cq_ring = mmap(NULL, _cq_ring_size, PROT_READ | PROT_WRITE,
+		                MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_CQ_RING);
+
+		if (_cq_ring == MAP_FAILED) {
+			log_error("Could not map io_uring completion queue: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+	}
+
+	phase = 3;
+
+	_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	_sqes = mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE,
+	             MAP_SHARED | MAP_POPULATE, _ring_fd, IORING_OFF_SQES);
+
+	if (_sqes == MAP_FAILED) {
+		log_error("Could not map io_uring submission queue entries: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 4;
+
+	_sq_head = (unsigned *)(_sq_ring + params.sq_off.head);
+	_sq_tail = (unsigned *)(_sq_ring + params.sq_off.tail);
+	_sq_mask = *(unsigned *)(_sq_ring + params.sq_off.ring_mask);
+	_sq_entries = params.sq_entries;
+	_sq_local_tail = *_sq_tail;
+	_cq_head = (unsigned *)(_cq_ring + params.cq_off.head);
+	_cq_tail = (unsigned *)(_cq_ring + params.cq_off.tail);
+	_cq_mask = *(unsigned *)(_cq_ring + params.cq_off.ring_mask);
+	_cqes = (struct io_uring_cqe *)(_cq_ring + params.cq_off.cqes);
+
+	// submission queue entries are always used in ring order
+	for (i = 0; i < params.sq_entries; ++i) {
+		((unsigned *)(_sq_ring + params.sq_off.array))[i] = i;
+	}
+
+	if (array_create(&_polls, 32, sizeof(UringPoll), true) < 0) {
+		log_error("Could not create io_uring poll array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 5;
+
+	_buffers = mmap(NULL, URING_SOCKET_SLOTS * URING_SLOT_SIZE, PROT_READ | PROT_WRITE,
+	                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (_buffers == MAP_FAILED) {
+		log_error("Could not allocate io_uring socket buffers: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		goto cleanup;
+	}
+
+	phase = 6;
+
+	for (i = 0; i < URING_SOCKET_SLOTS; ++i) {
+		memset(&_sockets[i], 0, sizeof(UringSocket));
+
+		_sockets[i].handle = IO_HANDLE_INVALID;
+		_sockets[i].receive_buffer = _buffers + i * URING_SLOT_SIZE;
+		_sockets[i].send_buffer = _sockets[i].receive_buffer + URING_RECEIVE_BUFFER_SIZE;
+
+		iovecs[i].iov_base = _sockets[i].receive_buffer;
+		iovecs[i].iov_len = URING_SLOT_SIZE;
+	}
+
+	// registered buffers are pinned and count against RLIMIT_MEMLOCK. if that
+	// is too low then use the same buffers without registration
+	_fixed_buffers = uring_register(IORING_REGISTER_BUFFERS, iovecs, URING_SOCKET_SLOTS) >= 0;
+
+	if (!_fixed_buffers) {
+		log_warn("Could not register io_uring socket buffers, using unregistered buffers instead: %s (%d)",
+		         get_errno_name(errno), errno);
+	}
+
+	_source_count = 0;
+	_ready_socket_count = 0;
+	_send_socket_count = 0;
+	_socket_progress = 0;
+
+	phase = 7;
+
+cleanup:
+	switch (phase) { // no breaks, all cases fall through intentionally
+	case 6:
+		munmap(_buffers, URING_SOCKET_SLOTS * URING_SLOT_SIZE);
+		// fall through
+
+	case 5:
+		array_destroy(&_polls, NULL);
+		// fall through
+
+	case 4:
+		munmap(_sqes, _sqes_size);
+		// fall through
+
+	case 3:
+		if (_cq_ring != _sq_ring) {
+			munmap(_cq_ring, _cq_ring_size);
+		}
+		// fall through
+
+	case 2:
+		munmap(_sq_ring, _sq_ring_size);
+		// fall through
+
+	case 1:
+		robust_close(_ring_fd);
+
+		_ring_fd = -1;
+		// fall through
+
+	default:
+		break;
+	}
+
+	return phase == 7 ? 0 : -1;
+}
+
+void event_exit_platform(void) {
+	int slot;
+
+	for (slot = 0; slot < URING_SOCKET_SLOTS; ++slot) {
+		if (_sockets[slot].attached) {
+			log_warn("Leaking attached socket (handle: %d) in io_uring slot %d",
+			         _sockets[slot].handle, slot);
+		}
+	}
+
+	// closing the ring cancels all requests that are still in flight
+	robust_close(_ring_fd);
+
+	_ring_fd = -1;
+
+	munmap(_buffers, URING_SOCKET_SLOTS * URING_SLOT_SIZE);
+	array_destroy(&_polls, NULL);
+	munmap(_sqes, _sqes_size);
+
+	if (_cq_ring != _sq_ring) {
+		munmap(_cq_ring, _cq_ring_size);
+	}
+
+	munmap(_sq_ring, _sq_ring_size);
+}
+
+int event_source_added_platform(EventSource *event_source) {
+	int slot = -1;
+	int i;
+	UringPoll *poll = NULL;
+
+	if (event_source->type == EVENT_SOURCE_TYPE_GENERIC) {
+		slot = uring_find_socket(event_source->handle);
+	}
+
+	if (slot >= 0) {
+		_sockets[slot].event_source = event_source;
+
+		uring_mark_socket_ready(slot);
+
+		++_source_count;
+
+		return 0;
+	}
+
+	for (i = 0; i < _polls.count; ++i) {
+		poll = array_get(&_polls, i);
+
+		if (poll->event_source == NULL) {
+			break;
+		}
+	}
+
+	if (i == _polls.count) {
+		poll = array_append(&_polls);
+
+		if (poll == NULL) {
+			log_error("Could not append to io_uring poll array: %s (%d)",
+			          get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		poll->generation = 0;
+	}
+
+	++poll->generation;
+
+	if (event_source->events != 0 &&
+	    uring_queue_poll(event_source->handle, event_source->events,
+	                     URING_USER_DATA(poll->generation, i, URING_KIND_POLL)) < 0) {
+		log_error("Could not add %s event source (handle: %d) to io_uring",
+		          event_get_source_type_name(event_source->type, false),
+		          event_source->handle);
+
+		return -1;
+	}
+
+	poll->event_source = event_source;
+
+	++_source_count;
+
+	return 0;
+}
+
+int event_source_modified_platform(EventSource *event_source) {
+	int slot = -1;
+	int index;
+	UringPoll *poll;
+	uint64_t user_data;
+
+	if (event_source->type == EVENT_SOURCE_TYPE_GENERIC) {
+		slot = uring_find_socket(event_source->handle);
+	}
+
+	if (slot >= 0 && _sockets[slot].event_source == event_source) {
+		uring_mark_socket_ready(slot);
+
+		return 0;
+	}
+
+	poll = uring_find_poll(event_source, &index);
+
+	if (poll == NULL) {
+		log_error("Could not modify unknown %s event source (handle: %d) added to io_uring",
+		          event_get_source_type_name(event_source->type, false),
+		          event_source->handle);
+
+		return -1;
+	}
+
+	// the armed poll request might have completed already, then the removal
+	// fails and the outdated completion is ignored because of the generation
+	uring_queue_cancel(IORING_OP_POLL_REMOVE,
+	                   URING_USER_DATA(poll->generation, index, URING_KIND_POLL));
+
+	user_data = URING_USER_DATA(++poll->generation, index, URING_KIND_POLL);
+
+	if (event_source->events != 0 &&
+	    uring_queue_poll(event_source->handle, event_source->events, user_data) < 0) {
+		log_error("Could not modify %s event source (handle: %d) added to io_uring",
+		          event_get_source_type_name(event_source->type, false),
+		          event_source->handle);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+void event_source_removed_platform(EventSource *event_source) {
+	int slot = -1;
+	int index;
+	UringPoll *poll;
+
+	if (event_source->type == EVENT_SOURCE_TYPE_GENERIC) {
+		slot = uring_find_socket(event_source->handle);
+	}
+
+	if (slot >= 0 && _sockets[slot].event_source == event_source) {
+		_sockets[slot].event_source = NULL;
+
+		--_source_count;
+
+		return;
+	}
+
+	poll = uring_find_poll(event_source, &index);
+
+	if (poll == NULL) {
+		log_error("Could not remove unknown %s event source (handle: %d) from io_uring",
+		          event_get_source_type_name(event_source->type, false),
+		          event_source->handle);
+
+		return;
+	}
+
+	uring_queue_cancel(IORING_OP_POLL_REMOVE,
+	                   URING_USER_DATA(poll->generation, index, URING_KIND_POLL));
+
+	poll->event_source = NULL;
+	++poll->generation;
+
+	--_source_count;
+}
+
+int event_run_platform(Array *event_sources, bool *running, EventCleanupFunction cleanup) {
+	int rc;
+
+	(void)event_sources;
+
+	*running = true;
+
+	cleanup();
+	event_cleanup_sources();
+
+	while (*running) {
+		uring_queue_sends();
+
+		// don't wait if attached sockets are still ready
+		log_event_debug("Starting to wait on %d event source(s) in io_uring",
+		                _source_count);
+
+		rc = uring_submit(_ready_socket_count > 0 ? 0 : 1);
+
+		if (rc < 0) {
+			if (errno_interrupted()) {
+				log_debug("Waiting in io_uring got interrupted");
+
+				continue;
+			}
+
+			// EBUSY means the completion queue overflowed, handle the
+			// completions to make room
+			if (errno != EBUSY && errno != EAGAIN) {
+				log_error("Could not wait in io_uring: %s (%d)",
+				          get_errno_name(errno), errno);
+
+				*running = false;
+
+				return -1;
+			}
+		}
+
+		// this loop relies on the same deferred removal of event sources as
+		// the epoll based event loop, see event_linux.c
+		uring_handle_completions(running);
+		uring_handle_ready_sockets(running);
+
+		log_event_debug("Handled all ready event sources");
+
+		event_count_iteration();
+
+		// now cleanup event sources that got marked as disconnected/removed
+		// during the event handling
+		cleanup();
+		event_cleanup_sources();
+	}
+
+	*running = false;
+
+	return 0;
+}
+
+// returns a slot index or -1 if the socket cannot be attached. then it has to
+// be used with plain syscalls
+int event_uring_attach_socket(IOHandle handle) {
+	int slot;
+	int flags;
+	UringSocket *socket;
+
+	if (_ring_fd < 0) {
+		return -1;
+	}
+
+	for (slot = 0; slot < URING_SOCKET_SLOTS; ++slot) {
+		if (_sockets[slot].handle == IO_HANDLE_INVALID) {
+			break;
+		}
+	}
+
+	if (slot == URING_SOCKET_SLOTS) {
+		log_debug("All %d io_uring socket slots are in use, not attaching socket (handle: %d)",
+		          URING_SOCKET_SLOTS, handle);
+
+		return -1;
+	}
+
+	// io_uring completes reads and writes on non-blocking files with EAGAIN
+	// instead of waiting for the socket to become ready
+	flags = fcntl(handle, F_GETFL, 0);
+
+	if (flags < 0 || fcntl(handle, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+		log_warn("Could not disable non-blocking mode of socket (handle: %d), not attaching it: %s (%d)",
+		         handle, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	socket = &_sockets[slot];
+
+	socket->handle = handle;
+	socket->attached = true;
+	socket->event_source = NULL;
+	socket->pending = 0;
+	socket->receiving = false;
+	socket->sending = false;
+	socket->receive_offset = 0;
+	socket->receive_length = 0;
+	socket->receive_eof = false;
+	socket->error = 0;
+	socket->send_length = 0;
+
+	uring_queue_receive(slot);
+
+	log_event_debug("Attached socket (handle: %d) to io_uring slot %d", handle, slot);
+
+	return slot;
+}
+
+// has to be called before the socket gets closed
+void event_uring_detach_socket(int slot) {
+	UringSocket *socket = &_sockets[slot];
+	int rc;
+
+	socket->attached = false;
+	socket->event_source = NULL;
+
+	// data that was accepted for sending but not submitted yet is written
+	// directly, like a plain send would have done before the socket is closed
+	if (!socket->sending && socket->send_length > 0 && socket->error == 0) {
+		rc = send(socket->handle, socket->send_buffer, socket->send_length,
+		          MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (rc < socket->send_length) {
+			log_debug("Dropping %d unsent byte(s) of socket (handle: %d) in io_uring slot %d",
+			          socket->send_length - MAX(rc, 0), socket->handle, slot);
+		}
+	}
+
+	socket->send_length = 0;
+
+	// the slot and its buffers stay in use until all requests are done
+	if (socket->receiving) {
+		uring_queue_cancel(IORING_OP_ASYNC_CANCEL, URING_USER_DATA(0, slot, URING_KIND_RECEIVE));
+	}
+
+	if (socket->sending) {
+		uring_queue_cancel(IORING_OP_ASYNC_CANCEL, URING_USER_DATA(0, slot, URING_KIND_SEND));
+	}
+
+	log_event_debug("Detached socket (handle: %d) from io_uring slot %d", socket->handle, slot);
+
+	if (socket->pending == 0) {
+		uring_release_socket(socket);
+	}
+}
+
+// sets errno on error
+int event_uring_receive(int slot, void *buffer, int length) {
+	UringSocket *socket = &_sockets[slot];
+
+	if (socket->receive_offset < socket->receive_length) {
+		length = MIN(length, socket->receive_length - socket->receive_offset);
+
+		memcpy(buffer, socket->receive_buffer + socket->receive_offset, length);
+
+		socket->receive_offset += length;
+
+		if (socket->receive_offset == socket->receive_length) {
+			socket->receive_offset = 0;
+			socket->receive_length = 0;
+
+			if (!socket->receive_eof && socket->error == 0) {
+				uring_queue_receive(slot);
+			}
+		}
+
+		++_socket_progress;
+
+		return length;
+	}
+
+	if (socket->error != 0) {
+		errno = socket->error;
+
+		return -1;
+	}
+
+	if (socket->receive_eof) {
+		return 0;
+	}
+
+	errno = EWOULDBLOCK;
+
+	return -1;
+}
+
+// sets errno on error
+int event_uring_send(int slot, const void *buffer, int length) {
+	UringSocket *socket = &_sockets[slot];
+
+	if (socket->error != 0) {
+		errno = socket->error;
+
+		return -1;
+	}
+
+	length = MIN(length, URING_SEND_BUFFER_SIZE - socket->send_length);
+
+	if (length == 0) {
+		errno = EWOULDBLOCK;
+
+		return -1;
+	}
+
+	memcpy(socket->send_buffer + socket->send_length, buffer, length);
+
+	socket->send_length += length;
+
+	if (!socket->send_queued && !socket->sending) {
+		socket->send_queued = true;
+		_send_sockets[_send_socket_count++] = slot;
+	}
+
+	++_socket_progress;
+
+	return length;
+}
@@ -0,0 +1,33 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * event_uring.h: io_uring based event loop
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_EVENT_URING_H
+#define DAEMONLIB_EVENT_URING_H
+
+#include "io.h"
+
+int event_uring_attach_socket(IOHandle handle);
+void event_uring_detach_socket(int slot);
+
+int event_uring_receive(int slot, void *buffer, int length);
+int event_uring_send(int slot, const void *buffer, int length);
+
+#endif // DAEMONLIB_EVENT_URING_H
@@ -0,0 +1,162 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * framer.c: Zero-copy stream framer for TFP and similar protocols
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framer.h"
+
+#include "packet.h"
+
+// the frames are handed out by pointer into the read buffer and some code
+// copies sizeof(Packet) bytes from such a pointer, even if the packet is
+// shorter. the padding after the end of the read buffer keeps this in bounds
+#define FRAMER_PADDING ((int)sizeof(Packet))
+
+// sets errno on error
+int framer_create(Framer *framer, int size, FramerGetLengthFunction get_length,
+                  void *opaque) {
+	framer->buffer = calloc(1, size + FRAMER_PADDING);
+
+	if (framer->buffer == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	framer->size = size;
+	framer->start = 0;
+	framer->end = 0;
+	framer->get_length = get_length;
+	framer->opaque = opaque;
+
+	return 0;
+}
+
+void framer_destroy(Framer *framer) {
+	free(framer->buffer);
+}
+
+void framer_reset(Framer *framer) {
+	framer->start = 0;
+	framer->end = 0;
+}
+
+// returns the result of io_read. the read buffer is compacted before reading,
+// so there is always space for at least one complete frame
+int framer_read(Framer *framer, IO *io) {
+	int length;
+
+	if (framer->start > 0) {
+		memmove(framer->buffer, framer->buffer + framer->start, framer->end - framer->start);
+
+		framer->end -= framer->start;
+		framer->start = 0;
+	}
+
+	length = io_read(io, framer->buffer + framer->end, framer->size - framer->end);
+
+	if (length > 0) {
+		framer->end += length;
+	}
+
+	return length;
+}
+
+// returns the next complete frame and sets LENGTH to its length. if no complete
+// frame is available then NULL is returned and LENGTH is set to 0. if the next
+// frame is invalid then NULL is returned, LENGTH is set to -1 and MESSAGE is
+// set. the returned frame stays valid until the next framer_read call
+uint8_t *framer_next(Framer *framer, int *length, const char **message) {
+	uint8_t *frame = framer->buffer + framer->start;
+	int available = framer->end - framer->start;
+	int frame_length;
+
+	*length = 0;
+
+	if (available == 0) {
+		return NULL;
+	}
+
+	frame_length = framer->get_length(frame, available, framer->opaque, message);
+
+	if (frame_length < 0) {
+		*length = -1;
+
+		return NULL;
+	}
+
+	if (frame_length > framer->size) {
+		*message = "Frame is too long";
+		*length = -1;
+
+		return NULL;
+	}
+
+	if (frame_length == 0 || frame_length > available) {
+		return NULL;
+	}
+
+	framer->start += frame_length;
+	*length = frame_length;
+
+	return frame;
+}
+
+// returns the bytes that were not handed out yet, e.g. for a dump of an
+// invalid frame
+uint8_t *framer_peek(Framer *framer, int *available) {
+	*available = framer->end - framer->start;
+
+	return framer->buffer + framer->start;
+}
+
+int framer_get_request_length(const uint8_t *data, int available,
+                              void *opaque, const char **message) {
+	(void)opaque;
+
+	if (available < (int)sizeof(PacketHeader)) {
+		return 0;
+	}
+
+	if (!packet_header_is_valid_request((PacketHeader *)data, message)) {
+		return -1;
+	}
+
+	return ((PacketHeader *)data)->length;
+}
+
+int framer_get_response_length(const uint8_t *data, int available,
+                               void *opaque, const char **message) {
+	(void)opaque;
+
+	if (available < (int)sizeof(PacketHeader)) {
+		return 0;
+	}
+
+	if (!packet_header_is_valid_response((PacketHeader *)data, message)) {
+		return -1;
+	}
+
+	return ((PacketHeader *)data)->length;
+}
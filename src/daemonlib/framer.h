@@ -0,0 +1,63 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * framer.h: Zero-copy stream framer for TFP and similar protocols
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef DAEMONLIB_FRAMER_H
+#define DAEMONLIB_FRAMER_H
+
+#include <stdint.h>
+
+#include "io.h"
+
+// returns the length of the frame at the start of DATA, 0 if more than
+// AVAILABLE bytes are needed to determine it or -1 if the frame is invalid, in
+// which case MESSAGE is set
+typedef int (*FramerGetLengthFunction)(const uint8_t *data, int available,
+                                       void *opaque, const char **message);
+
+// the frames are parsed out of the read buffer by offset and handed out by
+// pointer. the remaining partial frame is moved to the front of the read
+// buffer only once before the next read instead of after each frame
+typedef struct {
+	uint8_t *buffer;
+	int size; // bytes, without the padding after the end
+	int start; // offset of the first byte not handed out yet
+	int end; // offset after the last byte received
+	FramerGetLengthFunction get_length;
+	void *opaque;
+} Framer;
+
+int framer_create(Framer *framer, int size, FramerGetLengthFunction get_length,
+                  void *opaque);
+void framer_destroy(Framer *framer);
+
+void framer_reset(Framer *framer);
+
+int framer_read(Framer *framer, IO *io);
+uint8_t *framer_next(Framer *framer, int *length, const char **message);
+uint8_t *framer_peek(Framer *framer, int *available);
+
+int framer_get_request_length(const uint8_t *data, int available,
+                              void *opaque, const char **message);
+int framer_get_response_length(const uint8_t *data, int available,
+                               void *opaque, const char **message);
+
+#endif // DAEMONLIB_FRAMER_H
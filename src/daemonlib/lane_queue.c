@@ -0,0 +1,249 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * lane_queue.c: Queue with a high and a low priority lane
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * a LaneQueue object consists of two Queue objects, a high priority lane for
+ * latency sensitive items and a low priority lane for bulk items. items are
+ * taken from the high lane first. to avoid starvation of the low lane an item
+ * from the low lane gets its turn after LANE_QUEUE_MAX_HIGH_STREAK items were
+ * taken from the high lane in a row while the low lane was waiting.
+ *
+ * the lane of the head item is selected once and stays selected until the
+ * item is popped. this ensures that peek can be called repeatedly and always
+ * returns the same item, even if new items are pushed in between. for example,
+ * the SPI stacks peek an item, try to send it and only pop it on success.
+ *
+ * each item is pushed with a key, for example the UID of a request. while a key
+ * has items queued in one lane, all further items with this key are pushed to
+ * the same lane, regardless of the requested lane. this keeps the items of a
+ * key in FIFO order, only items of different keys can overtake each other.
+ */
+
+#include <string.h>
+
+#include "lane_queue.h"
+
+// each queued entry starts with the key of its item. the header is 8 bytes in
+// size to keep the item 8 byte aligned
+#define LANE_QUEUE_ENTRY_HEADER_SIZE ((int)sizeof(uint64_t))
+
+typedef struct {
+	uint32_t key;
+	int lane;
+	int count; // number of queued items with this key
+} LaneQueuePin;
+
+static void *lane_queue_entry_get_item(void *entry) {
+	return (uint8_t *)entry + LANE_QUEUE_ENTRY_HEADER_SIZE;
+}
+
+static int lane_queue_find_pin(LaneQueue *lane_queue, uint32_t key) {
+	int i;
+
+	for (i = 0; i < lane_queue->pins.count; ++i) {
+		if (((LaneQueuePin *)array_get(&lane_queue->pins, i))->key == key) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// removes the head entry of the given LANE and releases its pin
+static void lane_queue_remove_head(LaneQueue *lane_queue, int lane,
+                                   ItemDestroyFunction destroy) {
+	void *entry = queue_peek(&lane_queue->lanes[lane]);
+	uint32_t key;
+	int i;
+	LaneQueuePin *pin;
+
+	memcpy(&key, entry, sizeof(key));
+
+	i = lane_queue_find_pin(lane_queue, key);
+
+	if (i >= 0) {
+		pin = array_get(&lane_queue->pins, i);
+
+		if (--pin->count == 0) {
+			array_remove(&lane_queue->pins, i, NULL);
+		}
+	}
+
+	if (destroy != NULL) {
+		destroy(lane_queue_entry_get_item(entry));
+	}
+
+	queue_pop(&lane_queue->lanes[lane], NULL);
+
+	--lane_queue->count;
+	lane_queue->selected = -1;
+}
+
+static int lane_queue_select(LaneQueue *lane_queue) {
+	if (lane_queue->selected >= 0 &&
+	    lane_queue->lanes[lane_queue->selected].count > 0) {
+		return lane_queue->selected;
+	}
+
+	if (lane_queue->lanes[QUEUE_LANE_LOW].count > 0 &&
+	    (lane_queue->lanes[QUEUE_LANE_HIGH].count == 0 ||
+	     lane_queue->high_streak >= LANE_QUEUE_MAX_HIGH_STREAK)) {
+		lane_queue->selected = QUEUE_LANE_LOW;
+	} else {
+		lane_queue->selected = QUEUE_LANE_HIGH;
+	}
+
+	return lane_queue->selected;
+}
+
+// creates an empty (count == 0) LaneQueue object. each item is SIZE (> 0)
+// bytes in size.
+//
+// returns -1 on error (sets errno) or 0 on success
+int lane_queue_create(LaneQueue *lane_queue, int size) {
+	int i;
+
+	lane_queue->count = 0;
+	lane_queue->selected = -1;
+	lane_queue->high_streak = 0;
+
+	if (array_create(&lane_queue->pins, 32, sizeof(LaneQueuePin), true) < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < QUEUE_LANE_COUNT; ++i) {
+		if (queue_create(&lane_queue->lanes[i], LANE_QUEUE_ENTRY_HEADER_SIZE + size) < 0) {
+			for (--i; i >= 0; --i) {
+				queue_destroy(&lane_queue->lanes[i], NULL);
+			}
+
+			array_destroy(&lane_queue->pins, NULL);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// destroys a LaneQueue object, see queue_destroy
+void lane_queue_destroy(LaneQueue *lane_queue, ItemDestroyFunction destroy) {
+	int i;
+
+	for (i = 0; i < QUEUE_LANE_COUNT; ++i) {
+		while (lane_queue->lanes[i].count > 0) {
+			lane_queue_remove_head(lane_queue, i, destroy);
+		}
+
+		queue_destroy(&lane_queue->lanes[i], NULL);
+	}
+
+	array_destroy(&lane_queue->pins, NULL);
+}
+
+// adds a new item with the given KEY to the tail of the given LANE of a
+// LaneQueue object. if items with the same KEY are already queued then the new
+// item is added to their lane instead. the memory of this item is initialized
+// to zero.
+//
+// returns NULL on error (sets errno) or a pointer to the new item on success
+void *lane_queue_push(LaneQueue *lane_queue, QueueLane lane, uint32_t key) {
+	int i = lane_queue_find_pin(lane_queue, key);
+	LaneQueuePin *pin;
+	void *entry;
+
+	if (i >= 0) {
+		pin = array_get(&lane_queue->pins, i);
+	} else {
+		pin = array_append(&lane_queue->pins);
+
+		if (pin == NULL) {
+			return NULL;
+		}
+
+		pin->key = key;
+		pin->lane = lane;
+		pin->count = 0;
+	}
+
+	entry = queue_push(&lane_queue->lanes[pin->lane]);
+
+	if (entry == NULL) {
+		if (pin->count == 0) {
+			array_remove(&lane_queue->pins, lane_queue->pins.count - 1, NULL);
+		}
+
+		return NULL;
+	}
+
+	memcpy(entry, &key, sizeof(key));
+
+	++pin->count;
+	++lane_queue->count;
+
+	return lane_queue_entry_get_item(entry);
+}
+
+// removes the head item of a LaneQueue object, see queue_pop
+void lane_queue_pop(LaneQueue *lane_queue, ItemDestroyFunction destroy) {
+	int lane;
+
+	if (lane_queue->count == 0) {
+		return;
+	}
+
+	lane = lane_queue_select(lane_queue);
+
+	if (lane == QUEUE_LANE_HIGH && lane_queue->lanes[QUEUE_LANE_LOW].count > 0) {
+		++lane_queue->high_streak;
+	} else {
+		lane_queue->high_streak = 0;
+	}
+
+	lane_queue_remove_head(lane_queue, lane, destroy);
+}
+
+// returns a pointer to the head item of a LaneQueue object or NULL if the
+// queue is empty
+void *lane_queue_peek(LaneQueue *lane_queue) {
+	if (lane_queue->count == 0) {
+		return NULL;
+	}
+
+	return lane_queue_entry_get_item(queue_peek(&lane_queue->lanes[lane_queue_select(lane_queue)]));
+}
+
+// removes the oldest item from the low lane, or from the high lane if the low
+// lane is empty. this is meant to make room in a full LaneQueue object. must
+// not be called while a peeked item is still in use
+void lane_queue_drop(LaneQueue *lane_queue, ItemDestroyFunction destroy) {
+	int lane = QUEUE_LANE_LOW;
+
+	if (lane_queue->count == 0) {
+		return;
+	}
+
+	if (lane_queue->lanes[QUEUE_LANE_LOW].count == 0) {
+		lane = QUEUE_LANE_HIGH;
+	}
+
+	lane_queue_remove_head(lane_queue, lane, destroy);
+}
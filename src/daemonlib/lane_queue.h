@@ -0,0 +1,57 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * lane_queue.h: Queue with a high and a low priority lane
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_LANE_QUEUE_H
+#define DAEMONLIB_LANE_QUEUE_H
+
+#include <stdint.h>
+
+#include "array.h"
+#include "queue.h"
+#include "utils.h"
+
+// number of items taken from the high lane in a row before an item from the
+// low lane gets its turn, if both lanes are not empty
+#define LANE_QUEUE_MAX_HIGH_STREAK 8
+
+typedef enum {
+	QUEUE_LANE_HIGH = 0, // latency sensitive items
+	QUEUE_LANE_LOW, // bulk items
+	QUEUE_LANE_COUNT
+} QueueLane;
+
+typedef struct {
+	int count; // number of items in all lanes
+	Queue lanes[QUEUE_LANE_COUNT];
+	int selected; // lane of the current head item, -1 if not selected yet
+	int high_streak;
+	Array pins; // keys with queued items and their lane
+} LaneQueue;
+
+int lane_queue_create(LaneQueue *lane_queue, int size);
+void lane_queue_destroy(LaneQueue *lane_queue, ItemDestroyFunction destroy);
+
+void *lane_queue_push(LaneQueue *lane_queue, QueueLane lane, uint32_t key);
+void lane_queue_pop(LaneQueue *lane_queue, ItemDestroyFunction destroy);
+void *lane_queue_peek(LaneQueue *lane_queue);
+void lane_queue_drop(LaneQueue *lane_queue, ItemDestroyFunction destroy);
+
+#endif // DAEMONLIB_LANE_QUEUE_H
@@ -20,7 +20,22 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+/*
+ * by default log_message formats and writes each message synchronously while
+ * holding the log mutex. in asynchronous mode each thread that logs gets its
+ * own single-producer/single-consumer ring. log_message only stores a compact
+ * record (timestamp, source, function, line and the formatted message text) in
+ * the ring of the calling thread and never blocks. a logger thread merges the
+ * records of all rings in timestamp order, formats their prefixes and writes
+ * them in batches. if a ring is full the record is dropped and the logger
+ * thread reports the number of dropped records instead of blocking the thread
+ * that logs. threads that cannot get a ring anymore fall back to synchronous
+ * logging.
+ */
+
+#include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "log.h"
@@ -51,6 +66,62 @@ static int _debug_filter_version = 0;
 static LogDebugFilter _debug_filters[64];
 static int _debug_filter_count = 0;
 
+// asynchronous mode relies on thread-local storage and atomic builtins
+#ifdef __GNUC__
+	#define LOG_WITH_ASYNC
+#endif
+
+#ifdef LOG_WITH_ASYNC
+
+#define LOG_RING_SIZE (64 * 1024) // bytes, has to be a power of two
+#define LOG_MAX_RINGS 32
+#define LOG_MAX_MESSAGE_LENGTH 1024 // bytes, including NULL-terminator
+#define LOG_MAX_BATCH_LENGTH (64 * 1024) // bytes
+#define LOG_MAX_LINE_LENGTH 1280 // bytes, prefix + message + newline
+
+typedef struct {
+	uint32_t length; // of the whole record, 0 marks the unused end of the ring
+	int8_t level;
+	uint16_t debug_group;
+	int line;
+	struct timeval timestamp;
+	LogSource *source;
+	const char *function; // has to be a static string
+	char message[LOG_MAX_MESSAGE_LENGTH];
+} LogRecord;
+
+#define LOG_RECORD_ALIGNMENT 8
+#define LOG_RECORD_LENGTH(message_length) \
+	((offsetof(LogRecord, message) + (message_length) + LOG_RECORD_ALIGNMENT - 1) & ~(LOG_RECORD_ALIGNMENT - 1))
+#define LOG_MAX_RECORD_LENGTH LOG_RECORD_LENGTH(LOG_MAX_MESSAGE_LENGTH)
+
+#define LOG_CACHE_LINE_SIZE 64 // bytes
+
+// the fields of the owning thread and the logger thread are kept on separate
+// cache lines, otherwise each record would bounce a cache line between them
+typedef struct {
+	uint8_t buffer[LOG_RING_SIZE];
+	uint32_t write; // only modified by the owning thread
+	uint32_t dropped; // only modified by the owning thread
+	uint8_t padding[LOG_CACHE_LINE_SIZE - 2 * sizeof(uint32_t)];
+	uint32_t read; // only modified by the logger thread
+	uint32_t reported_dropped; // only accessed by the logger thread
+} LogRing;
+
+static bool _async = false;
+static bool _async_running = false;
+static bool _logger_idle = false;
+static Semaphore _logger_wakeup;
+static Thread _logger_thread;
+static LogRing *_rings[LOG_MAX_RINGS];
+static int _ring_count = 0; // can exceed LOG_MAX_RINGS
+static __thread LogRing *_ring = NULL;
+static __thread bool _ring_unavailable = false;
+static char _batch[LOG_MAX_BATCH_LENGTH]; // only used by the logger thread
+static int _batch_length = 0;
+
+#endif
+
 IO log_stderr_output;
 
 extern void log_init_platform(IO *output);
@@ -194,6 +265,61 @@ static void log_set_output_unlocked(IO *output, LogRotateFunction rotate) {
 	log_set_output_platform(_output);
 }
 
+// formats the prefix into BUFFER and returns its length
+static int log_format_prefix(char *buffer, int length, struct timeval *timestamp,
+                             LogLevel level, LogSource *source,
+                             LogDebugGroup debug_group, const char *function,
+                             int line) {
+	time_t unix_seconds;
+	struct tm localized_timestamp;
+	char formatted_timestamp[64] = "<unknown>";
+	char level_char;
+	char *debug_group_name = "";
+	char line_str[16] = "<unknown>";
+	int rc;
+
+	// copy value to time_t variable because timeval.tv_sec and time_t
+	// can have different sizes between different compilers and compiler
+	// version and platforms. for example with WDK 7 both are 4 byte in
+	// size, but with MSVC 2010 time_t is 8 byte in size but timeval.tv_sec
+	// is still 4 byte in size.
+	unix_seconds = timestamp->tv_sec;
+
+	// format time
+	if (localtime_r(&unix_seconds, &localized_timestamp) != NULL) {
+		strftime(formatted_timestamp, sizeof(formatted_timestamp),
+		         "%Y-%m-%d %H:%M:%S", &localized_timestamp);
+	}
+
+	// format level
+	switch (level) {
+	case LOG_LEVEL_ERROR: level_char = 'E'; break;
+	case LOG_LEVEL_WARN:  level_char = 'W'; break;
+	case LOG_LEVEL_INFO:  level_char = 'I'; break;
+	case LOG_LEVEL_DEBUG: level_char = 'D'; break;
+	default:              level_char = 'U'; break;
+	}
+
+	// format debug group
+	switch (debug_group) {
+	case LOG_DEBUG_GROUP_EVENT:  debug_group_name = "event|";  break;
+	case LOG_DEBUG_GROUP_PACKET: debug_group_name = "packet|"; break;
+	case LOG_DEBUG_GROUP_OBJECT: debug_group_name = "object|"; break;
+	case LOG_DEBUG_GROUP_LIBUSB:                               break;
+	default:                                                   break;
+	}
+
+	// format line
+	snprintf(line_str, sizeof(line_str), "%d", line);
+
+	// format prefix
+	rc = snprintf(buffer, length, "%s.%06d <%c> <%s%s:%s> ",
+	              formatted_timestamp, (int)timestamp->tv_usec, level_char,
+	              debug_group_name, source->name, line >= 0 ? line_str : function);
+
+	return rc < 0 ? 0 : MIN(rc, MAX(length - 1, 0));
+}
+
 // NOTE: assumes that _mutex is locked
 static int log_write(struct timeval *timestamp, LogLevel level, LogSource *source,
                      LogDebugGroup debug_group, const char *function, int line,
@@ -217,6 +343,332 @@ static int log_write(struct timeval *timestamp, LogLevel level, LogSource *sourc
 	return length;
 }
 
+// NOTE: assumes that _mutex is locked
+static void log_rotate_unlocked(LogLevel *rotate_level, char *rotate_message,
+                                int rotate_message_length) {
+	if (_rotate == NULL || _output_size < MAX_OUTPUT_SIZE || _rotate_countdown > 0) {
+		return;
+	}
+
+	if (_rotate(_output, rotate_level, rotate_message, rotate_message_length) < 0) {
+		log_set_output_unlocked(NULL, NULL);
+	} else {
+		log_set_output_unlocked(_output, _rotate);
+	}
+}
+
+static void log_report_rotation(LogLevel rotate_level, const char *rotate_message) {
+	LogDebugGroup debug_group = rotate_level == LOG_LEVEL_DEBUG
+	                            ? LOG_DEBUG_GROUP_COMMON
+	                            : LOG_DEBUG_GROUP_NONE;
+
+	if (rotate_level != LOG_LEVEL_DUMMY &&
+	    log_is_included(rotate_level, &_log_source, debug_group)) {
+		log_message(rotate_level, &_log_source, debug_group, false,
+		            __FUNCTION__, __LINE__, "%s", rotate_message);
+	}
+}
+
+#ifdef LOG_WITH_ASYNC
+
+// returns the ring of the calling thread, allocates one on first use
+static LogRing *log_get_ring(void) {
+	LogRing *ring;
+	int index;
+
+	if (_ring != NULL || _ring_unavailable) {
+		return _ring;
+	}
+
+	ring = calloc(1, sizeof(LogRing));
+
+	if (ring == NULL) {
+		_ring_unavailable = true;
+
+		return NULL;
+	}
+
+	index = __atomic_fetch_add(&_ring_count, 1, __ATOMIC_RELAXED);
+
+	if (index >= LOG_MAX_RINGS) {
+		free(ring);
+
+		_ring_unavailable = true;
+
+		return NULL;
+	}
+
+	__atomic_store_n(&_rings[index], ring, __ATOMIC_RELEASE);
+
+	_ring = ring;
+
+	return ring;
+}
+
+// stores a record in the ring of the calling thread, never blocks. returns
+// false if the ring is full and the record was dropped
+static bool log_push_record(LogRing *ring, struct timeval *timestamp,
+                            LogLevel level, LogSource *source,
+                            LogDebugGroup debug_group, const char *function,
+                            int line, const char *format, va_list arguments) {
+	uint32_t write = ring->write;
+	uint32_t read = __atomic_load_n(&ring->read, __ATOMIC_ACQUIRE);
+	uint32_t offset = write & (LOG_RING_SIZE - 1);
+	uint32_t padding = 0;
+	LogRecord *record;
+	int rc;
+
+	// a record is always stored in one piece. if the longest possible record
+	// does not fit before the end of the ring, then the rest is skipped
+	if (offset + LOG_MAX_RECORD_LENGTH > LOG_RING_SIZE) {
+		padding = LOG_RING_SIZE - offset;
+	}
+
+	if (write - read + padding + LOG_MAX_RECORD_LENGTH > LOG_RING_SIZE) {
+		__atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+
+		return false;
+	}
+
+	if (padding > 0) {
+		((LogRecord *)(ring->buffer + offset))->length = 0;
+
+		write += padding;
+		offset = 0;
+	}
+
+	record = (LogRecord *)(ring->buffer + offset);
+
+	// format the message directly into the ring
+	rc = vsnprintf(record->message, sizeof(record->message), format, arguments);
+
+	if (rc < 0) {
+		record->message[0] = '\0';
+		rc = 0;
+	}
+
+	rc = MIN(rc, (int)sizeof(record->message) - 1);
+
+	record->length = LOG_RECORD_LENGTH(rc + 1);
+	record->level = (int8_t)level;
+	record->debug_group = (uint16_t)debug_group;
+	record->line = line;
+	record->timestamp = *timestamp;
+	record->source = source;
+	record->function = function;
+
+	__atomic_store_n(&ring->write, write + record->length, __ATOMIC_RELEASE);
+
+	// only write to the shared idle flag if the logger thread is asleep. the
+	// fence orders the load of the idle flag after the store to the ring
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&_logger_idle, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&_logger_idle, false, __ATOMIC_SEQ_CST)) {
+		semaphore_release(&_logger_wakeup);
+	}
+
+	return true;
+}
+
+// NOTE: assumes that _mutex is locked
+static void log_flush_batch(void) {
+	int length;
+
+	if (_batch_length == 0) {
+		return;
+	}
+
+	if (_output != NULL) {
+		length = io_write(_output, _batch, _batch_length);
+
+		if (_output_size >= 0 && length >= 0) {
+			_output_size += length;
+		}
+	}
+
+	_batch_length = 0;
+}
+
+// NOTE: assumes that _mutex is locked
+static void log_append_line(struct timeval *timestamp, LogLevel level,
+                            LogSource *source, LogDebugGroup debug_group,
+                            const char *function, int line, const char *message) {
+	char *buffer;
+
+	if (_rotate_countdown > 0) {
+		--_rotate_countdown;
+	}
+
+	if (_output == NULL) {
+		return;
+	}
+
+	// debug messages are never colored, all others are written on their own
+	// to apply the color around them
+	if (level != LOG_LEVEL_DEBUG || _batch_length + LOG_MAX_LINE_LENGTH > LOG_MAX_BATCH_LENGTH) {
+		log_flush_batch();
+	}
+
+	buffer = _batch + _batch_length;
+
+	log_format_prefix(buffer, LOG_MAX_LINE_LENGTH, timestamp, level, source,
+	                  debug_group, function, line);
+
+	string_append(buffer, LOG_MAX_LINE_LENGTH, message);
+	string_append(buffer, LOG_MAX_LINE_LENGTH, LOG_NEWLINE);
+
+	_batch_length += strlen(buffer);
+
+	if (level != LOG_LEVEL_DEBUG) {
+		log_apply_color_platform(level, true);
+		log_flush_batch();
+		log_apply_color_platform(level, false);
+	}
+}
+
+// writes all records that are currently stored in the rings, merged in
+// timestamp order. returns the number of records. this is only called by the
+// logger thread, or after the logger thread was stopped
+static int log_drain_rings(void) {
+	int ring_count = MIN(__atomic_load_n(&_ring_count, __ATOMIC_ACQUIRE), LOG_MAX_RINGS);
+	LogRing *rings[LOG_MAX_RINGS];
+	uint32_t reads[LOG_MAX_RINGS];
+	uint32_t writes[LOG_MAX_RINGS];
+	uint32_t dropped;
+	LogRecord *record;
+	LogRecord *oldest;
+	int oldest_index;
+	int count = 0;
+	int i;
+	struct timeval timestamp;
+	char message[128];
+	LogLevel rotate_level = LOG_LEVEL_DUMMY;
+	char rotate_message[1024] = "<unknown>";
+
+	for (i = 0; i < ring_count; ++i) {
+		rings[i] = __atomic_load_n(&_rings[i], __ATOMIC_ACQUIRE);
+
+		if (rings[i] != NULL) {
+			reads[i] = rings[i]->read;
+			writes[i] = __atomic_load_n(&rings[i]->write, __ATOMIC_ACQUIRE);
+		}
+	}
+
+	log_lock();
+
+	for (;;) {
+		oldest = NULL;
+		oldest_index = -1;
+
+		for (i = 0; i < ring_count; ++i) {
+			if (rings[i] == NULL || reads[i] == writes[i]) {
+				continue;
+			}
+
+			record = (LogRecord *)(rings[i]->buffer + (reads[i] & (LOG_RING_SIZE - 1)));
+
+			if (record->length == 0) {
+				reads[i] += LOG_RING_SIZE - (reads[i] & (LOG_RING_SIZE - 1));
+
+				if (reads[i] == writes[i]) {
+					continue;
+				}
+
+				record = (LogRecord *)rings[i]->buffer;
+			}
+
+			if (oldest == NULL ||
+			    record->timestamp.tv_sec < oldest->timestamp.tv_sec ||
+			    (record->timestamp.tv_sec == oldest->timestamp.tv_sec &&
+			     record->timestamp.tv_usec < oldest->timestamp.tv_usec)) {
+				oldest = record;
+				oldest_index = i;
+			}
+		}
+
+		if (oldest == NULL) {
+			break;
+		}
+
+		log_append_line(&oldest->timestamp, oldest->level, oldest->source,
+		                oldest->debug_group, oldest->function, oldest->line,
+		                oldest->message);
+
+		reads[oldest_index] += oldest->length;
+		++count;
+	}
+
+	// report dropped records after the records that made it into the ring
+	for (i = 0; i < ring_count; ++i) {
+		if (rings[i] == NULL) {
+			continue;
+		}
+
+		dropped = __atomic_load_n(&rings[i]->dropped, __ATOMIC_RELAXED);
+
+		if (dropped != rings[i]->reported_dropped) {
+			if (gettimeofday(&timestamp, NULL) < 0) {
+				timestamp.tv_sec = time(NULL);
+				timestamp.tv_usec = 0;
+			}
+
+			snprintf(message, sizeof(message),
+			         "Log ring %d is full, dropped %u log message(s), %u dropped in total",
+			         i, dropped - rings[i]->reported_dropped, dropped);
+
+			log_append_line(&timestamp, LOG_LEVEL_WARN, &_log_source,
+			                LOG_DEBUG_GROUP_NONE, __FUNCTION__, __LINE__, message);
+
+			rings[i]->reported_dropped = dropped;
+		}
+	}
+
+	log_flush_batch();
+
+	// the records were copied to the output, the producers can reuse the space
+	for (i = 0; i < ring_count; ++i) {
+		if (rings[i] != NULL) {
+			__atomic_store_n(&rings[i]->read, reads[i], __ATOMIC_RELEASE);
+		}
+	}
+
+	if (count > 0) {
+		log_rotate_unlocked(&rotate_level, rotate_message, sizeof(rotate_message));
+	}
+
+	log_unlock();
+
+	log_report_rotation(rotate_level, rotate_message);
+
+	return count;
+}
+
+static void log_run_logger(void *opaque) {
+	(void)opaque;
+
+	while (__atomic_load_n(&_async_running, __ATOMIC_ACQUIRE)) {
+		if (log_drain_rings() > 0) {
+			continue;
+		}
+
+		// announce going to sleep, then check the rings once more. a producer
+		// either sees the idle flag and wakes the logger thread or stored its
+		// record early enough to be seen by this check
+		__atomic_store_n(&_logger_idle, true, __ATOMIC_SEQ_CST);
+
+		if (log_drain_rings() > 0) {
+			__atomic_store_n(&_logger_idle, false, __ATOMIC_SEQ_CST);
+
+			continue;
+		}
+
+		semaphore_acquire(&_logger_wakeup);
+	}
+}
+
+#endif
+
 void log_init(void) {
 	const char *filter;
 
@@ -239,6 +691,34 @@ void log_init(void) {
 }
 
 void log_exit(void) {
+#ifdef LOG_WITH_ASYNC
+	int i;
+
+	if (_async) {
+		__atomic_store_n(&_async_running, false, __ATOMIC_RELEASE);
+
+		semaphore_release(&_logger_wakeup);
+		thread_join(&_logger_thread);
+		thread_destroy(&_logger_thread);
+		semaphore_destroy(&_logger_wakeup);
+
+		// write whatever is left in the rings. all other threads that might
+		// log have to be stopped already
+		log_drain_rings();
+
+		_async = false;
+
+		for (i = 0; i < MIN(_ring_count, LOG_MAX_RINGS); ++i) {
+			free(_rings[i]);
+
+			_rings[i] = NULL;
+		}
+
+		_ring_count = 0;
+		_ring = NULL;
+	}
+#endif
+
 	log_exit_platform();
 
 	mutex_destroy(&_mutex);
@@ -258,6 +738,33 @@ void log_enable_debug_override(const char *filter) {
 	log_set_debug_filter(filter);
 }
 
+// has to be called after daemonizing, because the logger thread does not
+// survive a fork
+void log_enable_async(void) {
+#ifdef LOG_WITH_ASYNC
+	if (_async) {
+		return;
+	}
+
+	if (semaphore_create(&_logger_wakeup) < 0) {
+		log_error("Could not create logger wakeup semaphore, staying in synchronous logging mode: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	_async_running = true;
+
+	thread_create(&_logger_thread, log_run_logger, NULL);
+
+	__atomic_store_n(&_async, true, __ATOMIC_RELEASE);
+
+	log_debug("Enabled asynchronous logging");
+#else
+	log_warn("Asynchronous logging is not supported on this platform");
+#endif
+}
+
 LogLevel log_get_effective_level(void) {
 	return _debug_override ? LOG_LEVEL_DEBUG : _level;
 }
@@ -346,9 +853,13 @@ void log_message(LogLevel level, LogSource *source, LogDebugGroup debug_group,
                  bool rotate_allowed, const char *function, int line, const char *format, ...) {
 	struct timeval timestamp;
 	va_list arguments;
+	bool primary;
 	int length;
 	LogLevel rotate_level = LOG_LEVEL_DUMMY;
 	char rotate_message[1024] = "<unknown>";
+#ifdef LOG_WITH_ASYNC
+	LogRing *ring;
+#endif
 
 	if (level == LOG_LEVEL_DUMMY) {
 		return; // should never be reachable
@@ -361,12 +872,36 @@ void log_message(LogLevel level, LogSource *source, LogDebugGroup debug_group,
 		timestamp.tv_usec = 0;
 	}
 
+	primary = (level <= _level || _debug_override) &&
+	          (level != LOG_LEVEL_DEBUG ||
+	           (source->included_debug_groups & debug_group) != 0);
+
+#ifdef LOG_WITH_ASYNC
+	// hand the message to the logger thread
+	if (primary && __atomic_load_n(&_async, __ATOMIC_ACQUIRE)) {
+		ring = log_get_ring();
+
+		if (ring != NULL) {
+			va_start(arguments, format);
+
+			log_push_record(ring, &timestamp, level, source, debug_group,
+			                function, line, format, arguments);
+
+			va_end(arguments);
+
+			if (!log_is_included_platform(level, source, debug_group)) {
+				return;
+			}
+
+			primary = false;
+		}
+	}
+#endif
+
 	// call log writers
 	log_lock();
 
-	if ((level <= _level || _debug_override) &&
-	    (level != LOG_LEVEL_DEBUG ||
-	     (source->included_debug_groups & debug_group) != 0)) {
+	if (primary) {
 		va_start(arguments, format);
 
 		length = log_write(&timestamp, level, source, debug_group, function,
@@ -391,85 +926,28 @@ void log_message(LogLevel level, LogSource *source, LogDebugGroup debug_group,
 		--_rotate_countdown;
 	}
 
-	if (_rotate != NULL && rotate_allowed &&
-	    _output_size >= MAX_OUTPUT_SIZE && _rotate_countdown <= 0) {
-		if (_rotate(_output, &rotate_level, rotate_message, sizeof(rotate_message)) < 0) {
-			log_set_output_unlocked(NULL, NULL);
-		} else {
-			log_set_output_unlocked(_output, _rotate);
-		}
+	if (rotate_allowed) {
+		log_rotate_unlocked(&rotate_level, rotate_message, sizeof(rotate_message));
 	}
 
 	log_unlock();
 
-	if (rotate_level != LOG_LEVEL_DUMMY) {
-		log_message_checked(rotate_level,
-		                    rotate_level == LOG_LEVEL_DEBUG
-		                    ? LOG_DEBUG_GROUP_COMMON
-		                    : LOG_DEBUG_GROUP_NONE,
-		                    false,
-		                    "%s",
-		                    rotate_message);
-	}
+	log_report_rotation(rotate_level, rotate_message);
 }
 
 void log_format(char *buffer, int length, struct timeval *timestamp,
                 LogLevel level, LogSource *source, LogDebugGroup debug_group,
                 const char *function, int line, const char *message,
                 const char *format, va_list arguments) {
-	time_t unix_seconds;
-	struct tm localized_timestamp;
-	char formatted_timestamp[64] = "<unknown>";
-	char level_char;
-	char *debug_group_name = "";
-	char line_str[16] = "<unknown>";
 	int offset;
 
-	// copy value to time_t variable because timeval.tv_sec and time_t
-	// can have different sizes between different compilers and compiler
-	// version and platforms. for example with WDK 7 both are 4 byte in
-	// size, but with MSVC 2010 time_t is 8 byte in size but timeval.tv_sec
-	// is still 4 byte in size.
-	unix_seconds = timestamp->tv_sec;
-
-	// format time
-	if (localtime_r(&unix_seconds, &localized_timestamp) != NULL) {
-		strftime(formatted_timestamp, sizeof(formatted_timestamp),
-		         "%Y-%m-%d %H:%M:%S", &localized_timestamp);
-	}
-
-	// format level
-	switch (level) {
-	case LOG_LEVEL_ERROR: level_char = 'E'; break;
-	case LOG_LEVEL_WARN:  level_char = 'W'; break;
-	case LOG_LEVEL_INFO:  level_char = 'I'; break;
-	case LOG_LEVEL_DEBUG: level_char = 'D'; break;
-	default:              level_char = 'U'; break;
-	}
-
-	// format debug group
-	switch (debug_group) {
-	case LOG_DEBUG_GROUP_EVENT:  debug_group_name = "event|";  break;
-	case LOG_DEBUG_GROUP_PACKET: debug_group_name = "packet|"; break;
-	case LOG_DEBUG_GROUP_OBJECT: debug_group_name = "object|"; break;
-	case LOG_DEBUG_GROUP_LIBUSB:                               break;
-	default:                                                   break;
-	}
-
-	// format line
-	snprintf(line_str, sizeof(line_str), "%d", line);
-
-	// format prefix
-	snprintf(buffer, length, "%s.%06d <%c> <%s%s:%s> ",
-	         formatted_timestamp, (int)timestamp->tv_usec, level_char,
-	         debug_group_name, source->name, line >= 0 ? line_str : function);
+	offset = log_format_prefix(buffer, length, timestamp, level, source,
+	                           debug_group, function, line);
 
 	// append/format message
 	if (message != NULL) {
 		string_append(buffer, length, message);
 	} else {
-		offset = strlen(buffer); // FIXME: avoid strlen call
-
 		vsnprintf(buffer + offset, MAX(length - offset, 0), format, arguments);
 	}
 
@@ -131,6 +131,7 @@ void log_lock(void);
 void log_unlock(void);
 
 void log_enable_debug_override(const char *filter);
+void log_enable_async(void);
 
 LogLevel log_get_effective_level(void);
 
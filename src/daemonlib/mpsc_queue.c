@@ -0,0 +1,68 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * mpsc_queue.c: Lock-free multi-producer single-consumer queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * the producers push nodes onto a singly linked stack with a compare-and-swap
+ * on its head. the consumer takes the whole stack at once by swapping the head
+ * with NULL and reverses it to get the nodes in FIFO order. because nodes are
+ * never removed individually there is no ABA problem. the nodes of a single
+ * producer are taken in the order they were pushed, the nodes of different
+ * producers are interleaved in the order their compare-and-swap succeeded.
+ */
+
+#include <stddef.h>
+
+#include "mpsc_queue.h"
+
+void mpsc_queue_create(MPSCQueue *queue) {
+	queue->head = NULL;
+}
+
+// might be called from any thread. returns true if the queue was empty before,
+// so the caller knows if the consumer has to be woken up
+bool mpsc_queue_push(MPSCQueue *queue, MPSCNode *node) {
+	MPSCNode *head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+	do {
+		node->next = head;
+	} while (!__atomic_compare_exchange_n(&queue->head, &head, node, true,
+	                                      __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	return head == NULL;
+}
+
+// must only be called from the consumer thread. returns all queued nodes
+// linked by their next pointers in FIFO order, or NULL if the queue is empty
+MPSCNode *mpsc_queue_take(MPSCQueue *queue) {
+	MPSCNode *node = __atomic_exchange_n(&queue->head, NULL, __ATOMIC_ACQUIRE);
+	MPSCNode *reversed = NULL;
+	MPSCNode *next;
+
+	while (node != NULL) {
+		next = node->next;
+		node->next = reversed;
+		reversed = node;
+		node = next;
+	}
+
+	return reversed;
+}
@@ -0,0 +1,45 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * mpsc_queue.h: Lock-free multi-producer single-consumer queue
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef DAEMONLIB_MPSC_QUEUE_H
+#define DAEMONLIB_MPSC_QUEUE_H
+
+#include <stdbool.h>
+
+typedef struct _MPSCNode MPSCNode;
+
+struct _MPSCNode {
+	MPSCNode *next;
+};
+
+// intrusive queue, the nodes are embedded into the items by the caller. any
+// thread can push, but only one thread can take items from the queue
+typedef struct {
+	MPSCNode *head; // most recently pushed node first
+} MPSCQueue;
+
+void mpsc_queue_create(MPSCQueue *queue);
+
+bool mpsc_queue_push(MPSCQueue *queue, MPSCNode *node);
+MPSCNode *mpsc_queue_take(MPSCQueue *queue);
+
+#endif // DAEMONLIB_MPSC_QUEUE_H
@@ -3,6 +3,8 @@
 
 import sys
 import struct
+import time
+import argparse
 
 if sys.hexversion < 0x03040000:
     print('Python 3.4 required')
@@ -20,47 +22,380 @@ def base58encode(value):
 
     return BASE58[value] + encoded
 
-def main():
-    path = sys.argv[1]
+PACKET_LOG_MAGIC = b'TFPKTLOG'
+PACKET_LOG_HEADER_LENGTH = 28
+PACKET_LOG_TYPE_NAMES = ['request', 'response']
 
-    with open(path, 'rb') as f:
-        data = f.read()
+PACKET_TRACE_MAGIC = b'TFPKTTRC'
+PACKET_TRACE_HEADER_FORMAT = '<8sIIIIQQIIQ'
+PACKET_TRACE_HEADER_LENGTH = 64
+PACKET_TRACE_RING_HEADER_LENGTH = 64
+PACKET_TRACE_RECORD_FORMAT = '<QQQIBBBBi20sQ'
 
-    last_timestamp = None
+# the file of the trace point that assigns the trace-ID of a response tells
+# which kind of stack it came from
+STACK_TYPES = {
+    'usb_stack.c': 'USB',
+    'red_stack.c': 'RED Brick SPI',
+    'bricklet_stack.c': 'Bricklet SPI',
+    'mesh_stack.c': 'Mesh',
+    'client.c': 'brickd',
+}
 
-    while len(data) > 0:
-        trace_id, timestamp, header_uid, header_length, header_function_id, \
-          header_sequence_number_and_options, header_error_code_and_future_use \
-          = struct.unpack_from('<QQIBBBB', data, 0)
+HOPS = [
+    'client read -> stack dispatch',
+    'stack dispatch -> device response',
+    'device response -> client write',
+    'total',
+]
+
+def format_header(header_uid, header_length, header_function_id,
+                  header_sequence_number_and_options, header_error_code_and_future_use):
+    return 'U: {:6}, L: {:3d}, F: {:3d}, S: {:2d}, R: {}, E: {}' \
+           .format(base58encode(header_uid),
+                   header_length,
+                   header_function_id,
+                   header_sequence_number_and_options >> 4,
+                   (header_sequence_number_and_options >> 3) & 1,
+                   header_error_code_and_future_use >> 6)
 
-        data = data[24:]
+def read_string(data, offset):
+    i = data.index(b'\0', offset)
 
-        i = data.find(b'\0')
-        filename = data[:i].decode('utf-8')
+    return data[offset:i].decode('utf-8'), i + 1
 
-        data = data[i + 1:]
+# binary packet trace as written by older versions of packet_add_trace to
+# /tmp/daemonlib-packet-trace, before it became a memory-mapped ring file
+def decode_packet_trace(data):
+    offset = 0
+    last_timestamp = None
 
-        line = struct.unpack_from('<i', data, 0)[0]
+    while offset < len(data):
+        trace_id, timestamp, header_uid, header_length, header_function_id, \
+          header_sequence_number_and_options, header_error_code_and_future_use \
+          = struct.unpack_from('<QQIBBBB', data, offset)
 
-        data = data[4:]
+        filename, offset = read_string(data, offset + 24)
+        line = struct.unpack_from('<i', data, offset)[0]
+        offset += 4
 
         if last_timestamp == None:
             last_timestamp = timestamp
 
-        print('I: {:20d}, T: {} {:+10d}, U: {:6}, L: {:3d}, F: {:3d}, S: {:2d}, R: {}, E: {} -> {}:{}'
+        print('I: {:20d}, T: {} {:+10d}, {} -> {}:{}'
               .format(trace_id,
                       timestamp,
                       timestamp - last_timestamp,
-                      base58encode(header_uid),
-                      header_length,
-                      header_function_id,
-                      header_sequence_number_and_options >> 4,
-                      (header_sequence_number_and_options >> 2) & 1,
-                      header_error_code_and_future_use >> 6,
+                      format_header(header_uid, header_length, header_function_id,
+                                    header_sequence_number_and_options,
+                                    header_error_code_and_future_use),
                       filename,
                       line))
 
         last_timestamp = timestamp
 
+# binary packet log as written by packet_log_ if log.packet_file is set. each
+# start of brickd appends a new file header that maps the monotonic record
+# timestamps to wall-clock time
+def decode_packet_log(data):
+    offset = 0
+    wall_clock_offset = 0
+    last_timestamp = None
+
+    while offset < len(data):
+        if data[offset:offset + len(PACKET_LOG_MAGIC)] == PACKET_LOG_MAGIC:
+            version, wall_clock, timestamp = struct.unpack_from('<IQQ', data, offset + len(PACKET_LOG_MAGIC))
+
+            if version != 1:
+                print('Unsupported packet log version {}'.format(version))
+                sys.exit(1)
+
+            wall_clock_offset = wall_clock - timestamp
+            last_timestamp = None
+            offset += PACKET_LOG_HEADER_LENGTH
+
+            continue
+
+        trace_id, timestamp, type_, packet_length = struct.unpack_from('<QQBB', data, offset)
+        offset += 18
+
+        packet = data[offset:offset + packet_length]
+        offset += packet_length
+
+        filename, offset = read_string(data, offset)
+        line = struct.unpack_from('<i', data, offset)[0]
+        offset += 4
+
+        if last_timestamp == None:
+            last_timestamp = timestamp
+
+        wall_clock = wall_clock_offset + timestamp
+
+        print('{}.{:06d} {:+10d} {:8} I: {:20d}, {} -> {}:{}, packet: {}'
+              .format(time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(wall_clock // 1000000)),
+                      wall_clock % 1000000,
+                      timestamp - last_timestamp,
+                      PACKET_LOG_TYPE_NAMES[type_] if type_ < len(PACKET_LOG_TYPE_NAMES) else '<unknown>',
+                      trace_id,
+                      format_header(*struct.unpack_from('<IBBBB', packet, 0)),
+                      filename,
+                      line,
+                      ' '.join('{:02X}'.format(b) for b in packet)))
+
+        last_timestamp = timestamp
+
+class TraceRecord:
+    def __init__(self, ring, number, trace_id, timestamp, header, filename, line):
+        self.ring = ring
+        self.number = number
+        self.trace_id = trace_id
+        self.timestamp = timestamp
+        self.header = header # uid, length, function-id, sequence-number-and-options, error-code-and-future-use
+        self.filename = filename
+        self.line = line
+
+# packet trace rings as written by packet_add_trace to the memory-mapped
+# /tmp/daemonlib-packet-trace. the file can be read while the daemon is
+# running. records that were overwritten while being read are skipped. returns
+# the file header and all records with a number above the given minimum per
+# ring, sorted by timestamp
+def read_packet_trace_rings(data, minimum_numbers=None):
+    magic, version, ring_count, ring_length, record_size, wall_clock, timestamp, \
+      rings_used, _, dropped = struct.unpack_from(PACKET_TRACE_HEADER_FORMAT, data, 0)
+
+    if magic != PACKET_TRACE_MAGIC:
+        print('Packet trace file is not initialized yet')
+        sys.exit(1)
+
+    if version != 1:
+        print('Unsupported packet trace version {}'.format(version))
+        sys.exit(1)
+
+    header = {
+        'ring_count': min(rings_used, ring_count),
+        'wall_clock_offset': wall_clock - timestamp,
+        'dropped': dropped,
+    }
+
+    records = []
+
+    for ring in range(header['ring_count']):
+        ring_offset = PACKET_TRACE_HEADER_LENGTH + ring * (PACKET_TRACE_RING_HEADER_LENGTH + ring_length * record_size)
+        write = struct.unpack_from('<Q', data, ring_offset)[0]
+        minimum = minimum_numbers[ring] if minimum_numbers != None and ring < len(minimum_numbers) else 0
+
+        for number in range(max(write - ring_length, minimum) + 1, write + 1):
+            record_offset = ring_offset + PACKET_TRACE_RING_HEADER_LENGTH + ((number - 1) % ring_length) * record_size
+            begin, trace_id, timestamp, header_uid, header_length, header_function_id, \
+              header_sequence_number_and_options, header_error_code_and_future_use, \
+              line, filename, end = struct.unpack_from(PACKET_TRACE_RECORD_FORMAT, data, record_offset)
+
+            if begin != number or end != number:
+                continue
+
+            records.append(TraceRecord(ring, number, trace_id, timestamp,
+                                       (header_uid, header_length, header_function_id,
+                                        header_sequence_number_and_options,
+                                        header_error_code_and_future_use),
+                                       filename.split(b'\0', 1)[0].decode('utf-8', 'replace'),
+                                       line))
+
+    records.sort(key=lambda record: record.timestamp)
+
+    return header, records
+
+def print_packet_trace_records(header, records, last_timestamp=None):
+    for record in records:
+        if last_timestamp == None:
+            last_timestamp = record.timestamp
+
+        wall_clock = header['wall_clock_offset'] + record.timestamp
+
+        print('{}.{:06d} {:+10d} R: {:2d}, I: {:20d}, {} -> {}:{}'
+              .format(time.strftime('%Y-%m-%d %H:%M:%S', time.localtime(wall_clock // 1000000)),
+                      wall_clock % 1000000,
+                      record.timestamp - last_timestamp,
+                      record.ring,
+                      record.trace_id,
+                      format_header(*record.header),
+                      record.filename,
+                      record.line))
+
+        last_timestamp = record.timestamp
+
+    return last_timestamp
+
+def decode_packet_trace_rings(filename, follow):
+    with open(filename, 'rb') as f:
+        data = f.read()
+
+    header, records = read_packet_trace_rings(data)
+    last_timestamp = print_packet_trace_records(header, records)
+
+    if header['dropped'] > 0:
+        print('{} record(s) of threads without a free ring dropped'.format(header['dropped']))
+
+    if not follow:
+        return
+
+    write_numbers = [0] * header['ring_count']
+
+    for record in records:
+        write_numbers[record.ring] = max(write_numbers[record.ring], record.number)
+
+    try:
+        while True:
+            time.sleep(0.5)
+
+            with open(filename, 'rb') as f:
+                data = f.read()
+
+            header, records = read_packet_trace_rings(data, write_numbers)
+            write_numbers += [0] * (header['ring_count'] - len(write_numbers))
+
+            for record in records:
+                write_numbers[record.ring] = max(write_numbers[record.ring], record.number)
+
+            last_timestamp = print_packet_trace_records(header, records, last_timestamp)
+    except KeyboardInterrupt:
+        pass
+
+# match each response to the request it answers by UID, function-ID and
+# sequence number and measure the time between the trace points along the way:
+#
+#   client read:     first trace point of the request in client.c
+#   stack dispatch:  first trace point of the request in stack.c
+#   device response: trace point that assigned the trace-ID of the response
+#   client write:    first trace point of the response in client.c
+def analyze_latency(records):
+    requests = {} # trace-ID -> [client read, stack dispatch, header]
+    responses = {} # trace-ID -> [device response, client write, header, stack type]
+
+    for record in records:
+        if record.trace_id == 0:
+            continue
+
+        if record.trace_id % 2 == 0:
+            request = requests.setdefault(record.trace_id, [None, None, record.header])
+
+            if record.filename == 'client.c' and request[0] == None:
+                request[0] = record.timestamp
+            elif record.filename == 'stack.c' and request[1] == None:
+                request[1] = record.timestamp
+        else:
+            if record.trace_id not in responses:
+                responses[record.trace_id] = [record.timestamp, None, record.header,
+                                              STACK_TYPES.get(record.filename, record.filename)]
+
+            response = responses[record.trace_id]
+
+            if record.filename == 'client.c' and response[1] == None:
+                response[1] = record.timestamp
+
+    pending = {} # UID, function-ID, sequence number -> requests in order
+
+    for request in sorted(requests.values(), key=lambda request: request[1] or request[0] or 0):
+        uid, _, function_id, sequence_number_and_options, _ = request[2]
+
+        # only requests with response-expected bit set get a response
+        if request[0] == None or (sequence_number_and_options >> 3) & 1 == 0:
+            continue
+
+        pending.setdefault((uid, function_id, sequence_number_and_options >> 4), []).append(request)
+
+    latencies = {} # stack type -> hop -> [microseconds]
+    unmatched = 0
+
+    for response in sorted(responses.values(), key=lambda response: response[0]):
+        uid, _, function_id, sequence_number_and_options, _ = response[2]
+        sequence_number = sequence_number_and_options >> 4
+
+        if sequence_number == 0:
+            continue # callback
+
+        candidates = pending.get((uid, function_id, sequence_number), [])
+
+        # responses to requests with the same key arrive in request order
+        if len(candidates) == 0 or (candidates[0][1] or candidates[0][0]) > response[0]:
+            unmatched += 1
+            continue
+
+        request = candidates.pop(0)
+
+        client_read, stack_dispatch = request[0], request[1]
+        device_response, client_write = response[0], response[1]
+        hops = latencies.setdefault(response[3], {hop: [] for hop in HOPS})
+
+        if stack_dispatch != None:
+            hops[HOPS[0]].append(stack_dispatch - client_read)
+            hops[HOPS[1]].append(device_response - stack_dispatch)
+
+        if client_write != None:
+            hops[HOPS[2]].append(client_write - device_response)
+            hops[HOPS[3]].append(client_write - client_read)
+
+    return latencies, unmatched, sum(len(candidates) for candidates in pending.values())
+
+def print_histogram(values):
+    values = sorted(values)
+    buckets = {}
+
+    for value in values:
+        bucket = 0
+
+        while (1 << bucket) <= value:
+            bucket += 1
+
+        buckets[bucket] = buckets.get(bucket, 0) + 1
+
+    print('    count: {}, p50: {} usec, p99: {} usec, max: {} usec'
+          .format(len(values), values[len(values) // 2], values[len(values) * 99 // 100], values[-1]))
+
+    largest = max(buckets.values())
+
+    for bucket in range(min(buckets), max(buckets) + 1):
+        count = buckets.get(bucket, 0)
+        lower = 0 if bucket == 0 else 1 << (bucket - 1)
+
+        print('    {:>9} .. {:<9} usec {:8d} {}'
+              .format(lower, (1 << bucket) - 1, count, '#' * ((count * 50 + largest - 1) // largest)))
+
+def print_latency(records):
+    latencies, unmatched, unanswered = analyze_latency(records)
+
+    for stack_type in sorted(latencies):
+        print('{}:'.format(stack_type))
+
+        for hop in HOPS:
+            values = latencies[stack_type][hop]
+
+            if len(values) == 0:
+                continue
+
+            print('  {}:'.format(hop))
+            print_histogram(values)
+
+    print('{} response(s) without request, {} request(s) without response'.format(unmatched, unanswered))
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a daemonlib packet trace or binary packet log')
+    parser.add_argument('filename', help='packet trace (/tmp/daemonlib-packet-trace) or packet log file')
+    parser.add_argument('--follow', action='store_true', help='keep printing new records of a packet trace')
+    parser.add_argument('--latency', action='store_true', help='print per-hop latency histograms of a packet trace')
+    args = parser.parse_args()
+
+    with open(args.filename, 'rb') as f:
+        data = f.read()
+
+    if data.startswith(PACKET_LOG_MAGIC):
+        decode_packet_log(data)
+    elif data.startswith(PACKET_TRACE_MAGIC):
+        if args.latency:
+            print_latency(read_packet_trace_rings(data)[1])
+        else:
+            decode_packet_trace_rings(args.filename, args.follow)
+    else:
+        decode_packet_trace(data)
+
 if __name__ == '__main__':
     main()
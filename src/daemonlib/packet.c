@@ -28,18 +28,25 @@
 #include <stdio.h>
 #include <string.h>
 #include <inttypes.h>
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+	#include <stdlib.h>
+	#ifndef _WIN32
+		#include <fcntl.h>
+		#include <sys/mman.h>
+		#include <unistd.h>
+	#endif
+#endif
 
 #include "packet.h"
 
 #include "base58.h"
 #include "log.h"
 #include "macros.h"
+#include "threads.h"
 #include "utils.h"
 
-#ifdef DAEMONLIB_WITH_PACKET_TRACE
-
+#ifdef DAEMONLIB_WITH_LOGGING
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
-
 #endif
 
 STATIC_ASSERT(sizeof(PacketHeader) == 8, "PacketHeader has invalid size");
@@ -51,22 +58,111 @@ STATIC_ASSERT(sizeof(AuthenticateRequest) == 32, "AuthenticateRequest has invali
 STATIC_ASSERT(sizeof(StackEnumerateRequest) == 8, "StackEnumerateRequest has invalid size");
 STATIC_ASSERT(sizeof(StackEnumerateResponse) == 72, "StackEnumerateResponse has invalid size");
 
+// the binary packet log starts with a file header, followed by one record per
+// logged packet. all values are little endian:
+//
+//   record: trace-id (8), timestamp (8), type (1), packet length (1),
+//           packet (packet length), filename (NULL-terminated), line (4)
+//
+// record timestamps are monotonic microseconds, the file header maps them to
+// wall-clock time. packet-trace.py decodes the file
+#define PACKET_LOG_MAGIC "TFPKTLOG"
+#define PACKET_LOG_VERSION 1
+#define PACKET_LOG_BUFFER_SIZE (64 * 1024) // bytes
+#define PACKET_LOG_MAX_FILENAME_LENGTH 128 // bytes, including NULL-terminator
+
+#include "packed_begin.h"
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint64_t wall_clock; // microseconds since epoch, at the time of ...
+	uint64_t timestamp; // ... this monotonic timestamp in microseconds
+} ATTRIBUTE_PACKED PacketLogHeader;
+
+typedef struct {
+	uint64_t trace_id;
+	uint64_t timestamp; // microseconds
+	uint8_t type;
+	uint8_t packet_length;
+} ATTRIBUTE_PACKED PacketLogRecordHeader;
+
+#include "packed_end.h"
+
+static Mutex _packet_log_mutex; // protects writing to _packet_log_file
+static FILE *_packet_log_file = NULL;
+
 #ifdef DAEMONLIB_WITH_PACKET_TRACE
 
-#define TRACE_BUFFER_SIZE 1000
+// the packet trace is a memory-mapped file that holds one ring of trace
+// records per thread. each thread claims a ring on its first trace and writes
+// to it without locking. old records get overwritten, the file always holds
+// the most recent records and can be read live by packet-trace.py while the
+// daemon is running. all values are in host byte order
+//
+//   file:   file header (64), ring count * (ring header (64),
+//           ring length * record (64))
+//   record: begin (8), trace-id (8), timestamp (8), packet header (8),
+//           line (4), filename (20, NULL-terminated), end (8)
+//
+// a record is written end first and begin last. the reader copies it from
+// begin to end and discards it if both don't match, because it was
+// overwritten while being copied
+#define PACKET_TRACE_FILENAME "/tmp/daemonlib-packet-trace"
+#define PACKET_TRACE_MAGIC "TFPKTTRC"
+#define PACKET_TRACE_VERSION 1
+#define PACKET_TRACE_MAX_RINGS 16
+#define PACKET_TRACE_RING_LENGTH 4096 // records
+#define PACKET_TRACE_MAX_FILENAME_LENGTH 20 // bytes, including NULL-terminator
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t ring_count;
+	uint32_t ring_length;
+	uint32_t record_size;
+	uint64_t wall_clock; // microseconds since epoch, at the time of ...
+	uint64_t timestamp; // ... this monotonic timestamp in microseconds
+	uint32_t rings_used; // can exceed ring_count if threads found no free ring
+	uint32_t padding1;
+	uint64_t dropped; // records of threads without a ring
+	uint8_t padding2[8];
+} PacketTraceHeader;
+
+typedef struct {
+	uint64_t write; // number of records written to this ring so far
+	uint8_t padding[56];
+} PacketTraceRingHeader;
 
 typedef struct {
+	uint64_t begin; // record number + 1, zero == unused
 	uint64_t trace_id;
 	uint64_t timestamp; // microseconds
 	PacketHeader header;
-	const char *filename; // __FILE__
-	int line; // __LINE__
-} PacketTrace;
+	int32_t line;
+	char filename[PACKET_TRACE_MAX_FILENAME_LENGTH];
+	uint64_t end; // same as begin, if the record is complete
+} PacketTraceRecord;
+
+typedef struct {
+	PacketTraceRingHeader header;
+	PacketTraceRecord records[PACKET_TRACE_RING_LENGTH];
+} PacketTraceRing;
+
+typedef struct {
+	PacketTraceHeader header;
+	PacketTraceRing rings[PACKET_TRACE_MAX_RINGS];
+} PacketTraceFile;
+
+STATIC_ASSERT(sizeof(PacketTraceHeader) == 64, "PacketTraceHeader has invalid size");
+STATIC_ASSERT(sizeof(PacketTraceRingHeader) == 64, "PacketTraceRingHeader has invalid size");
+STATIC_ASSERT(sizeof(PacketTraceRecord) == 64, "PacketTraceRecord has invalid size");
 
 static uint64_t _next_request_trace_id = 2; // start even
 static uint64_t _next_response_trace_id = UINT64_MAX; // start odd and high
-static PacketTrace _trace_buffer[TRACE_BUFFER_SIZE];
-static int _trace_buffer_used = 0;
+static PacketTraceFile *_packet_trace = NULL;
+static __thread PacketTraceRing *_packet_trace_ring = NULL;
+static __thread bool _packet_trace_ring_unavailable = false;
 
 #endif
 
@@ -150,6 +246,34 @@ bool packet_header_is_valid_response(PacketHeader *header, const char **message)
 	return true;
 }
 
+bool packet_batch_header_is_valid(BatchHeader *header, const char **message) {
+	if (uint32_from_le(header->uid) != 1 || header->zero_length != 0 ||
+	    header->function_id != FUNCTION_SET_BATCH_MODE) {
+		if (message != NULL) {
+			*message = "Invalid batch header";
+		}
+
+		return false;
+	}
+
+	if (uint16_from_le(header->payload_length) > PACKET_MAX_BATCH_PAYLOAD_LENGTH) {
+		if (message != NULL) {
+			*message = "Batch payload length is too big";
+		}
+
+		return false;
+	}
+
+	return true;
+}
+
+void packet_batch_header_init(BatchHeader *header, int payload_length) {
+	header->uid = uint32_to_le(1);
+	header->zero_length = 0;
+	header->function_id = FUNCTION_SET_BATCH_MODE;
+	header->payload_length = uint16_to_le((uint16_t)payload_length);
+}
+
 uint8_t packet_header_get_sequence_number(PacketHeader *header) {
 	return (header->sequence_number_and_options >> 4) & 0x0F;
 }
@@ -295,7 +419,204 @@ bool packet_is_matching_response(Packet *packet, PacketHeader *pending_request)
 	return true;
 }
 
+int packet_log_init(const char *filename) {
+	PacketLogHeader header;
+	struct timeval now;
+
+	_packet_log_file = fopen(filename, "ab");
+
+	if (_packet_log_file == NULL) {
+		log_error("Could not open packet log file '%s': %s (%d)",
+		          filename, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	// the file is written in full buffers, not record by record
+	setvbuf(_packet_log_file, NULL, _IOFBF, PACKET_LOG_BUFFER_SIZE);
+
+	if (gettimeofday(&now, NULL) < 0) {
+		now.tv_sec = time(NULL);
+		now.tv_usec = 0;
+	}
+
+	// each start appends a new file header, the decoder handles that
+	memcpy(header.magic, PACKET_LOG_MAGIC, sizeof(header.magic));
+
+	header.version = uint32_to_le(PACKET_LOG_VERSION);
+	header.wall_clock = uint64_to_le((uint64_t)now.tv_sec * 1000000 + now.tv_usec);
+	header.timestamp = uint64_to_le(microtime());
+
+	fwrite(&header, 1, sizeof(header), _packet_log_file);
+	fflush(_packet_log_file);
+
+	mutex_create(&_packet_log_mutex);
+
+	log_info("Writing binary packet log to '%s'", filename);
+
+	return 0;
+}
+
+void packet_log_exit(void) {
+	if (_packet_log_file == NULL) {
+		return;
+	}
+
+	fclose(_packet_log_file);
+	mutex_destroy(&_packet_log_mutex);
+
+	_packet_log_file = NULL;
+}
+
+bool packet_log_is_enabled(void) {
+	return _packet_log_file != NULL;
+}
+
+// called from the SPI threads as well
+void packet_log_(Packet *packet, PacketLogType type, const char *filename, int line) {
+	uint8_t buffer[sizeof(PacketLogRecordHeader) + sizeof(Packet) +
+	               PACKET_LOG_MAX_FILENAME_LENGTH + sizeof(int32_t)];
+	PacketLogRecordHeader *header = (PacketLogRecordHeader *)buffer;
+	int packet_length = MIN(MAX(packet->header.length, (int)sizeof(PacketHeader)), (int)sizeof(Packet));
+	int filename_length = MIN((int)strlen(filename), PACKET_LOG_MAX_FILENAME_LENGTH - 1);
+	int32_t line_le = (int32_t)uint32_to_le((uint32_t)line);
+	int length = sizeof(PacketLogRecordHeader);
+
 #ifdef DAEMONLIB_WITH_PACKET_TRACE
+	header->trace_id = uint64_to_le(packet->trace_id);
+#else
+	header->trace_id = 0;
+#endif
+	header->timestamp = uint64_to_le(microtime());
+	header->type = (uint8_t)type;
+	header->packet_length = (uint8_t)packet_length;
+
+	memcpy(buffer + length, packet, packet_length);
+	length += packet_length;
+
+	memcpy(buffer + length, filename, filename_length);
+	length += filename_length;
+	buffer[length++] = '\0';
+
+	memcpy(buffer + length, &line_le, sizeof(line_le));
+	length += sizeof(line_le);
+
+	mutex_lock(&_packet_log_mutex);
+
+	fwrite(buffer, 1, length, _packet_log_file);
+
+	mutex_unlock(&_packet_log_mutex);
+}
+
+// a full buffer is written by the record that does not fit anymore. in a quiet
+// period that record might not come for a long time, so the user of the packet
+// log has to call this every PACKET_LOG_FLUSH_INTERVAL
+void packet_log_flush(void) {
+	if (_packet_log_file == NULL) {
+		return;
+	}
+
+	mutex_lock(&_packet_log_mutex);
+
+	fflush(_packet_log_file);
+
+	mutex_unlock(&_packet_log_mutex);
+}
+
+#ifdef DAEMONLIB_WITH_PACKET_TRACE
+
+int packet_trace_init(void) {
+	PacketTraceHeader *header;
+	struct timeval now;
+#ifndef _WIN32
+	int fd;
+
+	fd = open(PACKET_TRACE_FILENAME, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		log_error("Could not open packet trace file '%s': %s (%d)",
+		          PACKET_TRACE_FILENAME, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (ftruncate(fd, sizeof(PacketTraceFile)) < 0) {
+		log_error("Could not resize packet trace file '%s': %s (%d)",
+		          PACKET_TRACE_FILENAME, get_errno_name(errno), errno);
+
+		close(fd);
+
+		return -1;
+	}
+
+	_packet_trace = mmap(NULL, sizeof(PacketTraceFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	close(fd);
+
+	if (_packet_trace == MAP_FAILED) {
+		log_error("Could not map packet trace file '%s': %s (%d)",
+		          PACKET_TRACE_FILENAME, get_errno_name(errno), errno);
+
+		_packet_trace = NULL;
+
+		return -1;
+	}
+#else
+	// there is no file to read live from, but the rings are still useful
+	// from a debugger
+	_packet_trace = calloc(1, sizeof(PacketTraceFile));
+
+	if (_packet_trace == NULL) {
+		log_error("Could not allocate packet trace: %s (%d)",
+		          get_errno_name(ENOMEM), ENOMEM);
+
+		return -1;
+	}
+#endif
+
+	if (gettimeofday(&now, NULL) < 0) {
+		now.tv_sec = time(NULL);
+		now.tv_usec = 0;
+	}
+
+	header = &_packet_trace->header;
+
+	header->version = PACKET_TRACE_VERSION;
+	header->ring_count = PACKET_TRACE_MAX_RINGS;
+	header->ring_length = PACKET_TRACE_RING_LENGTH;
+	header->record_size = sizeof(PacketTraceRecord);
+	header->wall_clock = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+	header->timestamp = microtime();
+
+	// the magic comes last, the file is not valid before the header is complete
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	memcpy(header->magic, PACKET_TRACE_MAGIC, sizeof(header->magic));
+
+#ifndef _WIN32
+	log_info("Writing packet trace to '%s'", PACKET_TRACE_FILENAME);
+#endif
+
+	return 0;
+}
+
+void packet_trace_exit(void) {
+	PacketTraceFile *packet_trace = _packet_trace;
+
+	if (packet_trace == NULL) {
+		return;
+	}
+
+	// the file is kept for post-mortem analysis. other threads might still
+	// be tracing at this point, the mapping stays valid until the process
+	// exits. only stop new traces from starting
+	__atomic_store_n(&_packet_trace, NULL, __ATOMIC_RELEASE);
+
+	if (packet_trace->header.dropped > 0) {
+		log_warn("Dropped %" PRIu64 " packet trace record(s) of threads without a free ring",
+		         packet_trace->header.dropped);
+	}
+}
 
 uint64_t packet_get_next_request_trace_id(void) {
 	return __sync_fetch_and_add(&_next_request_trace_id, 2); // keep even
@@ -305,45 +626,67 @@ uint64_t packet_get_next_response_trace_id(void) {
 	return __sync_fetch_and_sub(&_next_response_trace_id, 2); // keep even
 }
 
-void packet_add_trace_(Packet *packet, const char *filename, int line) {
-	PacketTrace *trace = &_trace_buffer[_trace_buffer_used++];
-	FILE *fp;
-	int i;
+static PacketTraceRing *packet_trace_get_ring(PacketTraceFile *packet_trace) {
+	uint32_t index;
+
+	if (_packet_trace_ring != NULL || _packet_trace_ring_unavailable) {
+		return _packet_trace_ring;
+	}
 
-	trace->trace_id = packet->trace_id;
-	trace->timestamp = microtime();
-	trace->header = packet->header;
-	trace->filename = filename;
-	trace->line = line;
+	index = __atomic_fetch_add(&packet_trace->header.rings_used, 1, __ATOMIC_RELAXED);
 
-	if (_trace_buffer_used == TRACE_BUFFER_SIZE) {
-		log_info("Writing packet trace to /tmp/daemonlib-packet-trace");
+	if (index >= PACKET_TRACE_MAX_RINGS) {
+		_packet_trace_ring_unavailable = true;
 
-		fp = fopen("/tmp/daemonlib-packet-trace", "wb");
+		return NULL;
+	}
 
-		if (fp == NULL) {
-			_trace_buffer_used = 0;
+	_packet_trace_ring = &packet_trace->rings[index];
 
-			log_error("Could not open /tmp/daemonlib-packet-trace");
+	return _packet_trace_ring;
+}
 
-			return;
-		}
+void packet_add_trace_(Packet *packet, const char *filename, int line) {
+	PacketTraceFile *packet_trace = __atomic_load_n(&_packet_trace, __ATOMIC_ACQUIRE);
+	PacketTraceRing *ring;
+	PacketTraceRecord *record;
+	uint64_t number;
+	const char *basename;
+
+	if (packet_trace == NULL) {
+		return;
+	}
 
-		for (i = 0; i < _trace_buffer_used; ++i) {
-			trace = &_trace_buffer[i];
+	ring = packet_trace_get_ring(packet_trace);
 
-			fwrite(&trace->trace_id, 1, sizeof(trace->trace_id), fp);
-			fwrite(&trace->timestamp, 1, sizeof(trace->timestamp), fp);
-			fwrite(&trace->header, 1, sizeof(trace->header), fp);
-			fwrite(trace->filename, 1, strlen(trace->filename) + 1, fp);
-			fwrite(&trace->line, 1, sizeof(trace->line), fp);
-		}
+	if (ring == NULL) {
+		__atomic_fetch_add(&packet_trace->header.dropped, 1, __ATOMIC_RELAXED);
+
+		return;
+	}
 
-		fflush(fp);
-		fclose(fp);
+	// only this thread writes to the ring, no atomic increment needed
+	number = ring->header.write + 1;
+	record = &ring->records[(number - 1) % PACKET_TRACE_RING_LENGTH];
+	basename = strrchr(filename, '/');
 
-		_trace_buffer_used = 0;
+	if (basename != NULL) {
+		filename = basename + 1;
 	}
+
+	__atomic_store_n(&record->end, number, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	record->trace_id = packet->trace_id;
+	record->timestamp = microtime();
+	record->header = packet->header;
+	record->line = line;
+
+	string_copy(record->filename, sizeof(record->filename), filename, -1);
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&record->begin, number, __ATOMIC_RELAXED);
+	__atomic_store_n(&ring->header.write, number, __ATOMIC_RELEASE);
 }
 
 #endif
@@ -45,7 +45,8 @@ typedef enum {
 
 typedef enum {
 	FUNCTION_GET_AUTHENTICATION_NONCE = 1,
-	FUNCTION_AUTHENTICATE
+	FUNCTION_AUTHENTICATE,
+	FUNCTION_SET_BATCH_MODE
 } BrickDaemonFunctionID;
 
 typedef enum {
@@ -66,6 +67,8 @@ typedef enum {
 #define PACKET_MAX_STACK_ENUMERATE_UIDS 16
 #define PACKET_NO_CONNECTED_UID_STR "0\0\0\0\0\0\0\0"
 #define PACKET_NO_CONNECTED_UID_STR_LENGTH 8
+#define PACKET_MAX_BATCH_PAYLOAD_LENGTH 1024
+#define PACKET_MAX_BATCH_LENGTH ((int)sizeof(BatchHeader) + PACKET_MAX_BATCH_PAYLOAD_LENGTH)
 
 #include "packed_begin.h"
 
@@ -122,6 +125,27 @@ typedef struct {
 	PacketHeader header;
 } ATTRIBUTE_PACKED AuthenticateResponse;
 
+typedef struct {
+	PacketHeader header;
+	uint8_t enable; // bool
+} ATTRIBUTE_PACKED SetBatchModeRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint16_t max_payload_length; // always little endian, 0 if disabled
+} ATTRIBUTE_PACKED SetBatchModeResponse;
+
+// in batch mode all packets are send inside of batch frames. a batch frame
+// starts with a header that has the same layout as a packet header of UID 1,
+// but with a length of 0, which is invalid for a packet. the length of the
+// payload follows the function ID. the payload consists of complete packets
+typedef struct {
+	uint32_t uid; // always 1, little endian
+	uint8_t zero_length; // always 0
+	uint8_t function_id; // always FUNCTION_SET_BATCH_MODE
+	uint16_t payload_length; // always little endian
+} ATTRIBUTE_PACKED BatchHeader;
+
 typedef struct {
 	PacketHeader header;
 } ATTRIBUTE_PACKED StackEnumerateRequest;
@@ -135,6 +159,8 @@ typedef struct {
 
 bool packet_header_is_valid_request(PacketHeader *header, const char **message);
 bool packet_header_is_valid_response(PacketHeader *header, const char **message);
+bool packet_batch_header_is_valid(BatchHeader *header, const char **message);
+void packet_batch_header_init(BatchHeader *header, int payload_length);
 
 uint8_t packet_header_get_sequence_number(PacketHeader *header);
 void packet_header_set_sequence_number(PacketHeader *header, uint8_t sequence_number);
@@ -153,16 +179,66 @@ char *packet_get_dump(char *dump, Packet *packet, int length);
 
 bool packet_is_matching_response(Packet *packet, PacketHeader *pending_request);
 
+typedef enum {
+	PACKET_LOG_TYPE_REQUEST = 0,
+	PACKET_LOG_TYPE_RESPONSE
+} PacketLogType;
+
+#define PACKET_LOG_FLUSH_INTERVAL 1000000 // microseconds
+
+int packet_log_init(const char *filename);
+void packet_log_exit(void);
+bool packet_log_is_enabled(void);
+void packet_log_(Packet *packet, PacketLogType type, const char *filename, int line);
+void packet_log_flush(void);
+
+// packet debug logging for messages that describe a single request or
+// response. if the binary packet log is enabled then only the raw packet is
+// recorded there and the log_packet_debug arguments are not evaluated at all.
+// this avoids formatting packet signatures on the hot path. the call site has
+// to include log.h
+#ifdef _MSC_VER
+	#define log_packet_typed_debug(packet, type, ...) \
+		do { \
+			if (packet_log_is_enabled()) { \
+				packet_log_(packet, type, __FILE__, __LINE__); \
+			} else { \
+				log_packet_debug(__VA_ARGS__); \
+			} \
+		__pragma(warning(push)) \
+		__pragma(warning(disable:4127)) \
+		} while (0) \
+		__pragma(warning(pop))
+#else
+	#define log_packet_typed_debug(packet, type, ...) \
+		do { \
+			if (packet_log_is_enabled()) { \
+				packet_log_(packet, type, __FILE__, __LINE__); \
+			} else { \
+				log_packet_debug(__VA_ARGS__); \
+			} \
+		} while (0)
+#endif
+
+#define log_packet_request_debug(packet, ...) log_packet_typed_debug(packet, PACKET_LOG_TYPE_REQUEST, __VA_ARGS__)
+#define log_packet_response_debug(packet, ...) log_packet_typed_debug(packet, PACKET_LOG_TYPE_RESPONSE, __VA_ARGS__)
+
 #ifdef DAEMONLIB_WITH_PACKET_TRACE
 
 #define packet_add_trace(packet) packet_add_trace_(packet, __FILE__, __LINE__)
 
+int packet_trace_init(void);
+void packet_trace_exit(void);
+
 uint64_t packet_get_next_request_trace_id(void);
 uint64_t packet_get_next_response_trace_id(void);
 void packet_add_trace_(Packet *packet, const char *filename, int line);
 
 #else
 
+#define packet_trace_init() ((void)0)
+#define packet_trace_exit() ((void)0)
+
 #define packet_add_trace(packet) ((void)(packet))
 
 #endif
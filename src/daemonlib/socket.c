@@ -69,6 +69,9 @@ int socket_create(Socket *socket) {
 	socket->destroy = socket_destroy_platform;
 	socket->receive = socket_receive_platform;
 	socket->send = socket_send_platform;
+#ifdef DAEMONLIB_WITH_IO_URING
+	socket->uring_slot = -1;
+#endif
 
 	return 0;
 }
@@ -50,6 +50,9 @@ struct _Socket {
 	SocketDestroyFunction destroy;
 	SocketReceiveFunction receive;
 	SocketSendFunction send;
+#ifdef DAEMONLIB_WITH_IO_URING
+	int uring_slot; // -1 if not attached to the io_uring event loop
+#endif
 };
 
 // FIXME: maybe merge socket_create and socket_open
@@ -83,4 +86,9 @@ int socket_address_to_hostname(struct sockaddr *address, socklen_t address_lengt
 void socket_open_server(Array *sockets, const char *address, uint16_t port, bool dual_stack,
                         SocketCreateAllocatedFunction create_allocated);
 
+#ifndef _WIN32
+void socket_open_unix_server(Array *sockets, const char *path,
+                             SocketCreateAllocatedFunction create_allocated);
+#endif
+
 #endif // DAEMONLIB_SOCKET_H
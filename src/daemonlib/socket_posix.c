@@ -28,13 +28,21 @@
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <arpa/inet.h>
 
 #include "socket.h"
 
+#ifdef DAEMONLIB_WITH_IO_URING
+	#include "event_uring.h"
+#endif
+#include "log.h"
 #include "utils.h"
 
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+
 // sets errno on error
 static int socket_prepare(Socket *socket) {
 	int no_delay = 1;
@@ -94,6 +102,11 @@ int socket_accept_platform(Socket *socket, Socket *accepted_socket,
 		return -1;
 	}
 
+#ifdef DAEMONLIB_WITH_IO_URING
+	// if the socket cannot be attached it is used with plain syscalls
+	accepted_socket->uring_slot = event_uring_attach_socket(accepted_socket->handle);
+#endif
+
 	return 0;
 }
 
@@ -101,6 +114,14 @@ void socket_destroy_platform(Socket *socket) {
 	// check if socket is actually open, as socket_create deviates from
 	// the common pattern of allocation the wrapped resource
 	if (socket->handle != IO_HANDLE_INVALID) {
+#ifdef DAEMONLIB_WITH_IO_URING
+		if (socket->uring_slot >= 0) {
+			event_uring_detach_socket(socket->uring_slot);
+
+			socket->uring_slot = -1;
+		}
+#endif
+
 		shutdown(socket->handle, SHUT_RDWR);
 		robust_close(socket->handle);
 	}
@@ -131,6 +152,12 @@ int socket_connect(Socket *socket, struct sockaddr *address, int length) {
 
 // sets errno on error
 int socket_receive_platform(Socket *socket, void *buffer, int length) {
+#ifdef DAEMONLIB_WITH_IO_URING
+	if (socket->uring_slot >= 0) {
+		return event_uring_receive(socket->uring_slot, buffer, length);
+	}
+#endif
+
 	return recv(socket->handle, buffer, length, 0);
 }
 
@@ -142,6 +169,12 @@ int socket_send_platform(Socket *socket, const void *buffer, int length) {
 	int flags = 0;
 #endif
 
+#ifdef DAEMONLIB_WITH_IO_URING
+	if (socket->uring_slot >= 0) {
+		return event_uring_send(socket->uring_slot, buffer, length);
+	}
+#endif
+
 	return send(socket->handle, buffer, length, flags);
 }
 
@@ -325,3 +358,99 @@ int socket_address_to_hostname(struct sockaddr *address, socklen_t address_lengt
 
 	return 0;
 }
+
+// logs errors
+void socket_open_unix_server(Array *sockets, const char *path,
+                             SocketCreateAllocatedFunction create_allocated) {
+	struct sockaddr_un address;
+	struct stat st;
+	Socket *socket;
+
+	log_debug("Opening UNIX domain server socket at '%s'", path);
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		log_error("Could not open UNIX domain server socket, path '%s' is too long (maximum: %d chars)",
+		          path, (int)sizeof(address.sun_path) - 1);
+
+		return;
+	}
+
+	memset(&address, 0, sizeof(address));
+
+	address.sun_family = AF_UNIX;
+
+	strcpy(address.sun_path, path);
+
+	// remove a stale socket file left behind by a previous run. refuse to
+	// remove anything that is not a socket
+	if (lstat(path, &st) >= 0) {
+		if (!S_ISSOCK(st.st_mode)) {
+			log_error("Could not open UNIX domain server socket, '%s' exists and is not a socket",
+			          path);
+
+			return;
+		}
+
+		if (unlink(path) < 0) {
+			log_error("Could not remove stale UNIX domain socket '%s': %s (%d)",
+			          path, get_errno_name(errno), errno);
+
+			return;
+		}
+	}
+
+	socket = array_append(sockets);
+
+	if (socket == NULL) {
+		log_error("Could not append to socket array: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		return;
+	}
+
+	if (socket_create(socket) < 0) {
+		log_error("Could not create socket: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_remove(sockets, sockets->count - 1, NULL);
+
+		return;
+	}
+
+	if (socket_open(socket, AF_UNIX, SOCK_STREAM, 0) < 0) {
+		log_error("Could not open UNIX domain server socket: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		array_remove(sockets, sockets->count - 1, (ItemDestroyFunction)socket_destroy);
+
+		return;
+	}
+
+	if (socket_bind(socket, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		log_error("Could not bind UNIX domain server socket to '%s': %s (%d)",
+		          path, get_errno_name(errno), errno);
+
+		array_remove(sockets, sockets->count - 1, (ItemDestroyFunction)socket_destroy);
+
+		return;
+	}
+
+	// allow all local users to connect, as they can connect to the plain
+	// TCP/IP port on the loopback interface as well
+	if (chmod(path, 0666) < 0) {
+		log_warn("Could not change permissions of UNIX domain socket '%s': %s (%d)",
+		         path, get_errno_name(errno), errno);
+	}
+
+	if (socket_listen(socket, 10, create_allocated) < 0) {
+		log_error("Could not listen to UNIX domain server socket bound to '%s': %s (%d)",
+		          path, get_errno_name(errno), errno);
+
+		array_remove(sockets, sockets->count - 1, (ItemDestroyFunction)socket_destroy);
+		unlink(path);
+
+		return;
+	}
+
+	log_debug("Started listening to UNIX domain socket '%s'", path);
+}
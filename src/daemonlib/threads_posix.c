@@ -24,7 +24,9 @@
 #include "log.h"
 #include "utils.h"
 
+#ifdef DAEMONLIB_WITH_LOGGING
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+#endif
 
 void mutex_create(Mutex *mutex) {
 	pthread_mutex_init(&mutex->handle, NULL);
@@ -23,6 +23,8 @@
 	#include "timer_uwp.c"
 #elif defined _WIN32
 	#include "timer_winapi.c"
+#elif defined __linux__ && !defined __ANDROID__ && defined DAEMONLIB_WITH_TIMER_WHEEL
+	#include "timer_wheel.c"
 #elif defined __linux__ && !defined __ANDROID__
 	#include "timer_linux.c"
 #else
@@ -28,6 +28,8 @@
 	#include "timer_uwp.h"
 #elif defined _WIN32
 	#include "timer_winapi.h"
+#elif defined __linux__ && !defined __ANDROID__ && defined DAEMONLIB_WITH_TIMER_WHEEL
+	#include "timer_wheel.h"
 #elif defined __linux__ && !defined __ANDROID__
 	#include "timer_linux.h"
 #else
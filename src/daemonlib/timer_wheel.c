@@ -0,0 +1,421 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * timer_wheel.c: Timer wheel based timer implementation for Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * all timers share a single timerfd. the timers are kept in a hierarchical
+ * timer wheel with TIMER_WHEEL_LEVELS levels of TIMER_WHEEL_SLOTS slots each.
+ * a slot on level 0 holds the timers that expire in one specific tick, a slot
+ * on level N holds the timers that expire in a range of SLOTS^N ticks. once
+ * the current tick reaches the start of such a range, its timers are moved
+ * down (cascaded) to the lower levels. arming and canceling a timer is O(1).
+ *
+ * the timerfd is not ticking periodically. it is armed for the next tick that
+ * has something to do, either timers to expire or timers to cascade, and only
+ * rearmed if that tick changes. the wheel is not thread-safe, it has to be
+ * used from the event loop thread only.
+ *
+ * timers expire with a resolution of TIMER_WHEEL_TICK, but never early.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timer_wheel.h"
+
+#include "event.h"
+#include "log.h"
+#include "utils.h"
+
+#ifdef DAEMONLIB_WITH_LOGGING
+static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+#endif
+
+#define TIMER_WHEEL_TICK 1000 // microseconds
+#define TIMER_WHEEL_LEVEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_LEVEL_BITS) // per level
+#define TIMER_WHEEL_LEVELS 6 // covers 2 years at 1 millisecond per tick
+#define TIMER_WHEEL_MAX_DELTA (((uint64_t)1 << (TIMER_WHEEL_LEVEL_BITS * TIMER_WHEEL_LEVELS)) - 1) // ticks
+#define TIMER_WHEEL_NO_SLOT -1
+
+static EVENT_THREAD_LOCAL IOHandle _handle = IO_HANDLE_INVALID;
+static EVENT_THREAD_LOCAL int _timer_count = 0; // the timerfd exists as long as timers exist
+static EVENT_THREAD_LOCAL bool _running = false;
+static EVENT_THREAD_LOCAL uint64_t _current_tick = 0; // next tick to be processed
+static EVENT_THREAD_LOCAL uint64_t _armed_tick = UINT64_MAX; // UINT64_MAX == timerfd is disarmed
+static EVENT_THREAD_LOCAL Node _slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+static EVENT_THREAD_LOCAL int _slotted_timer_count = 0; // timers in slots, not counting the expired list
+static EVENT_THREAD_LOCAL uint64_t _occupied[TIMER_WHEEL_LEVELS]; // bitmap of non-empty slots
+
+// the same clock the timerfd uses, microtime uses CLOCK_MONOTONIC_RAW
+static uint64_t timer_wheel_get_time(void) { // microseconds
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		abort(); // clock_gettime cannot fail under normal circumstances
+	}
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t timer_wheel_rotate_right(uint64_t value, int count) {
+	return (value >> count) | (value << ((64 - count) & 63));
+}
+
+static void timer_wheel_add(Timer *timer) {
+	uint64_t expiry = timer->expiry;
+	uint64_t delta;
+	int level = 0;
+	int index;
+
+	if (expiry < _current_tick) {
+		expiry = _current_tick;
+	}
+
+	delta = MIN(expiry - _current_tick, TIMER_WHEEL_MAX_DELTA);
+	expiry = _current_tick + delta;
+
+	while (delta >= TIMER_WHEEL_SLOTS) {
+		delta >>= TIMER_WHEEL_LEVEL_BITS;
+		++level;
+	}
+
+	index = (int)(expiry >> (level * TIMER_WHEEL_LEVEL_BITS)) & (TIMER_WHEEL_SLOTS - 1);
+
+	node_insert_before(&_slots[level][index], &timer->node);
+
+	_occupied[level] |= (uint64_t)1 << index;
+	timer->slot = level * TIMER_WHEEL_SLOTS + index;
+
+	++_slotted_timer_count;
+}
+
+static void timer_wheel_remove(Timer *timer) {
+	int level;
+	int index;
+
+	if (timer->node.next == &timer->node) {
+		return; // not armed
+	}
+
+	node_remove(&timer->node);
+
+	if (timer->slot == TIMER_WHEEL_NO_SLOT) {
+		return; // in the expired list
+	}
+
+	level = timer->slot / TIMER_WHEEL_SLOTS;
+	index = timer->slot % TIMER_WHEEL_SLOTS;
+
+	if (_slots[level][index].next == &_slots[level][index]) {
+		_occupied[level] &= ~((uint64_t)1 << index);
+	}
+
+	timer->slot = TIMER_WHEEL_NO_SLOT;
+
+	--_slotted_timer_count;
+}
+
+// moves all timers of a slot to the end of the TARGET list
+static void timer_wheel_take_slot(int level, int index, Node *target) {
+	Node *slot = &_slots[level][index];
+	Timer *timer;
+
+	while (slot->next != slot) {
+		timer = containerof(slot->next, Timer, node);
+
+		timer_wheel_remove(timer);
+		node_insert_before(target, &timer->node);
+	}
+}
+
+// returns the first tick, starting with the current tick, on which a slot has
+// to be processed. level 0 slots are processed on their tick, higher level
+// slots are cascaded on the first tick of their range
+static uint64_t timer_wheel_get_next_tick(void) {
+	uint64_t next = UINT64_MAX;
+	uint64_t unit;
+	int shift;
+	int level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		if (_occupied[level] == 0) {
+			continue;
+		}
+
+		shift = level * TIMER_WHEEL_LEVEL_BITS;
+		unit = (_current_tick + ((uint64_t)1 << shift) - 1) >> shift;
+		unit += __builtin_ctzll(timer_wheel_rotate_right(_occupied[level],
+		                                                 (int)(unit & (TIMER_WHEEL_SLOTS - 1))));
+
+		next = MIN(next, unit << shift);
+	}
+
+	return next;
+}
+
+static int timer_wheel_update(void) {
+	uint64_t next;
+	struct itimerspec itimerspec;
+
+	if (_running || _handle == IO_HANDLE_INVALID) {
+		return 0;
+	}
+
+	next = timer_wheel_get_next_tick();
+
+	if (next == _armed_tick) {
+		return 0;
+	}
+
+	memset(&itimerspec, 0, sizeof(itimerspec));
+
+	if (next != UINT64_MAX) {
+		itimerspec.it_value.tv_sec = next * TIMER_WHEEL_TICK / 1000000;
+		itimerspec.it_value.tv_nsec = (next * TIMER_WHEEL_TICK % 1000000) * 1000;
+
+		// an all-zero it_value disarms the timerfd
+		if (itimerspec.it_value.tv_sec == 0 && itimerspec.it_value.tv_nsec == 0) {
+			itimerspec.it_value.tv_nsec = 1;
+		}
+	}
+
+	if (timerfd_settime(_handle, TFD_TIMER_ABSTIME, &itimerspec, NULL) < 0) {
+		log_error("Could not configure timerfd (handle: %d): %s (%d)",
+		          _handle, get_errno_name(errno), errno);
+
+		_armed_tick = UINT64_MAX;
+
+		return -1;
+	}
+
+	_armed_tick = next;
+
+	return 0;
+}
+
+static void timer_wheel_run(uint64_t now) { // ticks
+	uint64_t tick;
+	int shift;
+	int level;
+	int top;
+	Node expired;
+	Timer *timer;
+
+	_running = true;
+
+	while (_current_tick <= now) {
+		tick = timer_wheel_get_next_tick();
+
+		if (tick > now) {
+			// nothing to do up to now, skip the empty ticks
+			_current_tick = now + 1;
+
+			break;
+		}
+
+		_current_tick = tick;
+
+		// cascade the higher levels whose range starts at this tick, top
+		// down so timers can move more than one level per tick
+		for (top = 0; top + 1 < TIMER_WHEEL_LEVELS; ++top) {
+			if ((tick & (((uint64_t)1 << ((top + 1) * TIMER_WHEEL_LEVEL_BITS)) - 1)) != 0) {
+				break;
+			}
+		}
+
+		node_reset(&expired);
+
+		for (level = top; level > 0; --level) {
+			shift = level * TIMER_WHEEL_LEVEL_BITS;
+
+			timer_wheel_take_slot(level, (int)(tick >> shift) & (TIMER_WHEEL_SLOTS - 1), &expired);
+
+			while (expired.next != &expired) {
+				timer = containerof(expired.next, Timer, node);
+
+				node_remove(&timer->node);
+				timer_wheel_add(timer);
+			}
+		}
+
+		timer_wheel_take_slot(0, (int)tick & (TIMER_WHEEL_SLOTS - 1), &expired);
+
+		_current_tick = tick + 1;
+
+		// the timer functions might reconfigure or destroy any timer,
+		// including the ones still in the expired list
+		while (expired.next != &expired) {
+			timer = containerof(expired.next, Timer, node);
+
+			node_remove(&timer->node);
+
+			if (timer->expiry > tick) {
+				// the expiry was beyond the range of the wheel
+				timer_wheel_add(timer);
+
+				continue;
+			}
+
+			// like a timerfd, call the timer function only once, even if the
+			// interval elapsed more than once until now
+			if (timer->interval > 0) {
+				timer->expiry += ((now - timer->expiry) / timer->interval + 1) * timer->interval;
+
+				timer_wheel_add(timer);
+			}
+
+			timer->function(timer->opaque);
+		}
+	}
+
+	_running = false;
+}
+
+static void timer_wheel_handle_read(void *opaque) {
+	uint64_t value;
+
+	(void)opaque;
+
+	// read the timer expire count and ignore it
+	if (robust_read(_handle, &value, sizeof(value)) < 0) {
+		if (errno_would_block()) {
+			return;
+		}
+
+		log_error("Could not read from timerfd (handle: %d): %s (%d)",
+		          _handle, get_errno_name(errno), errno);
+
+		return;
+	}
+
+	_armed_tick = UINT64_MAX; // expired, not armed anymore
+
+	timer_wheel_run(timer_wheel_get_time() / TIMER_WHEEL_TICK);
+	timer_wheel_update();
+}
+
+static int timer_wheel_init(void) {
+	int level;
+	int index;
+
+	_handle = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+	if (_handle < 0) {
+		log_error("Could not create timerfd: %s (%d)",
+		          get_errno_name(errno), errno);
+
+		_handle = IO_HANDLE_INVALID;
+
+		return -1;
+	}
+
+	if (event_add_source(_handle, EVENT_SOURCE_TYPE_GENERIC, "timer-wheel",
+	                     EVENT_READ, timer_wheel_handle_read, NULL) < 0) {
+		robust_close(_handle);
+
+		_handle = IO_HANDLE_INVALID;
+
+		return -1;
+	}
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		for (index = 0; index < TIMER_WHEEL_SLOTS; ++index) {
+			node_reset(&_slots[level][index]);
+		}
+
+		_occupied[level] = 0;
+	}
+
+	_slotted_timer_count = 0;
+	_armed_tick = UINT64_MAX;
+
+	log_debug("Created timer wheel timerfd (handle: %d)", _handle);
+
+	return 0;
+}
+
+static void timer_wheel_exit(void) {
+	log_debug("Destroying timer wheel timerfd (handle: %d)", _handle);
+
+	event_remove_source(_handle, EVENT_SOURCE_TYPE_GENERIC);
+
+	robust_close(_handle);
+
+	_handle = IO_HANDLE_INVALID;
+}
+
+int timer_create_(Timer *timer, TimerFunction function, void *opaque) {
+	if (_timer_count == 0 && timer_wheel_init() < 0) {
+		return -1;
+	}
+
+	++_timer_count;
+
+	node_reset(&timer->node);
+
+	timer->slot = TIMER_WHEEL_NO_SLOT;
+	timer->expiry = 0;
+	timer->interval = 0;
+	timer->function = function;
+	timer->opaque = opaque;
+
+	return 0;
+}
+
+void timer_destroy(Timer *timer) {
+	timer_wheel_remove(timer);
+
+	if (--_timer_count == 0) {
+		timer_wheel_exit();
+	} else {
+		timer_wheel_update();
+	}
+}
+
+// setting delay and interval to 0 stops the timer
+int timer_configure(Timer *timer, uint64_t delay, uint64_t interval) { // microseconds
+	uint64_t now;
+
+	timer_wheel_remove(timer);
+
+	if (delay == 0 && interval == 0) {
+		return timer_wheel_update();
+	}
+
+	now = timer_wheel_get_time();
+
+	// an empty wheel has no position to keep, move it to the present so the
+	// ticks it was idle don't have to be skipped later
+	if (_slotted_timer_count == 0) {
+		_current_tick = MAX(_current_tick, now / TIMER_WHEEL_TICK);
+	}
+
+	timer->expiry = (now + delay + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+	timer->interval = (interval + TIMER_WHEEL_TICK - 1) / TIMER_WHEEL_TICK;
+
+	timer_wheel_add(timer);
+
+	return timer_wheel_update();
+}
@@ -0,0 +1,40 @@
+/*
+ * daemonlib
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * timer_wheel.h: Timer wheel based timer implementation for Linux
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DAEMONLIB_TIMER_WHEEL_H
+#define DAEMONLIB_TIMER_WHEEL_H
+
+#include <stdint.h>
+
+#include "node.h"
+
+typedef void (*TimerFunction)(void *opaque);
+
+typedef struct {
+	Node node; // in a wheel slot or in the expired list, if armed
+	int slot; // level * slots per level + index, -1 == not in a wheel slot
+	uint64_t expiry; // ticks
+	uint64_t interval; // ticks, 0 == one-shot
+	TimerFunction function;
+	void *opaque;
+} Timer;
+
+#endif // DAEMONLIB_TIMER_WHEEL_H
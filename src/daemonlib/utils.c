@@ -467,6 +467,29 @@ uint32_t uint32_to_le(uint32_t native) {
 	return c.little;
 }
 
+// convert from host endian to little endian
+uint64_t uint64_to_le(uint64_t native) {
+	union {
+		uint8_t bytes[8];
+		uint64_t little;
+	} c;
+	int i;
+
+	for (i = 0; i < 8; ++i) {
+		c.bytes[i] = (native >> (i * 8)) & 0xFF;
+	}
+
+	return c.little;
+}
+
+// convert from little endian to host endian
+uint16_t uint16_from_le(uint16_t value) {
+	uint8_t *bytes = (uint8_t *)&value;
+
+	return (uint16_t)(((uint16_t)bytes[1] << 8) |
+	                  ((uint16_t)bytes[0] << 0));
+}
+
 // convert from little endian to host endian
 uint32_t uint32_from_le(uint32_t value) {
 	uint8_t *bytes = (uint8_t *)&value;
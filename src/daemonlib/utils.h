@@ -49,7 +49,9 @@ int parse_int(const char *string, char **end_ptr, int base, int *value);
 
 uint16_t uint16_to_le(uint16_t native);
 uint32_t uint32_to_le(uint32_t native);
+uint64_t uint64_to_le(uint64_t native);
 
+uint16_t uint16_from_le(uint16_t value);
 uint32_t uint32_from_le(uint32_t value);
 
 void microsleep(uint32_t duration);
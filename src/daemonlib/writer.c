@@ -20,42 +20,243 @@
  */
 
 #include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "writer.h"
 
 #include "event.h"
 #include "log.h"
+#include "macros.h"
+#include "utils.h"
 
+#ifdef DAEMONLIB_WITH_LOGGING
 static LogSource _log_source = LOG_SOURCE_INITIALIZER;
+#endif
 
-#define MAX_QUEUED_WRITES 32768
+// the backlog is a byte ring that stores only header.length bytes per packet.
+// it starts small and grows geometrically up to MAX_BACKLOG_SIZE. this allows
+// the same worst-case capacity as the former 32768 packets queue, but most
+// packets are much smaller than 80 bytes
+#define MIN_BACKLOG_SIZE 1024 // bytes
+#define MAX_BACKLOG_SIZE (32768 * (int)sizeof(Packet)) // bytes
+
+static void writer_copy_to_backlog(Writer *writer, int offset, const void *data, int length) {
+	int first = MIN(length, writer->backlog_allocated - offset);
+
+	memcpy(writer->backlog + offset, data, first);
+
+	if (length > first) {
+		memcpy(writer->backlog, (const uint8_t *)data + first, length - first);
+	}
+}
+
+static void writer_copy_from_backlog(Writer *writer, int offset, void *data, int length) {
+	int first = MIN(length, writer->backlog_allocated - offset);
+
+	memcpy(data, writer->backlog + offset, first);
+
+	if (length > first) {
+		memcpy((uint8_t *)data + first, writer->backlog, length - first);
+	}
+}
+
+// returns the length of the packet or batch frame that starts at DATA
+static int writer_get_packet_length(Writer *writer, const uint8_t *data) {
+	if (writer->packet_length != NULL) {
+		return writer->packet_length(data);
+	}
+
+	if (((const PacketHeader *)data)->length == 0) {
+		// batch frame, see BatchHeader
+		return (int)sizeof(BatchHeader) + uint16_from_le(((const BatchHeader *)data)->payload_length);
+	}
+
+	return ((const PacketHeader *)data)->length;
+}
+
+// returns the length of the packet or batch frame that starts at OFFSET in the
+// backlog. this only works for packets that are stored completely in the
+// backlog, which is true for every packet except a partially sent first packet
+static int writer_get_backlog_packet_length(Writer *writer, int offset) {
+	uint8_t header[WRITER_PACKET_LENGTH_HEADER_SIZE];
+
+	writer_copy_from_backlog(writer, offset, header, sizeof(header));
+
+	return writer_get_packet_length(writer, header);
+}
+
+#ifdef DAEMONLIB_WITH_LOGGING
+
+static char *writer_get_signature(Writer *writer, char *signature, const uint8_t *data, int length) {
+	if (writer->packet_length == NULL && ((const PacketHeader *)data)->length == 0) {
+		snprintf(signature, PACKET_MAX_SIGNATURE_LENGTH, "batch of %d byte(s)", length);
+
+		return signature;
+	}
+
+	return writer->packet_signature(signature, (Packet *)data);
+}
+
+#endif
+
+// sets errno on error
+static int writer_grow_backlog(Writer *writer, int needed) {
+	int allocated = writer->backlog_allocated > 0 ? writer->backlog_allocated : MIN_BACKLOG_SIZE;
+	uint8_t *backlog;
+
+	while (allocated < needed) {
+		allocated *= 2;
+	}
+
+	if (allocated > MAX_BACKLOG_SIZE) {
+		allocated = MAX_BACKLOG_SIZE;
+	}
+
+	backlog = malloc(allocated);
+
+	if (backlog == NULL) {
+		errno = ENOMEM;
+
+		return -1;
+	}
+
+	// linearize the queued data while moving it into the new ring
+	if (writer->backlog_used > 0) {
+		writer_copy_from_backlog(writer, writer->backlog_start, backlog, writer->backlog_used);
+	}
+
+	free(writer->backlog);
+
+	writer->backlog = backlog;
+	writer->backlog_allocated = allocated;
+	writer->backlog_start = 0;
+
+	return 0;
+}
+
+// drop the oldest queued packets until LENGTH more bytes fit into the backlog.
+// a partially sent first packet is never dropped, as this would tear apart the
+// packet stream of the recipient. instead its remaining bytes are moved in
+// front of the first packet that is kept. returns the number of dropped packets
+static uint32_t writer_drop_from_backlog(Writer *writer, int length) {
+	uint8_t head[PACKET_MAX_BATCH_LENGTH];
+	int head_length = 0;
+	int packet_length;
+	uint32_t dropped = 0;
+
+	if (writer->backlog_head_partial) {
+		head_length = writer->backlog_head_remaining;
+
+		writer_copy_from_backlog(writer, writer->backlog_start, head, head_length);
+
+		writer->backlog_start = (writer->backlog_start + head_length) % writer->backlog_allocated;
+		writer->backlog_used -= head_length;
+		--writer->backlog_count;
+	}
+
+	while (writer->backlog_count > 0 &&
+	       MAX_BACKLOG_SIZE - writer->backlog_used - head_length < length) {
+		packet_length = writer_get_backlog_packet_length(writer, writer->backlog_start);
+
+		writer->backlog_start = (writer->backlog_start + packet_length) % writer->backlog_allocated;
+		writer->backlog_used -= packet_length;
+		--writer->backlog_count;
+
+		++dropped;
+	}
+
+	if (head_length > 0) {
+		writer->backlog_start = (writer->backlog_start - head_length + writer->backlog_allocated) % writer->backlog_allocated;
+
+		writer_copy_to_backlog(writer, writer->backlog_start, head, head_length);
+
+		writer->backlog_used += head_length;
+		++writer->backlog_count;
+	} else if (writer->backlog_count > 0) {
+		writer->backlog_head_remaining = writer_get_backlog_packet_length(writer, writer->backlog_start);
+		writer->backlog_head_partial = false;
+	}
+
+	return dropped;
+}
+
+// remove LENGTH sent bytes from the front of the backlog and keep track of
+// the first packet. returns the number of completely sent packets
+static int writer_consume_backlog(Writer *writer, int length) {
+	int offset = writer->backlog_start;
+	int completed = 0;
+
+	writer->backlog_start = (writer->backlog_start + length) % writer->backlog_allocated;
+	writer->backlog_used -= length;
+
+	while (length > 0) {
+		if (length < writer->backlog_head_remaining) {
+			writer->backlog_head_remaining -= length;
+			writer->backlog_head_partial = true;
+
+			break;
+		}
+
+		offset = (offset + writer->backlog_head_remaining) % writer->backlog_allocated;
+		length -= writer->backlog_head_remaining;
+
+		--writer->backlog_count;
+		++completed;
+
+		if (writer->backlog_count > 0) {
+			writer->backlog_head_remaining = writer_get_backlog_packet_length(writer, offset);
+		} else {
+			writer->backlog_head_remaining = 0;
+		}
+
+		writer->backlog_head_partial = false;
+	}
+
+	return completed;
+}
 
 static void writer_handle_write(void *opaque) {
 	Writer *writer = opaque;
-	PartialPacket *partial_packet;
-	void *remaining_data;
-	int remaining_length;
+	int length;
 	int rc;
-	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
+	int sent_length = 0;
+	int sent_count = 0;
+#ifdef DAEMONLIB_WITH_LOGGING
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+#endif
+
+	if (writer->backlog_used == 0) {
+		// nothing queued, but the IO still has data of its own to write. an
+		// empty write lets it continue, it reports through writer_set_io_pending
+		// once it is done
+		if (writer->io_pending && io_write(writer->io, NULL, 0) < 0 && !errno_would_block()) {
+			log_error("Could not send pending data to %s, disconnecting %s: %s (%d)",
+			          writer->recipient_signature(recipient_signature, false, writer->opaque),
+			          writer->recipient_name,
+			          get_errno_name(errno), errno);
+
+			writer->recipient_disconnect(writer->opaque);
+		}
 
-	if (writer->backlog.count == 0) {
 		return;
 	}
 
-	// write remaining packet data
-	partial_packet = queue_peek(&writer->backlog);
-	remaining_data = (uint8_t *)&partial_packet->packet + partial_packet->written;
-	remaining_length = (int)partial_packet->packet.header.length - partial_packet->written;
-
-	if (remaining_length > 0) {
-		rc = io_write(writer->io, remaining_data, remaining_length);
+	// write as much of the backlog as possible. if the stored data wraps around
+	// the end of the ring then this takes two writes
+	while (writer->backlog_used > 0) {
+		length = MIN(writer->backlog_used, writer->backlog_allocated - writer->backlog_start);
+		rc = io_write(writer->io, writer->backlog + writer->backlog_start, length);
 
 		if (rc < 0) {
-			log_error("Could not send queued %s (%s) to %s, disconnecting %s: %s (%d)",
-			          writer->packet_type,
-			          writer->packet_signature(packet_signature, &partial_packet->packet),
+			if (errno_would_block()) {
+				break;
+			}
+
+			log_error("Could not send %d queued %s(s) to %s, disconnecting %s: %s (%d)",
+			          writer->backlog_count, writer->packet_type,
 			          writer->recipient_signature(recipient_signature, false, writer->opaque),
 			          writer->recipient_name,
 			          get_errno_name(errno), errno);
@@ -65,61 +266,72 @@ static void writer_handle_write(void *opaque) {
 			return;
 		}
 
-		partial_packet->written += rc;
-	}
+		sent_count += writer_consume_backlog(writer, rc);
+		sent_length += rc;
 
-	// if packet was no completely written then don't remove it from the backlog yet
-	if (partial_packet->written < (int)partial_packet->packet.header.length) {
-		return;
+		if (rc < length) {
+			break;
+		}
 	}
 
-	log_packet_debug("Sent queued %s (%s) to %s, %d %s(s) left in write backlog",
-	                 writer->packet_type,
-	                 writer->packet_signature(packet_signature, &partial_packet->packet),
+	log_packet_debug("Sent %d queued %s(s) (%d byte(s)) to %s, %d %s(s) left in write backlog",
+	                 sent_count, writer->packet_type, sent_length,
 	                 writer->recipient_signature(recipient_signature, false, writer->opaque),
-	                 writer->backlog.count - 1,
-	                 writer->packet_type);
-
-	queue_pop(&writer->backlog, NULL);
+	                 writer->backlog_count, writer->packet_type);
 
-	if (writer->backlog.count == 0) {
+	if (writer->backlog_used == 0) {
 		// last queued packet handled, deregister for write events
-		event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
-		                    EVENT_WRITE, 0, NULL, NULL);
+		if (!writer->io_pending) {
+			event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
+			                    EVENT_WRITE, 0, NULL, NULL);
+		}
+
+		// release the memory of a grown backlog after a burst is over
+		if (writer->backlog_allocated > MIN_BACKLOG_SIZE) {
+			free(writer->backlog);
+
+			writer->backlog = NULL;
+			writer->backlog_allocated = 0;
+		}
+
+		writer->backlog_start = 0;
+	}
+
+	if (sent_count > 0 && writer->backlog_written != NULL) {
+		writer->backlog_written(writer->opaque);
 	}
 }
 
-static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int written) {
-	PartialPacket *queued_partial_packet;
+static int writer_push_to_backlog(Writer *writer, const uint8_t *data, int data_length, int written) {
+	int length = data_length - written;
+	bool was_empty = writer->backlog_used == 0;
+	uint32_t packets_to_drop;
+#ifdef DAEMONLIB_WITH_LOGGING
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
-	uint32_t packets_to_drop;
+#endif
 
-	log_packet_debug("%s is not ready to receive, pushing %s to write backlog (count: %d + 1)",
+	log_packet_debug("%s is not ready to receive, pushing %s to write backlog (count: %d + 1, size: %d + %d byte(s))",
 	                 writer->recipient_signature(recipient_signature, true, writer->opaque),
-	                 writer->packet_type, writer->backlog.count);
+	                 writer->packet_type, writer->backlog_count,
+	                 writer->backlog_used, length);
 
-	if (writer->backlog.count >= MAX_QUEUED_WRITES) {
-		packets_to_drop = writer->backlog.count - MAX_QUEUED_WRITES + 1;
+	if (writer->backlog_used + length > MAX_BACKLOG_SIZE) {
+		packets_to_drop = writer_drop_from_backlog(writer, length);
 
-		log_warn("Write backlog for %s is full, dropping %u queued %s(s), %u + %u dropped in total",
+		log_warn("Write backlog for %s is full, dropped %u queued %s(s), %u + %u dropped in total",
 		         writer->recipient_signature(recipient_signature, false, writer->opaque),
 		         packets_to_drop, writer->packet_type,
 		         writer->dropped_packets, packets_to_drop);
 
 		writer->dropped_packets += packets_to_drop;
-
-		while (writer->backlog.count >= MAX_QUEUED_WRITES) {
-			queue_pop(&writer->backlog, NULL);
-		}
 	}
 
-	queued_partial_packet = queue_push(&writer->backlog);
-
-	if (queued_partial_packet == NULL) {
+	if (writer->backlog_used + length > writer->backlog_allocated &&
+	    writer_grow_backlog(writer, writer->backlog_used + length) < 0) {
 		log_error("Could not push %s (%s) to write backlog for %s, discarding %s: %s (%d)",
 		          writer->packet_type,
-		          writer->packet_signature(packet_signature, packet),
+		          writer_get_signature(writer, packet_signature, data, data_length),
 		          writer->recipient_signature(recipient_signature, false, writer->opaque),
 		          writer->packet_type,
 		          get_errno_name(errno), errno);
@@ -127,10 +339,18 @@ static int writer_push_packet_to_backlog(Writer *writer, Packet *packet, int wri
 		return -1;
 	}
 
-	memcpy(&queued_partial_packet->packet, packet, packet->header.length);
-	queued_partial_packet->written = written;
+	writer_copy_to_backlog(writer, (writer->backlog_start + writer->backlog_used) % writer->backlog_allocated,
+	                       data + written, length);
+
+	writer->backlog_used += length;
+	++writer->backlog_count;
 
-	if (writer->backlog.count == 1) {
+	if (writer->backlog_count == 1) {
+		writer->backlog_head_remaining = length;
+		writer->backlog_head_partial = written > 0;
+	}
+
+	if (was_empty && !writer->paused && !writer->io_pending) {
 		// first queued packet, register for write events
 		if (event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
 		                        0, EVENT_WRITE, writer_handle_write, writer) < 0) {
@@ -152,49 +372,73 @@ int writer_create(Writer *writer, IO *io,
 	writer->io = io;
 	writer->packet_type = packet_type;
 	writer->packet_signature = packet_signature;
+	writer->packet_length = NULL;
 	writer->recipient_name = recipient_name;
 	writer->recipient_signature = recipient_signature;
 	writer->recipient_disconnect = recipient_disconnect;
+	writer->backlog_written = NULL;
 	writer->opaque = opaque;
 	writer->dropped_packets = 0;
 
-	// create write queue
-	if (queue_create(&writer->backlog, sizeof(PartialPacket)) < 0) {
-		log_error("Could not create backlog: %s (%d)",
-		          get_errno_name(errno), errno);
-
-		return -1;
-	}
+	// the backlog memory is allocated on first use, most recipients never
+	// need a backlog at all
+	writer->backlog = NULL;
+	writer->backlog_allocated = 0;
+	writer->backlog_start = 0;
+	writer->backlog_used = 0;
+	writer->backlog_count = 0;
+	writer->backlog_head_remaining = 0;
+	writer->backlog_head_partial = false;
+	writer->paused = false;
+	writer->io_pending = false;
 
 	return 0;
 }
 
 void writer_destroy(Writer *writer) {
+#ifdef DAEMONLIB_WITH_LOGGING
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+#endif
 
-	if (writer->backlog.count > 0) {
+	if (writer->backlog_count > 0) {
 		log_warn("Destroying writer for %s while %d %s(s) have not been send",
 		         writer->recipient_signature(recipient_signature, false, writer->opaque),
-		         writer->backlog.count,
+		         writer->backlog_count,
 		         writer->packet_type);
+	}
 
+	if ((writer->backlog_count > 0 || writer->io_pending) && !writer->paused) {
 		event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
 		                    EVENT_WRITE, 0, NULL, NULL);
 	}
 
-	queue_destroy(&writer->backlog, NULL);
+	free(writer->backlog);
 }
 
-// returns -1 on error, 0 if the packet was completely written and 1 if the
-// packet was completely or partly pushed to the backlog
-int writer_write(Writer *writer, Packet *packet) {
+// by default the writer handles TFP packets and batch frames. for other kinds
+// of packets a function has to be set that determines the packet length. this
+// has to be done before the first packet is written
+void writer_set_packet_length_function(Writer *writer, WriterPacketLengthFunction packet_length) {
+	writer->packet_length = packet_length;
+}
+
+// lets the owner of the writer know when the backlog got smaller, e.g. to
+// refill it from another queue
+void writer_set_backlog_written_function(Writer *writer, WriterBacklogWrittenFunction backlog_written) {
+	writer->backlog_written = backlog_written;
+}
+
+static int writer_write_data(Writer *writer, const uint8_t *data, int length) {
 	int rc;
+#ifdef DAEMONLIB_WITH_LOGGING
 	char packet_signature[PACKET_MAX_SIGNATURE_LENGTH];
 	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+#endif
 
-	// there is already a backlog, push complete packet to backlog
-	if (writer->backlog.count > 0) {
-		if (writer_push_packet_to_backlog(writer, packet, 0) < 0) {
+	// there is already a backlog or the writer is paused, push complete
+	// packet to backlog
+	if (writer->backlog_count > 0 || writer->paused) {
+		if (writer_push_to_backlog(writer, data, length, 0) < 0) {
 			return -1;
 		}
 
@@ -202,12 +446,12 @@ int writer_write(Writer *writer, Packet *packet) {
 	}
 
 	// if there is no backlog, try to write
-	rc = io_write(writer->io, packet, packet->header.length);
+	rc = io_write(writer->io, data, length);
 
 	if (rc < 0) {
 		if (errno_would_block()) {
 			// if write failed with EWOULDBLOCK, push complete packet to backlog
-			if (writer_push_packet_to_backlog(writer, packet, 0) < 0) {
+			if (writer_push_to_backlog(writer, data, length, 0) < 0) {
 				return -1;
 			}
 
@@ -217,7 +461,7 @@ int writer_write(Writer *writer, Packet *packet) {
 		// otherwise give up and disconnect the recipient
 		log_error("Could not send %s (%s) to %s, disconnecting %s: %s (%d)",
 		          writer->packet_type,
-		          writer->packet_signature(packet_signature, packet),
+		          writer_get_signature(writer, packet_signature, data, length),
 		          writer->recipient_signature(recipient_signature, false, writer->opaque),
 		          writer->recipient_name,
 		          get_errno_name(errno), errno);
@@ -225,9 +469,9 @@ int writer_write(Writer *writer, Packet *packet) {
 		writer->recipient_disconnect(writer->opaque);
 
 		return -1;
-	} else if (rc < packet->header.length) {
+	} else if (rc < length) {
 		// packet was not written completely, push remaining packet to backlog
-		if (writer_push_packet_to_backlog(writer, packet, rc) < 0) {
+		if (writer_push_to_backlog(writer, data, length, rc) < 0) {
 			return -1;
 		}
 
@@ -236,3 +480,149 @@ int writer_write(Writer *writer, Packet *packet) {
 
 	return 0;
 }
+
+// returns -1 on error, 0 if the packet was completely written and 1 if the
+// packet was completely or partly pushed to the backlog
+int writer_write(Writer *writer, Packet *packet) {
+	return writer_write_data(writer, (const uint8_t *)packet, packet->header.length);
+}
+
+// writes a batch frame that consists of a BatchHeader followed by its payload.
+// the batch frame is handled as a single unit, it is never split or dropped
+// partially. returns the same as writer_write
+int writer_write_batch(Writer *writer, BatchHeader *batch) {
+	return writer_write_data(writer, (const uint8_t *)batch,
+	                         (int)sizeof(BatchHeader) + uint16_from_le(batch->payload_length));
+}
+
+// writes several complete packets that are stored back to back in DATA with a
+// single write. if not everything can be written then the unsent packets are
+// pushed to the backlog one by one, as if they had been written separately.
+// returns the same as writer_write
+int writer_write_multiple(Writer *writer, const void *data, int length) {
+	const uint8_t *bytes = data;
+	int rc = 0;
+	int offset;
+	int packet_length;
+	int result = 0;
+#ifdef DAEMONLIB_WITH_LOGGING
+	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+#endif
+
+	// if there is no backlog, try to write everything at once
+	if (writer->backlog_count == 0 && !writer->paused) {
+		rc = io_write(writer->io, bytes, length);
+
+		if (rc < 0) {
+			if (!errno_would_block()) {
+				log_error("Could not send %d byte(s) of %ss to %s, disconnecting %s: %s (%d)",
+				          length, writer->packet_type,
+				          writer->recipient_signature(recipient_signature, false, writer->opaque),
+				          writer->recipient_name,
+				          get_errno_name(errno), errno);
+
+				writer->recipient_disconnect(writer->opaque);
+
+				return -1;
+			}
+
+			rc = 0;
+		}
+	}
+
+	for (offset = 0; offset < length; offset += packet_length) {
+		packet_length = writer_get_packet_length(writer, bytes + offset);
+
+		if (offset + packet_length <= rc) {
+			continue; // completely written
+		}
+
+		if (writer_push_to_backlog(writer, bytes + offset, packet_length,
+		                           MAX(rc - offset, 0)) < 0) {
+			return -1;
+		}
+
+		result = 1;
+	}
+
+	return result;
+}
+
+// while paused, packets are kept in the backlog. this is used if the IO cannot
+// accept data yet, e.g. before the WebSocket handshake is done. the backlog
+// limit applies as usual
+void writer_pause(Writer *writer) {
+	if (writer->paused) {
+		return;
+	}
+
+	writer->paused = true;
+
+	if (writer->backlog_used > 0 || writer->io_pending) {
+		event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
+		                    EVENT_WRITE, 0, NULL, NULL);
+	}
+}
+
+static void writer_register_for_write_events(Writer *writer) {
+#ifdef DAEMONLIB_WITH_LOGGING
+	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+#endif
+
+	if (event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
+	                        0, EVENT_WRITE, writer_handle_write, writer) < 0) {
+		log_error("Could not register for write events for %s, disconnecting %s: %s (%d)",
+		          writer->recipient_signature(recipient_signature, false, writer->opaque),
+		          writer->recipient_name, get_errno_name(errno), errno);
+
+		writer->recipient_disconnect(writer->opaque);
+	}
+}
+
+void writer_resume(Writer *writer) {
+#ifdef DAEMONLIB_WITH_LOGGING
+	char recipient_signature[WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH];
+#endif
+
+	if (!writer->paused) {
+		return;
+	}
+
+	writer->paused = false;
+
+	if (writer->backlog_used > 0) {
+		log_packet_debug("Resuming writer for %s, %d %s(s) in write backlog",
+		                 writer->recipient_signature(recipient_signature, false, writer->opaque),
+		                 writer->backlog_count, writer->packet_type);
+	}
+
+	if (writer->backlog_used > 0 || writer->io_pending) {
+		writer_register_for_write_events(writer);
+	}
+}
+
+// some IOs write data of their own besides the packets given to them, e.g. a
+// WebSocket answering a ping. if such data could not be written completely then
+// the IO reports it as pending. the writer then keeps waiting for write events,
+// even with an empty backlog, and passes an empty write to the IO on each of
+// them until the IO reports that nothing is pending anymore
+void writer_set_io_pending(Writer *writer, bool pending) {
+	if (writer->io_pending == pending) {
+		return;
+	}
+
+	writer->io_pending = pending;
+
+	// with a backlog the write events are registered anyway and nothing is
+	// registered while paused
+	if (writer->backlog_used > 0 || writer->paused) {
+		return;
+	}
+
+	if (pending) {
+		writer_register_for_write_events(writer);
+	} else {
+		event_modify_source(writer->io->write_handle, EVENT_SOURCE_TYPE_GENERIC,
+		                    EVENT_WRITE, 0, NULL, NULL);
+	}
+}
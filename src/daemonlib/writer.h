@@ -26,33 +26,41 @@
 
 #include "io.h"
 #include "packet.h"
-#include "queue.h"
 
 #define WRITER_MAX_RECIPIENT_SIGNATURE_LENGTH 256
 
+// a packet length function gets the first WRITER_PACKET_LENGTH_HEADER_SIZE
+// bytes of a packet and returns the full length of the packet
+#define WRITER_PACKET_LENGTH_HEADER_SIZE ((int)sizeof(BatchHeader))
+
 typedef char *(*WriterPacketSignatureFunction)(char *signature, Packet *packet);
+typedef int (*WriterPacketLengthFunction)(const uint8_t *header);
 typedef char *(*WriterRecipientSignatureFunction)(char *signature, bool upper, void *opaque);
 typedef void (*WriterRecipientDisconnectFunction)(void *opaque);
-
-typedef struct {
-	Packet packet;
-	int written;
-} PartialPacket;
+typedef void (*WriterBacklogWrittenFunction)(void *opaque);
 
 typedef struct {
 	IO *io;
 	const char *packet_type; // for display purpose
 	WriterPacketSignatureFunction packet_signature;
+	WriterPacketLengthFunction packet_length; // NULL for TFP packets and batch frames
 	const char *recipient_name; // for display purpose
 	WriterRecipientSignatureFunction recipient_signature;
 	WriterRecipientDisconnectFunction recipient_disconnect;
+	WriterBacklogWrittenFunction backlog_written; // optional, called after queued packets were sent
 	void *opaque;
 	uint32_t dropped_packets;
-	Queue backlog;
+	uint8_t *backlog; // byte ring, each packet or batch frame is stored with its actual length
+	int backlog_allocated; // bytes
+	int backlog_start; // offset of the first unsent byte
+	int backlog_used; // bytes
+	int backlog_count; // number of queued packets, including a partially sent one
+	int backlog_head_remaining; // unsent bytes of the first queued packet
+	bool backlog_head_partial; // true if the first queued packet was partially sent
+	bool paused; // if true, everything goes to the backlog and nothing is written
+	bool io_pending; // the IO has unsent data of its own, see writer_set_io_pending
 } Writer;
 
-// FIXME: rework this to work for mesh packets as well
-
 int writer_create(Writer *writer, IO *io,
                   const char *packet_type,
                   WriterPacketSignatureFunction packet_signature,
@@ -62,6 +70,16 @@ int writer_create(Writer *writer, IO *io,
                   void *opaque);
 void writer_destroy(Writer *writer);
 
+void writer_set_packet_length_function(Writer *writer, WriterPacketLengthFunction packet_length);
+void writer_set_backlog_written_function(Writer *writer, WriterBacklogWrittenFunction backlog_written);
+
 int writer_write(Writer *writer, Packet *packet);
+int writer_write_batch(Writer *writer, BatchHeader *batch);
+int writer_write_multiple(Writer *writer, const void *data, int length);
+
+void writer_pause(Writer *writer);
+void writer_resume(Writer *writer);
+
+void writer_set_io_pending(Writer *writer, bool pending);
 
 #endif // DAEMONLIB_WRITER_H
@@ -150,5 +150,49 @@ rem @set LD=link /nologo /debug
 @del *.obj *.res *.bin *.exp *.manifest
 
 
+%CC% writer_test.c^
+ ..\brickd\fixes_msvc.c^
+ ..\daemonlib\writer.c^
+ ..\daemonlib\io.c^
+ ..\daemonlib\base58.c^
+ ..\daemonlib\utils.c
+
+%LD% /out:writer_test.exe *.obj ws2_32.lib
+
+@if exist writer_test.exe.manifest^
+ %MT% /manifest writer_test.exe.manifest -outputresource:writer_test.exe
+
+@del *.obj *.res *.bin *.exp *.manifest
+
+
+%CC% lane_queue_test.c^
+ ..\brickd\fixes_msvc.c^
+ ..\daemonlib\lane_queue.c^
+ ..\daemonlib\queue.c
+
+%LD% /out:lane_queue_test.exe *.obj ws2_32.lib
+
+@if exist lane_queue_test.exe.manifest^
+ %MT% /manifest lane_queue_test.exe.manifest -outputresource:lane_queue_test.exe
+
+@del *.obj *.res *.bin *.exp *.manifest
+
+
+%CC% websocket_test.c^
+ ..\brickd\fixes_msvc.c^
+ ..\brickd\websocket.c^
+ ..\brickd\base64.c^
+ ..\brickd\sha1.c^
+ ..\daemonlib\base58.c^
+ ..\daemonlib\utils.c
+
+%LD% /out:websocket_test.exe *.obj ws2_32.lib
+
+@if exist websocket_test.exe.manifest^
+ %MT% /manifest websocket_test.exe.manifest -outputresource:websocket_test.exe
+
+@del *.obj *.res *.bin *.exp *.manifest
+
+
 :done
 @endlocal
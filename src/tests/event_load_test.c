@@ -0,0 +1,564 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * event_load_test.c: Measures syscalls and CPU time of brickd per request
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * several connections keep a window of requests in flight that are answered
+ * by brickd itself, like in latency_test. the CPU time of brickd is taken
+ * from /proc. the syscalls of its event loop thread are counted in a second
+ * run with ptrace, because tracing slows brickd down too much to measure the
+ * CPU time at the same time. compare a brickd built with the epoll event loop
+ * to one built with WITH_IO_URING=yes:
+ *
+ *   event_load_test $(pidof brickd) localhost 4223
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <daemonlib/utils.h>
+
+#define CONNECTIONS 8
+#define WINDOW 32 // requests in flight per connection
+#define CPU_REQUESTS 400000
+#define SYSCALL_REQUESTS 40000
+#define FUNCTION_ID 200 // not supported by brickd
+#define MAX_SYSCALL_NUMBER 512
+
+typedef struct {
+	int fd;
+	int sent;
+	int received;
+	int response_offset;
+	uint8_t response[256];
+} Connection;
+
+static volatile sig_atomic_t tracer_done = 0;
+
+static int connect_tcp(const char *host, const char *port) {
+	struct addrinfo hints;
+	struct addrinfo *resolved;
+	int fd;
+	int flag = 1;
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &resolved) != 0) {
+		return -1;
+	}
+
+	fd = socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+
+	if (fd < 0) {
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	// same as the bindings do
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	if (connect(fd, resolved->ai_addr, resolved->ai_addrlen) < 0) {
+		close(fd);
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	freeaddrinfo(resolved);
+
+	return fd;
+}
+
+static int send_requests(Connection *connection, int count) {
+	uint8_t requests[WINDOW * 8];
+	uint32_t uid = uint32_to_le(1);
+	int sequence_number;
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		sequence_number = ((connection->sent + i) % 15) + 1;
+
+		memcpy(&requests[i * 8], &uid, sizeof(uid));
+
+		requests[i * 8 + 4] = 8;
+		requests[i * 8 + 5] = FUNCTION_ID;
+		requests[i * 8 + 6] = (uint8_t)((sequence_number << 4) | 0x08); // response expected
+		requests[i * 8 + 7] = 0;
+	}
+
+	if (write(connection->fd, requests, count * 8) != count * 8) {
+		return -1;
+	}
+
+	connection->sent += count;
+
+	return 0;
+}
+
+// returns the number of complete responses
+static int receive_responses(Connection *connection) {
+	int rc;
+	int count = 0;
+	int length;
+
+	rc = read(connection->fd, connection->response + connection->response_offset,
+	          sizeof(connection->response) - connection->response_offset);
+
+	if (rc <= 0) {
+		if (rc == 0) {
+			errno = ECONNRESET;
+		}
+
+		return -1;
+	}
+
+	connection->response_offset += rc;
+
+	while (connection->response_offset >= 8) {
+		length = connection->response[4];
+
+		if (length < 8) {
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		if (connection->response_offset < length) {
+			break;
+		}
+
+		if (connection->response[5] != FUNCTION_ID ||
+		    (connection->response[6] >> 4) != (connection->received % 15) + 1) {
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		memmove(connection->response, connection->response + length,
+		        connection->response_offset - length);
+
+		connection->response_offset -= length;
+		++connection->received;
+		++count;
+	}
+
+	return count;
+}
+
+static int run_load(Connection *connections, int requests_per_connection) {
+	struct pollfd pollfds[CONNECTIONS];
+	int remaining = CONNECTIONS;
+	int i;
+	int rc;
+
+	for (i = 0; i < CONNECTIONS; ++i) {
+		connections[i].sent = 0;
+		connections[i].received = 0;
+		connections[i].response_offset = 0;
+
+		if (send_requests(&connections[i], WINDOW) < 0) {
+			return -1;
+		}
+
+		pollfds[i].fd = connections[i].fd;
+		pollfds[i].events = POLLIN;
+	}
+
+	while (remaining > 0) {
+		if (poll(pollfds, CONNECTIONS, 5000) <= 0) {
+			errno = ETIMEDOUT;
+
+			return -1;
+		}
+
+		for (i = 0; i < CONNECTIONS; ++i) {
+			if ((pollfds[i].revents & (POLLIN | POLLERR | POLLHUP)) == 0) {
+				continue;
+			}
+
+			rc = receive_responses(&connections[i]);
+
+			if (rc < 0) {
+				return -1;
+			}
+
+			// keep the window full
+			rc = MIN(rc, requests_per_connection - connections[i].sent);
+
+			if (rc > 0 && send_requests(&connections[i], rc) < 0) {
+				return -1;
+			}
+
+			if (connections[i].received == requests_per_connection) {
+				pollfds[i].fd = -1;
+				--remaining;
+			}
+		}
+	}
+
+	return 0;
+}
+
+// returns the user and system time of all threads in microseconds
+static int64_t get_cpu_time(pid_t pid) {
+	char path[64];
+	char buffer[1024];
+	FILE *fp;
+	char *p;
+	unsigned long utime;
+	unsigned long stime;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+
+	fp = fopen(path, "r");
+
+	if (fp == NULL) {
+		return -1;
+	}
+
+	if (fgets(buffer, sizeof(buffer), fp) == NULL) {
+		fclose(fp);
+
+		return -1;
+	}
+
+	fclose(fp);
+
+	// skip the process name, it can contain spaces
+	p = strrchr(buffer, ')');
+
+	if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+	                        &utime, &stime) != 2) {
+		return -1;
+	}
+
+	return (int64_t)(utime + stime) * 1000000 / sysconf(_SC_CLK_TCK);
+}
+
+static const char *get_syscall_name(int number) {
+	switch (number) {
+#ifdef __NR_read
+	case __NR_read:           return "read";
+#endif
+#ifdef __NR_write
+	case __NR_write:          return "write";
+#endif
+#ifdef __NR_recvfrom
+	case __NR_recvfrom:       return "recvfrom";
+#endif
+#ifdef __NR_sendto
+	case __NR_sendto:         return "sendto";
+#endif
+#ifdef __NR_epoll_wait
+	case __NR_epoll_wait:     return "epoll_wait";
+#endif
+#ifdef __NR_epoll_pwait
+	case __NR_epoll_pwait:    return "epoll_pwait";
+#endif
+#ifdef __NR_epoll_ctl
+	case __NR_epoll_ctl:      return "epoll_ctl";
+#endif
+#ifdef __NR_poll
+	case __NR_poll:           return "poll";
+#endif
+#ifdef __NR_ppoll
+	case __NR_ppoll:          return "ppoll";
+#endif
+#ifdef __NR_io_uring_enter
+	case __NR_io_uring_enter: return "io_uring_enter";
+#endif
+#ifdef __NR_clock_gettime
+	case __NR_clock_gettime:  return "clock_gettime";
+#endif
+
+	default:                  return "other";
+	}
+}
+
+static void handle_tracer_signal(int signal_number) {
+	(void)signal_number;
+
+	tracer_done = 1;
+}
+
+// counts the syscall entries of PID until SIGUSR1 is received and writes the
+// counts to FD
+static int trace_syscalls(pid_t pid, int fd) {
+	static uint64_t counts[MAX_SYSCALL_NUMBER + 1];
+	struct sigaction action;
+	struct __ptrace_syscall_info info;
+	bool stopping = false;
+	int status;
+	int signal_number;
+
+	memset(&action, 0, sizeof(action));
+
+	action.sa_handler = handle_tracer_signal; // no SA_RESTART, interrupt waitpid
+
+	sigaction(SIGUSR1, &action, NULL);
+
+	if (ptrace(PTRACE_SEIZE, pid, NULL, (void *)PTRACE_O_TRACESYSGOOD) < 0 ||
+	    ptrace(PTRACE_INTERRUPT, pid, NULL, NULL) < 0) {
+		return -1;
+	}
+
+	for (;;) {
+		if (tracer_done && !stopping) {
+			// an idle brickd makes no more syscalls, stop it explicitly
+			ptrace(PTRACE_INTERRUPT, pid, NULL, NULL);
+
+			stopping = true;
+		}
+
+		if (waitpid(pid, &status, __WALL) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		if (!WIFSTOPPED(status)) {
+			return -1;
+		}
+
+		signal_number = 0;
+
+		if (WSTOPSIG(status) == (SIGTRAP | 0x80)) {
+			if (ptrace(PTRACE_GET_SYSCALL_INFO, pid, (void *)sizeof(info), &info) > 0 &&
+			    info.op == PTRACE_SYSCALL_INFO_ENTRY) {
+				++counts[MIN(info.entry.nr, MAX_SYSCALL_NUMBER)];
+			}
+		} else if (status >> 16 == PTRACE_EVENT_STOP) {
+			if (stopping) {
+				break;
+			}
+
+			// the first stop, tell the parent that tracing is set up
+			if (write(fd, counts, 1) != 1) {
+				return -1;
+			}
+		} else {
+			signal_number = WSTOPSIG(status);
+		}
+
+		if (ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(intptr_t)signal_number) < 0) {
+			return -1;
+		}
+	}
+
+	ptrace(PTRACE_DETACH, pid, NULL, NULL);
+
+	return write(fd, counts, sizeof(counts)) == (int)sizeof(counts) ? 0 : -1;
+}
+
+static int measure_syscalls(pid_t pid, Connection *connections) {
+	static uint64_t counts[MAX_SYSCALL_NUMBER + 1];
+	static const char *names[] = {
+		"read", "write", "recvfrom", "sendto", "epoll_wait", "epoll_pwait",
+		"epoll_ctl", "poll", "ppoll", "io_uring_enter", "clock_gettime", "other"
+	};
+	uint64_t totals[sizeof(names) / sizeof(names[0])];
+	uint64_t total = 0;
+	int fds[2];
+	struct pollfd pollfd;
+	pid_t tracer;
+	int offset = 0;
+	int rc;
+	int status;
+	int requests = CONNECTIONS * (SYSCALL_REQUESTS / CONNECTIONS);
+	size_t i;
+	int k;
+
+	if (pipe(fds) < 0) {
+		return -1;
+	}
+
+	tracer = fork();
+
+	if (tracer < 0) {
+		return -1;
+	}
+
+	if (tracer == 0) {
+		close(fds[0]);
+
+		_exit(trace_syscalls(pid, fds[1]) < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(fds[1]);
+
+	if (read(fds[0], counts, 1) != 1) {
+		printf("could not trace brickd (pid: %d), ptrace not permitted?\n", (int)pid);
+
+		waitpid(tracer, NULL, 0);
+		close(fds[0]);
+
+		return -1;
+	}
+
+	rc = run_load(connections, SYSCALL_REQUESTS / CONNECTIONS);
+
+	// the signal might arrive before the tracer waits, repeat it until the
+	// tracer answers
+	pollfd.fd = fds[0];
+	pollfd.events = POLLIN;
+
+	do {
+		kill(tracer, SIGUSR1);
+	} while (poll(&pollfd, 1, 100) == 0);
+
+	while (offset < (int)sizeof(counts)) {
+		k = read(fds[0], (uint8_t *)counts + offset, sizeof(counts) - offset);
+
+		if (k <= 0) {
+			break;
+		}
+
+		offset += k;
+	}
+
+	waitpid(tracer, &status, 0);
+	close(fds[0]);
+
+	if (rc < 0) {
+		printf("traced load failed: %s (%d)\n", get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	if (offset < (int)sizeof(counts)) {
+		printf("could not get syscall counts from tracer\n");
+
+		return -1;
+	}
+
+	memset(totals, 0, sizeof(totals));
+
+	for (k = 0; k <= MAX_SYSCALL_NUMBER; ++k) {
+		for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+			if (strcmp(get_syscall_name(k), names[i]) == 0) {
+				totals[i] += counts[k];
+			}
+		}
+
+		total += counts[k];
+	}
+
+	printf("syscalls: %.3f per request, %llu in total for %d requests\n",
+	       (double)total / requests, (unsigned long long)total, requests);
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+		if (totals[i] > 0) {
+			printf("  %-16s %.3f per request\n", names[i], (double)totals[i] / requests);
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	Connection connections[CONNECTIONS];
+	const char *host = "localhost";
+	const char *port = "4223";
+	pid_t pid;
+	int64_t cpu_start;
+	int64_t cpu_end;
+	uint64_t start;
+	uint64_t duration;
+	int requests = CONNECTIONS * (CPU_REQUESTS / CONNECTIONS);
+	int i;
+
+	if (argc < 2 || argc > 4) {
+		printf("usage: %s <brickd-pid> [<host> [<port>]]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	pid = atoi(argv[1]);
+
+	if (argc > 2) {
+		host = argv[2];
+	}
+
+	if (argc > 3) {
+		port = argv[3];
+	}
+
+	for (i = 0; i < CONNECTIONS; ++i) {
+		connections[i].fd = connect_tcp(host, port);
+
+		if (connections[i].fd < 0) {
+			printf("could not connect to %s:%s\n", host, port);
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	cpu_start = get_cpu_time(pid);
+
+	if (cpu_start < 0) {
+		printf("could not get CPU time of brickd (pid: %d)\n", (int)pid);
+
+		return EXIT_FAILURE;
+	}
+
+	start = microtime();
+
+	if (run_load(connections, CPU_REQUESTS / CONNECTIONS) < 0) {
+		printf("load failed: %s (%d)\n", get_errno_name(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	duration = MAX(microtime() - start, 1);
+	cpu_end = get_cpu_time(pid);
+
+	printf("%d connections, %d requests in flight each: %.0f requests/s, brickd CPU time %.2f usec per request\n",
+	       CONNECTIONS, WINDOW, (double)requests * 1000000 / duration,
+	       (double)(cpu_end - cpu_start) / requests);
+
+	if (measure_syscalls(pid, connections) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < CONNECTIONS; ++i) {
+		close(connections[i].fd);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,374 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * framer_test.c: Tests and microbenchmark for the Framer type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/framer.h>
+#include <daemonlib/packet.h>
+#include <daemonlib/utils.h>
+
+#define SOURCE_SIZE (4 * 1024 * 1024)
+#define BENCHMARK_ROUNDS 20
+
+typedef struct {
+	IO base;
+	uint8_t *data;
+	int length;
+	int offset;
+	int chunk; // maximum bytes returned per read
+} SourceIO;
+
+// packet.c needs log.c, which is used here without the config subsystem
+ConfigOptionValue *config_get_option_value(const char *name) {
+	static ConfigOptionValue value = {NULL, 0, false, 0};
+
+	(void)name;
+
+	return &value;
+}
+
+static int source_read(IO *io, void *buffer, int length) {
+	SourceIO *source = (SourceIO *)io;
+
+	if (length > source->length - source->offset) {
+		length = source->length - source->offset;
+	}
+
+	if (length > source->chunk) {
+		length = source->chunk;
+	}
+
+	memcpy(buffer, source->data + source->offset, length);
+	source->offset += length;
+
+	return length;
+}
+
+static void make_packet(Packet *packet, uint32_t uid, int length) {
+	int i;
+
+	memset(packet, 0, sizeof(Packet));
+
+	packet->header.uid = uid;
+	packet->header.length = (uint8_t)length;
+	packet->header.function_id = (uint8_t)(1 + uid % 200);
+	packet_header_set_sequence_number(&packet->header, 1 + uid % 15);
+	packet_header_set_response_expected(&packet->header, true);
+
+	for (i = (int)sizeof(PacketHeader); i < length; ++i) {
+		((uint8_t *)packet)[i] = (uint8_t)(uid + i);
+	}
+}
+
+static int packet_length(uint32_t uid) {
+	return 8 + (int)(uid % 9) * 8;
+}
+
+// fill the source with COUNT requests of different lengths
+static int setup(SourceIO *source, int count, int chunk) {
+	Packet packet;
+	uint32_t uid;
+
+	memset(source, 0, sizeof(SourceIO));
+	io_create(&source->base, "source", NULL, source_read, NULL, NULL);
+
+	source->data = malloc(SOURCE_SIZE);
+
+	if (source->data == NULL) {
+		return -1;
+	}
+
+	for (uid = 1; uid <= (uint32_t)count; ++uid) {
+		make_packet(&packet, uid, packet_length(uid));
+
+		if (source->length + packet.header.length > SOURCE_SIZE) {
+			free(source->data);
+
+			return -1;
+		}
+
+		memcpy(source->data + source->length, &packet, packet.header.length);
+		source->length += packet.header.length;
+	}
+
+	source->chunk = chunk;
+
+	return 0;
+}
+
+// packets split at arbitrary read boundaries are reassembled in order
+int test1(void) {
+	SourceIO source;
+	Framer framer;
+	Packet expected;
+	uint8_t *frame;
+	int length;
+	const char *message = NULL;
+	uint32_t uid = 1;
+	int chunks[] = { 1, 7, 13, 80, 512, 8192 };
+	int i;
+
+	for (i = 0; i < (int)(sizeof(chunks) / sizeof(chunks[0])); ++i) {
+		if (setup(&source, 2000, chunks[i]) < 0 ||
+		    framer_create(&framer, 512, framer_get_request_length, NULL) < 0) {
+			printf("test1: setup failed\n");
+
+			return -1;
+		}
+
+		uid = 1;
+
+		while (framer_read(&framer, &source.base) > 0) {
+			for (;;) {
+				frame = framer_next(&framer, &length, &message);
+
+				if (frame == NULL) {
+					if (length < 0) {
+						printf("test1: unexpected invalid frame: %s\n", message);
+
+						return -1;
+					}
+
+					break;
+				}
+
+				make_packet(&expected, uid, packet_length(uid));
+
+				if (length != expected.header.length ||
+				    memcmp(frame, &expected, length) != 0) {
+					printf("test1: unexpected data for packet %u (chunk %d)\n", uid, chunks[i]);
+
+					return -1;
+				}
+
+				++uid;
+			}
+		}
+
+		if (uid != 2001) {
+			printf("test1: got %u packet(s) instead of 2000 (chunk %d)\n", uid - 1, chunks[i]);
+
+			return -1;
+		}
+
+		framer_destroy(&framer);
+		free(source.data);
+	}
+
+	return 0;
+}
+
+// an invalid header is reported after all complete packets before it
+int test2(void) {
+	SourceIO source;
+	Framer framer;
+	uint8_t *frame;
+	int length;
+	int count = 0;
+	int available;
+	const char *message = NULL;
+
+	if (setup(&source, 10, 8192) < 0 ||
+	    framer_create(&framer, 512, framer_get_request_length, NULL) < 0) {
+		printf("test2: setup failed\n");
+
+		return -1;
+	}
+
+	// packet length 3 is shorter than the header
+	memset(source.data + source.length, 0, sizeof(PacketHeader));
+	source.data[source.length + 4] = 3;
+	source.length += (int)sizeof(PacketHeader);
+
+	if (framer_read(&framer, &source.base) <= 0) {
+		printf("test2: read failed\n");
+
+		return -1;
+	}
+
+	while ((frame = framer_next(&framer, &length, &message)) != NULL) {
+		++count;
+	}
+
+	if (count != 10 || length != -1 || message == NULL) {
+		printf("test2: unexpected result, %d packet(s), length %d\n", count, length);
+
+		return -1;
+	}
+
+	framer_peek(&framer, &available);
+
+	if (available != (int)sizeof(PacketHeader)) {
+		printf("test2: unexpected available bytes %d\n", available);
+
+		return -1;
+	}
+
+	framer_destroy(&framer);
+	free(source.data);
+
+	return 0;
+}
+
+// the previous framing loop: 512 byte buffer, memmove after each packet and a
+// copy of each packet into a stack-local Packet before handling it
+static uint32_t legacy_parse(SourceIO *source, uint32_t *checksum) {
+	uint8_t buffer[512];
+	int used = 0;
+	int length;
+	uint32_t count = 0;
+	Packet request;
+
+	for (;;) {
+		length = io_read(&source->base, buffer + used, (int)sizeof(buffer) - used);
+
+		if (length <= 0) {
+			break;
+		}
+
+		used += length;
+
+		while (used >= (int)sizeof(PacketHeader)) {
+			if (!packet_header_is_valid_request((PacketHeader *)buffer, NULL)) {
+				return count;
+			}
+
+			length = ((PacketHeader *)buffer)->length;
+
+			if (used < length) {
+				break;
+			}
+
+			memcpy(&request, buffer, length);
+
+			*checksum += request.header.uid + request.header.function_id;
+			++count;
+
+			memmove(buffer, buffer + length, used - length);
+			used -= length;
+		}
+	}
+
+	return count;
+}
+
+static uint32_t framer_parse(SourceIO *source, int size, uint32_t *checksum) {
+	Framer framer;
+	uint8_t *frame;
+	int length;
+	const char *message;
+	uint32_t count = 0;
+
+	if (framer_create(&framer, size, framer_get_request_length, NULL) < 0) {
+		return 0;
+	}
+
+	while (framer_read(&framer, &source->base) > 0) {
+		while ((frame = framer_next(&framer, &length, &message)) != NULL) {
+			*checksum += ((PacketHeader *)frame)->uid + ((PacketHeader *)frame)->function_id;
+			++count;
+		}
+	}
+
+	framer_destroy(&framer);
+
+	return count;
+}
+
+// parse the same stream with the legacy loop and the framer. the source returns
+// as many bytes as fit into the read buffer, like a socket with enough data
+// queued would do
+int benchmark(void) {
+	SourceIO source;
+	uint32_t count;
+	uint32_t checksum;
+	uint32_t expected_checksum = 0;
+	uint64_t start;
+	uint64_t duration;
+	int sizes[] = { 0, 512, 8192 }; // 0 is the legacy loop
+	int i;
+	int round;
+
+	if (setup(&source, 100000, SOURCE_SIZE) < 0) {
+		printf("benchmark: setup failed\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < (int)(sizeof(sizes) / sizeof(sizes[0])); ++i) {
+		count = 0;
+		checksum = 0;
+		start = microtime();
+
+		for (round = 0; round < BENCHMARK_ROUNDS; ++round) {
+			source.offset = 0;
+
+			if (sizes[i] == 0) {
+				count += legacy_parse(&source, &checksum);
+			} else {
+				count += framer_parse(&source, sizes[i], &checksum);
+			}
+		}
+
+		duration = microtime() - start;
+
+		if (i == 0) {
+			expected_checksum = checksum;
+		}
+
+		if (count != 100000 * BENCHMARK_ROUNDS || checksum != expected_checksum) {
+			printf("benchmark: unexpected result %u %u\n", count, checksum);
+
+			return -1;
+		}
+
+		printf("%s %5d byte buffer: %.0f packets/s\n",
+		       sizes[i] == 0 ? "memmove" : "framer ",
+		       sizes[i] == 0 ? 512 : sizes[i],
+		       (double)count * 1000000.0 / (double)(duration > 0 ? duration : 1));
+	}
+
+	free(source.data);
+
+	return 0;
+}
+
+int main(void) {
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (benchmark() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
@@ -173,6 +173,8 @@ struct _Socket {
 	int handle;
 #endif
 	Mutex send_mutex; // used to serialize socket_send calls
+	bool websocket;
+	int payload_remaining; // of the current WebSocket frame
 };
 
 #ifdef _WIN32
@@ -297,6 +299,153 @@ static int socket_send(Socket *socket, void *buffer, int length) {
 
 #endif
 
+/*
+ * WebSocket support is not part of the official bindings. It's only here to
+ * put load on the WebSocket port of the Brick Daemon. Each packet is send as
+ * its own binary frame, masked with an all-zero key. Therefore, the payload
+ * does not need to be masked.
+ */
+
+static int socket_receive_exactly(Socket *socket, void *buffer, int length) {
+	int offset = 0;
+	int rc;
+
+	while (offset < length) {
+		rc = socket_receive(socket, (uint8_t *)buffer + offset, length - offset);
+
+		if (rc <= 0) {
+			if (rc < 0 && errno == EINTR) {
+				continue;
+			}
+
+			return rc;
+		}
+
+		offset += rc;
+	}
+
+	return length;
+}
+
+static int socket_websocket_handshake(Socket *socket, const char *host) {
+	char request[512];
+	char response[1024];
+	int length = 0;
+
+	snprintf(request, sizeof(request),
+	         "GET / HTTP/1.1\r\n"
+	         "Host: %s\r\n"
+	         "Upgrade: websocket\r\n"
+	         "Connection: Upgrade\r\n"
+	         "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	         "Sec-WebSocket-Protocol: tfp\r\n"
+	         "Sec-WebSocket-Version: 13\r\n"
+	         "\r\n", host);
+
+	if (socket_send(socket, request, (int)strlen(request)) < 0) {
+		return -1;
+	}
+
+	// read byte-wise to not consume anything after the end of the header
+	while (length < (int)sizeof(response) - 1) {
+		if (socket_receive_exactly(socket, response + length, 1) <= 0) {
+			return -1;
+		}
+
+		++length;
+
+		if (length >= 4 && memcmp(response + length - 4, "\r\n\r\n", 4) == 0) {
+			response[length] = '\0';
+
+			return strncmp(response, "HTTP/1.1 101", 12) == 0 ? 0 : -1;
+		}
+	}
+
+	return -1;
+}
+
+static int socket_receive_packet_data(Socket *socket, void *buffer, int length) {
+	uint8_t header[4];
+	uint8_t control_payload[125];
+	int opcode;
+	int payload_length;
+	int rc;
+
+	if (!socket->websocket) {
+		return socket_receive(socket, buffer, length);
+	}
+
+	while (socket->payload_remaining == 0) {
+		rc = socket_receive_exactly(socket, header, 2);
+
+		if (rc <= 0) {
+			return rc;
+		}
+
+		opcode = header[0] & 0x0F;
+		payload_length = header[1] & 0x7F;
+
+		if (payload_length == 126) {
+			rc = socket_receive_exactly(socket, header + 2, 2);
+
+			if (rc <= 0) {
+				return rc;
+			}
+
+			payload_length = (header[2] << 8) | header[3];
+		} else if (payload_length == 127 || (header[1] & 0x80) != 0) {
+			// the Brick Daemon never sends frames this long or masked
+			errno = EINVAL;
+
+			return -1;
+		}
+
+		if (opcode == 0x08) { // close
+			return 0;
+		}
+
+		if (opcode >= 0x08) { // ignore other control frames
+			rc = socket_receive_exactly(socket, control_payload, payload_length);
+
+			if (rc < 0 || (rc == 0 && payload_length > 0)) {
+				return rc;
+			}
+
+			continue;
+		}
+
+		socket->payload_remaining = payload_length;
+	}
+
+	if (length > socket->payload_remaining) {
+		length = socket->payload_remaining;
+	}
+
+	rc = socket_receive(socket, buffer, length);
+
+	if (rc > 0) {
+		socket->payload_remaining -= rc;
+	}
+
+	return rc;
+}
+
+static int socket_send_packet(Socket *socket, void *buffer, int length) {
+	uint8_t frame[6 + sizeof(Packet)];
+
+	if (!socket->websocket) {
+		return socket_send(socket, buffer, length);
+	}
+
+	frame[0] = 0x82; // FIN and binary opcode
+	frame[1] = 0x80 | (length & 0x7F); // mask and payload length
+
+	memset(frame + 2, 0, 4); // all-zero masking key
+	memcpy(frame + 6, buffer, length);
+
+	return socket_send(socket, frame, 6 + length) < 0 ? -1 : length;
+}
+
 /*****************************************************************************
  *
  *                                 Mutex
@@ -1220,7 +1369,7 @@ static void ipcon_disconnect_probe_loop(void *opaque) {
 	                  IPCON_DISCONNECT_PROBE_INTERVAL) < 0) {
 		if (ipcon_p->disconnect_probe_flag) {
 			// FIXME: this might block
-			if (socket_send(ipcon_p->socket, &disconnect_probe,
+			if (socket_send_packet(ipcon_p->socket, &disconnect_probe,
 			                disconnect_probe.length) < 0) {
 				ipcon_handle_disconnect_by_peer(ipcon_p, IPCON_DISCONNECT_REASON_ERROR,
 				                                ipcon_p->socket_id, false);
@@ -1290,8 +1439,8 @@ static void ipcon_receive_loop(void *opaque) {
 	uint8_t disconnect_reason;
 
 	while (ipcon_p->receive_flag) {
-		length = socket_receive(ipcon_p->socket, (uint8_t *)pending_data + pending_length,
-		                        sizeof(pending_data) - pending_length);
+		length = socket_receive_packet_data(ipcon_p->socket, (uint8_t *)pending_data + pending_length,
+		                                    sizeof(pending_data) - pending_length);
 
 		if (!ipcon_p->receive_flag) {
 			return;
@@ -1410,7 +1559,11 @@ static int ipcon_connect_unlocked(IPConnectionPrivate *ipcon_p, bool is_auto_rec
 		return E_NO_STREAM_SOCKET;
 	}
 
-	if (socket_connect(ipcon_p->socket, &address, sizeof(address)) < 0) {
+	ipcon_p->socket->websocket = ipcon_p->websocket;
+	ipcon_p->socket->payload_remaining = 0;
+
+	if (socket_connect(ipcon_p->socket, &address, sizeof(address)) < 0 ||
+	    (ipcon_p->websocket && socket_websocket_handshake(ipcon_p->socket, ipcon_p->host) < 0)) {
 		// destroy callback thread
 		if (!is_auto_reconnect) {
 			queue_put(&ipcon_p->callback->queue, QUEUE_KIND_EXIT, NULL, 0);
@@ -1546,7 +1699,7 @@ static int ipcon_send_request(IPConnectionPrivate *ipcon_p, Packet *request) {
 	}
 
 	if (ret == E_OK) {
-		if (socket_send(ipcon_p->socket, request, request->header.length) < 0) {
+		if (socket_send_packet(ipcon_p->socket, request, request->header.length) < 0) {
 			ipcon_handle_disconnect_by_peer(ipcon_p, IPCON_DISCONNECT_REASON_ERROR,
 			                                0, true);
 
@@ -1574,6 +1727,7 @@ void ipcon_create(IPConnection *ipcon) {
 
 	ipcon_p->host = NULL;
 	ipcon_p->port = 0;
+	ipcon_p->websocket = false;
 
 	ipcon_p->timeout = 2500;
 
@@ -1738,6 +1892,10 @@ bool ipcon_get_auto_reconnect(IPConnection *ipcon) {
 	return ipcon->p->auto_reconnect;
 }
 
+void ipcon_set_websocket(IPConnection *ipcon, bool websocket) {
+	ipcon->p->websocket = websocket;
+}
+
 void ipcon_set_timeout(IPConnection *ipcon, uint32_t timeout) { // in msec
 	ipcon->p->timeout = timeout;
 }
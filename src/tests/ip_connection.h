@@ -358,6 +358,7 @@ struct _IPConnectionPrivate {
 
 	char *host;
 	uint16_t port;
+	bool websocket;
 
 	uint32_t timeout; // in msec
 
@@ -462,6 +463,16 @@ void ipcon_set_auto_reconnect(IPConnection *ipcon, bool auto_reconnect);
  */
 bool ipcon_get_auto_reconnect(IPConnection *ipcon);
 
+/**
+ * \ingroup IPConnection
+ *
+ * Enables or disables WebSocket framing for the next connect. The port given
+ * to ipcon_connect has to be the WebSocket port of the Brick Daemon then.
+ *
+ * Default value is *false*.
+ */
+void ipcon_set_websocket(IPConnection *ipcon, bool websocket);
+
 /**
  * \ingroup IPConnection
  *
@@ -0,0 +1,423 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * lane_queue_test.c: Tests for the LaneQueue type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <daemonlib/lane_queue.h>
+
+#define BENCHMARK_SLOTS 100000
+#define BENCHMARK_BACKLOG 256 // bulk items kept in the queue
+#define BENCHMARK_GETTER_INTERVAL 16 // slots
+
+typedef struct {
+	uint32_t id;
+	int lane;
+	bool getter;
+	int enqueued; // slot
+} Item;
+
+// each item gets its own key, so the requested lane is always used
+static int push(LaneQueue *lane_queue, uint32_t id, QueueLane lane) {
+	Item *item = lane_queue_push(lane_queue, lane, id);
+
+	if (item == NULL) {
+		return -1;
+	}
+
+	item->id = id;
+	item->lane = lane;
+
+	return 0;
+}
+
+// pop items and compare their IDs to the expected ones
+static int expect(const char *test, LaneQueue *lane_queue, const uint32_t *ids, int count) {
+	int i;
+	Item *item;
+
+	for (i = 0; i < count; ++i) {
+		item = lane_queue_peek(lane_queue);
+
+		if (item == NULL || item->id != ids[i]) {
+			printf("%s: unexpected item at index %d\n", test, i);
+
+			return -1;
+		}
+
+		lane_queue_pop(lane_queue, NULL);
+	}
+
+	return 0;
+}
+
+// the high lane is served first, each lane in FIFO order
+int test1(void) {
+	LaneQueue lane_queue;
+	uint32_t ids[] = {3, 4, 1, 2, 5};
+
+	if (lane_queue_create(&lane_queue, sizeof(Item)) < 0) {
+		printf("test1: lane_queue_create failed\n");
+
+		return -1;
+	}
+
+	push(&lane_queue, 1, QUEUE_LANE_LOW);
+	push(&lane_queue, 2, QUEUE_LANE_LOW);
+	push(&lane_queue, 3, QUEUE_LANE_HIGH);
+	push(&lane_queue, 4, QUEUE_LANE_HIGH);
+	push(&lane_queue, 5, QUEUE_LANE_LOW);
+
+	if (lane_queue.count != 5) {
+		printf("test1: unexpected lane_queue.count\n");
+
+		return -1;
+	}
+
+	if (expect("test1", &lane_queue, ids, 5) < 0) {
+		return -1;
+	}
+
+	if (lane_queue.count != 0 || lane_queue_peek(&lane_queue) != NULL) {
+		printf("test1: lane queue not empty\n");
+
+		return -1;
+	}
+
+	lane_queue_destroy(&lane_queue, NULL);
+
+	return 0;
+}
+
+// the low lane gets a turn after LANE_QUEUE_MAX_HIGH_STREAK high items
+int test2(void) {
+	LaneQueue lane_queue;
+	uint32_t i;
+	int k;
+	int high = 0;
+	Item *item;
+
+	if (lane_queue_create(&lane_queue, sizeof(Item)) < 0) {
+		printf("test2: lane_queue_create failed\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < 4; ++i) {
+		push(&lane_queue, 1000 + i, QUEUE_LANE_LOW);
+	}
+
+	for (i = 0; i < 100; ++i) {
+		push(&lane_queue, i, QUEUE_LANE_HIGH);
+	}
+
+	for (k = 0; k < 4; ++k) {
+		for (i = 0; i < LANE_QUEUE_MAX_HIGH_STREAK; ++i) {
+			item = lane_queue_peek(&lane_queue);
+
+			if (item->lane != QUEUE_LANE_HIGH || item->id != (uint32_t)high) {
+				printf("test2: expected high item %d\n", high);
+
+				return -1;
+			}
+
+			lane_queue_pop(&lane_queue, NULL);
+
+			++high;
+		}
+
+		item = lane_queue_peek(&lane_queue);
+
+		if (item->lane != QUEUE_LANE_LOW || item->id != 1000 + (uint32_t)k) {
+			printf("test2: expected low item %d\n", k);
+
+			return -1;
+		}
+
+		lane_queue_pop(&lane_queue, NULL);
+	}
+
+	// the low lane is empty now, the high lane is served without interruption
+	while (lane_queue.count > 0) {
+		item = lane_queue_peek(&lane_queue);
+
+		if (item->lane != QUEUE_LANE_HIGH || item->id != (uint32_t)high) {
+			printf("test2: expected high item %d\n", high);
+
+			return -1;
+		}
+
+		lane_queue_pop(&lane_queue, NULL);
+
+		++high;
+	}
+
+	lane_queue_destroy(&lane_queue, NULL);
+
+	return 0;
+}
+
+// peek returns the same item until it is popped, even if a higher priority
+// item is pushed in between. drop removes the oldest low item first
+int test3(void) {
+	LaneQueue lane_queue;
+	Item *item;
+	uint32_t ids[] = {3, 6, 5};
+
+	if (lane_queue_create(&lane_queue, sizeof(Item)) < 0) {
+		printf("test3: lane_queue_create failed\n");
+
+		return -1;
+	}
+
+	push(&lane_queue, 1, QUEUE_LANE_LOW);
+
+	item = lane_queue_peek(&lane_queue);
+
+	push(&lane_queue, 2, QUEUE_LANE_HIGH);
+
+	if (item->id != 1 || lane_queue_peek(&lane_queue) != item) {
+		printf("test3: peeked item changed\n");
+
+		return -1;
+	}
+
+	lane_queue_pop(&lane_queue, NULL);
+
+	item = lane_queue_peek(&lane_queue);
+
+	if (item->id != 2) {
+		printf("test3: unexpected item after pop\n");
+
+		return -1;
+	}
+
+	lane_queue_pop(&lane_queue, NULL);
+
+	push(&lane_queue, 3, QUEUE_LANE_HIGH);
+	push(&lane_queue, 4, QUEUE_LANE_LOW);
+	push(&lane_queue, 5, QUEUE_LANE_LOW);
+
+	lane_queue_drop(&lane_queue, NULL);
+
+	push(&lane_queue, 6, QUEUE_LANE_HIGH);
+
+	if (lane_queue.count != 3 || expect("test3", &lane_queue, ids, 3) < 0) {
+		printf("test3: unexpected state after drop\n");
+
+		return -1;
+	}
+
+	lane_queue_drop(&lane_queue, NULL);
+
+	if (lane_queue.count != 0) {
+		printf("test3: drop on empty lane queue changed count\n");
+
+		return -1;
+	}
+
+	lane_queue_destroy(&lane_queue, NULL);
+
+	return 0;
+}
+
+static int compare_int(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+// simulates a stack write queue that can send one item per slot, while a bulk
+// writer keeps it filled and a getter is issued every few slots. without lanes
+// all items go into the low lane, which makes the LaneQueue a plain FIFO
+static int benchmark_run(bool lanes, int *p50, int *p99) {
+	LaneQueue lane_queue;
+	int slot;
+	Item *item;
+	int *latencies;
+	int count = 0;
+
+	latencies = malloc((BENCHMARK_SLOTS / BENCHMARK_GETTER_INTERVAL + 1) * sizeof(int));
+
+	if (latencies == NULL) {
+		return -1;
+	}
+
+	if (lane_queue_create(&lane_queue, sizeof(Item)) < 0) {
+		free(latencies);
+
+		return -1;
+	}
+
+	for (slot = 0; slot < BENCHMARK_SLOTS; ++slot) {
+		while (lane_queue.count < BENCHMARK_BACKLOG) {
+			item = lane_queue_push(&lane_queue, QUEUE_LANE_LOW, 1);
+			item->enqueued = slot;
+		}
+
+		if (slot % BENCHMARK_GETTER_INTERVAL == 0) {
+			item = lane_queue_push(&lane_queue, lanes ? QUEUE_LANE_HIGH : QUEUE_LANE_LOW, 2);
+			item->getter = true;
+			item->enqueued = slot;
+		}
+
+		item = lane_queue_peek(&lane_queue);
+
+		if (item->getter) {
+			latencies[count++] = slot - item->enqueued;
+		}
+
+		lane_queue_pop(&lane_queue, NULL);
+	}
+
+	lane_queue_destroy(&lane_queue, NULL);
+
+	qsort(latencies, count, sizeof(int), compare_int);
+
+	*p50 = latencies[count / 2];
+	*p99 = latencies[count * 99 / 100];
+
+	free(latencies);
+
+	return 0;
+}
+
+// getters have to overtake a saturating bulk writer
+int test4(void) {
+	int fifo_p50;
+	int fifo_p99;
+	int lanes_p50;
+	int lanes_p99;
+
+	if (benchmark_run(false, &fifo_p50, &fifo_p99) < 0 ||
+	    benchmark_run(true, &lanes_p50, &lanes_p99) < 0) {
+		printf("test4: benchmark failed\n");
+
+		return -1;
+	}
+
+	printf("getter latency with %d queued bulk items, FIFO: p50 %d, p99 %d slots, lanes: p50 %d, p99 %d slots\n",
+	       BENCHMARK_BACKLOG, fifo_p50, fifo_p99, lanes_p50, lanes_p99);
+
+	if (fifo_p99 < BENCHMARK_BACKLOG || lanes_p99 > 1) {
+		printf("test4: unexpected getter latency\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// items with the same key stay in FIFO order, even if they ask for different
+// lanes. the pin of a key is released once all its items are gone
+int test5(void) {
+	LaneQueue lane_queue;
+	Item *item;
+	uint32_t ids[] = {4, 5, 1, 2, 3};
+	uint32_t dropped_ids[] = {7, 8};
+
+	if (lane_queue_create(&lane_queue, sizeof(Item)) < 0) {
+		printf("test5: lane_queue_create failed\n");
+
+		return -1;
+	}
+
+	// key 100 is pinned to the low lane, key 200 to the high lane
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_LOW, 100);
+	item->id = 1;
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_HIGH, 100);
+	item->id = 2;
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_HIGH, 100);
+	item->id = 3;
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_HIGH, 200);
+	item->id = 4;
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_LOW, 200);
+	item->id = 5;
+
+	if (lane_queue.lanes[QUEUE_LANE_LOW].count != 3 ||
+	    lane_queue.lanes[QUEUE_LANE_HIGH].count != 2 ||
+	    lane_queue.pins.count != 2) {
+		printf("test5: items not pinned to the lane of their key\n");
+
+		return -1;
+	}
+
+	if (expect("test5", &lane_queue, ids, 5) < 0) {
+		return -1;
+	}
+
+	if (lane_queue.pins.count != 0) {
+		printf("test5: pins not released\n");
+
+		return -1;
+	}
+
+	// without queued items the requested lane is used again
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_HIGH, 100);
+	item->id = 6;
+	lane_queue_pop(&lane_queue, NULL);
+
+	// dropping an item releases its pin as well
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_LOW, 100);
+	item->id = 7;
+	lane_queue_drop(&lane_queue, NULL);
+
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_HIGH, 100);
+	item->id = 7;
+	item = lane_queue_push(&lane_queue, QUEUE_LANE_LOW, 100);
+	item->id = 8;
+
+	if (lane_queue.lanes[QUEUE_LANE_HIGH].count != 2 ||
+	    expect("test5", &lane_queue, dropped_ids, 2) < 0) {
+		printf("test5: unexpected lane after pin release\n");
+
+		return -1;
+	}
+
+	lane_queue_destroy(&lane_queue, NULL);
+
+	return 0;
+}
+
+int main(void) {
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test3() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test4() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test5() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,270 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * latency_test.c: Round-trip latency over TCP/IP and UNIX domain sockets
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * measures the round-trip time of requests that are answered by brickd
+ * itself, without involving any hardware. a request for an unknown function
+ * of UID 1 (brickd) gets a function-not-supported response. run brickd with
+ * listen.unix_socket_path set and compare the results:
+ *
+ *   latency_test /var/run/brickd.sock localhost 4223
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <daemonlib/utils.h>
+
+#define REPEATS 10000
+#define WARMUP 100
+#define FUNCTION_ID 200 // not supported by brickd
+
+static int connect_tcp(const char *host, const char *port) {
+	struct addrinfo hints;
+	struct addrinfo *resolved;
+	int fd;
+	int flag = 1;
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &resolved) != 0) {
+		return -1;
+	}
+
+	fd = socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+
+	if (fd < 0) {
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	// same as the bindings do
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	if (connect(fd, resolved->ai_addr, resolved->ai_addrlen) < 0) {
+		close(fd);
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	freeaddrinfo(resolved);
+
+	return fd;
+}
+
+static int connect_unix(const char *path) {
+	struct sockaddr_un address;
+	int fd;
+
+	if (strlen(path) >= sizeof(address.sun_path)) {
+		errno = ENAMETOOLONG;
+
+		return -1;
+	}
+
+	memset(&address, 0, sizeof(address));
+
+	address.sun_family = AF_UNIX;
+
+	strcpy(address.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (fd < 0) {
+		return -1;
+	}
+
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+		close(fd);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+static int read_exactly(int fd, uint8_t *buffer, int length) {
+	int offset = 0;
+	int rc;
+
+	while (offset < length) {
+		rc = read(fd, buffer + offset, length - offset);
+
+		if (rc <= 0) {
+			if (rc == 0) {
+				errno = ECONNRESET;
+			}
+
+			return -1;
+		}
+
+		offset += rc;
+	}
+
+	return 0;
+}
+
+static int round_trip(int fd, int sequence_number) {
+	uint8_t request[8];
+	uint8_t response[80];
+	uint32_t uid = uint32_to_le(1);
+
+	memcpy(request, &uid, sizeof(uid));
+
+	request[4] = sizeof(request);
+	request[5] = FUNCTION_ID;
+	request[6] = (uint8_t)((sequence_number << 4) | 0x08); // response expected
+	request[7] = 0;
+
+	if (write(fd, request, sizeof(request)) != (int)sizeof(request)) {
+		return -1;
+	}
+
+	// skip callbacks (sequence number 0) until the response arrives
+	for (;;) {
+		if (read_exactly(fd, response, 8) < 0) {
+			return -1;
+		}
+
+		if (response[4] < 8 || response[4] > sizeof(response)) {
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		if (read_exactly(fd, response + 8, response[4] - 8) < 0) {
+			return -1;
+		}
+
+		if ((response[6] >> 4) != 0) {
+			break;
+		}
+	}
+
+	if (response[5] != FUNCTION_ID || (response[6] >> 4) != sequence_number) {
+		errno = EPROTO;
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static int compare_uint64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int measure(const char *name, int fd) {
+	static uint64_t durations[REPEATS];
+	uint64_t start;
+	uint64_t total = 0;
+	int i;
+
+	for (i = 0; i < WARMUP + REPEATS; ++i) {
+		start = microtime();
+
+		if (round_trip(fd, (i % 15) + 1) < 0) {
+			printf("%s: round-trip failed: %s (%d)\n", name, get_errno_name(errno), errno);
+
+			return -1;
+		}
+
+		if (i >= WARMUP) {
+			durations[i - WARMUP] = microtime() - start;
+			total += durations[i - WARMUP];
+		}
+	}
+
+	qsort(durations, REPEATS, sizeof(uint64_t), compare_uint64);
+
+	printf("%s: average %.1f usec, p50 %u usec, p99 %u usec, max %u usec\n",
+	       name, (double)total / REPEATS, (uint32_t)durations[REPEATS / 2],
+	       (uint32_t)durations[REPEATS * 99 / 100], (uint32_t)durations[REPEATS - 1]);
+
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	const char *host = "localhost";
+	const char *port = "4223";
+	int fd;
+	int rc;
+
+	if (argc < 2 || argc > 4) {
+		printf("usage: %s <unix-socket-path> [<host> [<port>]]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2) {
+		host = argv[2];
+	}
+
+	if (argc > 3) {
+		port = argv[3];
+	}
+
+	fd = connect_tcp(host, port);
+
+	if (fd < 0) {
+		printf("could not connect to %s:%s\n", host, port);
+
+		return EXIT_FAILURE;
+	}
+
+	rc = measure("TCP/IP", fd);
+
+	close(fd);
+
+	if (rc < 0) {
+		return EXIT_FAILURE;
+	}
+
+	fd = connect_unix(argv[1]);
+
+	if (fd < 0) {
+		printf("could not connect to %s: %s (%d)\n", argv[1], get_errno_name(errno), errno);
+
+		return EXIT_FAILURE;
+	}
+
+	rc = measure("UNIX domain", fd);
+
+	close(fd);
+
+	return rc < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
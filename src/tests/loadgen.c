@@ -0,0 +1,772 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * loadgen.c: Multi-connection load generator for the Brick Daemon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * opens many IP Connections to brickd and sends a mix of getters and setters
+ * to all Master Bricks found by enumeration, at a fixed rate per connection.
+ * optionally the stack voltage callback of all Master Bricks is enabled and
+ * the callbacks are counted on every connection. this works with real Master
+ * Bricks and with the simulated stack (simulation.devices option of brickd).
+ *
+ * the latency of each request is measured from sending the request to
+ * receiving its response and collected in a log-linear histogram. requests
+ * without a response in time are counted as timeouts. this includes requests
+ * dropped by brickd, because a full queue is only reported in its log. use
+ * --json to get a single JSON object that can be compared between builds:
+ *
+ *   brickd-loadgen --connections 200 --duration 10 --getter-rate 50 --json
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <brickd/hmac.h>
+#include <daemonlib/base58.h>
+#include <daemonlib/utils.h>
+
+#define IPCON_EXPOSE_INTERNALS
+
+#include "ip_connection.h"
+#include "brick_master.h"
+
+#define MAX_DEVICES 64
+#define DISCOVERY_TIME 500000 // 0.5 seconds in microseconds
+
+#define BRICK_DAEMON_UID "2" // UID 1 in base58
+#define FUNCTION_GET_AUTHENTICATION_NONCE 1
+#define FUNCTION_AUTHENTICATE 2
+
+// 16 buckets per power of two, this gives a resolution of about 6%. values
+// above 2^31 microseconds end up in the last bucket
+#define HISTOGRAM_SUB_BUCKETS 16
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS * 28)
+
+#include <daemonlib/packed_begin.h>
+
+typedef struct {
+	PacketHeader header;
+} ATTRIBUTE_PACKED GetAuthenticationNonceRequest;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t server_nonce[4];
+} ATTRIBUTE_PACKED GetAuthenticationNonceResponse;
+
+typedef struct {
+	PacketHeader header;
+	uint8_t client_nonce[4];
+	uint8_t digest[SHA1_DIGEST_LENGTH];
+} ATTRIBUTE_PACKED AuthenticateRequest;
+
+#include <daemonlib/packed_end.h>
+
+typedef struct {
+	uint64_t sent;
+	uint64_t ok;
+	uint64_t errors;
+	uint64_t timeouts;
+	uint64_t latency_sum;
+	uint64_t latency_min;
+	uint64_t latency_max;
+	uint64_t histogram[HISTOGRAM_BUCKETS];
+} RequestStats;
+
+typedef struct {
+	IPConnection ipcon;
+	Master masters[MAX_DEVICES];
+	bool connected;
+	pthread_t thread;
+	RequestStats getters;
+	RequestStats setters;
+	uint64_t callbacks; // only written by the callback thread of the ipcon
+	int next_device;
+	int next_getter;
+} Connection;
+
+static const char *_host = "localhost";
+static int _port = 4223;
+static bool _websocket = false;
+static const char *_secret = NULL;
+static int _connection_count = 10;
+static int _duration = 10; // seconds
+static int _getter_rate = 100; // per connection and second, 0 = back-to-back
+static int _setter_rate = 10; // per connection and second
+static int _callback_period = 0; // milliseconds, 0 = disabled
+static int _timeout = 2500; // milliseconds
+static bool _json = false;
+
+static char _uids[MAX_DEVICES][BASE58_MAX_LENGTH + 1];
+static int _uid_count = 0;
+static pthread_mutex_t _uid_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile bool _running = true;
+
+static int histogram_get_bucket(uint64_t value) {
+	int exponent = 0;
+	int bucket;
+
+	if (value < HISTOGRAM_SUB_BUCKETS) {
+		return (int)value;
+	}
+
+	while ((value >> exponent) >= 2 * HISTOGRAM_SUB_BUCKETS) {
+		++exponent;
+	}
+
+	bucket = (exponent + 1) * HISTOGRAM_SUB_BUCKETS +
+	         (int)(value >> exponent) - HISTOGRAM_SUB_BUCKETS;
+
+	return bucket < HISTOGRAM_BUCKETS ? bucket : HISTOGRAM_BUCKETS - 1;
+}
+
+// returns the largest value that falls into BUCKET
+static uint64_t histogram_get_upper_bound(int bucket) {
+	int exponent;
+	uint64_t mantissa;
+
+	if (bucket < HISTOGRAM_SUB_BUCKETS) {
+		return bucket;
+	}
+
+	exponent = bucket / HISTOGRAM_SUB_BUCKETS - 1;
+	mantissa = bucket % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+
+	return ((mantissa + 1) << exponent) - 1;
+}
+
+static void stats_init(RequestStats *stats) {
+	memset(stats, 0, sizeof(*stats));
+
+	stats->latency_min = UINT64_MAX;
+}
+
+static void stats_add(RequestStats *stats, int rc, uint64_t latency) {
+	++stats->sent;
+
+	if (rc == E_TIMEOUT) {
+		++stats->timeouts;
+
+		return;
+	}
+
+	if (rc < 0) {
+		++stats->errors;
+
+		return;
+	}
+
+	++stats->ok;
+
+	stats->latency_sum += latency;
+
+	if (latency < stats->latency_min) {
+		stats->latency_min = latency;
+	}
+
+	if (latency > stats->latency_max) {
+		stats->latency_max = latency;
+	}
+
+	++stats->histogram[histogram_get_bucket(latency)];
+}
+
+static void stats_merge(RequestStats *total, RequestStats *stats) {
+	int i;
+
+	total->sent += stats->sent;
+	total->ok += stats->ok;
+	total->errors += stats->errors;
+	total->timeouts += stats->timeouts;
+	total->latency_sum += stats->latency_sum;
+
+	if (stats->latency_min < total->latency_min) {
+		total->latency_min = stats->latency_min;
+	}
+
+	if (stats->latency_max > total->latency_max) {
+		total->latency_max = stats->latency_max;
+	}
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		total->histogram[i] += stats->histogram[i];
+	}
+}
+
+static uint64_t stats_get_percentile(RequestStats *stats, double percentile) {
+	uint64_t threshold = (uint64_t)(stats->ok * percentile / 100.0 + 0.5);
+	uint64_t count = 0;
+	uint64_t upper_bound;
+	int i;
+
+	if (stats->ok == 0) {
+		return 0;
+	}
+
+	if (threshold == 0) {
+		threshold = 1;
+	}
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		count += stats->histogram[i];
+
+		if (count >= threshold) {
+			upper_bound = histogram_get_upper_bound(i);
+
+			return upper_bound < stats->latency_max ? upper_bound : stats->latency_max;
+		}
+	}
+
+	return stats->latency_max;
+}
+
+static void stats_print(const char *name, RequestStats *stats, double duration) {
+	int i;
+	bool first = true;
+
+	if (_json) {
+		printf("\"%s\":{\"sent\":%" PRIu64 ",\"ok\":%" PRIu64 ",\"errors\":%" PRIu64
+		       ",\"timeouts\":%" PRIu64 ",\"throughput\":%.1f,\"latency_us\":{"
+		       "\"min\":%" PRIu64 ",\"mean\":%.1f,\"p50\":%" PRIu64 ",\"p90\":%" PRIu64
+		       ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64 ",\"max\":%" PRIu64 "},\"histogram\":[",
+		       name, stats->sent, stats->ok, stats->errors, stats->timeouts,
+		       stats->ok / duration, stats->ok > 0 ? stats->latency_min : 0,
+		       stats->ok > 0 ? (double)stats->latency_sum / stats->ok : 0.0,
+		       stats_get_percentile(stats, 50), stats_get_percentile(stats, 90),
+		       stats_get_percentile(stats, 99), stats_get_percentile(stats, 99.9),
+		       stats->latency_max);
+
+		for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+			if (stats->histogram[i] == 0) {
+				continue;
+			}
+
+			printf("%s[%" PRIu64 ",%" PRIu64 "]", first ? "" : ",",
+			       histogram_get_upper_bound(i), stats->histogram[i]);
+
+			first = false;
+		}
+
+		printf("]}");
+
+		return;
+	}
+
+	printf("%s: %" PRIu64 " sent, %" PRIu64 " ok, %" PRIu64 " errors, %" PRIu64 " timeouts, %.1f per second\n",
+	       name, stats->sent, stats->ok, stats->errors, stats->timeouts, stats->ok / duration);
+
+	if (stats->ok == 0) {
+		return;
+	}
+
+	printf("%s latency: min %" PRIu64 " usec, mean %.1f usec, p50 %" PRIu64 " usec, p90 %" PRIu64 " usec, p99 %" PRIu64 " usec, p99.9 %" PRIu64 " usec, max %" PRIu64 " usec\n",
+	       name, stats->latency_min, (double)stats->latency_sum / stats->ok,
+	       stats_get_percentile(stats, 50), stats_get_percentile(stats, 90),
+	       stats_get_percentile(stats, 99), stats_get_percentile(stats, 99.9),
+	       stats->latency_max);
+
+	for (i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+		if (stats->histogram[i] > 0) {
+			printf("  <= %8" PRIu64 " usec: %" PRIu64 "\n",
+			       histogram_get_upper_bound(i), stats->histogram[i]);
+		}
+	}
+}
+
+static int authenticate(IPConnection *ipcon, const char *secret) {
+	Device brickd;
+	GetAuthenticationNonceRequest nonce_request;
+	GetAuthenticationNonceResponse nonce_response;
+	AuthenticateRequest authenticate_request;
+	uint32_t nonces[2];
+	int rc;
+
+	device_create(&brickd, BRICK_DAEMON_UID, ipcon->p, 2, 0, 0);
+
+	brickd.p->response_expected[FUNCTION_GET_AUTHENTICATION_NONCE] = DEVICE_RESPONSE_EXPECTED_ALWAYS_TRUE;
+	brickd.p->response_expected[FUNCTION_AUTHENTICATE] = DEVICE_RESPONSE_EXPECTED_TRUE;
+
+	rc = packet_header_create(&nonce_request.header, sizeof(nonce_request),
+	                          FUNCTION_GET_AUTHENTICATION_NONCE, ipcon->p, brickd.p);
+
+	if (rc >= 0) {
+		rc = device_send_request(brickd.p, (Packet *)&nonce_request,
+		                         (Packet *)&nonce_response);
+	}
+
+	if (rc >= 0) {
+		rc = packet_header_create(&authenticate_request.header, sizeof(authenticate_request),
+		                          FUNCTION_AUTHENTICATE, ipcon->p, brickd.p);
+	}
+
+	if (rc >= 0) {
+		memcpy(&nonces[0], nonce_response.server_nonce, sizeof(nonces[0]));
+
+		nonces[1] = get_random_uint32();
+
+		memcpy(authenticate_request.client_nonce, &nonces[1],
+		       sizeof(authenticate_request.client_nonce));
+
+		hmac_sha1((uint8_t *)secret, strlen(secret), (uint8_t *)nonces,
+		          sizeof(nonces), authenticate_request.digest);
+
+		rc = device_send_request(brickd.p, (Packet *)&authenticate_request, NULL);
+	}
+
+	device_destroy(&brickd);
+
+	return rc;
+}
+
+static int connect_ipcon(IPConnection *ipcon) {
+	int rc;
+
+	ipcon_create(ipcon);
+	ipcon_set_auto_reconnect(ipcon, false);
+	ipcon_set_timeout(ipcon, _timeout);
+	ipcon_set_websocket(ipcon, _websocket);
+
+	rc = ipcon_connect(ipcon, _host, _port);
+
+	if (rc < 0) {
+		ipcon_destroy(ipcon);
+
+		return rc;
+	}
+
+	if (_secret != NULL) {
+		rc = authenticate(ipcon, _secret);
+
+		if (rc < 0) {
+			ipcon_destroy(ipcon);
+
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static void handle_enumerate(const char *uid, const char *connected_uid,
+                             char position, uint8_t hardware_version[3],
+                             uint8_t firmware_version[3], uint16_t device_identifier,
+                             uint8_t enumeration_type, void *user_data) {
+	int i;
+
+	(void)connected_uid;
+	(void)position;
+	(void)hardware_version;
+	(void)firmware_version;
+	(void)user_data;
+
+	if (device_identifier != MASTER_DEVICE_IDENTIFIER ||
+	    enumeration_type == IPCON_ENUMERATION_TYPE_DISCONNECTED) {
+		return;
+	}
+
+	pthread_mutex_lock(&_uid_mutex);
+
+	for (i = 0; i < _uid_count; ++i) {
+		if (strcmp(_uids[i], uid) == 0) {
+			break;
+		}
+	}
+
+	if (i == _uid_count && _uid_count < MAX_DEVICES) {
+		snprintf(_uids[_uid_count++], sizeof(_uids[0]), "%s", uid);
+	}
+
+	pthread_mutex_unlock(&_uid_mutex);
+}
+
+static void handle_stack_voltage(uint16_t voltage, void *user_data) {
+	Connection *connection = user_data;
+
+	(void)voltage;
+
+	++connection->callbacks;
+}
+
+static int send_getter(Connection *connection, Master *master) {
+	uint16_t voltage;
+	int16_t temperature;
+
+	switch (connection->next_getter++ % 3) {
+	case 0:  return master_get_stack_voltage(master, &voltage);
+	case 1:  return master_get_usb_voltage(master, &voltage);
+	default: return master_get_chip_temperature(master, &temperature);
+	}
+}
+
+// sleeps until DEADLINE, but at most 10 milliseconds to notice the end of the
+// run in time
+static void sleep_until(uint64_t deadline) {
+	uint64_t now = microtime();
+
+	if (deadline <= now) {
+		return;
+	}
+
+	usleep(deadline - now < 10000 ? deadline - now : 10000);
+}
+
+static void *connection_loop(void *opaque) {
+	Connection *connection = opaque;
+	uint64_t getter_interval = _getter_rate > 0 ? 1000000 / _getter_rate : 0;
+	uint64_t setter_interval = _setter_rate > 0 ? 1000000 / _setter_rate : 0;
+	uint64_t now = microtime();
+	uint64_t next_getter = now;
+	uint64_t next_setter = now + setter_interval;
+	uint64_t start;
+	Master *master;
+	int rc;
+
+	while (_running) {
+		now = microtime();
+		master = &connection->masters[connection->next_device++ % _uid_count];
+
+		if (setter_interval > 0 && next_setter <= now) {
+			start = microtime();
+			rc = master_set_debounce_period(master, 100);
+
+			stats_add(&connection->setters, rc, microtime() - start);
+
+			// don't try to catch up after a slow response, that would only
+			// turn the configured rate into a burst
+			next_setter = next_setter + setter_interval > now ? next_setter + setter_interval : now + setter_interval;
+		} else if (getter_interval == 0 || next_getter <= now) {
+			start = microtime();
+			rc = send_getter(connection, master);
+
+			stats_add(&connection->getters, rc, microtime() - start);
+
+			next_getter = next_getter + getter_interval > now ? next_getter + getter_interval : now + getter_interval;
+		} else {
+			sleep_until(setter_interval > 0 && next_setter < next_getter ? next_setter : next_getter);
+		}
+	}
+
+	return NULL;
+}
+
+static int set_callback_period(IPConnection *ipcon, uint32_t period) {
+	Master master;
+	int i;
+	int rc;
+
+	for (i = 0; i < _uid_count; ++i) {
+		master_create(&master, _uids[i], ipcon);
+
+		rc = master_set_stack_voltage_callback_period(&master, period);
+
+		master_destroy(&master);
+
+		if (rc < 0) {
+			fprintf(stderr, "could not set callback period of %s: %d\n", _uids[i], rc);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static int parse_integer(const char *name, const char *value, int min, int max) {
+	char *end;
+	long result = strtol(value, &end, 10);
+
+	if (*value == '\0' || *end != '\0' || result < min || result > max) {
+		fprintf(stderr, "invalid value '%s' for %s, expecting %d..%d\n", value, name, min, max);
+
+		exit(EXIT_FAILURE);
+	}
+
+	return (int)result;
+}
+
+static void print_usage(const char *binary) {
+	printf("usage: %s [<option>...]\n"
+	       "\n"
+	       "  --host <host>             brickd host (default: localhost)\n"
+	       "  --port <port>             brickd plain or WebSocket port (default: 4223)\n"
+	       "  --websocket               connect to the WebSocket port\n"
+	       "  --secret <secret>         authenticate with this secret\n"
+	       "  --connections <count>     number of IP Connections (default: 10)\n"
+	       "  --duration <seconds>      duration of the run (default: 10)\n"
+	       "  --getter-rate <rate>      getters per connection and second, 0 = back-to-back (default: 100)\n"
+	       "  --setter-rate <rate>      setters per connection and second (default: 10)\n"
+	       "  --callback-period <msec>  stack voltage callback period, 0 = disabled (default: 0)\n"
+	       "  --timeout <msec>          response timeout (default: 2500)\n"
+	       "  --uid <uid>               use this Master Brick instead of enumerating, can be repeated\n"
+	       "  --json                    print the results as a single JSON object\n",
+	       binary);
+}
+
+int main(int argc, char **argv) {
+	IPConnection control;
+	Connection *connections;
+	Connection *connection;
+	RequestStats getters;
+	RequestStats setters;
+	uint64_t callbacks = 0;
+	uint64_t callbacks_expected = 0;
+	int connect_failures = 0;
+	int connected_count = 0;
+	uint64_t start;
+	double duration;
+	int rc;
+	int i;
+	int k;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--help") == 0) {
+			print_usage(argv[0]);
+
+			return EXIT_SUCCESS;
+		} else if (strcmp(argv[i], "--websocket") == 0) {
+			_websocket = true;
+		} else if (strcmp(argv[i], "--json") == 0) {
+			_json = true;
+		} else if (i + 1 >= argc) {
+			print_usage(argv[0]);
+
+			return EXIT_FAILURE;
+		} else if (strcmp(argv[i], "--host") == 0) {
+			_host = argv[++i];
+		} else if (strcmp(argv[i], "--port") == 0) {
+			_port = parse_integer(argv[i], argv[i + 1], 1, 65535);
+			++i;
+		} else if (strcmp(argv[i], "--secret") == 0) {
+			_secret = argv[++i];
+		} else if (strcmp(argv[i], "--connections") == 0) {
+			_connection_count = parse_integer(argv[i], argv[i + 1], 1, 10000);
+			++i;
+		} else if (strcmp(argv[i], "--duration") == 0) {
+			_duration = parse_integer(argv[i], argv[i + 1], 1, 86400);
+			++i;
+		} else if (strcmp(argv[i], "--getter-rate") == 0) {
+			_getter_rate = parse_integer(argv[i], argv[i + 1], 0, 1000000);
+			++i;
+		} else if (strcmp(argv[i], "--setter-rate") == 0) {
+			_setter_rate = parse_integer(argv[i], argv[i + 1], 0, 1000000);
+			++i;
+		} else if (strcmp(argv[i], "--callback-period") == 0) {
+			_callback_period = parse_integer(argv[i], argv[i + 1], 0, 3600000);
+			++i;
+		} else if (strcmp(argv[i], "--timeout") == 0) {
+			_timeout = parse_integer(argv[i], argv[i + 1], 1, 3600000);
+			++i;
+		} else if (strcmp(argv[i], "--uid") == 0) {
+			if (_uid_count >= MAX_DEVICES) {
+				fprintf(stderr, "too many UIDs, at most %d are supported\n", MAX_DEVICES);
+
+				return EXIT_FAILURE;
+			}
+
+			snprintf(_uids[_uid_count++], sizeof(_uids[0]), "%s", argv[++i]);
+		} else {
+			print_usage(argv[0]);
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	// the control connection discovers the Master Bricks and configures their
+	// callback period, it's not part of the measurement
+	rc = connect_ipcon(&control);
+
+	if (rc < 0) {
+		fprintf(stderr, "could not connect to %s:%d: %d\n", _host, _port, rc);
+
+		return EXIT_FAILURE;
+	}
+
+	if (_uid_count == 0) {
+		ipcon_register_callback(&control, IPCON_CALLBACK_ENUMERATE,
+		                        (void *)handle_enumerate, NULL);
+		ipcon_enumerate(&control);
+
+		usleep(DISCOVERY_TIME);
+
+		ipcon_register_callback(&control, IPCON_CALLBACK_ENUMERATE, NULL, NULL);
+	}
+
+	pthread_mutex_lock(&_uid_mutex);
+
+	if (_uid_count == 0) {
+		pthread_mutex_unlock(&_uid_mutex);
+
+		fprintf(stderr, "no Master Bricks found\n");
+
+		ipcon_destroy(&control);
+
+		return EXIT_FAILURE;
+	}
+
+	pthread_mutex_unlock(&_uid_mutex);
+
+	connections = calloc(_connection_count, sizeof(Connection));
+
+	if (connections == NULL) {
+		fprintf(stderr, "could not allocate connections\n");
+
+		ipcon_destroy(&control);
+
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < _connection_count; ++i) {
+		connection = &connections[i];
+
+		stats_init(&connection->getters);
+		stats_init(&connection->setters);
+
+		connection->next_device = i;
+
+		if (connect_ipcon(&connection->ipcon) < 0) {
+			++connect_failures;
+
+			continue;
+		}
+
+		for (k = 0; k < _uid_count; ++k) {
+			master_create(&connection->masters[k], _uids[k], &connection->ipcon);
+			master_register_callback(&connection->masters[k], MASTER_CALLBACK_STACK_VOLTAGE,
+			                         (void *)handle_stack_voltage, connection);
+		}
+
+		connection->connected = true;
+		++connected_count;
+	}
+
+	if (connected_count == 0) {
+		fprintf(stderr, "could not connect any IP Connection\n");
+
+		free(connections);
+		ipcon_destroy(&control);
+
+		return EXIT_FAILURE;
+	}
+
+	if (_callback_period > 0 && set_callback_period(&control, _callback_period) < 0) {
+		_callback_period = 0;
+	}
+
+	start = microtime();
+
+	for (i = 0; i < _connection_count; ++i) {
+		connection = &connections[i];
+
+		if (connection->connected &&
+		    pthread_create(&connection->thread, NULL, connection_loop, connection) != 0) {
+			fprintf(stderr, "could not create thread: %s (%d)\n", get_errno_name(errno), errno);
+
+			ipcon_destroy(&connection->ipcon);
+
+			connection->connected = false;
+			--connected_count;
+			++connect_failures;
+		}
+	}
+
+	sleep(_duration);
+
+	_running = false;
+
+	for (i = 0; i < _connection_count; ++i) {
+		if (connections[i].connected) {
+			pthread_join(connections[i].thread, NULL);
+		}
+	}
+
+	duration = (microtime() - start) / 1000000.0;
+
+	if (_callback_period > 0) {
+		set_callback_period(&control, 0);
+
+		callbacks_expected = (uint64_t)(duration * 1000 / _callback_period) * _uid_count * connected_count;
+	}
+
+	stats_init(&getters);
+	stats_init(&setters);
+
+	for (i = 0; i < _connection_count; ++i) {
+		connection = &connections[i];
+
+		if (!connection->connected) {
+			continue;
+		}
+
+		// disconnecting joins the callback thread, so the callback counter
+		// can be read and the devices can be destroyed safely afterwards
+		ipcon_disconnect(&connection->ipcon);
+
+		for (k = 0; k < _uid_count; ++k) {
+			master_destroy(&connection->masters[k]);
+		}
+
+		ipcon_destroy(&connection->ipcon);
+
+		stats_merge(&getters, &connection->getters);
+		stats_merge(&setters, &connection->setters);
+
+		callbacks += connection->callbacks;
+	}
+
+	ipcon_destroy(&control);
+
+	if (_json) {
+		printf("{\"host\":\"%s\",\"port\":%d,\"websocket\":%s,\"authentication\":%s,"
+		       "\"connections\":%d,\"connect_failures\":%d,\"devices\":%d,"
+		       "\"duration\":%.3f,\"getter_rate\":%d,\"setter_rate\":%d,",
+		       _host, _port, _websocket ? "true" : "false",
+		       _secret != NULL ? "true" : "false", connected_count,
+		       connect_failures, _uid_count, duration, _getter_rate, _setter_rate);
+
+		stats_print("getters", &getters, duration);
+		printf(",");
+		stats_print("setters", &setters, duration);
+
+		printf(",\"callbacks\":{\"period\":%d,\"received\":%" PRIu64 ",\"expected\":%" PRIu64 ",\"throughput\":%.1f}}\n",
+		       _callback_period, callbacks, callbacks_expected, callbacks / duration);
+	} else {
+		printf("%d connection(s) to %s:%d%s%s, %d connect failure(s), %d Master Brick(s), %.3f seconds\n",
+		       connected_count, _host, _port, _websocket ? " (WebSocket)" : "",
+		       _secret != NULL ? " (authenticated)" : "", connect_failures,
+		       _uid_count, duration);
+
+		stats_print("getters", &getters, duration);
+		stats_print("setters", &setters, duration);
+
+		if (_callback_period > 0) {
+			printf("callbacks: %" PRIu64 " received, %" PRIu64 " expected, %.1f per second\n",
+			       callbacks, callbacks_expected, callbacks / duration);
+		}
+	}
+
+	free(connections);
+
+	return EXIT_SUCCESS;
+}
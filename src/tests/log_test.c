@@ -0,0 +1,325 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * log_test.c: Tests and benchmark for the asynchronous logging mode
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/config.h>
+#include <daemonlib/log.h>
+#include <daemonlib/threads.h>
+#include <daemonlib/utils.h>
+
+#define THREAD_COUNT 4
+#define MESSAGES_PER_THREAD 5000
+#define OUTPUT_SIZE (16 * 1024 * 1024)
+#define BENCHMARK_MESSAGES 200000 // per thread
+
+static LogSource _test_log_source = LOG_SOURCE_INITIALIZER;
+
+static IO output;
+static char *output_buffer = NULL;
+static int output_length = 0;
+static bool output_discard = false;
+static int output_lines = 0; // counted while discarding
+static bool output_blocked = false;
+static Semaphore output_entered;
+static Semaphore output_unblocked;
+
+typedef struct {
+	Thread thread;
+	int index;
+	int count;
+} Producer;
+
+// log.c is tested without the config subsystem
+ConfigOptionValue *config_get_option_value(const char *name) {
+	static ConfigOptionValue level = {NULL, 0, false, LOG_LEVEL_INFO};
+	static ConfigOptionValue debug_filter = {NULL, 0, false, 0};
+
+	return strcmp(name, "log.level") == 0 ? &level : &debug_filter;
+}
+
+// only one thread writes to the output at a time, log.c holds its mutex
+static int output_write(IO *io, const void *buffer, int length) {
+	int i;
+
+	(void)io;
+
+	if (output_blocked) {
+		output_blocked = false;
+
+		semaphore_release(&output_entered);
+		semaphore_acquire(&output_unblocked);
+	}
+
+	if (output_discard) {
+		for (i = 0; i < length; ++i) {
+			if (((const char *)buffer)[i] == '\n') {
+				++output_lines;
+			}
+		}
+	} else if (output_length + length <= OUTPUT_SIZE) {
+		memcpy(output_buffer + output_length, buffer, length);
+
+		output_length += length;
+	}
+
+	return length;
+}
+
+static void setup(bool async) {
+	log_init();
+
+	io_create(&output, "test", NULL, NULL, output_write, NULL);
+	log_set_output(&output, NULL);
+
+	output_length = 0;
+
+	if (async) {
+		log_enable_async();
+	}
+}
+
+static void produce(void *opaque) {
+	Producer *producer = opaque;
+	int i;
+
+	for (i = 0; i < producer->count; ++i) {
+		log_message(LOG_LEVEL_INFO, &_test_log_source, LOG_DEBUG_GROUP_NONE, true,
+		            __FUNCTION__, __LINE__, "thread %d message %d", producer->index, i);
+	}
+}
+
+// counts the messages of each thread in the output and checks that they are
+// in order. returns the number of messages reported as dropped
+static int check_output(const char *test, int *counts) {
+	char *line = output_buffer;
+	char *end;
+	char *p;
+	int index;
+	int number;
+	int dropped = 0;
+	int n;
+
+	output_buffer[output_length] = '\0';
+
+	for (index = 0; index < THREAD_COUNT; ++index) {
+		counts[index] = 0;
+	}
+
+	while (*line != '\0') {
+		end = strchr(line, '\n');
+
+		if (end == NULL) {
+			printf("%s: incomplete line in output\n", test);
+
+			return -1;
+		}
+
+		*end = '\0';
+
+		if ((p = strstr(line, "thread ")) != NULL &&
+		    sscanf(p, "thread %d message %d", &index, &number) == 2) {
+			if (index < 0 || index >= THREAD_COUNT || number < counts[index]) {
+				printf("%s: unexpected message '%s'\n", test, line);
+
+				return -1;
+			}
+
+			counts[index] = number + 1;
+		} else if ((p = strstr(line, "full, dropped ")) != NULL &&
+		           sscanf(p, "full, dropped %d", &n) == 1) {
+			dropped += n;
+		}
+
+		line = end + 1;
+	}
+
+	return dropped;
+}
+
+// messages from several threads arrive complete and in order per thread. the
+// output of each thread can only have gaps if messages were dropped and the
+// number of dropped messages is reported
+int test1(void) {
+	Producer producers[THREAD_COUNT];
+	int counts[THREAD_COUNT];
+	int received = 0;
+	int dropped;
+	int i;
+
+	setup(true);
+
+	for (i = 0; i < THREAD_COUNT; ++i) {
+		producers[i].index = i;
+		producers[i].count = MESSAGES_PER_THREAD;
+
+		thread_create(&producers[i].thread, produce, &producers[i]);
+	}
+
+	for (i = 0; i < THREAD_COUNT; ++i) {
+		thread_join(&producers[i].thread);
+		thread_destroy(&producers[i].thread);
+	}
+
+	log_exit();
+
+	dropped = check_output("test1", counts);
+
+	if (dropped < 0) {
+		return -1;
+	}
+
+	for (i = 0; i < THREAD_COUNT; ++i) {
+		received += counts[i];
+	}
+
+	if (received + dropped < THREAD_COUNT * MESSAGES_PER_THREAD) {
+		printf("test1: %d message(s) missing\n", THREAD_COUNT * MESSAGES_PER_THREAD - received - dropped);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// a stuck output does not block the thread that logs, the ring overflows
+// and the dropped messages are reported once the output is back
+int test2(void) {
+	Producer producer;
+	int counts[THREAD_COUNT];
+	int dropped;
+
+	semaphore_create(&output_entered);
+	semaphore_create(&output_unblocked);
+
+	setup(true);
+
+	output_blocked = true;
+
+	// the first message gets the logger thread stuck in the output
+	producer.index = 0;
+	producer.count = 1;
+
+	produce(&producer);
+
+	semaphore_acquire(&output_entered);
+
+	producer.index = 1;
+	producer.count = MESSAGES_PER_THREAD;
+
+	produce(&producer);
+
+	semaphore_release(&output_unblocked);
+
+	log_exit();
+
+	dropped = check_output("test2", counts);
+
+	if (dropped < 0) {
+		return -1;
+	}
+
+	if (counts[0] != 1 || dropped == 0 || counts[1] + dropped != MESSAGES_PER_THREAD) {
+		printf("test2: unexpected output, %d message(s) received, %d dropped\n",
+		       counts[1], dropped);
+
+		return -1;
+	}
+
+	semaphore_destroy(&output_entered);
+	semaphore_destroy(&output_unblocked);
+
+	return 0;
+}
+
+static uint64_t benchmark_run(bool async, int *lines) {
+	Producer producers[THREAD_COUNT];
+	uint64_t start;
+	uint64_t duration;
+	int i;
+
+	setup(async);
+
+	output_discard = true;
+	output_lines = 0;
+	start = microtime();
+
+	for (i = 0; i < THREAD_COUNT; ++i) {
+		producers[i].index = i;
+		producers[i].count = BENCHMARK_MESSAGES;
+
+		thread_create(&producers[i].thread, produce, &producers[i]);
+	}
+
+	for (i = 0; i < THREAD_COUNT; ++i) {
+		thread_join(&producers[i].thread);
+		thread_destroy(&producers[i].thread);
+	}
+
+	// the time the threads spent logging, not including the logger thread
+	// catching up afterwards
+	duration = MAX(microtime() - start, 1);
+
+	log_exit();
+
+	output_discard = false;
+	*lines = output_lines;
+
+	return duration;
+}
+
+// without a logger thread that keeps up some messages get dropped in
+// asynchronous mode, report how many lines made it into the output
+static void benchmark(void) {
+	int sync_lines;
+	int async_lines;
+	uint64_t sync_duration = benchmark_run(false, &sync_lines);
+	uint64_t async_duration = benchmark_run(true, &async_lines);
+
+	printf("%d threads logging %d messages each: synchronous %.0f msg/s (%d lines), asynchronous %.0f msg/s (%d lines)\n",
+	       THREAD_COUNT, BENCHMARK_MESSAGES,
+	       (double)THREAD_COUNT * BENCHMARK_MESSAGES * 1000000 / sync_duration, sync_lines,
+	       (double)THREAD_COUNT * BENCHMARK_MESSAGES * 1000000 / async_duration, async_lines);
+}
+
+int main(void) {
+	output_buffer = malloc(OUTPUT_SIZE + 1);
+
+	_test_log_source.name = "log_test.c";
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	benchmark();
+
+	free(output_buffer);
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
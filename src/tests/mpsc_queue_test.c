@@ -0,0 +1,212 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * mpsc_queue_test.c: Tests for the MPSCQueue type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <daemonlib/mpsc_queue.h>
+#include <daemonlib/utils.h>
+
+#define PRODUCER_COUNT 4
+#define PRODUCER_ITEMS 200000 // per producer
+
+typedef struct {
+	MPSCNode node;
+	int producer;
+	int sequence;
+} Item;
+
+typedef struct {
+	pthread_t thread;
+	int index;
+	MPSCQueue *queue;
+	Item *items;
+} Producer;
+
+// items of a single thread come out in FIFO order and push reports if the
+// queue was empty before
+static int test1(void) {
+	MPSCQueue queue;
+	Item items[3];
+	MPSCNode *node;
+	int i;
+
+	mpsc_queue_create(&queue);
+
+	if (mpsc_queue_take(&queue) != NULL) {
+		printf("test1: empty queue returned an item\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < 3; ++i) {
+		items[i].sequence = i;
+
+		if (mpsc_queue_push(&queue, &items[i].node) != (i == 0)) {
+			printf("test1: wrong empty indication for item %d\n", i);
+
+			return -1;
+		}
+	}
+
+	node = mpsc_queue_take(&queue);
+
+	for (i = 0; i < 3; ++i) {
+		if (node == NULL || containerof(node, Item, node)->sequence != i) {
+			printf("test1: unexpected item at index %d\n", i);
+
+			return -1;
+		}
+
+		node = node->next;
+	}
+
+	if (node != NULL || mpsc_queue_take(&queue) != NULL) {
+		printf("test1: queue returned too many items\n");
+
+		return -1;
+	}
+
+	if (!mpsc_queue_push(&queue, &items[0].node)) {
+		printf("test1: queue is not empty after taking all items\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *produce(void *opaque) {
+	Producer *producer = opaque;
+	int i;
+
+	for (i = 0; i < PRODUCER_ITEMS; ++i) {
+		producer->items[i].producer = producer->index;
+		producer->items[i].sequence = i;
+
+		mpsc_queue_push(producer->queue, &producer->items[i].node);
+	}
+
+	return NULL;
+}
+
+// items from several threads arrive complete and in order per thread
+static int test2(void) {
+	MPSCQueue queue;
+	Producer producers[PRODUCER_COUNT];
+	int expected[PRODUCER_COUNT] = {0};
+	int total = 0;
+	int takes = 0;
+	MPSCNode *node;
+	Item *item;
+	uint64_t start;
+	uint64_t duration;
+	int result = -1;
+	int i;
+
+	mpsc_queue_create(&queue);
+
+	for (i = 0; i < PRODUCER_COUNT; ++i) {
+		producers[i].index = i;
+		producers[i].queue = &queue;
+		producers[i].items = calloc(PRODUCER_ITEMS, sizeof(Item));
+
+		if (producers[i].items == NULL) {
+			printf("test2: could not allocate items\n");
+
+			return -1;
+		}
+	}
+
+	start = microtime();
+
+	for (i = 0; i < PRODUCER_COUNT; ++i) {
+		pthread_create(&producers[i].thread, NULL, produce, &producers[i]);
+	}
+
+	while (total < PRODUCER_COUNT * PRODUCER_ITEMS) {
+		node = mpsc_queue_take(&queue);
+
+		if (node == NULL) {
+			sched_yield();
+
+			continue;
+		}
+
+		++takes;
+
+		for (; node != NULL; node = node->next) {
+			item = containerof(node, Item, node);
+
+			if (item->sequence != expected[item->producer]) {
+				printf("test2: producer %d item %d arrived, expected item %d\n",
+				       item->producer, item->sequence, expected[item->producer]);
+
+				goto cleanup;
+			}
+
+			++expected[item->producer];
+			++total;
+		}
+	}
+
+	duration = microtime() - start;
+
+	if (mpsc_queue_take(&queue) != NULL) {
+		printf("test2: queue returned too many items\n");
+
+		goto cleanup;
+	}
+
+	printf("test2: %d items from %d threads in %d takes, %.1f Mitems/s\n",
+	       total, PRODUCER_COUNT, takes, duration > 0 ? (double)total / duration : 0.0);
+
+	result = 0;
+
+cleanup:
+	for (i = 0; i < PRODUCER_COUNT; ++i) {
+		pthread_join(producers[i].thread, NULL);
+	}
+
+	for (i = 0; i < PRODUCER_COUNT; ++i) {
+		free(producers[i].items);
+	}
+
+	return result;
+}
+
+int main(void) {
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
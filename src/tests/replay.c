@@ -0,0 +1,1020 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * replay.c: Replays a TFP capture against the Brick Daemon
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * reads a capture written by brickd (capture.file option) and replays the
+ * client side of it: one TCP/IP connection per captured client, sending the
+ * captured requests with their original inter-arrival times. with --fast the
+ * requests are send as fast as possible instead, with at most --window
+ * requests waiting for a response per connection. requests for brickd itself
+ * (UID 1) are not replayed, use --secret if the target requires
+ * authentication.
+ *
+ * the latency of each replayed request is measured from sending the request
+ * to receiving its response and compared to the latency recorded in the
+ * capture. the captured latency is measured inside brickd, from receiving the
+ * request to dispatching the response, so it lacks the socket round-trip that
+ * the replayed latency includes. for an exact comparison between two builds
+ * of brickd replay the same capture against both, typically with a simulated
+ * stack (simulation.devices option) that has the same UIDs as the captured
+ * stack, and compare the replayed figures:
+ *
+ *   brickd-replay --json capture.bin > build-a.json
+ *
+ * note that the replayed requests change the state of the target. for
+ * example, a captured callback period setter stays in effect after the replay.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <brickd/hmac.h>
+#include <daemonlib/utils.h>
+
+#define CAPTURE_MAGIC "TFPCAPTR"
+#define CAPTURE_VERSION 1
+#define CAPTURE_HEADER_LENGTH 28
+#define CAPTURE_RECORD_HEADER_LENGTH 16
+
+#define CAPTURE_TYPE_REQUEST 0
+#define CAPTURE_TYPE_RESPONSE 1
+#define CAPTURE_TYPE_CALLBACK 2
+#define CAPTURE_TYPE_ROUTE 3
+
+#define MAX_CLIENT_ID 1000000
+#define MAX_STACK_ID 65535
+#define PACKET_MIN_LENGTH 8
+#define PACKET_MAX_LENGTH 80
+#define READ_BUFFER_SIZE 8192 // bytes
+#define POLL_INTERVAL 10 // milliseconds
+#define TIMEOUT_CHECK_INTERVAL 100000 // 0.1 seconds in microseconds
+
+#define UID_BRICK_DAEMON 1
+#define FUNCTION_GET_AUTHENTICATION_NONCE 1
+#define FUNCTION_AUTHENTICATE 2
+
+typedef struct {
+	uint64_t timestamp; // microseconds, relative to the first request
+	int connection;
+	int length;
+	uint8_t packet[PACKET_MAX_LENGTH];
+	// filled from the capture
+	bool captured_response;
+	bool captured_error;
+	uint64_t captured_latency; // microseconds
+} Request;
+
+typedef struct {
+	int request; // index into _requests
+	uint64_t sent; // microseconds
+} PendingRequest;
+
+typedef struct {
+	uint32_t client_id;
+	int fd;
+	int *requests; // indices into _requests, in capture order
+	int request_count;
+	int request_allocated;
+	int next_request;
+	PendingRequest *pending;
+	int pending_count;
+	int pending_allocated;
+	uint8_t buffer[READ_BUFFER_SIZE];
+	int buffer_used;
+} Connection;
+
+typedef struct {
+	uint64_t requests;
+	uint64_t responses;
+	uint64_t errors;
+	uint64_t timeouts;
+	uint64_t callbacks;
+	double duration; // seconds, from the first request to the last response
+	uint64_t *latencies; // microseconds
+	uint64_t latency_count;
+	uint64_t latency_sum;
+	uint64_t last_response; // microseconds
+} Stats;
+
+static const char *_host = "localhost";
+static int _port = 4223;
+static const char *_secret = NULL;
+static bool _fast = false;
+static int _window = 16; // only for --fast
+static int _timeout = 2500; // milliseconds
+static bool _json = false;
+
+static Request *_requests = NULL;
+static int _request_count = 0;
+static Connection *_connections = NULL;
+static int _connection_count = 0;
+static int _stack_count = 0;
+
+// all values in the capture are little endian
+static uint64_t read_le(const uint8_t *data, int length) {
+	uint64_t value = 0;
+	int i;
+
+	for (i = length - 1; i >= 0; --i) {
+		value = (value << 8) | data[i];
+	}
+
+	return value;
+}
+
+static uint32_t packet_get_uid(const uint8_t *packet) {
+	return (uint32_t)read_le(packet, 4);
+}
+
+static uint8_t packet_get_function_id(const uint8_t *packet) {
+	return packet[5];
+}
+
+static int packet_get_sequence_number(const uint8_t *packet) {
+	return packet[6] >> 4;
+}
+
+static bool packet_get_response_expected(const uint8_t *packet) {
+	return (packet[6] & 0x08) != 0;
+}
+
+static int packet_get_error_code(const uint8_t *packet) {
+	return packet[7] >> 6;
+}
+
+static bool packet_is_matching_response(const uint8_t *response, const uint8_t *request) {
+	return memcmp(response, request, 4) == 0 && // UID
+	       packet_get_function_id(response) == packet_get_function_id(request) &&
+	       packet_get_sequence_number(response) == packet_get_sequence_number(request);
+}
+
+static void *grow(void *array, int *allocated, int count, size_t size) {
+	void *bigger;
+
+	if (count < *allocated) {
+		return array;
+	}
+
+	bigger = realloc(array, (*allocated > 0 ? *allocated * 2 : 64) * size);
+
+	if (bigger == NULL) {
+		fprintf(stderr, "could not allocate memory\n");
+
+		exit(EXIT_FAILURE);
+	}
+
+	*allocated = *allocated > 0 ? *allocated * 2 : 64;
+
+	return bigger;
+}
+
+static void connection_add_pending(Connection *connection, int request, uint64_t sent) {
+	connection->pending = grow(connection->pending, &connection->pending_allocated,
+	                           connection->pending_count, sizeof(PendingRequest));
+
+	connection->pending[connection->pending_count].request = request;
+	connection->pending[connection->pending_count].sent = sent;
+
+	++connection->pending_count;
+}
+
+// matches the oldest pending request, the same way brickd does. returns the
+// index of the pending request or -1
+static int connection_find_pending(Connection *connection, const uint8_t *response) {
+	int i;
+
+	for (i = 0; i < connection->pending_count; ++i) {
+		if (packet_is_matching_response(response, _requests[connection->pending[i].request].packet)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static void connection_remove_pending(Connection *connection, int i) {
+	memmove(&connection->pending[i], &connection->pending[i + 1],
+	        (connection->pending_count - i - 1) * sizeof(PendingRequest));
+
+	--connection->pending_count;
+}
+
+static int compare_uint64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static int stats_allocate_latencies(Stats *stats) {
+	stats->latencies = calloc(_request_count > 0 ? _request_count : 1, sizeof(uint64_t));
+
+	return stats->latencies != NULL ? 0 : -1;
+}
+
+static void stats_add_response(Stats *stats, bool error, uint64_t latency) {
+	++stats->responses;
+
+	if (error) {
+		++stats->errors;
+	}
+
+	stats->latencies[stats->latency_count++] = latency;
+	stats->latency_sum += latency;
+}
+
+static uint64_t stats_get_percentile(Stats *stats, double percentile) {
+	uint64_t i;
+
+	if (stats->latency_count == 0) {
+		return 0;
+	}
+
+	i = (uint64_t)(stats->latency_count * percentile / 100.0);
+
+	return stats->latencies[i < stats->latency_count ? i : stats->latency_count - 1];
+}
+
+static double stats_get_mean(Stats *stats) {
+	return stats->latency_count > 0 ? (double)stats->latency_sum / stats->latency_count : 0.0;
+}
+
+static double stats_get_throughput(Stats *stats) {
+	return stats->duration > 0 ? stats->responses / stats->duration : 0.0;
+}
+
+static int load_capture(const char *filename, Stats *captured) {
+	FILE *fp;
+	uint8_t header[CAPTURE_HEADER_LENGTH];
+	uint8_t record[CAPTURE_RECORD_HEADER_LENGTH];
+	uint8_t packet[PACKET_MAX_LENGTH];
+	uint64_t timestamp;
+	uint64_t first_timestamp = 0;
+	uint64_t last_timestamp = 0;
+	uint32_t client_id;
+	uint16_t stack_id;
+	int type;
+	int length;
+	int *client_connections;
+	bool *stack_seen;
+	Connection *connection;
+	Request *request;
+	int request_allocated = 0;
+	int connection_allocated = 0;
+	int i;
+	int rc = -1;
+
+	fp = fopen(filename, "rb");
+
+	if (fp == NULL) {
+		fprintf(stderr, "could not open capture '%s': %s (%d)\n",
+		        filename, get_errno_name(errno), errno);
+
+		return -1;
+	}
+
+	client_connections = calloc(MAX_CLIENT_ID + 1, sizeof(int));
+	stack_seen = calloc(MAX_STACK_ID + 1, sizeof(bool));
+
+	if (client_connections == NULL || stack_seen == NULL) {
+		fprintf(stderr, "could not allocate memory\n");
+
+		goto cleanup;
+	}
+
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+	    memcmp(header, CAPTURE_MAGIC, 8) != 0) {
+		fprintf(stderr, "'%s' is not a capture file\n", filename);
+
+		goto cleanup;
+	}
+
+	if (read_le(header + 8, 4) != CAPTURE_VERSION) {
+		fprintf(stderr, "capture '%s' has unsupported version %u\n", filename,
+		        (uint32_t)read_le(header + 8, 4));
+
+		goto cleanup;
+	}
+
+	while (fread(record, 1, sizeof(record), fp) == sizeof(record)) {
+		timestamp = read_le(record, 8);
+		client_id = (uint32_t)read_le(record + 8, 4);
+		stack_id = (uint16_t)read_le(record + 12, 2);
+		type = record[14];
+		length = record[15];
+
+		if (length < PACKET_MIN_LENGTH || length > PACKET_MAX_LENGTH ||
+		    fread(packet, 1, length, fp) != (size_t)length) {
+			fprintf(stderr, "capture '%s' is truncated, using the complete records\n", filename);
+
+			break;
+		}
+
+		if (type == CAPTURE_TYPE_ROUTE) {
+			if (!stack_seen[stack_id]) {
+				stack_seen[stack_id] = true;
+				++_stack_count;
+			}
+
+			continue;
+		}
+
+		if (type == CAPTURE_TYPE_CALLBACK) {
+			++captured->callbacks;
+
+			continue;
+		}
+
+		// requests for brickd itself are not replayed, they depend on the
+		// authentication nonce and can switch the framing to batch mode
+		if (client_id == 0 || client_id > MAX_CLIENT_ID ||
+		    packet_get_uid(packet) == UID_BRICK_DAEMON) {
+			continue;
+		}
+
+		if (type == CAPTURE_TYPE_REQUEST) {
+			if (_request_count == 0) {
+				first_timestamp = timestamp;
+			}
+
+			if (client_connections[client_id] == 0) {
+				_connections = grow(_connections, &connection_allocated,
+				                    _connection_count, sizeof(Connection));
+
+				memset(&_connections[_connection_count], 0, sizeof(Connection));
+
+				_connections[_connection_count].client_id = client_id;
+				_connections[_connection_count].fd = -1;
+
+				client_connections[client_id] = ++_connection_count;
+			}
+
+			connection = &_connections[client_connections[client_id] - 1];
+
+			_requests = grow(_requests, &request_allocated, _request_count, sizeof(Request));
+			request = &_requests[_request_count];
+
+			memset(request, 0, sizeof(Request));
+
+			// with network worker threads records can be slightly out of order
+			request->timestamp = timestamp > first_timestamp ? timestamp - first_timestamp : 0;
+			request->connection = client_connections[client_id] - 1;
+			request->length = length;
+
+			memcpy(request->packet, packet, length);
+
+			connection->requests = grow(connection->requests, &connection->request_allocated,
+			                            connection->request_count, sizeof(int));
+			connection->requests[connection->request_count++] = _request_count;
+
+			if (packet_get_response_expected(packet)) {
+				connection_add_pending(connection, _request_count, timestamp);
+			}
+
+			++_request_count;
+			++captured->requests;
+		} else if (type == CAPTURE_TYPE_RESPONSE && client_connections[client_id] != 0) {
+			connection = &_connections[client_connections[client_id] - 1];
+			i = connection_find_pending(connection, packet);
+
+			if (i < 0) {
+				continue;
+			}
+
+			request = &_requests[connection->pending[i].request];
+
+			request->captured_response = true;
+			request->captured_error = packet_get_error_code(packet) != 0;
+			request->captured_latency = timestamp > connection->pending[i].sent ? timestamp - connection->pending[i].sent : 0;
+
+			connection_remove_pending(connection, i);
+
+			last_timestamp = timestamp;
+		}
+	}
+
+	if (_request_count == 0) {
+		fprintf(stderr, "capture '%s' contains no requests to replay\n", filename);
+
+		goto cleanup;
+	}
+
+	if (stats_allocate_latencies(captured) < 0) {
+		fprintf(stderr, "could not allocate memory\n");
+
+		goto cleanup;
+	}
+
+	// requests from the capture without a response got dropped or timed
+	// out in the original run. the pending requests are reused for the replay
+	for (i = 0; i < _connection_count; ++i) {
+		captured->timeouts += _connections[i].pending_count;
+		_connections[i].pending_count = 0;
+	}
+
+	for (i = 0; i < _request_count; ++i) {
+		if (_requests[i].captured_response) {
+			stats_add_response(captured, _requests[i].captured_error,
+			                   _requests[i].captured_latency);
+		}
+	}
+
+	captured->duration = last_timestamp > first_timestamp ? (last_timestamp - first_timestamp) / 1000000.0 : 0.0;
+
+	rc = 0;
+
+cleanup:
+	free(stack_seen);
+	free(client_connections);
+	fclose(fp);
+
+	return rc;
+}
+
+static int connect_tcp(void) {
+	struct addrinfo hints;
+	struct addrinfo *resolved;
+	char port[16];
+	int fd;
+	int flag = 1;
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	snprintf(port, sizeof(port), "%d", _port);
+
+	if (getaddrinfo(_host, port, &hints, &resolved) != 0) {
+		return -1;
+	}
+
+	fd = socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+
+	if (fd < 0) {
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	// same as the bindings do
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	if (connect(fd, resolved->ai_addr, resolved->ai_addrlen) < 0) {
+		close(fd);
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	freeaddrinfo(resolved);
+
+	return fd;
+}
+
+static int write_exactly(int fd, const uint8_t *data, int length) {
+	int offset = 0;
+	int rc;
+
+	while (offset < length) {
+		rc = write(fd, data + offset, length - offset);
+
+		if (rc < 0 && errno == EINTR) {
+			continue;
+		}
+
+		if (rc <= 0) {
+			return -1;
+		}
+
+		offset += rc;
+	}
+
+	return 0;
+}
+
+// reads until the response to the given brickd function arrives, callbacks
+// that arrive before are skipped. only used before the replay starts
+static int read_brickd_response(int fd, uint8_t function_id, uint8_t *response, int length) {
+	uint8_t packet[PACKET_MAX_LENGTH];
+	int offset;
+	int rc;
+
+	for (;;) {
+		offset = 0;
+
+		while (offset < PACKET_MIN_LENGTH || offset < packet[4]) {
+			rc = read(fd, packet + offset, (offset < PACKET_MIN_LENGTH ? PACKET_MIN_LENGTH : packet[4]) - offset);
+
+			if (rc <= 0 || (offset + rc >= PACKET_MIN_LENGTH &&
+			                (packet[4] < PACKET_MIN_LENGTH || packet[4] > PACKET_MAX_LENGTH))) {
+				return -1;
+			}
+
+			offset += rc;
+		}
+
+		if (packet_get_uid(packet) == UID_BRICK_DAEMON &&
+		    packet_get_function_id(packet) == function_id) {
+			if (packet_get_error_code(packet) != 0 || packet[4] < length) {
+				return -1;
+			}
+
+			memcpy(response, packet, length);
+
+			return 0;
+		}
+	}
+}
+
+static int authenticate(int fd) {
+	uint8_t request[32];
+	uint8_t response[12];
+	uint32_t uid = uint32_to_le(UID_BRICK_DAEMON);
+	uint32_t nonces[2];
+
+	memcpy(request, &uid, sizeof(uid));
+
+	request[4] = 8;
+	request[5] = FUNCTION_GET_AUTHENTICATION_NONCE;
+	request[6] = (1 << 4) | 0x08; // response expected
+	request[7] = 0;
+
+	if (write_exactly(fd, request, 8) < 0 ||
+	    read_brickd_response(fd, FUNCTION_GET_AUTHENTICATION_NONCE, response, sizeof(response)) < 0) {
+		return -1;
+	}
+
+	memcpy(&nonces[0], response + 8, sizeof(nonces[0]));
+
+	nonces[1] = get_random_uint32();
+
+	request[4] = sizeof(request);
+	request[5] = FUNCTION_AUTHENTICATE;
+	request[6] = (2 << 4) | 0x08; // response expected
+
+	memcpy(request + 8, &nonces[1], sizeof(nonces[1]));
+
+	hmac_sha1((uint8_t *)_secret, strlen(_secret), (uint8_t *)nonces,
+	          sizeof(nonces), request + 12);
+
+	if (write_exactly(fd, request, sizeof(request)) < 0 ||
+	    read_brickd_response(fd, FUNCTION_AUTHENTICATE, response, PACKET_MIN_LENGTH) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void handle_packet(Connection *connection, const uint8_t *packet, Stats *replayed,
+                          uint64_t now) {
+	PendingRequest *pending;
+	int i;
+
+	if (packet_get_sequence_number(packet) == 0) {
+		++replayed->callbacks;
+
+		return;
+	}
+
+	i = connection_find_pending(connection, packet);
+
+	if (i < 0) {
+		return; // late response for a timed out request
+	}
+
+	pending = &connection->pending[i];
+
+	stats_add_response(replayed, packet_get_error_code(packet) != 0, now - pending->sent);
+
+	replayed->last_response = now;
+
+	connection_remove_pending(connection, i);
+}
+
+static int handle_read(Connection *connection, Stats *replayed, uint64_t now) {
+	int rc;
+	int offset = 0;
+	int length;
+
+	rc = read(connection->fd, connection->buffer + connection->buffer_used,
+	          sizeof(connection->buffer) - connection->buffer_used);
+
+	if (rc < 0 && errno == EINTR) {
+		return 0;
+	}
+
+	if (rc <= 0) {
+		return -1;
+	}
+
+	connection->buffer_used += rc;
+
+	while (connection->buffer_used - offset >= PACKET_MIN_LENGTH) {
+		length = connection->buffer[offset + 4];
+
+		if (length < PACKET_MIN_LENGTH || length > PACKET_MAX_LENGTH) {
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		if (connection->buffer_used - offset < length) {
+			break;
+		}
+
+		handle_packet(connection, connection->buffer + offset, replayed, now);
+
+		offset += length;
+	}
+
+	memmove(connection->buffer, connection->buffer + offset, connection->buffer_used - offset);
+
+	connection->buffer_used -= offset;
+
+	return 0;
+}
+
+static void expire_pending(Stats *replayed, uint64_t now) {
+	Connection *connection;
+	int i;
+	int k;
+
+	for (i = 0; i < _connection_count; ++i) {
+		connection = &_connections[i];
+
+		for (k = 0; k < connection->pending_count; ) {
+			if (now - connection->pending[k].sent >= (uint64_t)_timeout * 1000) {
+				++replayed->timeouts;
+
+				connection_remove_pending(connection, k);
+			} else {
+				++k;
+			}
+		}
+	}
+}
+
+static int replay(Stats *replayed) {
+	struct pollfd *pollfds;
+	Connection *connection;
+	Request *request;
+	uint64_t start;
+	uint64_t now;
+	uint64_t next_due;
+	uint64_t last_expire;
+	int timeout;
+	int remaining = _request_count;
+	int pending_count;
+	int i;
+	int rc = -1;
+
+	pollfds = calloc((unsigned int)_connection_count, sizeof(struct pollfd));
+
+	if (pollfds == NULL) {
+		fprintf(stderr, "could not allocate memory\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < _connection_count; ++i) {
+		pollfds[i].fd = _connections[i].fd;
+		pollfds[i].events = POLLIN;
+	}
+
+	start = microtime();
+	last_expire = start;
+
+	for (;;) {
+		now = microtime();
+		next_due = UINT64_MAX;
+		pending_count = 0;
+
+		for (i = 0; i < _connection_count; ++i) {
+			connection = &_connections[i];
+
+			while (connection->next_request < connection->request_count) {
+				request = &_requests[connection->requests[connection->next_request]];
+
+				if (_fast) {
+					if (connection->pending_count >= _window) {
+						break;
+					}
+				} else if (start + request->timestamp > now) {
+					if (start + request->timestamp < next_due) {
+						next_due = start + request->timestamp;
+					}
+
+					break;
+				}
+
+				if (write_exactly(connection->fd, request->packet, request->length) < 0) {
+					fprintf(stderr, "could not send request for client %u: %s (%d)\n",
+					        connection->client_id, get_errno_name(errno), errno);
+
+					goto cleanup;
+				}
+
+				if (packet_get_response_expected(request->packet)) {
+					connection_add_pending(connection, connection->requests[connection->next_request], now);
+				}
+
+				++connection->next_request;
+				++replayed->requests;
+				--remaining;
+			}
+
+			pending_count += connection->pending_count;
+		}
+
+		if (remaining == 0 && pending_count == 0) {
+			break;
+		}
+
+		timeout = POLL_INTERVAL;
+
+		// round up, busy waiting for the last fraction of a millisecond would
+		// take CPU time away from a brickd running on the same machine
+		if (next_due != UINT64_MAX) {
+			timeout = next_due > now ? (int)((next_due - now + 999) / 1000) : 0;
+			timeout = timeout < POLL_INTERVAL ? timeout : POLL_INTERVAL;
+		}
+
+		if (poll(pollfds, _connection_count, timeout) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			fprintf(stderr, "could not poll: %s (%d)\n", get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+
+		now = microtime();
+
+		for (i = 0; i < _connection_count; ++i) {
+			if ((pollfds[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+				continue;
+			}
+
+			connection = &_connections[i];
+
+			if (handle_read(connection, replayed, now) < 0) {
+				fprintf(stderr, "connection for client %u failed: %s (%d)\n",
+				        connection->client_id, get_errno_name(errno), errno);
+
+				goto cleanup;
+			}
+		}
+
+		if (now - last_expire >= TIMEOUT_CHECK_INTERVAL) {
+			expire_pending(replayed, now);
+
+			last_expire = now;
+		}
+	}
+
+	replayed->duration = replayed->last_response > start ? (replayed->last_response - start) / 1000000.0 : 0.0;
+
+	rc = 0;
+
+cleanup:
+	free(pollfds);
+
+	return rc;
+}
+
+static double get_delta(double captured, double replayed) {
+	return captured > 0 ? (replayed - captured) * 100.0 / captured : 0.0;
+}
+
+static void stats_print_json(const char *name, Stats *stats) {
+	printf("\"%s\":{\"requests\":%" PRIu64 ",\"responses\":%" PRIu64 ",\"errors\":%" PRIu64
+	       ",\"timeouts\":%" PRIu64 ",\"callbacks\":%" PRIu64 ",\"duration\":%.3f,\"throughput\":%.1f,"
+	       "\"latency_us\":{\"min\":%" PRIu64 ",\"mean\":%.1f,\"p50\":%" PRIu64 ",\"p90\":%" PRIu64
+	       ",\"p99\":%" PRIu64 ",\"max\":%" PRIu64 "}}",
+	       name, stats->requests, stats->responses, stats->errors, stats->timeouts,
+	       stats->callbacks, stats->duration, stats_get_throughput(stats),
+	       stats_get_percentile(stats, 0), stats_get_mean(stats),
+	       stats_get_percentile(stats, 50), stats_get_percentile(stats, 90),
+	       stats_get_percentile(stats, 99), stats_get_percentile(stats, 100));
+}
+
+static void print_row(const char *name, double captured, double replayed, bool delta) {
+	if (delta) {
+		printf("%-16s %14.1f %14.1f %+9.1f%%\n", name, captured, replayed, get_delta(captured, replayed));
+	} else {
+		printf("%-16s %14.0f %14.0f\n", name, captured, replayed);
+	}
+}
+
+static void print_report(Stats *captured, Stats *replayed) {
+	if (_json) {
+		printf("{\"host\":\"%s\",\"port\":%d,\"fast\":%s,\"window\":%d,\"connections\":%d,\"stacks\":%d,",
+		       _host, _port, _fast ? "true" : "false", _window, _connection_count, _stack_count);
+
+		stats_print_json("captured", captured);
+		printf(",");
+		stats_print_json("replayed", replayed);
+
+		printf(",\"delta_percent\":{\"throughput\":%.1f,\"mean\":%.1f,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+		       get_delta(stats_get_throughput(captured), stats_get_throughput(replayed)),
+		       get_delta(stats_get_mean(captured), stats_get_mean(replayed)),
+		       get_delta(stats_get_percentile(captured, 50), stats_get_percentile(replayed, 50)),
+		       get_delta(stats_get_percentile(captured, 90), stats_get_percentile(replayed, 90)),
+		       get_delta(stats_get_percentile(captured, 99), stats_get_percentile(replayed, 99)),
+		       get_delta(stats_get_percentile(captured, 100), stats_get_percentile(replayed, 100)));
+
+		return;
+	}
+
+	printf("replayed %d request(s) of %d client(s) routed to %d stack(s) to %s:%d%s\n",
+	       _request_count, _connection_count, _stack_count, _host, _port,
+	       _fast ? " as fast as possible" : " with original timing");
+	printf("%-16s %14s %14s %10s\n", "", "captured", "replayed", "delta");
+
+	print_row("requests", captured->requests, replayed->requests, false);
+	print_row("responses", captured->responses, replayed->responses, false);
+	print_row("errors", captured->errors, replayed->errors, false);
+	print_row("timeouts", captured->timeouts, replayed->timeouts, false);
+	print_row("callbacks", captured->callbacks, replayed->callbacks, false);
+	print_row("duration (sec)", captured->duration, replayed->duration, true);
+	print_row("throughput (1/s)", stats_get_throughput(captured), stats_get_throughput(replayed), true);
+	print_row("min (usec)", stats_get_percentile(captured, 0), stats_get_percentile(replayed, 0), true);
+	print_row("mean (usec)", stats_get_mean(captured), stats_get_mean(replayed), true);
+	print_row("p50 (usec)", stats_get_percentile(captured, 50), stats_get_percentile(replayed, 50), true);
+	print_row("p90 (usec)", stats_get_percentile(captured, 90), stats_get_percentile(replayed, 90), true);
+	print_row("p99 (usec)", stats_get_percentile(captured, 99), stats_get_percentile(replayed, 99), true);
+	print_row("max (usec)", stats_get_percentile(captured, 100), stats_get_percentile(replayed, 100), true);
+
+	printf("captured latencies exclude the socket round-trip, replayed latencies include it\n");
+	printf("captured callbacks are counted once per broadcast, replayed callbacks once per connection\n");
+}
+
+static void print_usage(const char *program) {
+	printf("usage: %s [options] <capture-file>\n"
+	       "\n"
+	       "options:\n"
+	       "  --host <host>        brickd host (default: localhost)\n"
+	       "  --port <port>        brickd port (default: 4223)\n"
+	       "  --secret <secret>    authentication secret (default: none)\n"
+	       "  --fast               send requests as fast as possible, not with original timing\n"
+	       "  --window <count>     requests waiting for a response per connection with --fast (default: 16)\n"
+	       "  --timeout <ms>       response timeout in milliseconds (default: 2500)\n"
+	       "  --json               print the results as a single JSON object\n",
+	       program);
+}
+
+static int parse_integer(const char *name, const char *value, int min, int max) {
+	char *end = NULL;
+	long number;
+
+	if (value == NULL) {
+		fprintf(stderr, "missing value for %s\n", name);
+
+		exit(EXIT_FAILURE);
+	}
+
+	number = strtol(value, &end, 10);
+
+	if (end == value || *end != '\0' || number < min || number > max) {
+		fprintf(stderr, "invalid value '%s' for %s, expecting %d..%d\n", value, name, min, max);
+
+		exit(EXIT_FAILURE);
+	}
+
+	return (int)number;
+}
+
+int main(int argc, char **argv) {
+	const char *filename = NULL;
+	Stats captured;
+	Stats replayed;
+	int exit_code = EXIT_FAILURE;
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--help") == 0) {
+			print_usage(argv[0]);
+
+			return EXIT_SUCCESS;
+		} else if (strcmp(argv[i], "--host") == 0 && i + 1 < argc) {
+			_host = argv[++i];
+		} else if (strcmp(argv[i], "--port") == 0) {
+			_port = parse_integer(argv[i], argv[i + 1], 1, 65535);
+			++i;
+		} else if (strcmp(argv[i], "--secret") == 0 && i + 1 < argc) {
+			_secret = argv[++i];
+		} else if (strcmp(argv[i], "--fast") == 0) {
+			_fast = true;
+		} else if (strcmp(argv[i], "--window") == 0) {
+			_window = parse_integer(argv[i], argv[i + 1], 1, 32768);
+			++i;
+		} else if (strcmp(argv[i], "--timeout") == 0) {
+			_timeout = parse_integer(argv[i], argv[i + 1], 1, 3600000);
+			++i;
+		} else if (strcmp(argv[i], "--json") == 0) {
+			_json = true;
+		} else if (argv[i][0] != '-' && filename == NULL) {
+			filename = argv[i];
+		} else {
+			print_usage(argv[0]);
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (filename == NULL) {
+		print_usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	memset(&captured, 0, sizeof(captured));
+	memset(&replayed, 0, sizeof(replayed));
+
+	if (load_capture(filename, &captured) < 0) {
+		goto cleanup;
+	}
+
+	if (stats_allocate_latencies(&replayed) < 0) {
+		fprintf(stderr, "could not allocate memory\n");
+
+		goto cleanup;
+	}
+
+	// all connections are established before the replay starts, connecting
+	// is not part of the measurement
+	for (i = 0; i < _connection_count; ++i) {
+		_connections[i].fd = connect_tcp();
+
+		if (_connections[i].fd < 0) {
+			fprintf(stderr, "could not connect to %s:%d: %s (%d)\n",
+			        _host, _port, get_errno_name(errno), errno);
+
+			goto cleanup;
+		}
+
+		if (_secret != NULL && authenticate(_connections[i].fd) < 0) {
+			fprintf(stderr, "could not authenticate to %s:%d\n", _host, _port);
+
+			goto cleanup;
+		}
+	}
+
+	if (replay(&replayed) < 0) {
+		goto cleanup;
+	}
+
+	qsort(captured.latencies, captured.latency_count, sizeof(uint64_t), compare_uint64);
+	qsort(replayed.latencies, replayed.latency_count, sizeof(uint64_t), compare_uint64);
+
+	print_report(&captured, &replayed);
+
+	exit_code = EXIT_SUCCESS;
+
+cleanup:
+	for (i = 0; i < _connection_count; ++i) {
+		if (_connections[i].fd >= 0) {
+			close(_connections[i].fd);
+		}
+
+		free(_connections[i].requests);
+		free(_connections[i].pending);
+	}
+
+	free(_connections);
+	free(_requests);
+	free(captured.latencies);
+	free(replayed.latencies);
+
+	return exit_code;
+}
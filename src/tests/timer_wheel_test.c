@@ -0,0 +1,327 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * timer_wheel_test.c: Tests for the timer wheel based timer implementation
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// the wheel is included directly, so the tests can drive it with simulated
+// ticks instead of waiting for the real clock
+#include "../daemonlib/timer_wheel.c"
+
+#define SIMULATED_TIMERS 5000
+
+typedef struct {
+	Timer timer;
+	int count;
+	uint64_t fired; // tick or microseconds
+	void *victim; // destroyed by the timer function
+} TestTimer;
+
+static IOHandle event_handle = IO_HANDLE_INVALID;
+static EventFunction event_read = NULL;
+static int event_source_count = 0;
+
+// timer_wheel.c is tested without the event loop
+int event_add_source(IOHandle handle, EventSourceType type, const char *name,
+                     uint32_t events, EventFunction read, void *opaque) {
+	(void)type;
+	(void)name;
+	(void)events;
+	(void)opaque;
+
+	event_handle = handle;
+	event_read = read;
+
+	++event_source_count;
+
+	return 0;
+}
+
+void event_remove_source(IOHandle handle, EventSourceType type) {
+	(void)handle;
+	(void)type;
+
+	event_handle = IO_HANDLE_INVALID;
+
+	--event_source_count;
+}
+
+static uint64_t random_delta(void) {
+	// spread the expiries over all levels of the wheel
+	return ((uint64_t)rand() << 16 ^ (uint64_t)rand()) & (((uint64_t)1 << (rand() % 33)) - 1);
+}
+
+static void record_tick(void *opaque) {
+	TestTimer *test_timer = opaque;
+
+	++test_timer->count;
+	test_timer->fired = _current_tick - 1; // the tick being processed
+
+	if (test_timer->victim != NULL) {
+		timer_wheel_remove(test_timer->victim);
+	}
+}
+
+static void simulated_setup(TestTimer *test_timer, uint64_t expiry, uint64_t interval) {
+	node_reset(&test_timer->timer.node);
+
+	test_timer->timer.slot = TIMER_WHEEL_NO_SLOT;
+	test_timer->timer.expiry = expiry;
+	test_timer->timer.interval = interval;
+	test_timer->timer.function = record_tick;
+	test_timer->timer.opaque = test_timer;
+	test_timer->count = 0;
+	test_timer->fired = 0;
+	test_timer->victim = NULL;
+
+	timer_wheel_add(&test_timer->timer);
+}
+
+static void simulated_reset(uint64_t tick) {
+	int level;
+	int index;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; ++level) {
+		for (index = 0; index < TIMER_WHEEL_SLOTS; ++index) {
+			node_reset(&_slots[level][index]);
+		}
+
+		_occupied[level] = 0;
+	}
+
+	_slotted_timer_count = 0;
+	_current_tick = tick;
+}
+
+// timers with expiries on all levels fire exactly on their tick, while the
+// wheel is advanced in steps of random size. canceled timers never fire
+int test1(void) {
+	TestTimer *timers = calloc(SIMULATED_TIMERS, sizeof(TestTimer));
+	uint64_t start = 1000003;
+	uint64_t now = start;
+	uint64_t last = start - 1;
+	int remaining = SIMULATED_TIMERS;
+	int i;
+
+	simulated_reset(start);
+
+	for (i = 0; i < SIMULATED_TIMERS; ++i) {
+		simulated_setup(&timers[i], start + random_delta(), 0);
+	}
+
+	// cancel every tenth timer
+	for (i = 0; i < SIMULATED_TIMERS; i += 10) {
+		timer_wheel_remove(&timers[i].timer);
+	}
+
+	while (_slotted_timer_count > 0) {
+		now += random_delta() + 1;
+
+		timer_wheel_run(now);
+
+		for (i = 0; i < SIMULATED_TIMERS; ++i) {
+			if (i % 10 == 0) {
+				if (timers[i].count > 0) {
+					printf("test1: canceled timer %d fired\n", i);
+
+					return -1;
+				}
+
+				continue;
+			}
+
+			if (timers[i].timer.expiry > last && timers[i].timer.expiry <= now) {
+				if (timers[i].count != 1 || timers[i].fired != timers[i].timer.expiry) {
+					printf("test1: timer %d with expiry %llu fired %d time(s), last at %llu\n",
+					       i, (unsigned long long)timers[i].timer.expiry, timers[i].count,
+					       (unsigned long long)timers[i].fired);
+
+					return -1;
+				}
+
+				--remaining;
+			} else if (timers[i].timer.expiry > now && timers[i].count > 0) {
+				printf("test1: timer %d fired early\n", i);
+
+				return -1;
+			}
+		}
+
+		last = now;
+	}
+
+	if (remaining != SIMULATED_TIMERS / 10) {
+		printf("test1: %d timer(s) did not fire\n", remaining - SIMULATED_TIMERS / 10);
+
+		return -1;
+	}
+
+	free(timers);
+
+	return 0;
+}
+
+// an interval timer fires once per run if it elapsed more than once and
+// stays on its grid. a timer function can cancel another expired timer
+int test2(void) {
+	TestTimer interval;
+	TestTimer first;
+	TestTimer second;
+	uint64_t now = 100;
+	int i;
+
+	simulated_reset(now);
+	simulated_setup(&interval, now + 7, 7);
+
+	for (i = 0; i < 10; ++i) {
+		now += 20;
+
+		timer_wheel_run(now);
+
+		if (interval.count != i + 1 || (interval.fired - 100) % 7 != 0 ||
+		    interval.timer.expiry <= now || interval.timer.expiry > now + 7) {
+			printf("test2: unexpected interval timer state in run %d\n", i);
+
+			return -1;
+		}
+	}
+
+	timer_wheel_remove(&interval.timer);
+
+	simulated_setup(&first, now + 5, 0);
+	simulated_setup(&second, now + 5, 0);
+
+	first.victim = &second.timer;
+
+	timer_wheel_run(now + 10);
+
+	if (first.count != 1 || second.count != 0 || _slotted_timer_count != 0) {
+		printf("test2: canceled expired timer fired\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+static void record_time(void *opaque) {
+	TestTimer *test_timer = opaque;
+
+	++test_timer->count;
+	test_timer->fired = timer_wheel_get_time();
+
+	if (test_timer->victim != NULL) {
+		timer_configure(test_timer->victim, 0, 0);
+	}
+}
+
+// the public API with a real timerfd, all timers share one event source
+int test3(void) {
+	TestTimer timers[4];
+	uint64_t delays[4] = {5000, 20000, 80000, 1000000};
+	uint64_t start;
+	struct pollfd pollfd;
+	int i;
+
+	simulated_reset(0);
+
+	for (i = 0; i < 4; ++i) {
+		if (timer_create_(&timers[i].timer, record_time, &timers[i]) < 0) {
+			printf("test3: timer_create_ failed\n");
+
+			return -1;
+		}
+
+		timers[i].count = 0;
+		timers[i].victim = NULL;
+	}
+
+	if (event_source_count != 1) {
+		printf("test3: unexpected event source count %d\n", event_source_count);
+
+		return -1;
+	}
+
+	// the third timer cancels the fourth one
+	timers[2].victim = &timers[3].timer;
+	start = timer_wheel_get_time();
+
+	for (i = 0; i < 4; ++i) {
+		timer_configure(&timers[i].timer, delays[i], 0);
+	}
+
+	while (timer_wheel_get_time() - start < 150000) {
+		pollfd.fd = event_handle;
+		pollfd.events = POLLIN;
+
+		if (poll(&pollfd, 1, 10) > 0) {
+			event_read(NULL);
+		}
+	}
+
+	for (i = 0; i < 3; ++i) {
+		if (timers[i].count != 1 || timers[i].fired - start < delays[i]) {
+			printf("test3: timer %d fired %d time(s), after %llu usec\n", i, timers[i].count,
+			       (unsigned long long)(timers[i].fired - start));
+
+			return -1;
+		}
+	}
+
+	if (timers[3].count != 0 || _armed_tick != UINT64_MAX) {
+		printf("test3: canceled timer fired or timerfd still armed\n");
+
+		return -1;
+	}
+
+	for (i = 0; i < 4; ++i) {
+		timer_destroy(&timers[i].timer);
+	}
+
+	if (event_source_count != 0) {
+		printf("test3: event source not removed\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+int main(void) {
+	srand(1234);
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test3() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
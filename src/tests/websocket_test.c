@@ -0,0 +1,426 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * websocket_test.c: Tests and benchmark for the WebSocket frame parser
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/utils.h>
+
+#include <brickd/websocket.h>
+
+#define STREAM_SIZE (4 * 1024 * 1024)
+#define BENCHMARK_BYTES (256 * 1024 * 1024)
+
+static uint8_t *sent = NULL;
+static int sent_length = 0;
+static int send_limit = -1; // bytes the socket accepts, -1 for no limit
+
+// websocket.c is tested without the socket layer below it
+int socket_create(Socket *socket) {
+	memset(socket, 0, sizeof(Socket));
+
+	return 0;
+}
+
+void socket_destroy_platform(Socket *socket) {
+	(void)socket;
+}
+
+int socket_receive_platform(Socket *socket, void *buffer, int length) {
+	(void)socket;
+	(void)buffer;
+	(void)length;
+
+	errno = ENOSYS;
+
+	return -1;
+}
+
+int socket_send_platform(Socket *socket, const void *buffer, int length) {
+	(void)socket;
+
+	if (send_limit >= 0) {
+		if (send_limit == 0) {
+			errno = EWOULDBLOCK;
+
+			return -1;
+		}
+
+		length = MIN(length, send_limit);
+		send_limit -= length;
+	}
+
+	if (sent != NULL && sent_length + length <= STREAM_SIZE) {
+		memcpy(sent + sent_length, buffer, length);
+
+		sent_length += length;
+	}
+
+	return length;
+}
+
+static void setup(Websocket *websocket) {
+	websocket_create(websocket);
+
+	websocket->state = WEBSOCKET_STATE_HANDSHAKE_DONE;
+	sent_length = 0;
+}
+
+// appends a masked client frame to STREAM
+static int append_frame(uint8_t *stream, int offset, int opcode, int fin,
+                        const uint8_t *payload, int length) {
+	uint8_t key[WEBSOCKET_MASK_LENGTH];
+	int i;
+
+	stream[offset++] = (uint8_t)((fin ? 0x80 : 0) | opcode);
+
+	if (length <= WEBSOCKET_MAX_UNEXTENDED_PAYLOAD_DATA_LENGTH) {
+		stream[offset++] = (uint8_t)(0x80 | length);
+	} else if (length <= UINT16_MAX) {
+		stream[offset++] = 0x80 | 126;
+		stream[offset++] = (uint8_t)(length >> 8);
+		stream[offset++] = (uint8_t)length;
+	} else {
+		stream[offset++] = 0x80 | 127;
+
+		for (i = 0; i < 8; ++i) {
+			stream[offset++] = (uint8_t)((uint64_t)length >> (56 - i * 8));
+		}
+	}
+
+	for (i = 0; i < WEBSOCKET_MASK_LENGTH; ++i) {
+		key[i] = (uint8_t)rand();
+		stream[offset++] = key[i];
+	}
+
+	for (i = 0; i < length; ++i) {
+		stream[offset++] = payload[i] ^ key[i % WEBSOCKET_MASK_LENGTH];
+	}
+
+	return offset;
+}
+
+// feed STREAM to the parser in reads of random length up to MAX_READ and
+// collect the payload
+static int parse_stream(Websocket *websocket, uint8_t *stream, int length,
+                        int max_read, uint8_t *payload) {
+	uint8_t *buffer = malloc(max_read);
+	int offset = 0;
+	int payload_length = 0;
+	int read_length;
+	int rc;
+
+	while (offset < length) {
+		read_length = MIN(length - offset, 1 + rand() % max_read);
+
+		memcpy(buffer, stream + offset, read_length);
+
+		rc = websocket_parse(websocket, buffer, read_length);
+
+		if (rc == -1) {
+			free(buffer);
+
+			return -1;
+		}
+
+		if (rc > 0) {
+			memcpy(payload + payload_length, buffer, rc);
+
+			payload_length += rc;
+		}
+
+		offset += read_length;
+	}
+
+	free(buffer);
+
+	return payload_length;
+}
+
+// frames of all sizes, fragmented messages and interleaved pings arrive in
+// reads of random length. the payload has to come out unchanged and each
+// ping has to be answered
+int test1(void) {
+	Websocket websocket;
+	uint8_t *stream = malloc(STREAM_SIZE);
+	uint8_t *expected = malloc(STREAM_SIZE);
+	uint8_t *payload = malloc(STREAM_SIZE);
+	uint8_t ping[] = {'p', 'i', 'n', 'g'};
+	int lengths[] = {0, 1, 7, 8, 9, 80, 125, 126, 127, 1000, 65535, 65536, 100000};
+	int stream_length = 0;
+	int expected_length = 0;
+	int max_reads[] = {1, 3, 64, 4096, 65536};
+	int pings = 0;
+	int i;
+	int k;
+	int rc;
+
+	sent = malloc(STREAM_SIZE);
+
+	for (i = 0; i < STREAM_SIZE; ++i) {
+		expected[i] = (uint8_t)rand();
+	}
+
+	for (k = 0; k < 3; ++k) {
+		for (i = 0; i < (int)(sizeof(lengths) / sizeof(lengths[0])); ++i) {
+			stream_length = append_frame(stream, stream_length, WEBSOCKET_OPCODE_BINARY_FRAME, 1,
+			                             expected + expected_length, lengths[i]);
+			expected_length += lengths[i];
+		}
+
+		// a message in three fragments with a ping in between
+		stream_length = append_frame(stream, stream_length, WEBSOCKET_OPCODE_BINARY_FRAME, 0,
+		                             expected + expected_length, 50);
+		expected_length += 50;
+		stream_length = append_frame(stream, stream_length, WEBSOCKET_OPCODE_PING_FRAME, 1,
+		                             ping, sizeof(ping));
+		++pings;
+		stream_length = append_frame(stream, stream_length, WEBSOCKET_OPCODE_CONTINUATION_FRAME, 0,
+		                             expected + expected_length, 3);
+		expected_length += 3;
+		stream_length = append_frame(stream, stream_length, WEBSOCKET_OPCODE_CONTINUATION_FRAME, 1,
+		                             expected + expected_length, 300);
+		expected_length += 300;
+	}
+
+	for (i = 0; i < (int)(sizeof(max_reads) / sizeof(max_reads[0])); ++i) {
+		setup(&websocket);
+
+		rc = parse_stream(&websocket, stream, stream_length, max_reads[i], payload);
+
+		if (rc != expected_length || memcmp(payload, expected, expected_length) != 0) {
+			printf("test1: unexpected payload for reads up to %d byte(s)\n", max_reads[i]);
+
+			return -1;
+		}
+
+		// each pong is a 2 byte header and the ping payload
+		if (sent_length != pings * (2 + (int)sizeof(ping)) ||
+		    sent[0] != (0x80 | WEBSOCKET_OPCODE_PONG_FRAME) ||
+		    memcmp(sent + 2, ping, sizeof(ping)) != 0) {
+			printf("test1: unexpected pong for reads up to %d byte(s)\n", max_reads[i]);
+
+			return -1;
+		}
+
+		websocket_destroy(&websocket.base);
+	}
+
+	free(sent);
+	sent = NULL;
+
+	free(stream);
+	free(expected);
+	free(payload);
+
+	return 0;
+}
+
+// protocol violations are rejected and a close frame ends the stream
+int test2(void) {
+	Websocket websocket;
+	uint8_t stream[256];
+	uint8_t data[16] = {0};
+	uint8_t status[2] = {0x03, 0xE8};
+	int length;
+
+	setup(&websocket);
+
+	length = append_frame(stream, 0, WEBSOCKET_OPCODE_CONTINUATION_FRAME, 1, data, sizeof(data));
+
+	if (websocket_parse(&websocket, stream, length) != -1) {
+		printf("test2: continuation frame without message accepted\n");
+
+		return -1;
+	}
+
+	websocket_destroy(&websocket.base);
+	setup(&websocket);
+
+	length = append_frame(stream, 0, WEBSOCKET_OPCODE_PING_FRAME, 0, data, sizeof(data));
+
+	if (websocket_parse(&websocket, stream, length) != -1) {
+		printf("test2: fragmented ping frame accepted\n");
+
+		return -1;
+	}
+
+	websocket_destroy(&websocket.base);
+	setup(&websocket);
+
+	length = append_frame(stream, 0, WEBSOCKET_OPCODE_BINARY_FRAME, 1, data, sizeof(data));
+	length = append_frame(stream, length, WEBSOCKET_OPCODE_CLOSE_FRAME, 1, status, sizeof(status));
+	length = append_frame(stream, length, WEBSOCKET_OPCODE_BINARY_FRAME, 1, data, sizeof(data));
+
+	if (websocket_parse(&websocket, stream, length) != (int)sizeof(data) || !websocket.closed) {
+		printf("test2: close frame not handled\n");
+
+		return -1;
+	}
+
+	websocket_destroy(&websocket.base);
+
+	return 0;
+}
+
+static void control_pending_changed(bool pending, void *opaque) {
+	*(int *)opaque = pending ? 1 : 0;
+}
+
+// a pong that only fits partly into the socket is reported as pending and
+// continued by an empty write once the socket is writable again
+int test3(void) {
+	Websocket websocket;
+	uint8_t stream[256];
+	uint8_t ping[] = {'p', 'i', 'n', 'g'};
+	int pending = -1;
+	int length;
+
+	sent = malloc(STREAM_SIZE);
+
+	setup(&websocket);
+	websocket_set_control_pending_function(&websocket, control_pending_changed, &pending);
+
+	length = append_frame(stream, 0, WEBSOCKET_OPCODE_PING_FRAME, 1, ping, sizeof(ping));
+	send_limit = 3;
+
+	if (websocket_parse(&websocket, stream, length) != IO_CONTINUE || pending != 1) {
+		printf("test3: partly sent pong not reported as pending\n");
+
+		return -1;
+	}
+
+	// still not writable
+	send_limit = 0;
+
+	if (websocket_send(&websocket.base, NULL, 0) != 0 || pending != 1) {
+		printf("test3: pending pong reported as sent\n");
+
+		return -1;
+	}
+
+	send_limit = -1;
+
+	if (websocket_send(&websocket.base, NULL, 0) != 0 || pending != 0 ||
+	    sent_length != 2 + (int)sizeof(ping) ||
+	    sent[0] != (0x80 | WEBSOCKET_OPCODE_PONG_FRAME) ||
+	    memcmp(sent + 2, ping, sizeof(ping)) != 0) {
+		printf("test3: pending pong not continued\n");
+
+		return -1;
+	}
+
+	websocket_destroy(&websocket.base);
+
+	free(sent);
+	sent = NULL;
+
+	return 0;
+}
+
+// the parser as it was before: byte-wise unmasking
+static void unmask_bytewise(uint8_t *buffer, int length, const uint8_t *key) {
+	int i;
+
+	for (i = 0; i < length; ++i) {
+		buffer[i] ^= key[i % WEBSOCKET_MASK_LENGTH];
+	}
+}
+
+static void benchmark(const char *name, int frame_length, int read_length) {
+	Websocket websocket;
+	uint8_t *payload = calloc(1, frame_length);
+	uint8_t *stream = malloc(read_length + 14);
+	uint8_t *buffer = malloc(read_length + 14);
+	uint8_t key[WEBSOCKET_MASK_LENGTH] = {1, 2, 3, 4};
+	int stream_length = 0;
+	int reads = BENCHMARK_BYTES / read_length;
+	uint64_t start;
+	uint64_t parse_duration;
+	uint64_t bytewise_duration;
+	int i;
+
+	// fill one read with complete frames
+	while (stream_length + frame_length + 14 <= read_length || stream_length == 0) {
+		stream_length = append_frame(stream, stream_length, WEBSOCKET_OPCODE_BINARY_FRAME, 1,
+		                             payload, frame_length);
+	}
+
+	setup(&websocket);
+
+	start = microtime();
+
+	for (i = 0; i < reads; ++i) {
+		memcpy(buffer, stream, stream_length);
+
+		websocket_parse(&websocket, buffer, stream_length);
+	}
+
+	parse_duration = MAX(microtime() - start, 1);
+	start = microtime();
+
+	for (i = 0; i < reads; ++i) {
+		memcpy(buffer, stream, stream_length);
+
+		unmask_bytewise(buffer, stream_length, key);
+	}
+
+	bytewise_duration = MAX(microtime() - start, 1);
+
+	printf("%s (%d byte frames in %d byte reads): parse %.0f MB/s, byte-wise unmask only %.0f MB/s\n",
+	       name, frame_length, stream_length,
+	       (double)reads * stream_length / parse_duration,
+	       (double)reads * stream_length / bytewise_duration);
+
+	websocket_destroy(&websocket.base);
+
+	free(payload);
+	free(stream);
+	free(buffer);
+}
+
+int main(void) {
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test3() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	benchmark("small reads", 16, 4096);
+	benchmark("small reads", 80, 4096);
+	benchmark("large reads", 65000, 65536);
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
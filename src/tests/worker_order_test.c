@@ -0,0 +1,534 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * worker_order_test.c: Tests the order of responses and callbacks with workers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * connects to the mesh gateway port of brickd as the root node of a mesh
+ * network with a single device. several clients keep a window of requests to
+ * this device in flight. the fake device answers each request and sends a
+ * callback after each response. every packet sent by the device carries a
+ * counter. each client has to see the counters of its responses and of all
+ * callbacks in increasing order. run a brickd built with WITH_NETWORK_WORKERS=yes
+ * with several network workers, so that the clients end up in different shards:
+ *
+ *   listen.mesh_gateway_port = 4240
+ *   network.worker_threads = 3
+ *
+ *   worker_order_test localhost 4223 4240
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <daemonlib/utils.h>
+
+#define CLIENTS 6
+#define WINDOW 8 // requests in flight per client
+#define REQUESTS 3000 // per client
+#define DEVICE_UID 0x12345678
+#define CALLBACK_FUNCTION_ID 100
+#define FIRST_FUNCTION_ID 10 // each client uses its own function ID
+#define FUNCTION_ENUMERATE 254
+#define CALLBACK_ENUMERATE 253
+
+#define MESH_HEADER_LENGTH 17
+#define MESH_FLAGS_UPWARD_BINARY 0x1100 // direction upward, protocol binary
+#define MESH_TYPE_HELLO 1
+#define MESH_TYPE_HEART_BEAT_PING 4
+#define MESH_TYPE_HEART_BEAT_PONG 5
+#define MESH_TYPE_PAYLOAD 6
+
+typedef struct {
+	int fd;
+	int sent;
+	int received;
+	int callbacks;
+	uint32_t last_counter;
+	bool first;
+	int offset;
+	uint8_t buffer[512];
+} Client;
+
+typedef struct {
+	int fd;
+	uint32_t counter;
+	bool enumerated;
+	int offset;
+	uint8_t buffer[4096];
+} Mesh;
+
+static const uint8_t root_addr[6] = {1, 2, 3, 4, 5, 6};
+
+static int connect_tcp(const char *host, const char *port) {
+	struct addrinfo hints;
+	struct addrinfo *resolved;
+	int fd;
+	int flag = 1;
+
+	memset(&hints, 0, sizeof(hints));
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &resolved) != 0) {
+		return -1;
+	}
+
+	fd = socket(resolved->ai_family, resolved->ai_socktype, resolved->ai_protocol);
+
+	if (fd < 0) {
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+
+	if (connect(fd, resolved->ai_addr, resolved->ai_addrlen) < 0) {
+		close(fd);
+		freeaddrinfo(resolved);
+
+		return -1;
+	}
+
+	freeaddrinfo(resolved);
+
+	return fd;
+}
+
+static int write_all(int fd, const uint8_t *data, int length) {
+	int rc;
+
+	while (length > 0) {
+		rc = write(fd, data, length);
+
+		if (rc < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return -1;
+		}
+
+		data += rc;
+		length -= rc;
+	}
+
+	return 0;
+}
+
+static void mesh_init_header(uint8_t *packet, int length, uint8_t type) {
+	uint16_t flags = uint16_to_le(MESH_FLAGS_UPWARD_BINARY);
+	uint16_t length_le = uint16_to_le((uint16_t)length);
+
+	memset(packet, 0, MESH_HEADER_LENGTH);
+	memcpy(&packet[0], &flags, sizeof(flags));
+	memcpy(&packet[2], &length_le, sizeof(length_le));
+	memcpy(&packet[10], root_addr, sizeof(root_addr)); // source, the destination is the gateway (zero)
+
+	packet[16] = type;
+}
+
+static int mesh_send_hello(Mesh *mesh) {
+	uint8_t packet[MESH_HEADER_LENGTH + 26];
+
+	mesh_init_header(packet, sizeof(packet), MESH_TYPE_HELLO);
+	memset(&packet[MESH_HEADER_LENGTH], 0, 26);
+
+	packet[MESH_HEADER_LENGTH] = 1; // is root node
+	memset(&packet[MESH_HEADER_LENGTH + 1], 0x47, 6); // group ID
+	memcpy(&packet[MESH_HEADER_LENGTH + 7], "TFMESH", 6); // prefix
+	packet[MESH_HEADER_LENGTH + 23] = 2; // firmware version 2.0.0
+
+	return write_all(mesh->fd, packet, sizeof(packet));
+}
+
+// sends a TFP packet with the given header fields from the device. if COUNTER
+// is true then the payload is the next counter value
+static int mesh_send_payload(Mesh *mesh, uint8_t function_id, uint8_t sequence_number,
+                             const uint8_t *payload, int payload_length, bool counter) {
+	uint8_t packet[MESH_HEADER_LENGTH + 80];
+	uint8_t *tfp = &packet[MESH_HEADER_LENGTH];
+	uint32_t uid = uint32_to_le(DEVICE_UID);
+	uint32_t counter_le;
+	int length;
+
+	if (counter) {
+		counter_le = uint32_to_le(mesh->counter++);
+		payload = (const uint8_t *)&counter_le;
+		payload_length = sizeof(counter_le);
+	}
+
+	length = 8 + payload_length;
+
+	mesh_init_header(packet, MESH_HEADER_LENGTH + length, MESH_TYPE_PAYLOAD);
+	memcpy(&tfp[0], &uid, sizeof(uid));
+
+	tfp[4] = (uint8_t)length;
+	tfp[5] = function_id;
+	tfp[6] = (uint8_t)((sequence_number << 4) | 0x08); // response expected
+	tfp[7] = 0;
+
+	memcpy(&tfp[8], payload, payload_length);
+
+	return write_all(mesh->fd, packet, MESH_HEADER_LENGTH + length);
+}
+
+static int mesh_send_enumerate_callback(Mesh *mesh) {
+	uint8_t payload[26];
+
+	memset(payload, 0, sizeof(payload));
+	memcpy(payload, "device", 6); // UID
+	payload[16] = 'a'; // position
+	payload[22] = 13; // device identifier
+	payload[25] = 0; // enumeration type available
+
+	return mesh_send_payload(mesh, CALLBACK_ENUMERATE, 0, payload, sizeof(payload), false);
+}
+
+static int mesh_handle_packet(Mesh *mesh, const uint8_t *packet) {
+	const uint8_t *tfp = &packet[MESH_HEADER_LENGTH];
+	uint8_t function_id = tfp[5];
+	uint8_t sequence_number = tfp[6] >> 4;
+	uint8_t pong[MESH_HEADER_LENGTH];
+
+	switch (packet[16]) {
+	case MESH_TYPE_HEART_BEAT_PING:
+		mesh_init_header(pong, sizeof(pong), MESH_TYPE_HEART_BEAT_PONG);
+
+		return write_all(mesh->fd, pong, sizeof(pong));
+
+	case MESH_TYPE_PAYLOAD:
+		if (function_id == FUNCTION_ENUMERATE) {
+			mesh->enumerated = true;
+
+			return mesh_send_enumerate_callback(mesh);
+		}
+
+		if (function_id < FIRST_FUNCTION_ID || function_id >= FIRST_FUNCTION_ID + CLIENTS) {
+			return 0;
+		}
+
+		// answer the request, then send a callback right behind it
+		if (mesh_send_payload(mesh, function_id, sequence_number, NULL, 0, true) < 0) {
+			return -1;
+		}
+
+		return mesh_send_payload(mesh, CALLBACK_FUNCTION_ID, 0, NULL, 0, true);
+
+	default:
+		return 0;
+	}
+}
+
+static int mesh_receive(Mesh *mesh) {
+	int rc = read(mesh->fd, mesh->buffer + mesh->offset, sizeof(mesh->buffer) - mesh->offset);
+	int consumed = 0;
+	uint16_t length;
+
+	if (rc <= 0) {
+		if (rc == 0) {
+			errno = ECONNRESET;
+		}
+
+		return -1;
+	}
+
+	mesh->offset += rc;
+
+	while (mesh->offset - consumed >= MESH_HEADER_LENGTH) {
+		memcpy(&length, &mesh->buffer[consumed + 2], sizeof(length));
+
+		length = uint16_from_le(length);
+
+		if (length < MESH_HEADER_LENGTH) {
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		if (mesh->offset - consumed < length) {
+			break;
+		}
+
+		if (mesh_handle_packet(mesh, &mesh->buffer[consumed]) < 0) {
+			return -1;
+		}
+
+		consumed += length;
+	}
+
+	memmove(mesh->buffer, mesh->buffer + consumed, mesh->offset - consumed);
+
+	mesh->offset -= consumed;
+
+	return 0;
+}
+
+static int client_send_requests(Client *client, int index, int count) {
+	uint8_t requests[WINDOW * 8];
+	uint32_t uid = uint32_to_le(DEVICE_UID);
+	int i;
+
+	for (i = 0; i < count; ++i) {
+		memcpy(&requests[i * 8], &uid, sizeof(uid));
+
+		requests[i * 8 + 4] = 8;
+		requests[i * 8 + 5] = (uint8_t)(FIRST_FUNCTION_ID + index);
+		requests[i * 8 + 6] = (uint8_t)(((((client->sent + i) % 15) + 1) << 4) | 0x08);
+		requests[i * 8 + 7] = 0;
+	}
+
+	if (write_all(client->fd, requests, count * 8) < 0) {
+		return -1;
+	}
+
+	client->sent += count;
+
+	return 0;
+}
+
+// returns the number of received responses
+static int client_receive(Client *client, int index) {
+	int rc = read(client->fd, client->buffer + client->offset, sizeof(client->buffer) - client->offset);
+	int consumed = 0;
+	int count = 0;
+	uint8_t *packet;
+	uint32_t counter;
+
+	if (rc <= 0) {
+		if (rc == 0) {
+			errno = ECONNRESET;
+		}
+
+		return -1;
+	}
+
+	client->offset += rc;
+
+	while (client->offset - consumed >= 8) {
+		packet = &client->buffer[consumed];
+
+		if (packet[4] < 8) {
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		if (client->offset - consumed < packet[4]) {
+			break;
+		}
+
+		consumed += packet[4];
+
+		if (packet[5] != CALLBACK_FUNCTION_ID && packet[5] != FIRST_FUNCTION_ID + index) {
+			continue; // e.g. an enumerate callback
+		}
+
+		if (packet[4] != 12) {
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		memcpy(&counter, &packet[8], sizeof(counter));
+
+		counter = uint32_from_le(counter);
+
+		if (!client->first && counter <= client->last_counter) {
+			printf("client %d received %s %u after %u\n", index,
+			       packet[5] == CALLBACK_FUNCTION_ID ? "callback" : "response",
+			       counter, client->last_counter);
+
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		client->first = false;
+		client->last_counter = counter;
+
+		if (packet[5] == CALLBACK_FUNCTION_ID) {
+			++client->callbacks;
+
+			continue;
+		}
+
+		if ((packet[6] >> 4) != (client->received % 15) + 1) {
+			printf("client %d received response with unexpected sequence number\n", index);
+
+			errno = EPROTO;
+
+			return -1;
+		}
+
+		++client->received;
+		++count;
+	}
+
+	memmove(client->buffer, client->buffer + consumed, client->offset - consumed);
+
+	client->offset -= consumed;
+
+	return count;
+}
+
+int main(int argc, char **argv) {
+	const char *host = "localhost";
+	const char *port = "4223";
+	const char *mesh_port = "4240";
+	Mesh mesh;
+	Client clients[CLIENTS];
+	struct pollfd pollfds[CLIENTS + 1];
+	int remaining = CLIENTS;
+	int callbacks = 0;
+	int i;
+	int rc;
+
+	if (argc > 4) {
+		printf("usage: %s [<host> [<port> [<mesh-port>]]]\n", argv[0]);
+
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 1) {
+		host = argv[1];
+	}
+
+	if (argc > 2) {
+		port = argv[2];
+	}
+
+	if (argc > 3) {
+		mesh_port = argv[3];
+	}
+
+	memset(&mesh, 0, sizeof(mesh));
+
+	mesh.fd = connect_tcp(host, mesh_port);
+
+	if (mesh.fd < 0 || mesh_send_hello(&mesh) < 0) {
+		printf("could not connect to mesh gateway %s:%s\n", host, mesh_port);
+
+		return EXIT_FAILURE;
+	}
+
+	// wait for the discovery, its answer makes the device known to brickd
+	pollfds[0].fd = mesh.fd;
+	pollfds[0].events = POLLIN;
+
+	while (!mesh.enumerated) {
+		if (poll(pollfds, 1, 5000) <= 0 || mesh_receive(&mesh) < 0) {
+			printf("no enumerate request from mesh gateway\n");
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < CLIENTS; ++i) {
+		memset(&clients[i], 0, sizeof(Client));
+
+		clients[i].first = true;
+		clients[i].fd = connect_tcp(host, port);
+
+		if (clients[i].fd < 0) {
+			printf("could not connect to %s:%s\n", host, port);
+
+			return EXIT_FAILURE;
+		}
+
+		pollfds[i + 1].fd = clients[i].fd;
+		pollfds[i + 1].events = POLLIN;
+	}
+
+	for (i = 0; i < CLIENTS; ++i) {
+		if (client_send_requests(&clients[i], i, WINDOW) < 0) {
+			printf("could not send requests: %s (%d)\n", get_errno_name(errno), errno);
+
+			return EXIT_FAILURE;
+		}
+	}
+
+	while (remaining > 0) {
+		if (poll(pollfds, CLIENTS + 1, 5000) <= 0) {
+			printf("timeout waiting for responses\n");
+
+			return EXIT_FAILURE;
+		}
+
+		if ((pollfds[0].revents & (POLLIN | POLLERR | POLLHUP)) != 0 && mesh_receive(&mesh) < 0) {
+			printf("mesh connection failed: %s (%d)\n", get_errno_name(errno), errno);
+
+			return EXIT_FAILURE;
+		}
+
+		for (i = 0; i < CLIENTS; ++i) {
+			if ((pollfds[i + 1].revents & (POLLIN | POLLERR | POLLHUP)) == 0) {
+				continue;
+			}
+
+			rc = client_receive(&clients[i], i);
+
+			if (rc < 0) {
+				printf("client %d failed: %s (%d)\n", i, get_errno_name(errno), errno);
+
+				return EXIT_FAILURE;
+			}
+
+			// keep the window full
+			rc = MIN(rc, REQUESTS - clients[i].sent);
+
+			if (rc > 0 && client_send_requests(&clients[i], i, rc) < 0) {
+				printf("could not send requests: %s (%d)\n", get_errno_name(errno), errno);
+
+				return EXIT_FAILURE;
+			}
+
+			if (clients[i].received == REQUESTS) {
+				pollfds[i + 1].fd = -1;
+				--remaining;
+			}
+		}
+	}
+
+	for (i = 0; i < CLIENTS; ++i) {
+		callbacks += clients[i].callbacks;
+
+		close(clients[i].fd);
+	}
+
+	close(mesh.fd);
+
+	printf("%d clients received %d responses each and %d callbacks in total in order\n",
+	       CLIENTS, REQUESTS, callbacks);
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,737 @@
+/*
+ * brickd
+ * Copyright (C) 2026 Matthias Bolte <matthias@tinkerforge.com>
+ *
+ * writer_test.c: Tests for the Writer type
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <daemonlib/event.h>
+#include <daemonlib/utils.h>
+#include <daemonlib/writer.h>
+
+#define SINK_SIZE (4 * 1024 * 1024)
+
+typedef struct {
+	IO base;
+	uint8_t *data;
+	int length;
+	int capacity; // bytes the next writes may accept in total
+	int own_pending; // bytes of its own the sink has to write before any data
+	Writer *writer; // to report own pending bytes to
+} SinkIO;
+
+static EventFunction write_function = NULL;
+static void *write_opaque = NULL;
+static int disconnected = 0;
+
+// the writer only needs event_modify_source, no real event loop is involved
+int event_modify_source(IOHandle handle, EventSourceType type, uint32_t events_to_remove,
+                        uint32_t events_to_add, EventFunction function, void *opaque) {
+	(void)handle;
+	(void)type;
+
+	if ((events_to_add & EVENT_WRITE) != 0) {
+		write_function = function;
+		write_opaque = opaque;
+	}
+
+	if ((events_to_remove & EVENT_WRITE) != 0) {
+		write_function = NULL;
+		write_opaque = NULL;
+	}
+
+	return 0;
+}
+
+static int sink_write(IO *io, const void *buffer, int length) {
+	SinkIO *sink = (SinkIO *)io;
+	int own_length;
+
+	// own bytes are not stored and not reported as written
+	if (sink->own_pending > 0 && sink->capacity > 0) {
+		own_length = MIN(sink->own_pending, sink->capacity);
+
+		sink->own_pending -= own_length;
+		sink->capacity -= own_length;
+
+		if (sink->own_pending == 0) {
+			writer_set_io_pending(sink->writer, false);
+		}
+	}
+
+	if (sink->own_pending > 0 || sink->capacity <= 0) {
+#ifdef _WIN32
+		errno = ERRNO_WINAPI_OFFSET + WSAEWOULDBLOCK;
+#else
+		errno = EWOULDBLOCK;
+#endif
+
+		return -1;
+	}
+
+	if (length > sink->capacity) {
+		length = sink->capacity;
+	}
+
+	memcpy(sink->data + sink->length, buffer, length);
+
+	sink->length += length;
+	sink->capacity -= length;
+
+	return length;
+}
+
+static char *packet_signature(char *signature, Packet *packet) {
+	(void)packet;
+
+	*signature = '\0';
+
+	return signature;
+}
+
+static char *recipient_signature(char *signature, bool upper, void *opaque) {
+	(void)upper;
+	(void)opaque;
+
+	*signature = '\0';
+
+	return signature;
+}
+
+static void recipient_disconnect(void *opaque) {
+	(void)opaque;
+
+	++disconnected;
+}
+
+static void make_packet(Packet *packet, uint32_t uid, int length) {
+	int i;
+
+	memset(packet, 0, sizeof(Packet));
+
+	packet->header.uid = uid;
+	packet->header.length = (uint8_t)length;
+	packet->header.function_id = (uint8_t)(uid & 0xFF);
+
+	for (i = (int)sizeof(PacketHeader); i < length; ++i) {
+		((uint8_t *)packet)[i] = (uint8_t)(uid + i);
+	}
+}
+
+static int setup(SinkIO *sink, Writer *writer) {
+	memset(sink, 0, sizeof(SinkIO));
+
+	io_create(&sink->base, "sink", NULL, NULL, sink_write, NULL);
+
+	sink->data = malloc(SINK_SIZE);
+
+	if (sink->data == NULL) {
+		return -1;
+	}
+
+	write_function = NULL;
+	write_opaque = NULL;
+	disconnected = 0;
+
+	return writer_create(writer, &sink->base, "packet", packet_signature,
+	                     "recipient", recipient_signature, recipient_disconnect, NULL);
+}
+
+static void teardown(SinkIO *sink, Writer *writer) {
+	writer_destroy(writer);
+	free(sink->data);
+}
+
+// drain the backlog like the event loop would do on write events
+static void flush(SinkIO *sink, int capacity) {
+	sink->capacity = capacity;
+
+	while (write_function != NULL && sink->capacity > 0) {
+		write_function(write_opaque);
+	}
+}
+
+// check that the sink contains the packets FIRST to LAST (UIDs) in order
+static int verify(const char *test, SinkIO *sink, uint32_t first, uint32_t last, int length) {
+	Packet expected;
+	uint32_t uid;
+	int offset = 0;
+
+	for (uid = first; uid <= last; ++uid) {
+		make_packet(&expected, uid, length);
+
+		if (offset + length > sink->length ||
+		    memcmp(sink->data + offset, &expected, length) != 0) {
+			printf("%s: unexpected data for packet %u\n", test, uid);
+
+			return -1;
+		}
+
+		offset += length;
+	}
+
+	if (offset != sink->length) {
+		printf("%s: unexpected sink length %d, expected %d\n", test, sink->length, offset);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+// packets are passed through directly while the IO accepts them, partially
+// written packets and everything after them go to the backlog in order
+int test1(void) {
+	SinkIO sink;
+	Writer writer;
+	Packet packet;
+	uint32_t uid;
+	int rc;
+
+	if (setup(&sink, &writer) < 0) {
+		printf("test1: setup failed\n");
+
+		return -1;
+	}
+
+	sink.capacity = 3 * 20 + 5;
+
+	for (uid = 1; uid <= 100; ++uid) {
+		make_packet(&packet, uid, 20);
+
+		rc = writer_write(&writer, &packet);
+
+		if ((uid <= 3 && rc != 0) || (uid > 3 && rc != 1)) {
+			printf("test1: unexpected writer_write result %d for packet %u\n", rc, uid);
+
+			return -1;
+		}
+	}
+
+	if (writer.backlog_count != 97 || writer.backlog_used != 97 * 20 - 5) {
+		printf("test1: unexpected backlog state\n");
+
+		return -1;
+	}
+
+	// drain in odd steps to split packets at different offsets
+	while (write_function != NULL) {
+		flush(&sink, 7);
+	}
+
+	if (writer.backlog_count != 0 || writer.backlog_used != 0) {
+		printf("test1: backlog not empty\n");
+
+		return -1;
+	}
+
+	if (verify("test1", &sink, 1, 100, 20) < 0) {
+		return -1;
+	}
+
+	teardown(&sink, &writer);
+
+	return 0;
+}
+
+// the byte ring wraps around and grows while it is partially drained
+int test2(void) {
+	SinkIO sink;
+	Writer writer;
+	Packet packet;
+	uint32_t uid;
+	int length;
+	int offset = 0;
+
+	if (setup(&sink, &writer) < 0) {
+		printf("test2: setup failed\n");
+
+		return -1;
+	}
+
+	for (uid = 1; uid <= 5000; ++uid) {
+		make_packet(&packet, uid, 8 + (int)(uid % 5) * 13);
+
+		if (writer_write(&writer, &packet) < 0) {
+			printf("test2: writer_write failed for packet %u\n", uid);
+
+			return -1;
+		}
+
+		if (uid % 7 == 0) {
+			flush(&sink, 150);
+		}
+	}
+
+	flush(&sink, SINK_SIZE - sink.length);
+
+	if (writer.backlog_count != 0 || disconnected != 0) {
+		printf("test2: unexpected backlog state\n");
+
+		return -1;
+	}
+
+	// packets have different lengths here, check them one by one
+	for (uid = 1; uid <= 5000; ++uid) {
+		length = 8 + (int)(uid % 5) * 13;
+
+		make_packet(&packet, uid, length);
+
+		if (offset + length > sink.length ||
+		    memcmp(sink.data + offset, &packet, length) != 0) {
+			printf("test2: unexpected data for packet %u\n", uid);
+
+			return -1;
+		}
+
+		offset += length;
+	}
+
+	teardown(&sink, &writer);
+
+	return 0;
+}
+
+// a full backlog drops the oldest complete packets, but keeps the remainder
+// of a partially sent packet to not break the stream
+int test3(void) {
+	SinkIO sink;
+	Writer writer;
+	Packet packet;
+	uint32_t uid;
+	uint32_t total = 32768 + 1000;
+
+	if (setup(&sink, &writer) < 0) {
+		printf("test3: setup failed\n");
+
+		return -1;
+	}
+
+	sink.capacity = 30;
+
+	for (uid = 1; uid <= total; ++uid) {
+		make_packet(&packet, uid, 80);
+
+		if (writer_write(&writer, &packet) < 0) {
+			printf("test3: writer_write failed for packet %u\n", uid);
+
+			return -1;
+		}
+	}
+
+	if (writer.dropped_packets != 1000) {
+		printf("test3: unexpected dropped packet count %u\n", writer.dropped_packets);
+
+		return -1;
+	}
+
+	flush(&sink, SINK_SIZE - sink.length);
+
+	if (sink.length != 80 + (32767 * 80)) {
+		printf("test3: unexpected sink length %d\n", sink.length);
+
+		return -1;
+	}
+
+	// the first packet has to be complete, followed by the newest packets
+	make_packet(&packet, 1, 80);
+
+	if (memcmp(sink.data, &packet, 80) != 0) {
+		printf("test3: first packet is broken\n");
+
+		return -1;
+	}
+
+	memmove(sink.data, sink.data + 80, sink.length - 80);
+	sink.length -= 80;
+
+	if (verify("test3", &sink, total - 32767 + 1, total, 80) < 0) {
+		return -1;
+	}
+
+	teardown(&sink, &writer);
+
+	return 0;
+}
+
+// batch frames and plain packets share the backlog and stay intact when they
+// are written partially
+int test4(void) {
+	SinkIO sink;
+	Writer writer;
+	Packet packet;
+	union {
+		BatchHeader header;
+		uint8_t buffer[PACKET_MAX_BATCH_LENGTH];
+	} batch;
+	uint8_t expected[8 + 10 * 40 + 20];
+	uint32_t uid;
+	int round;
+	int offset;
+	int length = 0;
+
+	if (setup(&sink, &writer) < 0) {
+		printf("test4: setup failed\n");
+
+		return -1;
+	}
+
+	offset = sizeof(BatchHeader);
+
+	for (uid = 1; uid <= 10; ++uid) {
+		make_packet(&packet, uid, 40);
+		memcpy(batch.buffer + offset, &packet, 40);
+
+		offset += 40;
+	}
+
+	batch.header.uid = uint32_to_le(1);
+	batch.header.zero_length = 0;
+	batch.header.function_id = FUNCTION_SET_BATCH_MODE;
+	batch.header.payload_length = uint16_to_le((uint16_t)(offset - sizeof(BatchHeader)));
+
+	memcpy(expected, batch.buffer, offset);
+
+	length = offset;
+
+	make_packet(&packet, 11, 20);
+	memcpy(expected + length, &packet, 20);
+
+	length += 20;
+
+	sink.capacity = 13;
+
+	for (round = 0; round < 50; ++round) {
+		if (writer_write_batch(&writer, &batch.header) < 0 ||
+		    writer_write(&writer, &packet) < 0) {
+			printf("test4: write failed in round %d\n", round);
+
+			return -1;
+		}
+	}
+
+	if (writer.backlog_count != 2 * 50) {
+		printf("test4: unexpected backlog count %d\n", writer.backlog_count);
+
+		return -1;
+	}
+
+	while (write_function != NULL) {
+		flush(&sink, 11);
+	}
+
+	if (sink.length != 50 * length) {
+		printf("test4: unexpected sink length %d\n", sink.length);
+
+		return -1;
+	}
+
+	for (round = 0; round < 50; ++round) {
+		if (memcmp(sink.data + round * length, expected, length) != 0) {
+			printf("test4: unexpected data in round %d\n", round);
+
+			return -1;
+		}
+	}
+
+	teardown(&sink, &writer);
+
+	return 0;
+}
+
+// while paused nothing is written and the backlog limit still applies. on
+// resume the backlog is written in order
+int test5(void) {
+	SinkIO sink;
+	Writer writer;
+	Packet packet;
+	uint32_t uid;
+
+	if (setup(&sink, &writer) < 0) {
+		printf("test5: setup failed\n");
+
+		return -1;
+	}
+
+	sink.capacity = SINK_SIZE;
+
+	writer_pause(&writer);
+
+	for (uid = 1; uid <= 100; ++uid) {
+		make_packet(&packet, uid, 30);
+
+		if (writer_write(&writer, &packet) != 1) {
+			printf("test5: packet %u not pushed to backlog\n", uid);
+
+			return -1;
+		}
+	}
+
+	if (sink.length != 0 || write_function != NULL || writer.backlog_count != 100) {
+		printf("test5: paused writer wrote data\n");
+
+		return -1;
+	}
+
+	writer_resume(&writer);
+
+	if (write_function == NULL) {
+		printf("test5: resumed writer not registered for write events\n");
+
+		return -1;
+	}
+
+	// packets written after resume have to stay behind the backlog
+	make_packet(&packet, 101, 30);
+
+	if (writer_write(&writer, &packet) != 1) {
+		printf("test5: packet 101 not pushed to backlog\n");
+
+		return -1;
+	}
+
+	flush(&sink, SINK_SIZE);
+
+	if (verify("test5", &sink, 1, 101, 30) < 0) {
+		return -1;
+	}
+
+	teardown(&sink, &writer);
+
+	return 0;
+}
+
+// frames with a 16 bit length at offset 2, like mesh packets
+static int frame_length(const uint8_t *header) {
+	return header[2] | (header[3] << 8);
+}
+
+static int make_frames(uint8_t *buffer, int first, int count) {
+	int offset = 0;
+	int length;
+	int i;
+	int k;
+
+	for (i = first; i < first + count; ++i) {
+		length = 16 + (i * 7) % 80;
+
+		buffer[offset] = (uint8_t)i;
+		buffer[offset + 1] = 0;
+		buffer[offset + 2] = (uint8_t)(length & 0xFF);
+		buffer[offset + 3] = (uint8_t)(length >> 8);
+
+		for (k = 4; k < length; ++k) {
+			buffer[offset + k] = (uint8_t)(i + k);
+		}
+
+		offset += length;
+	}
+
+	return offset;
+}
+
+// several frames are written with one write, the unsent ones go to the backlog
+// one by one and are written in order afterwards
+int test6(void) {
+	SinkIO sink;
+	Writer writer;
+	uint8_t frames[2][2048];
+	int frames_length[2];
+	int rc;
+
+	if (setup(&sink, &writer) < 0) {
+		printf("test6: setup failed\n");
+
+		return -1;
+	}
+
+	writer_set_packet_length_function(&writer, frame_length);
+
+	frames_length[0] = make_frames(frames[0], 0, 10);
+	frames_length[1] = make_frames(frames[1], 10, 10);
+
+	// everything fits
+	sink.capacity = SINK_SIZE;
+
+	if (writer_write_multiple(&writer, frames[0], frames_length[0]) != 0 ||
+	    sink.length != frames_length[0]) {
+		printf("test6: frames not written directly\n");
+
+		return -1;
+	}
+
+	sink.length = 0;
+
+	// the write ends in the middle of the 4th frame
+	sink.capacity = 16 + 23 + 30 + 10;
+
+	rc = writer_write_multiple(&writer, frames[0], frames_length[0]);
+
+	if (rc != 1 || writer.backlog_count != 7 || !writer.backlog_head_partial) {
+		printf("test6: unexpected backlog after partial write (rc: %d, count: %d)\n",
+		       rc, writer.backlog_count);
+
+		return -1;
+	}
+
+	// with a backlog everything goes to the backlog
+	if (writer_write_multiple(&writer, frames[1], frames_length[1]) != 1 ||
+	    writer.backlog_count != 17) {
+		printf("test6: frames not pushed to backlog\n");
+
+		return -1;
+	}
+
+	flush(&sink, SINK_SIZE);
+
+	if (writer.backlog_count != 0 ||
+	    sink.length != frames_length[0] + frames_length[1] ||
+	    memcmp(sink.data, frames[0], frames_length[0]) != 0 ||
+	    memcmp(sink.data + frames_length[0], frames[1], frames_length[1]) != 0) {
+		printf("test6: unexpected data after flush\n");
+
+		return -1;
+	}
+
+	teardown(&sink, &writer);
+
+	return 0;
+}
+
+// pending bytes of the IO itself keep the writer waiting for write events even
+// with an empty backlog, also across a pause
+int test7(void) {
+	SinkIO sink;
+	Writer writer;
+	Packet packet;
+
+	if (setup(&sink, &writer) < 0) {
+		printf("test7: setup failed\n");
+
+		return -1;
+	}
+
+	sink.writer = &writer;
+	sink.own_pending = 10;
+
+	writer_set_io_pending(&writer, true);
+
+	if (write_function == NULL) {
+		printf("test7: not registered for write events\n");
+
+		return -1;
+	}
+
+	flush(&sink, 4);
+
+	if (write_function == NULL || sink.own_pending != 6) {
+		printf("test7: unexpected state after partial flush\n");
+
+		return -1;
+	}
+
+	// the IO still has pending bytes, the packet goes to the backlog
+	make_packet(&packet, 1, 20);
+
+	if (writer_write(&writer, &packet) != 1 || writer.backlog_count != 1) {
+		printf("test7: packet not pushed to backlog\n");
+
+		return -1;
+	}
+
+	flush(&sink, SINK_SIZE);
+
+	if (write_function != NULL || writer.io_pending || sink.own_pending != 0 ||
+	    writer.backlog_count != 0) {
+		printf("test7: unexpected state after flush\n");
+
+		return -1;
+	}
+
+	if (verify("test7", &sink, 1, 1, 20) < 0) {
+		return -1;
+	}
+
+	// nothing is registered while paused, resuming picks the pending bytes up
+	sink.own_pending = 5;
+
+	writer_pause(&writer);
+	writer_set_io_pending(&writer, true);
+
+	if (write_function != NULL) {
+		printf("test7: registered for write events while paused\n");
+
+		return -1;
+	}
+
+	writer_resume(&writer);
+	flush(&sink, SINK_SIZE);
+
+	if (write_function != NULL || writer.io_pending || sink.own_pending != 0 ||
+	    disconnected != 0) {
+		printf("test7: pending bytes not written after resume\n");
+
+		return -1;
+	}
+
+	teardown(&sink, &writer);
+
+	return 0;
+}
+
+int main(void) {
+#ifdef _WIN32
+	fixes_init();
+#endif
+
+	if (test1() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test2() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test3() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test4() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test5() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test6() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	if (test7() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	printf("success\n");
+
+	return EXIT_SUCCESS;
+}